@@ -0,0 +1,1656 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+// Console commands measuring the CPU-side hot paths of the plugin on synthetic data.
+// They don't need a GPU or a loaded level, so they also run in a headless -nullrhi session on the build farm, i.e.
+// UE4Editor-Cmd <Project> -nullrhi -ExecCmds="Raymarch.Benchmark.VoxelConversion 64, Quit"
+// Every benchmark also checks the optimized path against a plain reference and logs an error on mismatch.
+// The only exceptions are Raymarch.Benchmark.CameraSetup, which measures the camera of a running game, and the GPU half
+// of Raymarch.Test.GoldenImages, which is skipped without a world to draw in.
+
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchVoxelConversion.h"
+#include "../Public/RaymarchMacroCells.h"
+#include "../Public/RaymarchVolumeMips.h"
+#include "../Public/RaymarchBrickPool.h"
+#include "../Public/RaymarchBrickCache.h"
+#include "../Public/RaymarchPreIntegration.h"
+#include "../Public/RaymarchFilters.h"
+#include "../Public/RaymarchGradients.h"
+#include "../Public/RaymarchRendering.h"
+#include "../Public/RaymarchReconstruction.h"
+#include "../Public/RaymarchCpuRaymarcher.h"
+#include "../Public/RaymarchVolumeFile.h"
+#include "../Public/RaymarchBlockCompression.h"
+#include "../Public/RaymarchVolumeSequence.h"
+
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Math/RandomStream.h"
+#include "Misc/App.h"
+#include "Interfaces/IPluginManager.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "RenderingThread.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+// Parses the first argument as a count in millions, falls back to the default if missing.
+static int64 GetMegaCountArgument(const TArray<FString>& Args, int32 DefaultMegaCount)
+{
+	const int32 MegaCount = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : DefaultMegaCount;
+	return int64(FMath::Max(MegaCount, 1)) * 1000 * 1000;
+}
+
+// Parses the first argument as edge length of a cubic volume, falls back to the default if missing.
+static FIntVector GetVolumeSizeArgument(const TArray<FString>& Args, int32 DefaultSize)
+{
+	const int32 Size = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : DefaultSize, 1);
+	return FIntVector(Size, Size, Size);
+}
+
+// Creates a mostly empty U8 volume with a noisy ball in the middle - roughly what a scan with a lot of air around looks like.
+static void MakeSyntheticVolume(FIntVector Dimensions, TArray<uint8>& OutVolume, int32 Seed)
+{
+	FRandomStream Random(Seed);
+	OutVolume.SetNumUninitialized(int64(Dimensions.X) * Dimensions.Y * Dimensions.Z);
+	const FVector Center = FVector(Dimensions) / 2;
+	const float Radius = Dimensions.GetMin() / 3.0f;
+	int64 Index = 0;
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+	for (int32 X = 0; X < Dimensions.X; ++X)
+	{
+		const bool bInside = FVector::Dist(FVector(X, Y, Z), Center) < Radius;
+		OutVolume[Index++] = bInside ? uint8(100 + Random.RandHelper(156)) : 0;
+	}
+}
+
+// Fills a buffer with random bytes. Good enough for conversions, as every bit pattern is a valid voxel (except some
+// float NaNs, which the benchmark masks away).
+static void FillRandom(TArray<uint8>& Buffer, int32 Seed)
+{
+	FRandomStream Random(Seed);
+	for (uint8& Byte : Buffer)
+	{
+		Byte = uint8(Random.RandHelper(256));
+	}
+}
+
+// Runs the function a few times and returns the best time in seconds.
+template<typename FunctionType>
+static double TimeBestOf(int32 Repetitions, FunctionType Function)
+{
+	double Best = TNumericLimits<double>::Max();
+	for (int32 i = 0; i < Repetitions; ++i)
+	{
+		const double Start = FPlatformTime::Seconds();
+		Function();
+		Best = FMath::Min(Best, FPlatformTime::Seconds() - Start);
+	}
+	return Best;
+}
+
+static void BenchmarkVoxelConversion(const TArray<FString>& Args)
+{
+	const int64 VoxelCount = GetMegaCountArgument(Args, 64);
+	const int32 Repetitions = 5;
+
+	TArray<uint8> Source;
+	Source.SetNumUninitialized(VoxelCount * 4);
+	FillRandom(Source, 42);
+	// Keep floats finite (clear the top exponent bit), NaNs would make comparing the paths meaningless.
+	for (int64 i = 3; i < Source.Num(); i += 4)
+	{
+		Source[i] &= 0xBF;
+	}
+	TArray<uint8> Reference, Optimized;
+	Reference.SetNumUninitialized(VoxelCount);
+	Optimized.SetNumUninitialized(VoxelCount);
+
+	UE_LOG(LogRaymarch, Display, TEXT("Voxel conversion benchmark, %lld voxels, best of %d:"), VoxelCount, Repetitions);
+
+	const ERaymarchVoxelFormat Formats[] = {
+		ERaymarchVoxelFormat::U8, ERaymarchVoxelFormat::U16, ERaymarchVoxelFormat::S16, ERaymarchVoxelFormat::F16, ERaymarchVoxelFormat::F32 };
+	const TCHAR* FormatNames[] = { TEXT("U8"), TEXT("U16"), TEXT("S16"), TEXT("F16"), TEXT("F32") };
+	for (int32 FormatIndex = 0; FormatIndex < ARRAY_COUNT(Formats); ++FormatIndex)
+	{
+		const ERaymarchVoxelFormat Format = Formats[FormatIndex];
+		// Some window that falls in the middle of the range of the format, so both clamping and scaling are exercised.
+		const float Center = Format == ERaymarchVoxelFormat::U8 ? 128.0f : (Format == ERaymarchVoxelFormat::U16 ? 32768.0f : 0.0f);
+		const float Width = Format == ERaymarchVoxelFormat::U8 ? 100.0f : 20000.0f;
+
+		const double ScalarTime = TimeBestOf(Repetitions, [&]()
+		{
+			QuantizeWindowed_Scalar(Source.GetData(), Format, VoxelCount, Center, Width, Reference.GetData());
+		});
+		const double VectorTime = TimeBestOf(Repetitions, [&]()
+		{
+			QuantizeWindowed(Source.GetData(), Format, VoxelCount, Center, Width, Optimized.GetData());
+		});
+
+		UE_LOG(LogRaymarch, Display, TEXT("  Quantize %s: scalar %.1f MVoxels/s, vectorized %.1f MVoxels/s"),
+			FormatNames[FormatIndex], VoxelCount / ScalarTime / 1e6, VoxelCount / VectorTime / 1e6);
+		if (FMemory::Memcmp(Reference.GetData(), Optimized.GetData(), VoxelCount) != 0)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("  Quantize %s: vectorized result differs from the scalar reference!"), FormatNames[FormatIndex]);
+		}
+	}
+
+	const double SignFlipTime = TimeBestOf(Repetitions, [&]()
+	{
+		ConvertSignedToUnsigned16(reinterpret_cast<int16*>(Source.GetData()), VoxelCount);
+	});
+	UE_LOG(LogRaymarch, Display, TEXT("  Signed to unsigned 16: %.1f MVoxels/s"), VoxelCount / SignFlipTime / 1e6);
+}
+
+static FAutoConsoleCommand BenchmarkVoxelConversionCommand(
+	TEXT("Raymarch.Benchmark.VoxelConversion"),
+	TEXT("Measures voxels/s of windowing and quantization for all voxel formats. Argument: number of megavoxels (default 64)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkVoxelConversion));
+
+static void BenchmarkMacroCells(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	const int32 CellSize = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : RAYMARCH_DEFAULT_MACRO_CELL_SIZE;
+	// Same kind of slabs the streaming loader would hand over.
+	const int32 SlabDepth = 32;
+	const int64 SliceVoxels = int64(Dimensions.X) * Dimensions.Y;
+	const int64 VoxelCount = SliceVoxels * Dimensions.Z;
+
+	TArray<uint8> Volume;
+	MakeSyntheticVolume(Dimensions, Volume, 42);
+
+	FRaymarchMacroCellGrid Grid;
+	const double ParallelTime = TimeBestOf(5, [&]()
+	{
+		Grid.Init(Dimensions, CellSize);
+		for (int32 FirstSlice = 0; FirstSlice < Dimensions.Z; FirstSlice += SlabDepth)
+		{
+			const int32 SliceCount = FMath::Min(SlabDepth, Dimensions.Z - FirstSlice);
+			Grid.AccumulateSlab(Volume.GetData() + FirstSlice * SliceVoxels, PF_G8, FirstSlice, SliceCount);
+		}
+	});
+
+	FRaymarchMacroCellGrid Reference;
+	const double ReferenceTime = TimeBestOf(1, [&]()
+	{
+		BuildMacroCells_Reference(Volume.GetData(), PF_G8, Dimensions, CellSize, Reference);
+	});
+
+	int32 EmptyCells = 0;
+	int32 Mismatches = 0;
+	for (int32 i = 0; i < Reference.MinMax.Num(); ++i)
+	{
+		EmptyCells += Grid.MinMax[i].Y <= 0.0f ? 1 : 0;
+		Mismatches += Grid.MinMax[i] != Reference.MinMax[i] ? 1 : 0;
+	}
+
+	UE_LOG(LogRaymarch, Display, TEXT("Macro cell benchmark, %dx%dx%d volume, cell size %d:"), Dimensions.X, Dimensions.Y, Dimensions.Z, CellSize);
+	UE_LOG(LogRaymarch, Display, TEXT("  Slab-wise parallel build: %.2f ms, %.3f ns/voxel"), ParallelTime * 1e3, ParallelTime * 1e9 / VoxelCount);
+	UE_LOG(LogRaymarch, Display, TEXT("  Brute-force reference: %.2f ms, %.3f ns/voxel"), ReferenceTime * 1e3, ReferenceTime * 1e9 / VoxelCount);
+	UE_LOG(LogRaymarch, Display, TEXT("  %d of %d cells empty"), EmptyCells, Reference.MinMax.Num());
+	if (Mismatches > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  %d cells differ from the brute-force reference!"), Mismatches);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkMacroCellsCommand(
+	TEXT("Raymarch.Benchmark.MacroCells"),
+	TEXT("Measures build time of the empty-space skipping cells and checks them against brute force. Arguments: volume edge length (default 256), cell size (default 8)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkMacroCells));
+
+static void BenchmarkDownsample(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	const int64 VoxelCount = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+
+	TArray<uint8> Volume;
+	MakeSyntheticVolume(Dimensions, Volume, 42);
+
+	TArray<TArray<uint8>> Mips;
+	const double ParallelTime = TimeBestOf(5, [&]()
+	{
+		GenerateVolumeMips(Volume.GetData(), PF_G8, Dimensions, 0, Mips);
+	});
+
+	TArray<TArray<uint8>> ReferenceMips;
+	const double ReferenceTime = TimeBestOf(1, [&]()
+	{
+		ReferenceMips.SetNum(Mips.Num());
+		ReferenceMips[0] = Volume;
+		for (int32 Level = 1; Level < Mips.Num(); ++Level)
+		{
+			DownsampleVolume_Reference(ReferenceMips[Level - 1].GetData(), PF_G8, GetVolumeMipDimensions(Dimensions, Level - 1), ReferenceMips[Level]);
+		}
+	});
+
+	UE_LOG(LogRaymarch, Display, TEXT("Mip chain benchmark, %dx%dx%d volume, %d levels:"), Dimensions.X, Dimensions.Y, Dimensions.Z, Mips.Num());
+	UE_LOG(LogRaymarch, Display, TEXT("  Parallel downsampling: %.2f ms, %.1f MVoxels/s"), ParallelTime * 1e3, VoxelCount / ParallelTime / 1e6);
+	UE_LOG(LogRaymarch, Display, TEXT("  Single-threaded reference: %.2f ms, %.1f MVoxels/s"), ReferenceTime * 1e3, VoxelCount / ReferenceTime / 1e6);
+	for (int32 Level = 1; Level < Mips.Num(); ++Level)
+	{
+		if (Mips[Level] != ReferenceMips[Level])
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("  Mip level %d differs from the reference!"), Level);
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkDownsampleCommand(
+	TEXT("Raymarch.Benchmark.Downsample"),
+	TEXT("Measures building a full mip chain of a synthetic volume and checks it against a single-threaded reference. Argument: volume edge length (default 256)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkDownsample));
+
+// Checks every voxel of the volume against its copy in the atlas. Voxels of dropped bricks have to be empty.
+static int64 CountBrickAtlasMismatches(const TArray<uint8>& Volume, const FRaymarchBrickLayout& Layout, const TArray<bool>& Occupied,
+	const FRaymarchBrickAtlas& Atlas)
+{
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+	const int32 Padded = Layout.GetPaddedBrickSize();
+	int64 Mismatches = 0;
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+	for (int32 X = 0; X < Dimensions.X; ++X)
+	{
+		const uint8 Value = Volume[X + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)];
+		const int32 BrickIndex = Layout.GetBrickIndex(X / Layout.BrickSize, Y / Layout.BrickSize, Z / Layout.BrickSize);
+		if (!Occupied[BrickIndex])
+		{
+			Mismatches += Value != 0 ? 1 : 0;
+			continue;
+		}
+		const FIntVector AtlasVoxel = Atlas.BrickSlots[BrickIndex] * Padded + FIntVector(Layout.Apron) +
+			FIntVector(X % Layout.BrickSize, Y % Layout.BrickSize, Z % Layout.BrickSize);
+		const FIntVector& AtlasDimensions = Atlas.AtlasDimensions;
+		Mismatches += Atlas.AtlasData[AtlasVoxel.X + int64(AtlasDimensions.X) * (AtlasVoxel.Y + int64(AtlasDimensions.Y) * AtlasVoxel.Z)] != Value ? 1 : 0;
+	}
+	return Mismatches;
+}
+
+static void BenchmarkBrickPool(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	const int32 BrickSize = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : RAYMARCH_DEFAULT_BRICK_SIZE;
+	const int64 VoxelCount = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+
+	TArray<uint8> Volume;
+	MakeSyntheticVolume(Dimensions, Volume, 42);
+
+	const FRaymarchBrickLayout Layout = PartitionIntoBricks(Dimensions, BrickSize);
+	TArray<bool> Occupied;
+	const double ClassifyTime = TimeBestOf(5, [&]()
+	{
+		ClassifyBricks(Volume.GetData(), PF_G8, Layout, 0.0f, Occupied);
+	});
+
+	FRaymarchBrickAtlas Atlas;
+	const double PackTime = TimeBestOf(5, [&]()
+	{
+		PackBrickAtlas(Volume.GetData(), PF_G8, Layout, Occupied, Atlas);
+	});
+
+	UE_LOG(LogRaymarch, Display, TEXT("Brick pool benchmark, %dx%dx%d volume, brick size %d:"), Dimensions.X, Dimensions.Y, Dimensions.Z, BrickSize);
+	UE_LOG(LogRaymarch, Display, TEXT("  Classification: %.2f ms, %.1f MVoxels/s"), ClassifyTime * 1e3, VoxelCount / ClassifyTime / 1e6);
+	UE_LOG(LogRaymarch, Display, TEXT("  Packing: %.2f ms, %.1f MVoxels/s"), PackTime * 1e3, VoxelCount / PackTime / 1e6);
+	LogBrickAtlasMemory(TEXT("  Synthetic volume"), Layout, Atlas, PF_G8);
+
+	const int64 Mismatches = CountBrickAtlasMismatches(Volume, Layout, Occupied, Atlas);
+	if (Mismatches > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  %lld voxels differ between the volume and the atlas!"), Mismatches);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkBrickPoolCommand(
+	TEXT("Raymarch.Benchmark.BrickPool"),
+	TEXT("Measures classifying and packing bricks of a synthetic volume and checks the atlas voxel by voxel. Arguments: volume edge length (default 256), brick size (default 16)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBrickPool));
+
+static void ReportBrickPool(const TArray<FString>& Args)
+{
+	if (Args.Num() < 4)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Usage: Raymarch.BrickPoolReport <File relative to Content> <X> <Y> <Z> [U8|U16|S16|F16|F32] [BrickSize] [WindowCenter] [WindowWidth]"));
+		return;
+	}
+
+	const FString FullPath = FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir() / Args[0]);
+	const FIntVector Dimensions(FCString::Atoi(*Args[1]), FCString::Atoi(*Args[2]), FCString::Atoi(*Args[3]));
+	const UEnum* FormatEnum = FindObject<UEnum>(ANY_PACKAGE, TEXT("ERaymarchVoxelFormat"), true);
+	const int64 FormatValue = Args.Num() > 4 ? FormatEnum->GetValueByNameString(Args[4]) : int64(ERaymarchVoxelFormat::U8);
+	const int32 BrickSize = Args.Num() > 5 ? FMath::Max(FCString::Atoi(*Args[5]), 1) : RAYMARCH_DEFAULT_BRICK_SIZE;
+	const float WindowCenter = Args.Num() > 6 ? FCString::Atof(*Args[6]) : 0.0f;
+	const float WindowWidth = Args.Num() > 7 ? FCString::Atof(*Args[7]) : 0.0f;
+	if (FormatValue == INDEX_NONE || Dimensions.GetMin() <= 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Invalid voxel format or dimensions."));
+		return;
+	}
+	const ERaymarchVoxelFormat Format = ERaymarchVoxelFormat(FormatValue);
+
+	TArray<uint8> Volume;
+	const int64 VoxelCount = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+	if (!FFileHelper::LoadFileToArray(Volume, *FullPath) || Volume.Num() < VoxelCount * GetVoxelByteSize(Format))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be read or is smaller than expected."), *FullPath);
+		return;
+	}
+	if (Format == ERaymarchVoxelFormat::S16)
+	{
+		ConvertSignedToUnsigned16(reinterpret_cast<int16*>(Volume.GetData()), VoxelCount);
+	}
+
+	// Same classification as the bricked loader does.
+	const FVector2D WindowScaleBias = GetWindowScaleBias(Format, WindowCenter, WindowWidth);
+	const FRaymarchBrickLayout Layout = PartitionIntoBricks(Dimensions, BrickSize);
+	TArray<bool> Occupied;
+	ClassifyBricks(Volume.GetData(), GetVoxelPixelFormat(Format), Layout, -WindowScaleBias.Y / WindowScaleBias.X, Occupied);
+	FRaymarchBrickAtlas Atlas;
+	PackBrickAtlas(Volume.GetData(), GetVoxelPixelFormat(Format), Layout, Occupied, Atlas);
+	LogBrickAtlasMemory(FullPath, Layout, Atlas, GetVoxelPixelFormat(Format));
+}
+
+static FAutoConsoleCommand ReportBrickPoolCommand(
+	TEXT("Raymarch.BrickPoolReport"),
+	TEXT("Bricks a RAW volume on the CPU and reports how much GPU memory the brick pool would save. Run without arguments for usage."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&ReportBrickPool));
+
+// Voxel of the synthetic paging file, easy to recompute for checking the bricks that come out of the cache.
+static FORCEINLINE uint8 GetPagingTestVoxel(int32 X, int32 Y, int32 Z)
+{
+	return uint8((X * 7 + Y * 13 + Z * 31) & 0xFF);
+}
+
+// Writes the synthetic paging file slice by slice, so it can be much larger than memory.
+static bool WritePagingTestFile(const FString& FullPath, FIntVector Dimensions)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(FullPath));
+	TUniquePtr<IFileHandle> FileHandle(PlatformFile.OpenWrite(*FullPath));
+	if (!FileHandle)
+	{
+		return false;
+	}
+
+	TArray<uint8> Slice;
+	Slice.SetNumUninitialized(int64(Dimensions.X) * Dimensions.Y);
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		for (int32 X = 0; X < Dimensions.X; ++X)
+		{
+			Slice[X + int64(Dimensions.X) * Y] = GetPagingTestVoxel(X, Y, Z);
+		}
+		if (!FileHandle->Write(Slice.GetData(), Slice.Num()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Checks a brick from the cache (including the clamped apron) against the synthetic file.
+static bool IsPagedBrickValid(const FRaymarchBrickLayout& Layout, int32 BrickIndex, const TArray<uint8>& Data)
+{
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+	const FIntVector& Counts = Layout.BrickCounts;
+	const int32 Padded = Layout.GetPaddedBrickSize();
+	const FIntVector Origin = FIntVector(BrickIndex % Counts.X, (BrickIndex / Counts.X) % Counts.Y, BrickIndex / (Counts.X * Counts.Y)) * Layout.BrickSize
+		- FIntVector(Layout.Apron);
+	int64 Index = 0;
+	for (int32 Z = 0; Z < Padded; ++Z)
+	for (int32 Y = 0; Y < Padded; ++Y)
+	for (int32 X = 0; X < Padded; ++X)
+	{
+		const uint8 Expected = GetPagingTestVoxel(FMath::Clamp(Origin.X + X, 0, Dimensions.X - 1),
+			FMath::Clamp(Origin.Y + Y, 0, Dimensions.Y - 1), FMath::Clamp(Origin.Z + Z, 0, Dimensions.Z - 1));
+		if (Data[Index++] != Expected)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Loads a camera path recorded with Raymarch.RecordCameraPath (eye and view direction in object space of the volume per line).
+// Without a file, the camera orbits the volume once, looking at its center.
+static void GetReplayCameraPath(const FString& PathFile, TArray<TPair<FVector, FVector>>& OutPath)
+{
+	TArray<FString> Lines;
+	if (!PathFile.IsEmpty() && FFileHelper::LoadFileToStringArray(Lines, *PathFile))
+	{
+		for (const FString& Line : Lines)
+		{
+			TArray<FString> Values;
+			if (Line.ParseIntoArray(Values, TEXT(","), true) == 6)
+			{
+				OutPath.Add(TPair<FVector, FVector>(
+					FVector(FCString::Atof(*Values[0]), FCString::Atof(*Values[1]), FCString::Atof(*Values[2])),
+					FVector(FCString::Atof(*Values[3]), FCString::Atof(*Values[4]), FCString::Atof(*Values[5]))));
+			}
+		}
+		return;
+	}
+
+	const int32 FrameCount = 240;
+	for (int32 Frame = 0; Frame < FrameCount; ++Frame)
+	{
+		const float Angle = 2.0f * PI * Frame / FrameCount;
+		// Close enough that only a part of the volume is in view at a time.
+		const FVector Eye(FMath::Cos(Angle) * 1.6f, FMath::Sin(Angle) * 1.6f, 0.3f);
+		OutPath.Add(TPair<FVector, FVector>(Eye, -Eye.GetSafeNormal()));
+	}
+}
+
+static void BenchmarkBrickCache(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 512);
+	const int32 BrickSize = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : RAYMARCH_DEFAULT_BRICK_SIZE;
+	const int64 BudgetBytes = int64(Args.Num() > 2 ? FMath::Max(FCString::Atoi(*Args[2]), 1) : 32) * 1024 * 1024;
+	const FString PathFile = Args.Num() > 3 ? Args[3] : FString();
+
+	const FString FullPath = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / TEXT("Raymarch") / TEXT("BrickCacheTest.raw"));
+	const double WriteStart = FPlatformTime::Seconds();
+	if (!WritePagingTestFile(FullPath, Dimensions))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Couldn't write the synthetic volume to %s."), *FullPath);
+		return;
+	}
+	const double WriteTime = FPlatformTime::Seconds() - WriteStart;
+
+	TSharedPtr<FRaymarchBrickCache, ESPMode::ThreadSafe> Cache = FRaymarchBrickCache::Open(FullPath, Dimensions, ERaymarchVoxelFormat::U8, BrickSize, BudgetBytes);
+	if (!Cache)
+	{
+		return;
+	}
+
+	TArray<TPair<FVector, FVector>> CameraPath;
+	GetReplayCameraPath(PathFile, CameraPath);
+
+	// Same kind of camera the renderer gets, with the volume at the origin.
+	FCompiledCameraModel CameraModel;
+	CameraModel.ModelMatrix = FMatrix::Identity;
+	CameraModel.ProjectionMatrix = FReversedZPerspectiveMatrix(PI / 4, 16.0f, 9.0f, 0.01f);
+
+	int32 InvalidBricks = 0;
+	int64 RequestedBricks = 0;
+	TArray<int32> VisibleBricks;
+	const double ReplayStart = FPlatformTime::Seconds();
+	for (const TPair<FVector, FVector>& Camera : CameraPath)
+	{
+		CameraModel.ViewMatrix = FLookAtMatrix(Camera.Key, Camera.Key + Camera.Value, FVector::UpVector);
+		CameraModel.RayOrigin = Camera.Key;
+		Cache->UpdateVisibility(CameraModel, VisibleBricks);
+
+		// Like a renderer that needs every visible brick of the frame, as many of them as the cache can hold at once.
+		const int32 NeededBricks = FMath::Min(VisibleBricks.Num(), Cache->GetCapacity());
+		for (int32 i = 0; i < NeededBricks; ++i)
+		{
+			FRaymarchBrickDataPtr Data = Cache->GetBrickBlocking(VisibleBricks[i]);
+			InvalidBricks += Data && IsPagedBrickValid(Cache->GetLayout(), VisibleBricks[i], *Data) ? 0 : 1;
+		}
+		RequestedBricks += NeededBricks;
+	}
+	const double ReplayTime = FPlatformTime::Seconds() - ReplayStart;
+	Cache->Flush();
+
+	const FRaymarchBrickCacheStats Stats = Cache->GetStats();
+	UE_LOG(LogRaymarch, Display, TEXT("Brick cache replay, %dx%dx%d volume (written in %.2f s), brick size %d, %d resident bricks, %d frames:"),
+		Dimensions.X, Dimensions.Y, Dimensions.Z, WriteTime, BrickSize, Cache->GetCapacity(), CameraPath.Num());
+	UE_LOG(LogRaymarch, Display, TEXT("  %.2f ms per frame, %.1f bricks needed per frame"),
+		ReplayTime * 1e3 / FMath::Max(CameraPath.Num(), 1), double(RequestedBricks) / FMath::Max(CameraPath.Num(), 1));
+	UE_LOG(LogRaymarch, Display, TEXT("  Hit rate %.1f%%, %lld bricks (%.1f MB) paged, %lld evictions, %.2f ms stalled"),
+		Stats.GetHitRate() * 100.0f, Stats.BricksPaged, Stats.BytesPaged / (1024.0 * 1024.0), Stats.Evictions, Stats.StallSeconds * 1e3);
+	if (InvalidBricks > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  %d bricks came out of the cache wrong or not at all!"), InvalidBricks);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkBrickCacheCommand(
+	TEXT("Raymarch.Benchmark.BrickCache"),
+	TEXT("Replays a camera path against a synthetic RAW file paged through the brick cache and reports hit rate, paging and stalls. ")
+	TEXT("Arguments: volume edge length (default 512), brick size (default 16), cache budget in MB (default 32), camera path file (default: orbit)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBrickCache));
+
+static void BenchmarkVolumeFile(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	const bool b16Bit = Args.Num() > 1 && Args[1] == TEXT("U16");
+	const ERaymarchVoxelFormat Format = b16Bit ? ERaymarchVoxelFormat::U16 : ERaymarchVoxelFormat::U8;
+	const int32 SlabDepth = 4 * RAYMARCH_DEFAULT_CHUNK_DEPTH;
+
+	// The synthetic scan, widened to 12 bits with noisy low bits for U16 - like CT data.
+	TArray<uint8> Volume;
+	MakeSyntheticVolume(Dimensions, Volume, 1);
+	if (b16Bit)
+	{
+		TArray<uint8> Wide;
+		Wide.SetNumUninitialized(Volume.Num() * 2);
+		uint16* WideVoxels = reinterpret_cast<uint16*>(Wide.GetData());
+		FRandomStream Random(2);
+		for (int32 i = 0; i < Volume.Num(); ++i)
+		{
+			WideVoxels[i] = Volume[i] ? uint16(Volume[i] * 16 + Random.RandHelper(16)) : 0;
+		}
+		Volume = MoveTemp(Wide);
+	}
+
+	const FString Directory = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / TEXT("Raymarch"));
+	const FString RawPath = Directory / TEXT("VolumeFileTest.raw");
+	const FString VolumePath = Directory / TEXT("VolumeFileTest.rvol");
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*Directory);
+	if (!FFileHelper::SaveArrayToFile(Volume, *RawPath))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Couldn't write the synthetic volume to %s."), *RawPath);
+		return;
+	}
+
+	FRaymarchVolumeFileHeader Header;
+	Header.Dimensions = Dimensions;
+	Header.VoxelFormat = Format;
+	FRaymarchVolumeFileStats Stats;
+	const double ConvertStart = FPlatformTime::Seconds();
+	if (!ConvertRawToRaymarchVolumeFile(RawPath, Header, VolumePath, &Stats))
+	{
+		return;
+	}
+	const double ConvertTime = FPlatformTime::Seconds() - ConvertStart;
+
+	// Both read slab by slab, the way the streaming loader does.
+	const int64 SliceBytes = int64(Dimensions.X) * Dimensions.Y * GetVoxelByteSize(Format);
+	TArray<uint8> RawVolume;
+	RawVolume.SetNumUninitialized(Volume.Num());
+	const double RawTime = TimeBestOf(3, [&]()
+	{
+		TUniquePtr<IFileHandle> FileHandle(PlatformFile.OpenRead(*RawPath));
+		for (int32 Z = 0; FileHandle && Z < Dimensions.Z; Z += SlabDepth)
+		{
+			const int32 Slices = FMath::Min(SlabDepth, Dimensions.Z - Z);
+			FileHandle->Read(RawVolume.GetData() + Z * SliceBytes, Slices * SliceBytes);
+		}
+	});
+
+	TArray<uint8> DecompressedVolume;
+	DecompressedVolume.SetNumZeroed(Volume.Num());
+	bool bReadFailed = false;
+	const double CompressedTime = TimeBestOf(3, [&]()
+	{
+		TUniquePtr<FRaymarchVolumeFileReader> Reader = FRaymarchVolumeFileReader::Open(VolumePath);
+		for (int32 Z = 0; Reader && Z < Dimensions.Z; Z += SlabDepth)
+		{
+			const int32 Slices = FMath::Min(SlabDepth, Dimensions.Z - Z);
+			bReadFailed |= !Reader->ReadSlices(Z, Slices, DecompressedVolume.GetData() + Z * SliceBytes);
+		}
+		bReadFailed |= !Reader;
+	});
+
+	const double VolumeMB = Volume.Num() / (1024.0 * 1024.0);
+	UE_LOG(LogRaymarch, Display, TEXT("Volume file, %dx%dx%d %s volume (%.1f MB), chunks of %d slices, read in slabs of %d slices:"),
+		Dimensions.X, Dimensions.Y, Dimensions.Z, b16Bit ? TEXT("U16") : TEXT("U8"), VolumeMB, Header.ChunkDepth, SlabDepth);
+	UE_LOG(LogRaymarch, Display, TEXT("  Compressed to %.1f MB (ratio %.2f), converted in %.2f s"),
+		Stats.CompressedBytes / (1024.0 * 1024.0), Stats.GetRatio(), ConvertTime);
+	UE_LOG(LogRaymarch, Display, TEXT("  RAW: %.2f ms (%.0f MB/s), compressed: %.2f ms (%.0f MB/s of voxels)"),
+		RawTime * 1e3, VolumeMB / RawTime, CompressedTime * 1e3, VolumeMB / CompressedTime);
+	UE_LOG(LogRaymarch, Display, TEXT("  Both files are likely in the OS file cache - a cold disk favors the compressed file by about the ratio."));
+	if (bReadFailed || RawVolume != Volume || DecompressedVolume != Volume)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  The voxels read back don't match the ones written!"));
+	}
+}
+
+static FAutoConsoleCommand BenchmarkVolumeFileCommand(
+	TEXT("Raymarch.Benchmark.VolumeFile"),
+	TEXT("Writes a synthetic volume as RAW and as compressed volume file, then compares how fast both load slab by slab and checks ")
+	TEXT("the round trip. Arguments: volume edge length (default 256), voxel format U8 or U16 (default U8)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkVolumeFile));
+
+// Smooth radial ramp, the kind of data BC4 handles best (soft tissue, windowed gradients).
+static void MakeSmoothVolume(FIntVector Dimensions, TArray<uint8>& OutVolume)
+{
+	OutVolume.SetNumUninitialized(int64(Dimensions.X) * Dimensions.Y * Dimensions.Z);
+	const FVector Center = FVector(Dimensions) / 2;
+	const float Radius = Dimensions.GetMax() / 2.0f;
+	int64 Index = 0;
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+	for (int32 X = 0; X < Dimensions.X; ++X)
+	{
+		OutVolume[Index++] = uint8(FMath::Clamp(255.0f * (1.0f - FVector::Dist(FVector(X, Y, Z), Center) / Radius), 0.0f, 255.0f));
+	}
+}
+
+static void BenchmarkBlockCompression(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	TArray<uint8> Volumes[2];
+	MakeSyntheticVolume(Dimensions, Volumes[0], 1);
+	MakeSmoothVolume(Dimensions, Volumes[1]);
+	const TCHAR* Names[] = { TEXT("Noisy scan"), TEXT("Smooth ramp") };
+
+	UE_LOG(LogRaymarch, Display, TEXT("BC4 encoder, %dx%dx%d volumes:"), Dimensions.X, Dimensions.Y, Dimensions.Z);
+	const double MegaVoxels = double(Volumes[0].Num()) / 1e6;
+	for (int32 i = 0; i < ARRAY_COUNT(Volumes); ++i)
+	{
+		TArray<uint8> Blocks;
+		Blocks.SetNumUninitialized(GetBC4SlabBytes(Dimensions.X, Dimensions.Y, Dimensions.Z));
+		FRaymarchBlockCompressionStats Stats;
+		const double CompressTime = TimeBestOf(3, [&]()
+		{
+			CompressSlabBC4(Volumes[i].GetData(), Dimensions.X, Dimensions.Y, Dimensions.Z, Blocks.GetData(), &Stats);
+		});
+		TArray<uint8> Decoded;
+		Decoded.SetNumUninitialized(Volumes[i].Num());
+		const double DecompressTime = TimeBestOf(3, [&]()
+		{
+			DecompressSlabBC4(Blocks.GetData(), Dimensions.X, Dimensions.Y, Dimensions.Z, Decoded.GetData());
+		});
+
+		UE_LOG(LogRaymarch, Display, TEXT("  %s: encode %.2f ms (%.0f MVoxels/s), decode %.2f ms (%.0f MVoxels/s)"),
+			Names[i], CompressTime * 1e3, MegaVoxels / CompressTime, DecompressTime * 1e3, MegaVoxels / DecompressTime);
+		UE_LOG(LogRaymarch, Display, TEXT("    ratio %.2f, max error %.1f, RMS error %.3f, PSNR %.1f dB"),
+			Stats.GetRatio(), Stats.MaxError, Stats.GetRootMeanSquareError(), FMath::Min(Stats.GetPeakSignalToNoiseRatio(), 999.0));
+	}
+}
+
+static FAutoConsoleCommand BenchmarkBlockCompressionCommand(
+	TEXT("Raymarch.Benchmark.BlockCompression"),
+	TEXT("Times the parallel BC4 encoder and decoder on a noisy and a smooth synthetic volume and reports ratio and error. ")
+	TEXT("Argument: volume edge length (default 256)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkBlockCompression));
+
+// What a BC4 round trip has to bring back at least.
+enum class EExpectedBlockError
+{
+	// The voxels as they were.
+	Exact,
+	// Voxels within half a step of the 8-value palette.
+	HalfStep,
+	// Voxels within the range of their block.
+	InRange
+};
+
+// Compresses and decodes a volume, then checks every voxel came back as expected. Returns the number of voxels that didn't.
+static int64 CountBlockCompressionErrors(const TArray<uint8>& Volume, FIntVector Dimensions, EExpectedBlockError Expected,
+	FRaymarchBlockCompressionStats& OutStats)
+{
+	TArray<uint8> Blocks, Decoded;
+	Blocks.SetNumUninitialized(GetBC4SlabBytes(Dimensions.X, Dimensions.Y, Dimensions.Z));
+	Decoded.SetNumUninitialized(Volume.Num());
+	CompressSlabBC4(Volume.GetData(), Dimensions.X, Dimensions.Y, Dimensions.Z, Blocks.GetData(), &OutStats);
+	DecompressSlabBC4(Blocks.GetData(), Dimensions.X, Dimensions.Y, Dimensions.Z, Decoded.GetData());
+
+	int64 Errors = 0;
+	float MaxError = 0.0f;
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+	for (int32 X = 0; X < Dimensions.X; ++X)
+	{
+		const int32 BlockX = X - X % RAYMARCH_BC4_BLOCK_SIZE, BlockY = Y - Y % RAYMARCH_BC4_BLOCK_SIZE;
+		uint8 Min = 255, Max = 0;
+		for (int32 InnerY = BlockY; InnerY < FMath::Min(BlockY + RAYMARCH_BC4_BLOCK_SIZE, Dimensions.Y); ++InnerY)
+		for (int32 InnerX = BlockX; InnerX < FMath::Min(BlockX + RAYMARCH_BC4_BLOCK_SIZE, Dimensions.X); ++InnerX)
+		{
+			const uint8 Value = Volume[InnerX + Dimensions.X * (InnerY + int64(Dimensions.Y) * Z)];
+			Min = FMath::Min(Min, Value);
+			Max = FMath::Max(Max, Value);
+		}
+
+		const int64 Index = X + Dimensions.X * (Y + int64(Dimensions.Y) * Z);
+		const int32 Error = FMath::Abs(int32(Decoded[Index]) - Volume[Index]);
+		// Half a palette step, plus rounding the decoded value to 8 bits.
+		const float AllowedError = Expected == EExpectedBlockError::Exact ? 0.0f
+			: (Expected == EExpectedBlockError::HalfStep ? (Max - Min) / 14.0f + 0.5f : 255.0f);
+		Errors += Decoded[Index] < Min || Decoded[Index] > Max || Error > AllowedError ? 1 : 0;
+		MaxError = FMath::Max(MaxError, float(Error));
+	}
+
+	// The stats measure the error before rounding to 8 bits.
+	if (FMath::Abs(OutStats.MaxError - MaxError) > 0.5f || OutStats.Voxels != Volume.Num())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  Stats say max error %.2f over %lld voxels, the decoded volume has %.0f over %d."),
+			OutStats.MaxError, OutStats.Voxels, MaxError, Volume.Num());
+		++Errors;
+	}
+	return Errors;
+}
+
+static void TestBlockCompression(const TArray<FString>& Args)
+{
+	// Odd sizes, so partial blocks at the borders get tested too (mip levels of most volumes have them).
+	const FIntVector Dimensions(37, 23, 3);
+	const int64 VoxelCount = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+	FRandomStream Random(3);
+	int32 Failures = 0;
+
+	auto RunCase = [&](const TCHAR* Name, const TArray<uint8>& Volume, EExpectedBlockError Expected)
+	{
+		FRaymarchBlockCompressionStats Stats;
+		const int64 Errors = CountBlockCompressionErrors(Volume, Dimensions, Expected, Stats);
+		UE_LOG(LogRaymarch, Display, TEXT("  %s: ratio %.2f, max error %.1f, RMS error %.3f, %lld voxels wrong"),
+			Name, Stats.GetRatio(), Stats.MaxError, Stats.GetRootMeanSquareError(), Errors);
+		if (Errors > 0)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("  %s: round trip failed!"), Name);
+			++Failures;
+		}
+	};
+
+	UE_LOG(LogRaymarch, Display, TEXT("BC4 round trips, %dx%dx%d volumes:"), Dimensions.X, Dimensions.Y, Dimensions.Z);
+	TArray<uint8> Volume;
+	Volume.SetNumUninitialized(VoxelCount);
+
+	// Constant blocks and blocks of two values are exact - the two values are the endpoints.
+	for (int64 i = 0; i < VoxelCount; ++i)
+	{
+		Volume[i] = uint8(7 + 50 * (i / (Dimensions.X * Dimensions.Y)));
+	}
+	RunCase(TEXT("Constant slices"), Volume, EExpectedBlockError::Exact);
+	for (int64 i = 0; i < VoxelCount; ++i)
+	{
+		Volume[i] = Random.RandHelper(2) ? 17 : 230;
+	}
+	RunCase(TEXT("Two values"), Volume, EExpectedBlockError::Exact);
+
+	// Air and saturated voxels next to two others, exact in the 6-value mode.
+	for (int64 i = 0; i < VoxelCount; ++i)
+	{
+		const uint8 Values[] = { 0, 255, 90, 91 };
+		Volume[i] = Values[Random.RandHelper(4)];
+	}
+	RunCase(TEXT("Air and saturation"), Volume, EExpectedBlockError::Exact);
+
+	// Noise without 0 or 255 only ever uses the 8-value mode, which has a known worst case.
+	for (int64 i = 0; i < VoxelCount; ++i)
+	{
+		Volume[i] = uint8(1 + Random.RandHelper(254));
+	}
+	RunCase(TEXT("Noise"), Volume, EExpectedBlockError::HalfStep);
+
+	// Any bytes at all - the range still has to hold, whichever mode wins.
+	FillRandom(Volume, 4);
+	RunCase(TEXT("Random bytes"), Volume, EExpectedBlockError::InRange);
+	UE_LOG(LogRaymarch, Display, TEXT("BC4 round trips: %d failures."), Failures);
+}
+
+static FAutoConsoleCommand TestBlockCompressionCommand(
+	TEXT("Raymarch.Test.BlockCompression"),
+	TEXT("Compresses and decodes synthetic volumes with BC4 and checks the voxels that come back against the guarantees of the encoder."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&TestBlockCompression));
+
+static void BenchmarkPreIntegration(const TArray<FString>& Args)
+{
+	const int32 Size = Args.Num() > 0 ? FMath::Clamp(FCString::Atoi(*Args[0]), 2, 1024) : RAYMARCH_TRANSFER_FUNCTION_SIZE;
+	const int32 SubSteps = 8;
+	const int32 Repetitions = 5;
+
+	// A smooth ramp with a sharp, opaque spike in it - the kind of transfer function that slices without pre-integration.
+	TArray<FLinearColor> Lut;
+	Lut.SetNumUninitialized(Size);
+	FRandomStream Random(0x5EED);
+	for (int32 i = 0; i < Size; ++i)
+	{
+		const float Intensity = float(i) / (Size - 1);
+		const float Opacity = FMath::Abs(Intensity - 0.3f) < 0.01f ? 0.95f : FMath::Max(Intensity - 0.5f, 0.0f);
+		Lut[i] = FLinearColor(Random.FRand(), Random.FRand(), Random.FRand(), Opacity);
+	}
+
+	TArray<FLinearColor> Reference;
+	TArray<FLinearColor> Optimized;
+	const double ReferenceTime = TimeBestOf(1, [&]()
+	{
+		BuildPreIntegrationTable_Reference(Lut, SubSteps, Reference);
+	});
+	const double OptimizedTime = TimeBestOf(Repetitions, [&]()
+	{
+		BuildPreIntegrationTable(Lut, Optimized);
+	});
+
+	// Colors only matter as much as the segment is opaque.
+	float MaxError = 0.0f;
+	for (int32 i = 0; i < Reference.Num(); ++i)
+	{
+		const FLinearColor& A = Reference[i];
+		const FLinearColor& B = Optimized[i];
+		MaxError = FMath::Max(MaxError, FMath::Abs(A.A - B.A));
+		MaxError = FMath::Max(MaxError, FMath::Max3(FMath::Abs(A.R - B.R), FMath::Abs(A.G - B.G), FMath::Abs(A.B - B.B)) * A.A);
+	}
+
+	UE_LOG(LogRaymarch, Display, TEXT("Pre-integration table, %d entries:"), Size);
+	UE_LOG(LogRaymarch, Display, TEXT("  Numerical (%d steps per entry): %.2f ms"), SubSteps, ReferenceTime * 1e3);
+	UE_LOG(LogRaymarch, Display, TEXT("  Running sums:                  %.3f ms (%.1fx), max error %f"),
+		OptimizedTime * 1e3, ReferenceTime / FMath::Max(OptimizedTime, 1e-9), MaxError);
+	if (MaxError > 0.01f)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  Pre-integration table differs from the numerical reference!"));
+	}
+}
+
+static FAutoConsoleCommand BenchmarkPreIntegrationCommand(
+	TEXT("Raymarch.Benchmark.PreIntegration"),
+	TEXT("Builds the pre-integration table of a synthetic transfer function and compares it to numerical integration. ")
+	TEXT("Argument: number of transfer function entries (default 256)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkPreIntegration));
+
+// Largest absolute difference between two float arrays of the same size.
+static float GetMaxDifference(const TArray<float>& A, const TArray<float>& B)
+{
+	check(A.Num() == B.Num());
+	float MaxDifference = 0.0f;
+	for (int32 i = 0; i < A.Num(); ++i)
+	{
+		MaxDifference = FMath::Max(MaxDifference, FMath::Abs(A[i] - B[i]));
+	}
+	return MaxDifference;
+}
+
+static void BenchmarkFilters(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 96);
+	const int32 Repetitions = 3;
+	const double VoxelCount = double(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+
+	// The noisy ball, normalized like the shaders sample it.
+	TArray<uint8> Bytes;
+	MakeSyntheticVolume(Dimensions, Bytes, 0x5EED);
+	TArray<float> Source;
+	Source.SetNumUninitialized(Bytes.Num());
+	for (int32 i = 0; i < Bytes.Num(); ++i)
+	{
+		Source[i] = Bytes[i] / 255.0f;
+	}
+
+	FRaymarchFilterSettings Vesselness;
+	Vesselness.Filter = ERaymarchFilter::Vesselness;
+	Vesselness.Sigma = 1.5f;
+
+	// Name, scalar reference and optimized version of every filter. Each writes into the second array.
+	struct FFilterCase
+	{
+		const TCHAR* Name;
+		TFunction<void(const TArray<float>&, TArray<float>&)> Scalar;
+		TFunction<void(const TArray<float>&, TArray<float>&)> Optimized;
+		// The Gaussians sum in a different order, so they may differ in the last bits.
+		float Tolerance;
+	};
+	const FFilterCase Cases[] =
+	{
+		{ TEXT("Gaussian (sigma 1.5)"),
+			[&](const TArray<float>& In, TArray<float>& Out) { GaussianFilter_Scalar(In.GetData(), Out.GetData(), Dimensions, 1.5f); },
+			[&](const TArray<float>& In, TArray<float>& Out) { GaussianFilter(In.GetData(), Out.GetData(), Dimensions, 1.5f); },
+			1e-5f },
+		{ TEXT("Median 3x3x3"),
+			[&](const TArray<float>& In, TArray<float>& Out) { MedianFilter_Scalar(In.GetData(), Out.GetData(), Dimensions); },
+			[&](const TArray<float>& In, TArray<float>& Out) { MedianFilter(In.GetData(), Out.GetData(), Dimensions); },
+			0.0f },
+		{ TEXT("Vesselness (sigma 1.5)"),
+			[&](const TArray<float>& In, TArray<float>& Out) { VesselnessFilter_Scalar(In.GetData(), Out.GetData(), Dimensions, Vesselness); },
+			[&](const TArray<float>& In, TArray<float>& Out) { VesselnessFilter(In.GetData(), Out.GetData(), Dimensions, Vesselness); },
+			1e-4f },
+	};
+
+	UE_LOG(LogRaymarch, Display, TEXT("Volume filters, %dx%dx%d float volume:"), Dimensions.X, Dimensions.Y, Dimensions.Z);
+	TArray<float> Reference;
+	TArray<float> Optimized;
+	Reference.SetNumUninitialized(Source.Num());
+	Optimized.SetNumUninitialized(Source.Num());
+	for (const FFilterCase& Case : Cases)
+	{
+		const double ScalarTime = TimeBestOf(1, [&]()
+		{
+			Case.Scalar(Source, Reference);
+		});
+		const double OptimizedTime = TimeBestOf(Repetitions, [&]()
+		{
+			Case.Optimized(Source, Optimized);
+		});
+		const float MaxDifference = GetMaxDifference(Reference, Optimized);
+
+		UE_LOG(LogRaymarch, Display, TEXT("  %s:"), Case.Name);
+		UE_LOG(LogRaymarch, Display, TEXT("    Scalar:    %.1f Mvoxels/s"), VoxelCount / ScalarTime / 1e6);
+		UE_LOG(LogRaymarch, Display, TEXT("    Optimized: %.1f Mvoxels/s (%.1fx), max difference %g"),
+			VoxelCount / OptimizedTime / 1e6, ScalarTime / FMath::Max(OptimizedTime, 1e-9), MaxDifference);
+		if (MaxDifference > Case.Tolerance)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("    Optimized %s differs from the scalar reference!"), Case.Name);
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkFiltersCommand(
+	TEXT("Raymarch.Benchmark.Filters"),
+	TEXT("Runs the CPU versions of the volume filters (the reference of the compute shaders) over a synthetic volume, ")
+	TEXT("parallel SIMD vs. scalar single-threaded. Argument: edge length of the volume (default 96)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkFilters));
+
+static int64 CountMismatches(const TArray<FColor>& A, const TArray<FColor>& B)
+{
+	int64 Mismatches = 0;
+	for (int32 i = 0; i < A.Num(); ++i)
+	{
+		Mismatches += A[i] != B[i];
+	}
+	return Mismatches;
+}
+
+static void BenchmarkGradients(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 128);
+	const int32 Repetitions = 3;
+	const double VoxelCount = double(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+	const int64 SliceVoxels = int64(Dimensions.X) * Dimensions.Y;
+
+	TArray<uint8> Volume;
+	MakeSyntheticVolume(Dimensions, Volume, 0x5EED);
+	// Some window, so that the conversion isn't just a division.
+	const FVector2D WindowScaleBias(1.5f, -0.2f);
+	TArray<float> Intensities;
+	Intensities.SetNumUninitialized(Volume.Num());
+	const double ConvertTime = TimeBestOf(Repetitions, [&]()
+	{
+		ConvertToWindowedIntensity(Volume.GetData(), PF_G8, Volume.Num(), WindowScaleBias, Intensities.GetData());
+	});
+
+	TArray<FColor> Reference;
+	TArray<FColor> Optimized;
+	Reference.SetNumUninitialized(Volume.Num());
+	Optimized.SetNumUninitialized(Volume.Num());
+	const double ScalarTime = TimeBestOf(1, [&]()
+	{
+		BuildGradientSlab_Scalar(Intensities.GetData(), 0, Dimensions, 0, Dimensions.Z, Reference.GetData());
+	});
+	const double OptimizedTime = TimeBestOf(Repetitions, [&]()
+	{
+		BuildGradientSlab(Intensities.GetData(), 0, Dimensions, 0, Dimensions.Z, Optimized.GetData());
+	});
+	const int64 Mismatches = CountMismatches(Reference, Optimized);
+
+	// The same volume as the streaming loader sees it, in slabs of a few slices.
+	TArray<FColor> Slabbed;
+	Slabbed.SetNumZeroed(Volume.Num());
+	const int32 SlabDepth = 7;
+	const double SlabbedTime = TimeBestOf(1, [&]()
+	{
+		FRaymarchGradientSlabBuilder Builder;
+		Builder.Init(Dimensions);
+		for (int32 FirstSlice = 0; FirstSlice < Dimensions.Z; FirstSlice += SlabDepth)
+		{
+			const int32 SliceCount = FMath::Min(SlabDepth, Dimensions.Z - FirstSlice);
+			if (Builder.AddSlab(Intensities.GetData() + FirstSlice * SliceVoxels, SliceCount) > 0)
+			{
+				Builder.BuildReadySlices(Slabbed.GetData() + Builder.GetFirstReadySlice() * SliceVoxels);
+			}
+		}
+	});
+	const int64 SlabbedMismatches = CountMismatches(Reference, Slabbed);
+
+	UE_LOG(LogRaymarch, Display, TEXT("Gradient volume, %dx%dx%d G8 volume:"), Dimensions.X, Dimensions.Y, Dimensions.Z);
+	UE_LOG(LogRaymarch, Display, TEXT("  Windowing:     %.1f Mvoxels/s"), VoxelCount / ConvertTime / 1e6);
+	UE_LOG(LogRaymarch, Display, TEXT("  Scalar:        %.1f Mvoxels/s"), VoxelCount / ScalarTime / 1e6);
+	UE_LOG(LogRaymarch, Display, TEXT("  Optimized:     %.1f Mvoxels/s (%.1fx), %lld mismatches"),
+		VoxelCount / OptimizedTime / 1e6, ScalarTime / FMath::Max(OptimizedTime, 1e-9), Mismatches);
+	UE_LOG(LogRaymarch, Display, TEXT("  Slabs of %d:   %.1f Mvoxels/s, %lld mismatches"),
+		SlabDepth, VoxelCount / SlabbedTime / 1e6, SlabbedMismatches);
+	if (Mismatches > 0 || SlabbedMismatches > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  Gradients differ from the scalar reference!"));
+	}
+}
+
+static FAutoConsoleCommand BenchmarkGradientsCommand(
+	TEXT("Raymarch.Benchmark.Gradients"),
+	TEXT("Builds the gradient volume of a synthetic volume, parallel SIMD and slab by slab vs. scalar single-threaded. ")
+	TEXT("Argument: edge length of the volume (default 128)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkGradients));
+
+// Camera setup of a draw as it was done before the camera model provider - a scene view family and CalcSceneView every time.
+static bool CompileCameraModelsWithSceneView(UWorld* World, const TArray<FTransform>& Transforms, TArray<FCompiledCameraModel>& OutModels)
+{
+	ULocalPlayer* LocalPlayer = World->GetFirstLocalPlayerFromController();
+	FSceneViewFamilyContext ViewFamily(FSceneViewFamily::ConstructionValues(
+		LocalPlayer->ViewportClient->Viewport,
+		World->Scene,
+		LocalPlayer->ViewportClient->EngineShowFlags)
+		.SetRealtimeUpdate(true));
+
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	FSceneView* SceneView = LocalPlayer->CalcSceneView(&ViewFamily, ViewLocation, ViewRotation, LocalPlayer->ViewportClient->Viewport);
+	if (!SceneView)
+	{
+		return false;
+	}
+	OutModels.SetNum(Transforms.Num());
+	for (int32 i = 0; i < Transforms.Num(); ++i)
+	{
+		OutModels[i].ModelMatrix = Transforms[i].ToMatrixWithScale();
+		OutModels[i].ViewMatrix = SceneView->ViewMatrices.GetViewMatrix();
+		OutModels[i].ProjectionMatrix = SceneView->ViewMatrices.GetProjectionMatrix();
+		OutModels[i].RayOrigin = Transforms[i].ToInverseMatrixWithScale().TransformPosition(ViewLocation);
+	}
+	return true;
+}
+
+// Camera setup of a draw through the provider, the view only gets computed once per frame.
+static bool CompileCameraModelsWithProvider(UWorld* World, const TArray<FTransform>& Transforms, TArray<FCompiledCameraModel>& OutModels)
+{
+	FRaymarchView View;
+	if (!FRaymarchCameraModelProvider::GetPlayerView_GameThread(World, 0, View))
+	{
+		return false;
+	}
+	OutModels.SetNum(Transforms.Num());
+	for (int32 i = 0; i < Transforms.Num(); ++i)
+	{
+		OutModels[i] = View.CompileCameraModel(Transforms[i]);
+	}
+	return true;
+}
+
+static bool AreCameraModelsEqual(const FCompiledCameraModel& A, const FCompiledCameraModel& B)
+{
+	const float Tolerance = 1e-3f;
+	return A.ModelMatrix.Equals(B.ModelMatrix, Tolerance) && A.ViewMatrix.Equals(B.ViewMatrix, Tolerance) &&
+		A.ProjectionMatrix.Equals(B.ProjectionMatrix, Tolerance) && A.RayOrigin.Equals(B.RayOrigin, 0.1f);
+}
+
+static void BenchmarkCameraSetup(const TArray<FString>& Args, UWorld* World)
+{
+	const int32 DrawCount = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 1000;
+	const int32 VolumeCount = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 4;
+	const int32 Repetitions = 5;
+
+	if (!World || !World->Scene || !World->GetFirstLocalPlayerFromController() || !World->GetFirstLocalPlayerFromController()->ViewportClient)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Raymarch.Benchmark.CameraSetup needs a running game with a local player."));
+		return;
+	}
+
+	TArray<FTransform> Transforms;
+	FRandomStream Random(0x5EED);
+	for (int32 i = 0; i < VolumeCount; ++i)
+	{
+		Transforms.Add(FTransform(FRotator(Random.FRandRange(-180, 180), Random.FRandRange(-180, 180), 0.0f),
+			Random.GetUnitVector() * Random.FRandRange(0.0f, 1000.0f), FVector(Random.FRandRange(50.0f, 200.0f))));
+	}
+
+	TArray<FCompiledCameraModel> Reference;
+	TArray<FCompiledCameraModel> Cached;
+	if (!CompileCameraModelsWithSceneView(World, Transforms, Reference) || !CompileCameraModelsWithProvider(World, Transforms, Cached))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Couldn't get the view of the first local player."));
+		return;
+	}
+	int32 Mismatches = 0;
+	for (int32 i = 0; i < VolumeCount; ++i)
+	{
+		Mismatches += AreCameraModelsEqual(Reference[i], Cached[i]) ? 0 : 1;
+	}
+
+	// All draws run in the same frame, like several render targets or batches drawn from one tick.
+	const int64 ComputesBefore = FRaymarchCameraModelProvider::GetPlayerViewComputeCount();
+	const double SceneViewTime = TimeBestOf(Repetitions, [&]()
+	{
+		for (int32 Draw = 0; Draw < DrawCount; ++Draw)
+		{
+			CompileCameraModelsWithSceneView(World, Transforms, Reference);
+		}
+	});
+	const double ProviderTime = TimeBestOf(Repetitions, [&]()
+	{
+		for (int32 Draw = 0; Draw < DrawCount; ++Draw)
+		{
+			CompileCameraModelsWithProvider(World, Transforms, Cached);
+		}
+	});
+	const int64 Computes = FRaymarchCameraModelProvider::GetPlayerViewComputeCount() - ComputesBefore;
+
+	UE_LOG(LogRaymarch, Display, TEXT("Camera setup, %d draws of %d volumes in one frame:"), DrawCount, VolumeCount);
+	UE_LOG(LogRaymarch, Display, TEXT("  CalcSceneView per draw: %.2f us per draw"), SceneViewTime * 1e6 / DrawCount);
+	UE_LOG(LogRaymarch, Display, TEXT("  Cached provider:        %.2f us per draw (%.1fx), view computed %lld times"),
+		ProviderTime * 1e6 / DrawCount, SceneViewTime / FMath::Max(ProviderTime, 1e-9), Computes);
+	if (Mismatches > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  %d camera models differ from the CalcSceneView ones!"), Mismatches);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkCameraSetupCommand(
+	TEXT("Raymarch.Benchmark.CameraSetup"),
+	TEXT("Measures game thread time of the camera setup per draw, CalcSceneView every draw vs. the cached camera model provider. ")
+	TEXT("Needs a running game (unlike the other benchmarks). Arguments: number of draws (default 1000), volumes per draw (default 4)."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&BenchmarkCameraSetup));
+
+// Transfer function of the CPU raymarcher scenes - transparent up to 0.3 (so empty-space skipping has cells to skip),
+// a soft ramp with an opaque band, colors changing along it. Goes through half floats like the textures the shader reads.
+static void MakeCpuRaymarchLut(TArray<FLinearColor>& OutLut, TArray<FLinearColor>& OutPreIntegrationTable, TArray<float>& OutMaxOpacityTable)
+{
+	const int32 Size = RAYMARCH_TRANSFER_FUNCTION_SIZE;
+	TArray<FLinearColor> Lut;
+	Lut.SetNumUninitialized(Size);
+	for (int32 i = 0; i < Size; ++i)
+	{
+		const float Intensity = float(i) / (Size - 1);
+		const float Opacity = FMath::Abs(Intensity - 0.7f) < 0.05f ? 0.9f : FMath::Max(Intensity - 0.3f, 0.0f) * 0.2f;
+		Lut[i] = FLinearColor(Intensity, 1.0f - Intensity, 0.5f, Opacity);
+	}
+	TArray<FLinearColor> PreIntegrationTable;
+	BuildPreIntegrationTable(Lut, PreIntegrationTable);
+
+	auto ToHalfPrecision = [](const FLinearColor& Color)
+	{
+		const FFloat16Color Half(Color);
+		return FLinearColor(Half.R.GetFloat(), Half.G.GetFloat(), Half.B.GetFloat(), Half.A.GetFloat());
+	};
+	OutLut.Reset(Lut.Num());
+	for (const FLinearColor& Color : Lut)
+	{
+		OutLut.Add(ToHalfPrecision(Color));
+	}
+	OutPreIntegrationTable.Reset(PreIntegrationTable.Num());
+	for (const FLinearColor& Color : PreIntegrationTable)
+	{
+		OutPreIntegrationTable.Add(ToHalfPrecision(Color));
+	}
+
+	// Built from the half float opacities like UpdateTransferFunctionTextures_RenderThread does.
+	TArray<float> Opacities;
+	Opacities.Reserve(OutLut.Num());
+	for (const FLinearColor& Color : OutLut)
+	{
+		Opacities.Add(Color.A);
+	}
+	BuildMaxOpacityTable(Opacities, OutMaxOpacityTable);
+	for (float& Opacity : OutMaxOpacityTable)
+	{
+		Opacity = FFloat16(Opacity).GetFloat();
+	}
+}
+
+// Turns U8 voxels into a volume for the CPU raymarcher - normalized like a PF_G8 texture samples them, with macro cells.
+static void MakeCpuRaymarchVolume(const TArray<uint8>& Voxels, FIntVector Dimensions, FRaymarchCpuVolume& OutVolume)
+{
+	OutVolume.Dimensions = Dimensions;
+	OutVolume.Voxels.SetNumUninitialized(Voxels.Num());
+	for (int32 i = 0; i < Voxels.Num(); ++i)
+	{
+		OutVolume.Voxels[i] = Voxels[i] / 255.0f;
+	}
+	// Windows the noise of the ball to [0,1] and everything outside of it to 0.
+	OutVolume.WindowScaleBias = FVector2D(1.5f, -0.4f);
+	OutVolume.MacroCells.Init(Dimensions, RAYMARCH_DEFAULT_MACRO_CELL_SIZE);
+	OutVolume.MacroCells.AccumulateSlab(OutVolume.Voxels.GetData(), PF_R32_FLOAT, 0, Dimensions.Z);
+	MakeCpuRaymarchLut(OutVolume.Lut, OutVolume.PreIntegrationTable, OutVolume.MaxOpacityTable);
+}
+
+// A camera a bit above the volume and off its axes, seeing all of it, like the first look at a freshly loaded scan.
+static FRaymarchView MakeCpuRaymarchView(FIntPoint ImageSize)
+{
+	const FVector Location(-3.0f, 1.2f, 1.5f);
+	return FRaymarchCameraModelProvider::MakeView(FTransform(FRotationMatrix::MakeFromX(-Location).Rotator(), Location), 60.0f, ImageSize);
+}
+
+// Configurations every CPU raymarcher benchmark and test goes through.
+struct FCpuRaymarchScene
+{
+	const TCHAR* Name;
+	ERaymarchCompositingMode CompositingMode;
+	bool bTransferFunction;
+	bool bPreIntegrate;
+	bool bMacroCells;
+	float Quality;
+	// World units, the volume is 2 across.
+	float SlabThickness;
+};
+
+static const FCpuRaymarchScene CpuRaymarchScenes[] = {
+	{ TEXT("FrontToBackPreIntegrated"), ERaymarchCompositingMode::FrontToBack, true, true, true, 1.0f, 0.0f },
+	{ TEXT("FrontToBackSkipping"), ERaymarchCompositingMode::FrontToBack, true, false, true, 2.0f, 0.0f },
+	{ TEXT("FrontToBackGrey"), ERaymarchCompositingMode::FrontToBack, false, false, false, 1.0f, 0.0f },
+	{ TEXT("Additive"), ERaymarchCompositingMode::Additive, false, false, true, 0.5f, 0.0f },
+	// Additive and average ignore the transfer function, bound or not - skipping mustn't go by it.
+	{ TEXT("AdditiveTransferFunction"), ERaymarchCompositingMode::Additive, true, false, true, 0.5f, 0.0f },
+	{ TEXT("MaximumIntensity"), ERaymarchCompositingMode::MaximumIntensity, false, false, true, 1.0f, 0.0f },
+	{ TEXT("MaximumIntensityNoSkipping"), ERaymarchCompositingMode::MaximumIntensity, false, false, false, 1.0f, 0.0f },
+	{ TEXT("MaximumIntensitySlab"), ERaymarchCompositingMode::MaximumIntensity, false, false, true, 1.0f, 0.5f },
+	{ TEXT("MinimumIntensity"), ERaymarchCompositingMode::MinimumIntensity, false, false, true, 1.0f, 0.0f },
+	{ TEXT("AverageIntensity"), ERaymarchCompositingMode::AverageIntensity, false, false, true, 1.0f, 0.0f },
+	{ TEXT("AverageIntensityTransferFunction"), ERaymarchCompositingMode::AverageIntensity, true, false, true, 1.0f, 0.0f },
+};
+
+// The volume as one of the scenes sees it - without the parts the scene doesn't use.
+static FRaymarchCpuVolume GetSceneVolume(const FRaymarchCpuVolume& Volume, const FCpuRaymarchScene& Scene, FRaymarchRenderSettings& OutSettings)
+{
+	FRaymarchCpuVolume SceneVolume = Volume;
+	if (!Scene.bTransferFunction)
+	{
+		SceneVolume.Lut.Empty();
+		SceneVolume.PreIntegrationTable.Empty();
+		SceneVolume.MaxOpacityTable.Empty();
+	}
+	if (!Scene.bMacroCells)
+	{
+		SceneVolume.MacroCells = FRaymarchMacroCellGrid();
+	}
+	OutSettings = FRaymarchRenderSettings();
+	OutSettings.CompositingMode = Scene.CompositingMode;
+	OutSettings.bPreIntegrate = Scene.bPreIntegrate;
+	OutSettings.Quality = Scene.Quality;
+	OutSettings.SlabThickness = Scene.SlabThickness;
+	return SceneVolume;
+}
+
+static void BenchmarkCpuRaymarch(const TArray<FString>& Args)
+{
+	// Either an edge length or a RAW file with its dimensions.
+	const bool bRawFile = Args.Num() > 0 && !Args[0].IsNumeric();
+	FIntVector Dimensions;
+	TArray<uint8> Voxels;
+	int32 ImageArgument = 1;
+	if (bRawFile)
+	{
+		if (Args.Num() < 4)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("A RAW file needs its dimensions: Raymarch.Benchmark.CpuRaymarch <file> <X> <Y> <Z> [image size]"));
+			return;
+		}
+		Dimensions = FIntVector(FCString::Atoi(*Args[1]), FCString::Atoi(*Args[2]), FCString::Atoi(*Args[3]));
+		ImageArgument = 4;
+		if (!FFileHelper::LoadFileToArray(Voxels, *Args[0]) || Dimensions.GetMin() <= 0 || Voxels.Num() != int64(Dimensions.X) * Dimensions.Y * Dimensions.Z)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("Couldn't load %s as a %dx%dx%d U8 volume."), *Args[0], Dimensions.X, Dimensions.Y, Dimensions.Z);
+			return;
+		}
+	}
+	else
+	{
+		Dimensions = GetVolumeSizeArgument(Args, 128);
+		MakeSyntheticVolume(Dimensions, Voxels, 42);
+	}
+	const int32 ImageEdge = Args.Num() > ImageArgument ? FMath::Clamp(FCString::Atoi(*Args[ImageArgument]), 16, 4096) : 256;
+	const FIntPoint ImageSize(ImageEdge, ImageEdge);
+	const int32 Repetitions = 3;
+
+	FRaymarchCpuVolume Volume;
+	MakeCpuRaymarchVolume(Voxels, Dimensions, Volume);
+	const FCompiledCameraModel CameraModel = MakeCpuRaymarchView(ImageSize).CompileCameraModel(FTransform::Identity);
+
+	UE_LOG(LogRaymarch, Display, TEXT("CPU raymarcher, %dx%dx%d volume%s, %dx%d image, best of %d:"), Dimensions.X, Dimensions.Y, Dimensions.Z,
+		bRawFile ? *FString::Printf(TEXT(" (%s)"), *FPaths::GetCleanFilename(Args[0])) : TEXT(""), ImageSize.X, ImageSize.Y, Repetitions);
+	for (const FCpuRaymarchScene& Scene : CpuRaymarchScenes)
+	{
+		FRaymarchRenderSettings Settings;
+		const FRaymarchCpuVolume SceneVolume = GetSceneVolume(Volume, Scene, Settings);
+
+		TArray<FLinearColor> Reference, Optimized;
+		FRaymarchCpuStats ReferenceStats, Stats;
+		const double ScalarTime = TimeBestOf(1, [&]()
+		{
+			RaymarchVolume_CpuScalar(SceneVolume, CameraModel, Settings, ImageSize, Reference, &ReferenceStats);
+		});
+		const double ParallelTime = TimeBestOf(Repetitions, [&]()
+		{
+			RaymarchVolume_Cpu(SceneVolume, CameraModel, Settings, ImageSize, Optimized, &Stats);
+		});
+
+		UE_LOG(LogRaymarch, Display, TEXT("  %s: %lld rays, %.1f samples and %.1f skipped per ray"), Scene.Name, Stats.Rays,
+			double(Stats.Samples) / FMath::Max<int64>(Stats.Rays, 1), double(Stats.SkippedSamples) / FMath::Max<int64>(Stats.Rays, 1));
+		UE_LOG(LogRaymarch, Display, TEXT("    Scalar:            %.2f MRays/s, %.1f MSamples/s"),
+			ReferenceStats.Rays / ScalarTime / 1e6, ReferenceStats.Samples / ScalarTime / 1e6);
+		UE_LOG(LogRaymarch, Display, TEXT("    Tiles and packets: %.2f MRays/s, %.1f MSamples/s (%.1fx)"),
+			Stats.Rays / ParallelTime / 1e6, Stats.Samples / ParallelTime / 1e6, ScalarTime / FMath::Max(ParallelTime, 1e-9));
+
+		// Both paths round the same way, anything above float noise is a bug in one of them.
+		const FRaymarchImageDifference Difference = CompareRaymarchImages(Reference, Optimized, 1e-4f);
+		if (Difference.DifferingPixels > 0 || Stats.Samples != ReferenceStats.Samples || Stats.SkippedSamples != ReferenceStats.SkippedSamples)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("    %lld pixels (max difference %f) or the sample counts differ from the scalar reference!"),
+				Difference.DifferingPixels, Difference.MaxDifference);
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkCpuRaymarchCommand(
+	TEXT("Raymarch.Benchmark.CpuRaymarch"),
+	TEXT("Measures rays/s and samples/s of the CPU reference raymarcher, single-threaded scalar vs. parallel tiles of SIMD packets. ")
+	TEXT("Arguments: volume edge length (default 128) or a RAW U8 file and its X Y Z dimensions, image edge length (default 256)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkCpuRaymarch));
+
+// Draws the volume with the shaders into a float render target FrameCount times in a row (so reduced resolution draws
+// accumulate a history) and reads back every frame.
+static bool RaymarchVolumeFrames_Gpu(UWorld* World, const FRaymarchCpuVolume& CpuVolume, const FRaymarchRenderSettings& Settings,
+	const FRaymarchView& View, FIntPoint ImageSize, int32 FrameCount, TArray<TArray<FLinearColor>>& OutFrames)
+{
+	FRaymarchVolumeRenderDataPtr Volume = MakeShareable(new FRaymarchVolumeRenderData());
+	BeginInitResource(Volume.Get());
+	const int32 Ticket = Volume->BeginLoad_AnyThread();
+	FRaymarchTransferFunctionRenderDataPtr TransferFunction;
+	if (CpuVolume.Lut.Num() > 0)
+	{
+		TransferFunction = MakeShareable(new FRaymarchTransferFunctionRenderData());
+	}
+
+	// Float voxels, so that the shader samples exactly what the CPU does. Flushed before returning, so the volume can be borrowed.
+	const FRaymarchCpuVolume* VolumePtr = &CpuVolume;
+	ENQUEUE_RENDER_COMMAND(UploadRaymarchGoldenVolumeCommand)(
+		[Volume, Ticket, TransferFunction, VolumePtr](FRHICommandListImmediate& RHICmdList)
+	{
+		FRaymarchVolumeDataset Dataset;
+		Dataset.VolumeTexture = CreateEmpty3DTexture_RenderThread(RHICmdList, VolumePtr->Dimensions, PF_R32_FLOAT);
+		Update3DTextureSlab_RenderThread(RHICmdList, Dataset.VolumeTexture, reinterpret_cast<const uint8*>(VolumePtr->Voxels.GetData()), 0, VolumePtr->Dimensions.Z);
+		Dataset.VolumeDimensions = VolumePtr->Dimensions;
+		Dataset.WindowScaleBias = VolumePtr->WindowScaleBias;
+		if (VolumePtr->MacroCells.IsValid())
+		{
+			Dataset.MacroCellTexture = CreateMacroCellTexture_RenderThread(RHICmdList, VolumePtr->MacroCells);
+			Dataset.ValueRange = VolumePtr->MacroCells.GetValueRange();
+		}
+		Volume->SwapDataset_RenderThread(MoveTemp(Dataset), Ticket);
+		if (TransferFunction.IsValid())
+		{
+			TArray<FFloat16Color> LutTexels, PreIntegrationTexels;
+			for (const FLinearColor& Color : VolumePtr->Lut)
+			{
+				LutTexels.Add(FFloat16Color(Color));
+			}
+			for (const FLinearColor& Color : VolumePtr->PreIntegrationTable)
+			{
+				PreIntegrationTexels.Add(FFloat16Color(Color));
+			}
+			UpdateTransferFunctionTextures_RenderThread(RHICmdList, *TransferFunction, LutTexels, PreIntegrationTexels, TArray<FFloat16Color>(), 0);
+		}
+	});
+
+	UTextureRenderTarget2D* Target = NewObject<UTextureRenderTarget2D>(GetTransientPackage());
+	Target->ClearColor = FLinearColor::Transparent;
+	Target->InitCustomFormat(ImageSize.X, ImageSize.Y, PF_A32B32G32R32F, true);
+	Target->UpdateResourceImmediate(true);
+
+	TArray<FRaymarchVolumeDrawDesc> Draws;
+	Draws.Add(FRaymarchVolumeDrawDesc{ Volume, FTransform::Identity, TransferFunction });
+	bool bRead = true;
+	OutFrames.SetNum(FrameCount);
+	for (TArray<FLinearColor>& Frame : OutFrames)
+	{
+		DrawRaymarchVolumesFromView_GameThread(World, Target, Draws, Settings, View);
+		FlushRenderingCommands();
+		FTextureRenderTargetResource* Resource = Target->GameThread_GetRenderTargetResource();
+		bRead = bRead && Resource && Resource->ReadLinearColorPixels(Frame) && Frame.Num() == ImageSize.X * ImageSize.Y;
+	}
+	Target->ReleaseResource();
+
+	// Released on the render thread like URaymarchVolume and URaymarchTransferFunction do.
+	Draws.Empty();
+	ENQUEUE_RENDER_COMMAND(ReleaseRaymarchGoldenVolumeCommand)(
+		[Volume, TransferFunction](FRHICommandListImmediate& RHICmdList) mutable
+	{
+		Volume->ReleaseResource();
+		Volume.Reset();
+		TransferFunction.Reset();
+	});
+	return bRead;
+}
+
+// Draws the volume with the shaders into a float render target and reads it back.
+static bool RaymarchVolume_Gpu(UWorld* World, const FRaymarchCpuVolume& CpuVolume, const FRaymarchRenderSettings& Settings,
+	const FRaymarchView& View, FIntPoint ImageSize, TArray<FLinearColor>& OutImage)
+{
+	TArray<TArray<FLinearColor>> Frames;
+	if (!RaymarchVolumeFrames_Gpu(World, CpuVolume, Settings, View, ImageSize, 1, Frames))
+	{
+		return false;
+	}
+	OutImage = MoveTemp(Frames[0]);
+	return true;
+}
+
+static void TestGoldenImages(const TArray<FString>& Args, UWorld* World)
+{
+	const bool bUpdate = Args.Contains(TEXT("update"));
+	const FIntVector Dimensions(64, 64, 64);
+	const FIntPoint ImageSize(128, 128);
+	// The CPU reference only changes with the raymarcher itself, not the compiler or the machine.
+	const float GoldenTolerance = 1e-3f;
+	// The GPU interpolates with less precision, and the rasterized cube edges may cover a few pixels more or less.
+	const float GpuTolerance = 0.02f;
+	const float MaxGpuDifferingFraction = 0.01f;
+
+	TArray<uint8> Voxels;
+	MakeSyntheticVolume(Dimensions, Voxels, 42);
+	FRaymarchCpuVolume Volume;
+	MakeCpuRaymarchVolume(Voxels, Dimensions, Volume);
+	const FRaymarchView View = MakeCpuRaymarchView(ImageSize);
+	const FCompiledCameraModel CameraModel = View.CompileCameraModel(FTransform::Identity);
+	const bool bCanDraw = World && FApp::CanEverRender();
+
+	// Checked in with the plugin, so that every checkout compares against the same images.
+	const TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("Raymarcher"));
+	if (!Plugin.IsValid())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Can't find the Raymarcher plugin to get the golden images from."));
+		return;
+	}
+	const FString GoldenDir = Plugin->GetBaseDir() / TEXT("Test") / TEXT("Golden");
+	UE_LOG(LogRaymarch, Display, TEXT("Golden images in %s%s:"), *FPaths::ConvertRelativePathToFull(GoldenDir),
+		bCanDraw ? TEXT("") : TEXT(" (no world to draw in, skipping the shaders)"));
+	int32 Failures = 0;
+	for (const FCpuRaymarchScene& Scene : CpuRaymarchScenes)
+	{
+		FRaymarchRenderSettings Settings;
+		const FRaymarchCpuVolume SceneVolume = GetSceneVolume(Volume, Scene, Settings);
+		TArray<FLinearColor> Reference;
+		RaymarchVolume_Cpu(SceneVolume, CameraModel, Settings, ImageSize, Reference);
+
+		const FString GoldenFile = GoldenDir / FString(Scene.Name) + TEXT(".rmgi");
+		FIntPoint GoldenSize;
+		TArray<FLinearColor> Golden;
+		const bool bMissing = !bUpdate && !LoadRaymarchGoldenImage(GoldenFile, GoldenSize, Golden);
+		if (bUpdate || bMissing)
+		{
+			if (!SaveRaymarchGoldenImage(GoldenFile, ImageSize, Reference))
+			{
+				UE_LOG(LogRaymarch, Error, TEXT("  %s: couldn't write the golden image!"), Scene.Name);
+				++Failures;
+			}
+			else if (bMissing)
+			{
+				// Nothing to compare against this time, the image only guards the raymarcher once it's checked in.
+				UE_LOG(LogRaymarch, Warning, TEXT("  %s: no golden image yet, wrote one - check it in."), Scene.Name);
+			}
+			else
+			{
+				UE_LOG(LogRaymarch, Display, TEXT("  %s: wrote the golden image"), Scene.Name);
+			}
+		}
+		else
+		{
+			const FRaymarchImageDifference Difference = CompareRaymarchImages(Golden, Reference, GoldenTolerance);
+			UE_LOG(LogRaymarch, Display, TEXT("  %s: CPU vs. golden, max difference %f, RMS %f"), Scene.Name, Difference.MaxDifference, Difference.RootMeanSquare);
+			if (GoldenSize != ImageSize || Difference.DifferingPixels > 0)
+			{
+				UE_LOG(LogRaymarch, Error, TEXT("  %s: %lld pixels differ from the golden image!"), Scene.Name, Difference.DifferingPixels);
+				++Failures;
+			}
+		}
+
+		if (bCanDraw)
+		{
+			TArray<FLinearColor> Drawn;
+			if (!RaymarchVolume_Gpu(World, SceneVolume, Settings, View, ImageSize, Drawn))
+			{
+				UE_LOG(LogRaymarch, Error, TEXT("  %s: couldn't draw or read back the volume."), Scene.Name);
+				++Failures;
+				continue;
+			}
+			const FRaymarchImageDifference Difference = CompareRaymarchImages(Reference, Drawn, GpuTolerance);
+			UE_LOG(LogRaymarch, Display, TEXT("  %s: shader vs. CPU, max difference %f, RMS %f, %lld pixels off"),
+				Scene.Name, Difference.MaxDifference, Difference.RootMeanSquare, Difference.DifferingPixels);
+			if (Difference.DifferingPixels > MaxGpuDifferingFraction * Reference.Num())
+			{
+				UE_LOG(LogRaymarch, Error, TEXT("  %s: the shader doesn't match the CPU reference!"), Scene.Name);
+				++Failures;
+			}
+		}
+	}
+	if (Failures > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Golden images: %d failures."), Failures);
+	}
+	else
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("Golden images: no failures."));
+	}
+}
+
+static FAutoConsoleCommand TestGoldenImagesCommand(
+	TEXT("Raymarch.Test.GoldenImages"),
+	TEXT("Renders synthetic scenes with the CPU reference raymarcher and compares them to the golden images in the Test/Golden ")
+	TEXT("folder of the plugin (missing ones are written, to be checked in), then draws them with the shaders and compares those ")
+	TEXT("to the CPU images. Argument: 'update' rewrites the golden images."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&TestGoldenImages));
+
+static void TestReconstructionConvergence(const TArray<FString>& Args, UWorld* World)
+{
+	if (!World || !FApp::CanEverRender())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Raymarch.Test.ReconstructionConvergence needs a world to draw in."));
+		return;
+	}
+	const FIntVector Dimensions(64, 64, 64);
+	const FIntPoint ImageSize(128, 128);
+	// Enough jitter cycles for the history of the first frames to have faded out.
+	const int32 FrameCount = 8 * RAYMARCH_JITTER_SEQUENCE_LENGTH;
+
+	TArray<uint8> Voxels;
+	MakeSyntheticVolume(Dimensions, Voxels, 42);
+	FRaymarchCpuVolume Volume;
+	MakeCpuRaymarchVolume(Voxels, Dimensions, Volume);
+	const FRaymarchView View = MakeCpuRaymarchView(ImageSize);
+	FRaymarchRenderSettings Settings;
+	const FRaymarchCpuVolume SceneVolume = GetSceneVolume(Volume, CpuRaymarchScenes[0], Settings);
+
+	// The camera never moves, so the history only gathers the sub-pixel positions of the jitter sequence.
+	TArray<FLinearColor> Reference;
+	RaymarchVolume_Cpu(SceneVolume, View.CompileCameraModel(FTransform::Identity), Settings, ImageSize, Reference);
+
+	UE_LOG(LogRaymarch, Display, TEXT("Reconstruction of a static scene over %d frames, %dx%d:"), FrameCount, ImageSize.X, ImageSize.Y);
+	int32 Failures = 0;
+	for (ERaymarchResolution Resolution : { ERaymarchResolution::Half, ERaymarchResolution::Quarter })
+	{
+		const TCHAR* Name = Resolution == ERaymarchResolution::Half ? TEXT("Half") : TEXT("Quarter");
+		Settings.Resolution = Resolution;
+		TArray<TArray<FLinearColor>> Frames;
+		if (!RaymarchVolumeFrames_Gpu(World, SceneVolume, Settings, View, ImageSize, FrameCount, Frames))
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("  %s: couldn't draw or read back the volume."), Name);
+			++Failures;
+			continue;
+		}
+		// Without the jitter undone, every frame upsamples the image from somewhere else - the history stays blurred and
+		// keeps moving with the sequence instead of settling on the full resolution image.
+		const float FirstError = CompareRaymarchImages(Reference, Frames[0], 0.0f).RootMeanSquare;
+		const float ConvergedError = CompareRaymarchImages(Reference, Frames.Last(), 0.0f).RootMeanSquare;
+		const float LastChange = CompareRaymarchImages(Frames[FrameCount - 2], Frames.Last(), 0.0f).RootMeanSquare;
+		UE_LOG(LogRaymarch, Display, TEXT("  %s: RMS to the full resolution image %f in the first frame, %f in the last, last frame changed by %f"),
+			Name, FirstError, ConvergedError, LastChange);
+		if (ConvergedError >= FirstError || LastChange > 0.5f * FirstError)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("  %s: the history doesn't converge!"), Name);
+			++Failures;
+		}
+	}
+	if (Failures > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Reconstruction convergence: %d failures."), Failures);
+	}
+	else
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("Reconstruction convergence: no failures."));
+	}
+}
+
+static FAutoConsoleCommand TestReconstructionConvergenceCommand(
+	TEXT("Raymarch.Test.ReconstructionConvergence"),
+	TEXT("Draws a static synthetic scene at half and quarter resolution for a few jitter cycles and checks that the ")
+	TEXT("reconstructed image settles closer to the full resolution CPU image than the first frame was. Needs a world to draw in."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&TestReconstructionConvergence));
+
+// Frame of a synthetic 4D scan - the static noisy ball of MakeSyntheticVolume with a small bright blob moving through it.
+static void MakeSequenceFrame(const TArray<uint8>& Background, FIntVector Dimensions, int32 Frame, int32 FrameCount, TArray<uint8>& OutFrame)
+{
+	OutFrame = Background;
+	const float Radius = Dimensions.GetMin() / 12.0f;
+	const FVector Center(Dimensions.X * (0.25f + 0.5f * Frame / FrameCount), Dimensions.Y / 2.0f, Dimensions.Z / 2.0f);
+	const FIntVector Min(FMath::Max(FMath::FloorToInt(Center.X - Radius), 0), FMath::Max(FMath::FloorToInt(Center.Y - Radius), 0),
+		FMath::Max(FMath::FloorToInt(Center.Z - Radius), 0));
+	const FIntVector Max(FMath::Min(FMath::CeilToInt(Center.X + Radius), Dimensions.X - 1), FMath::Min(FMath::CeilToInt(Center.Y + Radius), Dimensions.Y - 1),
+		FMath::Min(FMath::CeilToInt(Center.Z + Radius), Dimensions.Z - 1));
+	for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+	for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+	for (int32 X = Min.X; X <= Max.X; ++X)
+	{
+		if (FVector::Dist(FVector(X, Y, Z), Center) < Radius)
+		{
+			OutFrame[X + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)] = 255;
+		}
+	}
+}
+
+static void BenchmarkSequenceDelta(const TArray<FString>& Args)
+{
+	const FIntVector Dimensions = GetVolumeSizeArgument(Args, 256);
+	const int32 BrickSize = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 4) : RAYMARCH_DEFAULT_SEQUENCE_BRICK_SIZE;
+	const int32 FrameCount = 8;
+	TArray<uint8> Background;
+	MakeSyntheticVolume(Dimensions, Background, 1);
+	TArray<TArray<uint8>> Frames;
+	Frames.SetNum(FrameCount);
+	for (int32 Frame = 0; Frame < FrameCount; ++Frame)
+	{
+		MakeSequenceFrame(Background, Dimensions, Frame, FrameCount, Frames[Frame]);
+	}
+
+	// Every step compares against the frame before, like a ring slot compares against the frame it held.
+	TArray<uint8> Resident = Frames[0];
+	TArray<FIntVector> ChangedBricks;
+	int64 ChangedBrickCount = 0;
+	int64 Mismatches = 0;
+	double CompareTime = 0.0;
+	for (int32 Frame = 1; Frame < FrameCount; ++Frame)
+	{
+		const double Start = FPlatformTime::Seconds();
+		UpdateChangedBricks(Resident, Frames[Frame], Dimensions, PF_G8, BrickSize, 0.0f, ChangedBricks);
+		CompareTime += FPlatformTime::Seconds() - Start;
+		ChangedBrickCount += ChangedBricks.Num();
+		Mismatches += FMemory::Memcmp(Resident.GetData(), Frames[Frame].GetData(), Resident.Num()) != 0 ? 1 : 0;
+	}
+
+	const int32 Steps = FrameCount - 1;
+	const int64 BricksPerFrame = int64(FMath::DivideAndRoundUp(Dimensions.X, BrickSize)) * FMath::DivideAndRoundUp(Dimensions.Y, BrickSize) *
+		FMath::DivideAndRoundUp(Dimensions.Z, BrickSize);
+	const double ChangedFraction = double(ChangedBrickCount) / (BricksPerFrame * Steps);
+	UE_LOG(LogRaymarch, Display, TEXT("Sequence delta uploads, %dx%dx%d frames, %d^3 bricks:"), Dimensions.X, Dimensions.Y, Dimensions.Z, BrickSize);
+	UE_LOG(LogRaymarch, Display, TEXT("  compare + copy %.2f ms per frame (%.0f MVoxels/s)"), CompareTime * 1e3 / Steps,
+		double(Resident.Num()) * Steps / 1e6 / CompareTime);
+	UE_LOG(LogRaymarch, Display, TEXT("  %.1f%% of the bricks changed per frame, about %.1f MB uploaded instead of %.1f MB"), ChangedFraction * 100.0,
+		ChangedFraction * Resident.Num() / (1024.0 * 1024.0), Resident.Num() / (1024.0 * 1024.0));
+	if (Mismatches == 0)
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("  resident copy matched every frame"));
+	}
+	else
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("  resident copy differs from %lld frames!"), Mismatches);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkSequenceDeltaCommand(
+	TEXT("Raymarch.Benchmark.SequenceDelta"),
+	TEXT("Times finding and copying the changed bricks of a synthetic 4D scan with a moving blob, reports how much of every frame ")
+	TEXT("delta uploads send and checks the result. Arguments: volume edge length (default 256), brick size (default 32)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkSequenceDelta));
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,281 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchBlockCompression.h"
+#include "../Public/Raymarcher.h"
+
+#include "Async/ParallelFor.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+static const int32 BlockVoxels = RAYMARCH_BC4_BLOCK_SIZE * RAYMARCH_BC4_BLOCK_SIZE;
+
+void FRaymarchBlockCompressionStats::Accumulate(const FRaymarchBlockCompressionStats& Other)
+{
+	Voxels += Other.Voxels;
+	SourceBytes += Other.SourceBytes;
+	CompressedBytes += Other.CompressedBytes;
+	SquaredErrorSum += Other.SquaredErrorSum;
+	MaxError = FMath::Max(MaxError, Other.MaxError);
+}
+
+double FRaymarchBlockCompressionStats::GetPeakSignalToNoiseRatio() const
+{
+	const double MeanSquaredError = Voxels > 0 ? SquaredErrorSum / Voxels : 0.0;
+	return MeanSquaredError > 0.0 ? 10.0 * FMath::LogX(10.0, 255.0 * 255.0 / MeanSquaredError) : TNumericLimits<double>::Max();
+}
+
+bool CanCompressVolumeBC4(FIntVector Dimensions)
+{
+	return Dimensions.X % RAYMARCH_BC4_BLOCK_SIZE == 0 && Dimensions.Y % RAYMARCH_BC4_BLOCK_SIZE == 0 && Dimensions.Z > 0;
+}
+
+int64 GetBC4SlabBytes(int32 SizeX, int32 SizeY, int32 SliceCount)
+{
+	return int64(FMath::DivideAndRoundUp(SizeX, RAYMARCH_BC4_BLOCK_SIZE)) * FMath::DivideAndRoundUp(SizeY, RAYMARCH_BC4_BLOCK_SIZE)
+		* SliceCount * RAYMARCH_BC4_BLOCK_BYTES;
+}
+
+// The 8 values a block can decode to, the way the GPU interpolates them (in float, see the D3D BC4_UNORM spec).
+// Endpoint0 > Endpoint1 selects 6 interpolated values between them, otherwise 4 plus exact 0 and 255.
+static FORCEINLINE void GetBC4Palette(uint8 Endpoint0, uint8 Endpoint1, float OutPalette[8])
+{
+	OutPalette[0] = Endpoint0;
+	OutPalette[1] = Endpoint1;
+	if (Endpoint0 > Endpoint1)
+	{
+		for (int32 i = 2; i < 8; ++i)
+		{
+			OutPalette[i] = ((8 - i) * Endpoint0 + (i - 1) * Endpoint1) / 7.0f;
+		}
+	}
+	else
+	{
+		for (int32 i = 2; i < 6; ++i)
+		{
+			OutPalette[i] = ((6 - i) * Endpoint0 + (i - 1) * Endpoint1) / 5.0f;
+		}
+		OutPalette[6] = 0.0f;
+		OutPalette[7] = 255.0f;
+	}
+}
+
+// The 3-bit indices of a block, voxel i in bits 3i to 3i+2.
+static FORCEINLINE uint64 ReadBC4Indices(const uint8* Block)
+{
+	uint64 Bits = 0;
+	for (int32 Byte = 0; Byte < 6; ++Byte)
+	{
+		Bits |= uint64(Block[2 + Byte]) << (8 * Byte);
+	}
+	return Bits;
+}
+
+// Picks the nearest palette entry for every voxel. Returns the squared error, writes the indices and the largest error.
+static FORCEINLINE float SelectBC4Indices(const uint8 Values[BlockVoxels], const float Palette[8], uint8 OutIndices[BlockVoxels], float& OutMaxError)
+{
+	float SquaredError = 0.0f;
+	OutMaxError = 0.0f;
+	for (int32 i = 0; i < BlockVoxels; ++i)
+	{
+		float BestError = FMath::Abs(Palette[0] - Values[i]);
+		uint8 BestIndex = 0;
+		for (uint8 Index = 1; Index < 8; ++Index)
+		{
+			const float Error = FMath::Abs(Palette[Index] - Values[i]);
+			if (Error < BestError)
+			{
+				BestError = Error;
+				BestIndex = Index;
+			}
+		}
+		OutIndices[i] = BestIndex;
+		SquaredError += BestError * BestError;
+		OutMaxError = FMath::Max(OutMaxError, BestError);
+	}
+	return SquaredError;
+}
+
+// Compresses one block, trying the 6-value mode too when it has voxels at 0 or 255 (air next to tissue, saturated
+// windows), which the other mode would have to stretch its range for.
+static void CompressBlockBC4(const uint8 Values[BlockVoxels], uint8 OutBlock[RAYMARCH_BC4_BLOCK_BYTES], float& OutSquaredError, float& OutMaxError)
+{
+	uint8 Min = 255, Max = 0;
+	uint8 InnerMin = 255, InnerMax = 0;
+	for (int32 i = 0; i < BlockVoxels; ++i)
+	{
+		Min = FMath::Min(Min, Values[i]);
+		Max = FMath::Max(Max, Values[i]);
+		if (Values[i] != 0 && Values[i] != 255)
+		{
+			InnerMin = FMath::Min(InnerMin, Values[i]);
+			InnerMax = FMath::Max(InnerMax, Values[i]);
+		}
+	}
+
+	uint8 Endpoint0 = Max, Endpoint1 = Min;
+	uint8 Indices[BlockVoxels];
+	float Palette[8];
+	if (Min == Max)
+	{
+		// Constant block, every index picks Endpoint0.
+		FMemory::Memzero(Indices);
+		OutSquaredError = 0.0f;
+		OutMaxError = 0.0f;
+	}
+	else
+	{
+		GetBC4Palette(Endpoint0, Endpoint1, Palette);
+		OutSquaredError = SelectBC4Indices(Values, Palette, Indices, OutMaxError);
+
+		if ((Min == 0 || Max == 255) && OutSquaredError > 0.0f)
+		{
+			// Endpoints ordered the other way round select the mode with exact 0 and 255.
+			const uint8 SixEndpoint0 = InnerMin <= InnerMax ? InnerMin : 0;
+			const uint8 SixEndpoint1 = InnerMin <= InnerMax ? InnerMax : 0;
+			uint8 SixIndices[BlockVoxels];
+			float SixMaxError;
+			GetBC4Palette(SixEndpoint0, SixEndpoint1, Palette);
+			const float SixSquaredError = SelectBC4Indices(Values, Palette, SixIndices, SixMaxError);
+			if (SixSquaredError < OutSquaredError)
+			{
+				Endpoint0 = SixEndpoint0;
+				Endpoint1 = SixEndpoint1;
+				FMemory::Memcpy(Indices, SixIndices, sizeof(Indices));
+				OutSquaredError = SixSquaredError;
+				OutMaxError = SixMaxError;
+			}
+		}
+	}
+
+	// Two endpoints, then 3 bits per voxel in X-major order, least significant bits first.
+	uint64 Bits = 0;
+	for (int32 i = 0; i < BlockVoxels; ++i)
+	{
+		Bits |= uint64(Indices[i]) << (3 * i);
+	}
+	OutBlock[0] = Endpoint0;
+	OutBlock[1] = Endpoint1;
+	for (int32 Byte = 0; Byte < 6; ++Byte)
+	{
+		OutBlock[2 + Byte] = uint8(Bits >> (8 * Byte));
+	}
+}
+
+void CompressSlabBC4(const uint8* Voxels, int32 SizeX, int32 SizeY, int32 SliceCount, uint8* OutBlocks,
+	FRaymarchBlockCompressionStats* OutStats)
+{
+	const int32 BlocksX = FMath::DivideAndRoundUp(SizeX, RAYMARCH_BC4_BLOCK_SIZE);
+	const int32 BlocksY = FMath::DivideAndRoundUp(SizeY, RAYMARCH_BC4_BLOCK_SIZE);
+	const int32 RowCount = BlocksY * SliceCount;
+	const int64 SliceSize = int64(SizeX) * SizeY;
+
+	TArray<FRaymarchBlockCompressionStats> RowStats;
+	RowStats.SetNum(OutStats ? RowCount : 0);
+	ParallelFor(RowCount, [&](int32 Row)
+	{
+		const int32 Slice = Row / BlocksY;
+		const int32 BlockY = Row % BlocksY;
+		const uint8* SliceVoxels = Voxels + Slice * SliceSize;
+		uint8* Block = OutBlocks + int64(Row) * BlocksX * RAYMARCH_BC4_BLOCK_BYTES;
+		double SquaredErrorSum = 0.0;
+		float MaxError = 0.0f;
+		for (int32 BlockX = 0; BlockX < BlocksX; ++BlockX, Block += RAYMARCH_BC4_BLOCK_BYTES)
+		{
+			// Partial blocks at the borders repeat the last voxels, the GPU never samples the voxels past the edge.
+			uint8 Values[BlockVoxels];
+			for (int32 Y = 0; Y < RAYMARCH_BC4_BLOCK_SIZE; ++Y)
+			for (int32 X = 0; X < RAYMARCH_BC4_BLOCK_SIZE; ++X)
+			{
+				const int32 VoxelX = FMath::Min(BlockX * RAYMARCH_BC4_BLOCK_SIZE + X, SizeX - 1);
+				const int32 VoxelY = FMath::Min(BlockY * RAYMARCH_BC4_BLOCK_SIZE + Y, SizeY - 1);
+				Values[X + Y * RAYMARCH_BC4_BLOCK_SIZE] = SliceVoxels[VoxelX + int64(SizeX) * VoxelY];
+			}
+
+			float BlockSquaredError, BlockMaxError;
+			CompressBlockBC4(Values, Block, BlockSquaredError, BlockMaxError);
+			if (OutStats && BlockSquaredError > 0.0f)
+			{
+				// Repeated border voxels would count twice, so measure partial blocks voxel by voxel.
+				if ((BlockX + 1) * RAYMARCH_BC4_BLOCK_SIZE > SizeX || (BlockY + 1) * RAYMARCH_BC4_BLOCK_SIZE > SizeY)
+				{
+					float Palette[8];
+					GetBC4Palette(Block[0], Block[1], Palette);
+					const uint64 Bits = ReadBC4Indices(Block);
+					BlockSquaredError = 0.0f;
+					BlockMaxError = 0.0f;
+					for (int32 Y = 0; Y < FMath::Min(RAYMARCH_BC4_BLOCK_SIZE, SizeY - BlockY * RAYMARCH_BC4_BLOCK_SIZE); ++Y)
+					for (int32 X = 0; X < FMath::Min(RAYMARCH_BC4_BLOCK_SIZE, SizeX - BlockX * RAYMARCH_BC4_BLOCK_SIZE); ++X)
+					{
+						const int32 i = X + Y * RAYMARCH_BC4_BLOCK_SIZE;
+						const float Error = FMath::Abs(Palette[(Bits >> (3 * i)) & 7] - Values[i]);
+						BlockSquaredError += Error * Error;
+						BlockMaxError = FMath::Max(BlockMaxError, Error);
+					}
+				}
+				SquaredErrorSum += BlockSquaredError;
+				MaxError = FMath::Max(MaxError, BlockMaxError);
+			}
+		}
+
+		if (OutStats)
+		{
+			FRaymarchBlockCompressionStats& Stats = RowStats[Row];
+			Stats.Voxels = int64(SizeX) * FMath::Min(RAYMARCH_BC4_BLOCK_SIZE, SizeY - BlockY * RAYMARCH_BC4_BLOCK_SIZE);
+			Stats.SourceBytes = Stats.Voxels;
+			Stats.CompressedBytes = int64(BlocksX) * RAYMARCH_BC4_BLOCK_BYTES;
+			Stats.SquaredErrorSum = SquaredErrorSum;
+			Stats.MaxError = MaxError;
+		}
+	});
+
+	if (OutStats)
+	{
+		*OutStats = FRaymarchBlockCompressionStats();
+		for (const FRaymarchBlockCompressionStats& Stats : RowStats)
+		{
+			OutStats->Accumulate(Stats);
+		}
+	}
+}
+
+void DecompressSlabBC4(const uint8* Blocks, int32 SizeX, int32 SizeY, int32 SliceCount, uint8* OutVoxels)
+{
+	const int32 BlocksX = FMath::DivideAndRoundUp(SizeX, RAYMARCH_BC4_BLOCK_SIZE);
+	const int32 BlocksY = FMath::DivideAndRoundUp(SizeY, RAYMARCH_BC4_BLOCK_SIZE);
+	const int64 SliceSize = int64(SizeX) * SizeY;
+
+	ParallelFor(BlocksY * SliceCount, [&](int32 Row)
+	{
+		const int32 Slice = Row / BlocksY;
+		const int32 BlockY = Row % BlocksY;
+		uint8* SliceVoxels = OutVoxels + Slice * SliceSize;
+		const uint8* Block = Blocks + int64(Row) * BlocksX * RAYMARCH_BC4_BLOCK_BYTES;
+		for (int32 BlockX = 0; BlockX < BlocksX; ++BlockX, Block += RAYMARCH_BC4_BLOCK_BYTES)
+		{
+			float Palette[8];
+			GetBC4Palette(Block[0], Block[1], Palette);
+			const uint64 Bits = ReadBC4Indices(Block);
+
+			for (int32 Y = 0; Y < RAYMARCH_BC4_BLOCK_SIZE; ++Y)
+			for (int32 X = 0; X < RAYMARCH_BC4_BLOCK_SIZE; ++X)
+			{
+				const int32 VoxelX = BlockX * RAYMARCH_BC4_BLOCK_SIZE + X;
+				const int32 VoxelY = BlockY * RAYMARCH_BC4_BLOCK_SIZE + Y;
+				if (VoxelX < SizeX && VoxelY < SizeY)
+				{
+					const int32 Index = (Bits >> (3 * (X + Y * RAYMARCH_BC4_BLOCK_SIZE))) & 7;
+					SliceVoxels[VoxelX + int64(SizeX) * VoxelY] = uint8(FMath::RoundToInt(Palette[Index]));
+				}
+			}
+		}
+	});
+}
+
+void LogBlockCompressionStats(const FString& VolumeName, const FRaymarchBlockCompressionStats& Stats)
+{
+	UE_LOG(LogRaymarch, Log, TEXT("%s: BC4 compressed %.1f MB to %.1f MB (ratio %.2f), max error %.1f, RMS error %.2f, PSNR %.1f dB."),
+		*VolumeName, Stats.SourceBytes / (1024.0 * 1024.0), Stats.CompressedBytes / (1024.0 * 1024.0), Stats.GetRatio(),
+		Stats.MaxError, Stats.GetRootMeanSquareError(), FMath::Min(Stats.GetPeakSignalToNoiseRatio(), 999.0));
+}
+
+#undef LOCTEXT_NAMESPACE
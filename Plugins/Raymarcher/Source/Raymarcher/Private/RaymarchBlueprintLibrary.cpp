@@ -4,11 +4,17 @@
 
 #include "../Public/RaymarchBlueprintLibrary.h"
 #include "../Public/RaymarchRendering.h"
+#include "../Public/RaymarchVolumeLoader.h"
+#include "../Public/RaymarchVolumeFile.h"
+#include "../Public/RaymarchBrickPager.h"
+#include "../Public/RaymarchVoxelConversion.h"
+#include "../Public/RaymarchFilterPipeline.h"
 
 #include "UnrealString.h"
 #include "Public/Logging/MessageLog.h"
 #include <cstdio>
 #include "RHICommandList.h"
+#include "Classes/Components/SceneCaptureComponent2D.h"
 #include "Classes/Engine/World.h"
 #include "Public/GlobalShader.h"
 #include "Public/PipelineStateCache.h"
@@ -27,62 +33,296 @@ URaymarchBlueprintLibrary::URaymarchBlueprintLibrary(const FObjectInitializer& O
 void URaymarchBlueprintLibrary::DrawRaymarchToRenderTarget(
 	const UObject* WorldContextObject,
 	class UTextureRenderTarget2D* OutputRenderTarget,
-	const FTransform Transform)
+	const FTransform Transform,
+	const FRaymarchRenderSettings& Settings)
 {
 		// Just pass this to Rendering code.
 		DrawRaymarchToRenderTarget_GameThread(
-		WorldContextObject->GetWorld(), OutputRenderTarget, Transform);
+		WorldContextObject->GetWorld(), OutputRenderTarget, Transform, Settings);
+}
+
+// Unwraps the render data of Blueprint volume draws, skipping unset volumes.
+static TArray<FRaymarchVolumeDrawDesc> GetVolumeDrawDescs(const TArray<FRaymarchVolumeDraw>& Volumes)
+{
+	TArray<FRaymarchVolumeDrawDesc> Descs;
+	for (const FRaymarchVolumeDraw& Draw : Volumes)
+	{
+		if (Draw.Volume)
+		{
+			Descs.Add(FRaymarchVolumeDrawDesc{ Draw.Volume->GetRenderData(), Draw.Transform,
+				Draw.TransferFunction ? Draw.TransferFunction->GetRenderData() : FRaymarchTransferFunctionRenderDataPtr(),
+				Draw.Volume->GetPager() });
+		}
+	}
+	return Descs;
+}
+
+void URaymarchBlueprintLibrary::DrawRaymarchVolumesToRenderTarget(
+	const UObject* WorldContextObject,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDraw>& Volumes,
+	const FRaymarchRenderSettings& Settings)
+{
+	DrawRaymarchVolumesToRenderTarget_GameThread(WorldContextObject->GetWorld(), OutputRenderTarget, GetVolumeDrawDescs(Volumes), Settings);
+}
+
+void URaymarchBlueprintLibrary::DrawRaymarchVolumesFromCamera(
+	const UObject* WorldContextObject,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDraw>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const FTransform& CameraTransform,
+	float FieldOfView)
+{
+	if (!OutputRenderTarget)
+	{
+		MY_LOG("Trying to render raymarch with render target not set!");
+		return;
+	}
+	const FRaymarchView View = FRaymarchCameraModelProvider::MakeView(CameraTransform, FieldOfView,
+		FIntPoint(OutputRenderTarget->SizeX, OutputRenderTarget->SizeY));
+	DrawRaymarchVolumesFromView_GameThread(WorldContextObject->GetWorld(), OutputRenderTarget, GetVolumeDrawDescs(Volumes), Settings, View);
+}
+
+void URaymarchBlueprintLibrary::DrawRaymarchVolumesFromViews(
+	const UObject* WorldContextObject,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDraw>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const TArray<FMatrix>& ViewMatrices,
+	const TArray<FMatrix>& ProjectionMatrices)
+{
+	if (ViewMatrices.Num() != ProjectionMatrices.Num())
+	{
+		MY_LOG("Trying to render raymarch with a different number of view and projection matrices!");
+		return;
+	}
+	TArray<FRaymarchView> Views;
+	for (int32 i = 0; i < ViewMatrices.Num(); ++i)
+	{
+		Views.Add(FRaymarchCameraModelProvider::MakeView(ViewMatrices[i], ProjectionMatrices[i]));
+	}
+	DrawRaymarchVolumesFromViews_GameThread(WorldContextObject->GetWorld(), OutputRenderTarget, GetVolumeDrawDescs(Volumes), Settings, Views);
+}
+
+void URaymarchBlueprintLibrary::DrawRaymarchVolumesStereo(
+	const UObject* WorldContextObject,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDraw>& Volumes,
+	const FRaymarchRenderSettings& Settings)
+{
+	UWorld* World = WorldContextObject->GetWorld();
+	TArray<FRaymarchView> Views;
+	Views.AddDefaulted(2);
+	if (!FRaymarchCameraModelProvider::GetPlayerStereoViews_GameThread(World, 0, Views[0], Views[1]))
+	{
+		DrawRaymarchVolumesToRenderTarget_GameThread(World, OutputRenderTarget, GetVolumeDrawDescs(Volumes), Settings);
+		return;
+	}
+	DrawRaymarchVolumesFromViews_GameThread(World, OutputRenderTarget, GetVolumeDrawDescs(Volumes), Settings, Views);
+}
+
+void URaymarchBlueprintLibrary::DrawRaymarchVolumesFromSceneCapture(
+	const UObject* WorldContextObject,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDraw>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	class USceneCaptureComponent2D* SceneCapture)
+{
+	if (!SceneCapture)
+	{
+		MY_LOG("Trying to render raymarch from a scene capture that isn't set!");
+		return;
+	}
+	if (SceneCapture->ProjectionType != ECameraProjectionMode::Perspective)
+	{
+		// Rays start at the camera position, parallel rays of an orthographic camera aren't supported.
+		MY_LOG("Raymarching only supports perspective scene captures.");
+		return;
+	}
+	// A capture of color and depth brings the depth to clip against along, unless another one was given. Can't be read
+	// while drawing over it, though.
+	FRaymarchRenderSettings CaptureSettings = Settings;
+	if (!CaptureSettings.SceneDepth && SceneCapture->CaptureSource == ESceneCaptureSource::SCS_SceneColorSceneDepth
+		&& SceneCapture->TextureTarget != OutputRenderTarget)
+	{
+		CaptureSettings.SceneDepth = SceneCapture->TextureTarget;
+		CaptureSettings.SceneDepthChannel = ERaymarchSceneDepthChannel::Alpha;
+	}
+	DrawRaymarchVolumesFromCamera(WorldContextObject, OutputRenderTarget, Volumes, CaptureSettings, SceneCapture->GetComponentTransform(), SceneCapture->FOVAngle);
+}
+
+URaymarchVolume* URaymarchBlueprintLibrary::CreateRaymarchVolume(const UObject* WorldContextObject)
+{
+	return NewObject<URaymarchVolume>(GetTransientPackage());
+}
+
+URaymarchVolumeSequence* URaymarchBlueprintLibrary::CreateRaymarchVolumeSequence(const UObject* WorldContextObject)
+{
+	return NewObject<URaymarchVolumeSequence>(GetTransientPackage());
+}
+
+URaymarchTransferFunction* URaymarchBlueprintLibrary::CreateRaymarchTransferFunction(const UObject* WorldContextObject, UCurveLinearColor* Curve)
+{
+	URaymarchTransferFunction* TransferFunction = NewObject<URaymarchTransferFunction>(GetTransientPackage());
+	TransferFunction->SetCurve(Curve);
+	return TransferFunction;
+}
+
+void URaymarchBlueprintLibrary::FilterRaymarchVolume(const UObject* WorldContextObject, URaymarchVolume* Volume, const TArray<FRaymarchFilterSettings>& Filters)
+{
+	ApplyVolumeFilters_GameThread(WorldContextObject->GetWorld(), Volume ? Volume->GetRenderData() : GetDefaultRaymarchVolume_GameThread(), Filters);
 }
 
 void URaymarchBlueprintLibrary::LoadRawTexture3D(const UObject* WorldContextObject, FString textureName, int xDim, int yDim, int zDim)
 {
-	FIntVector Size(xDim, yDim, zDim);
-	const int TotalSize = xDim * yDim * yDim;
+	FString RelativePath = FPaths::GameContentDir();
+
+	// A plain U8 load into the default volume. Going through the streaming loader keeps the file off the game thread,
+	// and loading another volume before this one is done just supersedes it.
+	FRaymarchVolumeLoadRequest Request;
+	Request.FullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath) + textureName;
+	Request.Dimensions = FIntVector(xDim, yDim, zDim);
+	Request.OnLoaded.BindLambda([](bool bSuccess)
+	{
+		if (bSuccess)
+		{
+			MY_LOG("File was successfully read!");
+		}
+		else
+		{
+			MY_LOG("File could not be loaded, see the log for details.");
+		}
+	});
 
-	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
-	uint8* ByteArray;
+	LoadRawVolumeStreaming_GameThread(Request);
+}
 
+void URaymarchBlueprintLibrary::LoadRawTexture3DAsync(
+	const UObject* WorldContextObject,
+	URaymarchVolume* Volume,
+	FString textureName, int xDim, int yDim, int zDim,
+	ERaymarchVoxelFormat VoxelFormat,
+	float WindowCenter, float WindowWidth,
+	bool bQuantizeTo8Bit,
+	bool bGenerateMips,
+	bool bComputeGradients,
+	ERaymarchVolumeCompression Compression,
+	int BrickSize,
+	int SlabBudgetMB,
+	FRaymarchLoadProgressEvent OnProgress,
+	FRaymarchLoadCompletedEvent OnCompleted)
+{
 	FString RelativePath = FPaths::GameContentDir();
-	FString FullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath) + textureName;
 
-	IFileHandle* FileHandle = PlatformFile.OpenRead(*FullPath);
-	if (FileHandle)
+	FRaymarchVolumeLoadRequest Request;
+	Request.Volume = Volume ? Volume->GetRenderData() : nullptr;
+	if (Volume)
+	{
+		// The load replaces whatever was paged into the volume, the pager would just keep its cache around.
+		Volume->SetPager(nullptr);
+	}
+	Request.FullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath) + textureName;
+	Request.Dimensions = FIntVector(xDim, yDim, zDim);
+	Request.VoxelFormat = VoxelFormat;
+	Request.WindowCenter = WindowCenter;
+	Request.WindowWidth = WindowWidth;
+	Request.bQuantizeTo8Bit = bQuantizeTo8Bit;
+	Request.bGenerateMips = bGenerateMips;
+	Request.bComputeGradients = bComputeGradients;
+	Request.Compression = Compression;
+	Request.BrickSize = FMath::Max(BrickSize, 0);
+	Request.SlabBudgetBytes = int64(FMath::Max(SlabBudgetMB, 1)) * 1024 * 1024;
+	// Forward the native callbacks to the blueprint ones. Both are fired on the game thread.
+	Request.OnProgress.BindLambda([OnProgress](float Progress)
+	{
+		OnProgress.ExecuteIfBound(Progress);
+	});
+	Request.OnLoaded.BindLambda([OnCompleted](bool bSuccess)
 	{
-		MY_LOG("RAW file was opened!")
-		if (FileHandle->Size() < TotalSize) {
-			MY_LOG("File is smaller than expected, quitting to avoid segfaults.")
-			return;
+		if (bSuccess)
+		{
+			MY_LOG("Volume was successfully streamed in!");
 		}
-		else if (FileHandle->Size() > TotalSize) {
-			MY_LOG("File is larger than expected, check your dimensions and pixel format (nonfatal, but don't blame me if the texture3d is screwed)")
+		else
+		{
+			MY_LOG("Streaming the volume failed, see the log for details.");
 		}
+		OnCompleted.ExecuteIfBound(bSuccess);
+	});
+
+	LoadRawVolumeStreaming_GameThread(Request);
+}
+
+void URaymarchBlueprintLibrary::LoadRaymarchVolumeFileAsync(
+	const UObject* WorldContextObject,
+	URaymarchVolume* Volume,
+	FString FileName,
+	float WindowCenter, float WindowWidth,
+	bool bQuantizeTo8Bit,
+	bool bGenerateMips,
+	bool bComputeGradients,
+	ERaymarchVolumeCompression Compression,
+	int BrickSize,
+	int SlabBudgetMB,
+	FRaymarchLoadProgressEvent OnProgress,
+	FRaymarchLoadCompletedEvent OnCompleted)
+{
+	// The loader takes dimensions and format from the header of volume files.
+	LoadRawTexture3DAsync(WorldContextObject, Volume, FileName, 0, 0, 0, ERaymarchVoxelFormat::U8, WindowCenter, WindowWidth,
+		bQuantizeTo8Bit, bGenerateMips, bComputeGradients, Compression, BrickSize, SlabBudgetMB, OnProgress, OnCompleted);
+}
 
-		// Create our byte buffer and rea the bytes of the file into it.
-		ByteArray = reinterpret_cast<uint8*>(FMemory::Malloc(TotalSize));
-		FileHandle->Read(ByteArray, TotalSize);
-		// Close the file again
-		delete FileHandle;
-		// Let the whole world know we were successful.
-		MY_LOG("File was successfully read!");
+bool URaymarchBlueprintLibrary::OpenPagedRawVolume(
+	const UObject* WorldContextObject,
+	URaymarchVolume* Volume,
+	FString textureName, int xDim, int yDim, int zDim,
+	ERaymarchVoxelFormat VoxelFormat,
+	float WindowCenter, float WindowWidth,
+	int BrickSize,
+	int HostBudgetMB,
+	int GpuBudgetMB)
+{
+	if (!Volume)
+	{
+		MY_LOG("Trying to page a raw volume without a volume to page it into!");
+		return false;
 	}
-	else {
-		// Or not.
-		MY_LOG("File could not be opened.");
-		return;
+	FString RelativePath = FPaths::GameContentDir();
+	const FString FullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath) + textureName;
+
+	FRaymarchBrickCachePtr Cache = FRaymarchBrickCache::Open(FullPath, FIntVector(xDim, yDim, zDim), VoxelFormat,
+		FMath::Max(BrickSize, 1), int64(FMath::Max(HostBudgetMB, 1)) * 1024 * 1024);
+	if (!Cache.IsValid())
+	{
+		MY_LOG("File could not be opened for paging, see the log for details.");
+		return false;
 	}
+	FRaymarchBrickPagerPtr Pager = FRaymarchBrickPager::Open_GameThread(Volume->GetRenderData(), Cache,
+		GetWindowScaleBias(VoxelFormat, WindowCenter, WindowWidth), int64(FMath::Max(GpuBudgetMB, 1)) * 1024 * 1024);
+	if (!Pager.IsValid())
+	{
+		MY_LOG("Paging atlas could not be created, see the log for details.");
+		return false;
+	}
+	Volume->SetPager(Pager);
+	return true;
+}
 
-	// Enqueue
-	ENQUEUE_RENDER_COMMAND(CaptureCommand)(
-		[ByteArray, Size](FRHICommandListImmediate& RHICmdList)
-	{
-		Create3DTexture_RenderThread(
-			RHICmdList,
-			ByteArray,
-			Size);
-		// Let's not forget to free the memory...
-		FMemory::Free(ByteArray);
+bool URaymarchBlueprintLibrary::GetRaymarchVolumeFileInfo(FString FileName, FIntVector& Dimensions, ERaymarchVoxelFormat& VoxelFormat, FVector& Spacing)
+{
+	FString RelativePath = FPaths::GameContentDir();
+	const FString FullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath) + FileName;
+
+	FRaymarchVolumeFileHeader Header;
+	if (!ReadRaymarchVolumeFileHeader(FullPath, Header))
+	{
+		return false;
 	}
-	);
+	Dimensions = Header.Dimensions;
+	VoxelFormat = Header.VoxelFormat;
+	Spacing = Header.Spacing;
+	return true;
 }
 
 void URaymarchBlueprintLibrary::InitializeRenderResources(class UTextureRenderTarget2D* OutputRenderTarget) {
@@ -0,0 +1,280 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchBrickCache.h"
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchRendering.h"
+#include "../Public/RaymarchVoxelConversion.h"
+
+#include "Async/Async.h"
+#include "ConvexVolume.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/ScopeLock.h"
+
+FRaymarchBrickCache::FRaymarchBrickCache(int32 InCapacity)
+	: Capacity(InCapacity)
+	, Resident(InCapacity)
+{ }
+
+TSharedPtr<FRaymarchBrickCache, ESPMode::ThreadSafe> FRaymarchBrickCache::Open(const FString& FullPath, FIntVector Dimensions,
+	ERaymarchVoxelFormat VoxelFormat, int32 BrickSize, int64 BudgetBytes, int32 MaxWorkers)
+{
+	check(BrickSize > 0);
+	const int64 TotalBytes = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z * GetVoxelByteSize(VoxelFormat);
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FullPath));
+	if (!FileHandle || FileHandle->Size() < TotalBytes)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be opened for paging or is smaller than expected."), *FullPath);
+		return nullptr;
+	}
+
+	const FRaymarchBrickLayout Layout = PartitionIntoBricks(Dimensions, BrickSize);
+	const int32 Padded = Layout.GetPaddedBrickSize();
+	const int64 BrickBytes = int64(Padded) * Padded * Padded * GetVoxelByteSize(VoxelFormat);
+	const int32 Capacity = int32(FMath::Clamp<int64>(BudgetBytes / BrickBytes, 1, Layout.GetBrickCount()));
+
+	TSharedPtr<FRaymarchBrickCache, ESPMode::ThreadSafe> Cache = MakeShareable(new FRaymarchBrickCache(Capacity));
+	Cache->FullPath = FullPath;
+	Cache->VoxelFormat = VoxelFormat;
+	Cache->PixelFormat = GetVoxelPixelFormat(VoxelFormat);
+	Cache->Layout = Layout;
+	Cache->BrickBytes = BrickBytes;
+	Cache->MaxWorkers = FMath::Max(MaxWorkers, 1);
+	return Cache;
+}
+
+void FRaymarchBrickCache::UpdateVisibility(const FCompiledCameraModel& CameraModel, TArray<int32>& OutVisibleBricks)
+{
+	// Frustum in the [-1,1] object space of the volume, where the bricks are easy to express.
+	FConvexVolume Frustum;
+	GetViewFrustumBounds(Frustum, CameraModel.ModelMatrix * CameraModel.ViewMatrix * CameraModel.ProjectionMatrix, true);
+
+	const FVector VoxelToObject = FVector(2.0f) / FVector(Layout.VolumeDimensions);
+	TArray<TPair<float, int32>> Visible;
+	for (int32 Z = 0; Z < Layout.BrickCounts.Z; ++Z)
+	for (int32 Y = 0; Y < Layout.BrickCounts.Y; ++Y)
+	for (int32 X = 0; X < Layout.BrickCounts.X; ++X)
+	{
+		// Bricks at the upper borders end with the volume.
+		const FIntVector First = FIntVector(X, Y, Z) * Layout.BrickSize;
+		const FIntVector End(
+			FMath::Min(First.X + Layout.BrickSize, Layout.VolumeDimensions.X),
+			FMath::Min(First.Y + Layout.BrickSize, Layout.VolumeDimensions.Y),
+			FMath::Min(First.Z + Layout.BrickSize, Layout.VolumeDimensions.Z));
+		const FVector Min = FVector(First) * VoxelToObject - 1.0f;
+		const FVector Max = FVector(End) * VoxelToObject - 1.0f;
+		const FVector Center = (Min + Max) / 2;
+		if (Frustum.IntersectBox(Center, (Max - Min) / 2))
+		{
+			Visible.Add(TPair<float, int32>(FVector::DistSquared(Center, CameraModel.RayOrigin), Layout.GetBrickIndex(X, Y, Z)));
+		}
+	}
+	Visible.Sort([](const TPair<float, int32>& A, const TPair<float, int32>& B) { return A.Key < B.Key; });
+
+	OutVisibleBricks.Reset(Visible.Num());
+	for (const TPair<float, int32>& Brick : Visible)
+	{
+		OutVisibleBricks.Add(Brick.Value);
+	}
+
+	FScopeLock ScopeLock(&Lock);
+	// Touch from the farthest to the closest, so the closest ones end up the most recently used.
+	for (int32 i = OutVisibleBricks.Num() - 1; i >= 0; --i)
+	{
+		Resident.FindAndTouch(OutVisibleBricks[i]);
+	}
+
+	// Never queue more than fits, the closest bricks would just get evicted by the farther ones.
+	FetchQueue.Reset();
+	for (int32 BrickIndex : OutVisibleBricks)
+	{
+		if (FetchQueue.Num() + InFlight.Num() >= Capacity)
+		{
+			break;
+		}
+		if (!Resident.Contains(BrickIndex) && !InFlight.Contains(BrickIndex) && !Failed.Contains(BrickIndex))
+		{
+			FetchQueue.Add(BrickIndex);
+		}
+	}
+	KickWorkers_Locked();
+}
+
+FRaymarchBrickDataPtr FRaymarchBrickCache::FindBrick(int32 BrickIndex, bool bFetchIfMissing)
+{
+	check(BrickIndex >= 0 && BrickIndex < Layout.GetBrickCount());
+	FScopeLock ScopeLock(&Lock);
+	++Stats.Lookups;
+	if (const FRaymarchBrickDataPtr* Data = Resident.FindAndTouch(BrickIndex))
+	{
+		++Stats.Hits;
+		return *Data;
+	}
+
+	// Somebody needs it right now, so it goes before everything that was only prefetched.
+	if (bFetchIfMissing && !InFlight.Contains(BrickIndex) && !Failed.Contains(BrickIndex))
+	{
+		FetchQueue.Remove(BrickIndex);
+		FetchQueue.Insert(BrickIndex, 0);
+		KickWorkers_Locked();
+	}
+	return nullptr;
+}
+
+FRaymarchBrickDataPtr FRaymarchBrickCache::GetBrickBlocking(int32 BrickIndex)
+{
+	FRaymarchBrickDataPtr Data = FindBrick(BrickIndex);
+	if (Data)
+	{
+		return Data;
+	}
+
+	const double StallStart = FPlatformTime::Seconds();
+	for (;;)
+	{
+		FPlatformProcess::Sleep(0.0001f);
+		FScopeLock ScopeLock(&Lock);
+		// Look it up without touching the stats, this isn't another lookup, just the same one waiting.
+		if (const FRaymarchBrickDataPtr* Found = Resident.FindAndTouch(BrickIndex))
+		{
+			Data = *Found;
+		}
+		else if (!Failed.Contains(BrickIndex) && !InFlight.Contains(BrickIndex) && !FetchQueue.Contains(BrickIndex))
+		{
+			// Got evicted right after being read (tiny cache under heavy traffic), ask again.
+			FetchQueue.Insert(BrickIndex, 0);
+			KickWorkers_Locked();
+			continue;
+		}
+		if (Data || Failed.Contains(BrickIndex))
+		{
+			Stats.StallSeconds += FPlatformTime::Seconds() - StallStart;
+			return Data;
+		}
+	}
+}
+
+void FRaymarchBrickCache::Flush()
+{
+	for (;;)
+	{
+		{
+			FScopeLock ScopeLock(&Lock);
+			if (FetchQueue.Num() == 0 && InFlight.Num() == 0)
+			{
+				return;
+			}
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+}
+
+FRaymarchBrickCacheStats FRaymarchBrickCache::GetStats() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Stats;
+}
+
+void FRaymarchBrickCache::ResetStats()
+{
+	FScopeLock ScopeLock(&Lock);
+	Stats = FRaymarchBrickCacheStats();
+}
+
+void FRaymarchBrickCache::KickWorkers_Locked()
+{
+	const int32 WantedWorkers = FMath::Min(MaxWorkers, FetchQueue.Num() + ActiveWorkers);
+	TSharedRef<FRaymarchBrickCache, ESPMode::ThreadSafe> This = AsShared();
+	for (; ActiveWorkers < WantedWorkers; ++ActiveWorkers)
+	{
+		// Workers hold a reference, so the cache stays alive until they're done with the queue.
+		Async<void>(EAsyncExecution::ThreadPool, [This]()
+		{
+			This->FetchBricks_AnyThread();
+		});
+	}
+}
+
+void FRaymarchBrickCache::FetchBricks_AnyThread()
+{
+	// Every worker has its own handle, so reads don't have to be serialized.
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FullPath));
+
+	for (;;)
+	{
+		int32 BrickIndex;
+		{
+			FScopeLock ScopeLock(&Lock);
+			if (FetchQueue.Num() == 0)
+			{
+				--ActiveWorkers;
+				return;
+			}
+			BrickIndex = FetchQueue[0];
+			FetchQueue.RemoveAt(0, 1, false);
+			InFlight.Add(BrickIndex);
+		}
+
+		TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> Data = MakeShareable(new TArray<uint8>());
+		const bool bSuccess = FileHandle && ReadBrick_AnyThread(*FileHandle, BrickIndex, *Data);
+
+		FScopeLock ScopeLock(&Lock);
+		InFlight.Remove(BrickIndex);
+		if (!bSuccess)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("Reading brick %d of %s failed."), BrickIndex, *FullPath);
+			Failed.Add(BrickIndex);
+			continue;
+		}
+		if (Resident.Num() >= Resident.Max())
+		{
+			++Stats.Evictions;
+		}
+		Resident.Add(BrickIndex, Data);
+		++Stats.BricksPaged;
+		Stats.BytesPaged += Data->Num();
+	}
+}
+
+bool FRaymarchBrickCache::ReadBrick_AnyThread(IFileHandle& FileHandle, int32 BrickIndex, TArray<uint8>& OutData) const
+{
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+	const FIntVector& Counts = Layout.BrickCounts;
+	const int32 Padded = Layout.GetPaddedBrickSize();
+	const int32 VoxelBytes = GetVoxelByteSize(VoxelFormat);
+	const FIntVector Brick(BrickIndex % Counts.X, (BrickIndex / Counts.X) % Counts.Y, BrickIndex / (Counts.X * Counts.Y));
+	const FIntVector Origin = Brick * Layout.BrickSize - FIntVector(Layout.Apron);
+
+	// Part of every row that's inside the volume, the rest gets clamped like the atlas packer does.
+	const int32 FirstInside = FMath::Clamp(-Origin.X, 0, Padded);
+	const int32 EndInside = FMath::Clamp(Dimensions.X - Origin.X, FirstInside, Padded);
+
+	OutData.SetNumUninitialized(BrickBytes);
+	for (int32 LocalZ = 0; LocalZ < Padded; ++LocalZ)
+	{
+		const int32 Z = FMath::Clamp(Origin.Z + LocalZ, 0, Dimensions.Z - 1);
+		for (int32 LocalY = 0; LocalY < Padded; ++LocalY)
+		{
+			const int32 Y = FMath::Clamp(Origin.Y + LocalY, 0, Dimensions.Y - 1);
+			uint8* Row = OutData.GetData() + (LocalY + int64(Padded) * LocalZ) * Padded * VoxelBytes;
+			const int64 FileOffset = (Origin.X + FirstInside + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)) * VoxelBytes;
+			if (!FileHandle.Seek(FileOffset) || !FileHandle.Read(Row + FirstInside * VoxelBytes, (EndInside - FirstInside) * VoxelBytes))
+			{
+				return false;
+			}
+			for (int32 LocalX = 0; LocalX < FirstInside; ++LocalX)
+			{
+				FMemory::Memcpy(Row + LocalX * VoxelBytes, Row + FirstInside * VoxelBytes, VoxelBytes);
+			}
+			for (int32 LocalX = EndInside; LocalX < Padded; ++LocalX)
+			{
+				FMemory::Memcpy(Row + LocalX * VoxelBytes, Row + (EndInside - 1) * VoxelBytes, VoxelBytes);
+			}
+		}
+	}
+
+	if (VoxelFormat == ERaymarchVoxelFormat::S16)
+	{
+		ConvertSignedToUnsigned16(reinterpret_cast<int16*>(OutData.GetData()), OutData.Num() / 2);
+	}
+	return true;
+}
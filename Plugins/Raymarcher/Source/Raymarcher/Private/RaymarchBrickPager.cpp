@@ -0,0 +1,185 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchBrickPager.h"
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchProfiling.h"
+
+#include "RenderingThread.h"
+
+/** A brick on its way into a slot of the atlas. */
+struct FRaymarchBrickUpload
+{
+	// First voxel of the slot in the atlas.
+	FIntVector SlotOrigin;
+	FRaymarchBrickDataPtr Data;
+};
+
+TSharedPtr<FRaymarchBrickPager, ESPMode::ThreadSafe> FRaymarchBrickPager::Open_GameThread(FRaymarchVolumeRenderDataPtr Volume,
+	FRaymarchBrickCachePtr Cache, FVector2D WindowScaleBias, int64 GpuBudgetBytes, int32 MaxUploadsPerFrame)
+{
+	check(IsInGameThread());
+	check(Volume.IsValid() && Cache.IsValid());
+
+	// The slots are arranged like a packed atlas of that many bricks. The arrangement rounds up, and the slots it adds
+	// take memory anyway, so they're all used.
+	const FRaymarchBrickLayout& Layout = Cache->GetLayout();
+	const int32 BudgetSlots = int32(FMath::Clamp<int64>(GpuBudgetBytes / Cache->GetBrickBytes(), 1, Layout.GetBrickCount()));
+	const FIntVector SlotCounts = GetAtlasSlotCounts(BudgetSlots);
+	const FIntVector AtlasDimensions = SlotCounts * Layout.GetPaddedBrickSize();
+	if (AtlasDimensions.GetMax() > GMaxVolumeTextureDimensions || SlotCounts.GetMax() > 255)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Paging atlas would be %dx%dx%d, that's more than the GPU supports. Try a smaller budget or bigger bricks."),
+			AtlasDimensions.X, AtlasDimensions.Y, AtlasDimensions.Z);
+		return nullptr;
+	}
+
+	TSharedPtr<FRaymarchBrickPager, ESPMode::ThreadSafe> Pager = MakeShareable(new FRaymarchBrickPager());
+	Pager->Volume = Volume;
+	Pager->Cache = Cache;
+	Pager->MaxUploadsPerFrame = FMath::Max(MaxUploadsPerFrame, 1);
+	Pager->SlotCounts = SlotCounts;
+	Pager->SlotBricks.Init(INDEX_NONE, SlotCounts.X * SlotCounts.Y * SlotCounts.Z);
+	Pager->SlotLastVisibleFrames.Init(0, Pager->SlotBricks.Num());
+	Pager->BrickSlots.Init(INDEX_NONE, Layout.GetBrickCount());
+	Pager->Ticket = Volume->BeginLoad_AnyThread();
+
+	// Nothing is paged in yet, so every brick is drawn as empty and the atlas can start out undefined.
+	const EPixelFormat PixelFormat = Cache->GetPixelFormat();
+	const int32 Ticket = Pager->Ticket;
+	ENQUEUE_RENDER_COMMAND(OpenPagedVolumeCommand)(
+		[Volume, Layout, AtlasDimensions, PixelFormat, WindowScaleBias, Ticket](FRHICommandListImmediate& RHICmdList)
+	{
+		TArray<FColor> Indirection;
+		Indirection.Init(FColor(0, 0, 0, 0), Layout.GetBrickCount());
+
+		FRaymarchVolumeDataset Dataset;
+		Dataset.VolumeTexture = CreateEmpty3DTexture_RenderThread(RHICmdList, AtlasDimensions, PixelFormat);
+		Dataset.VolumeDimensions = Layout.VolumeDimensions;
+		Dataset.WindowScaleBias = WindowScaleBias;
+		Dataset.BrickIndirectionTexture = CreateBrickIndirectionTexture_RenderThread(RHICmdList, Layout, Indirection);
+		Dataset.BrickLayout = Layout;
+		Dataset.BrickAtlasDimensions = AtlasDimensions;
+		Volume->SwapDataset_RenderThread(MoveTemp(Dataset), Ticket);
+	});
+
+	UE_LOG(LogRaymarch, Log, TEXT("Paging %d bricks through %d slots (%dx%dx%d atlas), %d bricks fit into host memory."),
+		Layout.GetBrickCount(), Pager->SlotBricks.Num(), AtlasDimensions.X, AtlasDimensions.Y, AtlasDimensions.Z, Cache->GetCapacity());
+	return Pager;
+}
+
+void FRaymarchBrickPager::Update_GameThread(const FCompiledCameraModel& CameraModel)
+{
+	check(IsInGameThread());
+	if (LastUpdateFrame == GFrameCounter || Volume->IsSuperseded_AnyThread(Ticket))
+	{
+		return;
+	}
+	LastUpdateFrame = GFrameCounter;
+
+	Cache->UpdateVisibility(CameraModel, VisibleBricks);
+	for (int32 BrickIndex : VisibleBricks)
+	{
+		if (BrickSlots[BrickIndex] != INDEX_NONE)
+		{
+			SlotLastVisibleFrames[BrickSlots[BrickIndex]] = GFrameCounter;
+		}
+	}
+
+	// Closest bricks first, so that when the atlas or the uploads run out, it's the farthest ones that are missing.
+	const int32 Padded = Cache->GetLayout().GetPaddedBrickSize();
+	TArray<FRaymarchBrickUpload> Uploads;
+	TArray<TPair<int32, FColor>> IndirectionUpdates;
+	for (int32 BrickIndex : VisibleBricks)
+	{
+		if (Uploads.Num() >= MaxUploadsPerFrame)
+		{
+			break;
+		}
+		if (BrickSlots[BrickIndex] != INDEX_NONE)
+		{
+			continue;
+		}
+		// UpdateVisibility already queued the missing ones in the right order, a miss mustn't reorder them.
+		FRaymarchBrickDataPtr Data = Cache->FindBrick(BrickIndex, false);
+		if (!Data)
+		{
+			continue;
+		}
+		const int32 Slot = FindSlotToReplace();
+		if (Slot == INDEX_NONE)
+		{
+			// Every slot holds a brick visible this frame, the atlas is too small for the view.
+			break;
+		}
+
+		if (SlotBricks[Slot] != INDEX_NONE)
+		{
+			BrickSlots[SlotBricks[Slot]] = INDEX_NONE;
+			IndirectionUpdates.Add(TPair<int32, FColor>(SlotBricks[Slot], FColor(0, 0, 0, 0)));
+			--PagedBrickCount;
+		}
+		SlotBricks[Slot] = BrickIndex;
+		SlotLastVisibleFrames[Slot] = GFrameCounter;
+		BrickSlots[BrickIndex] = Slot;
+		++PagedBrickCount;
+
+		const FIntVector SlotCoords(Slot % SlotCounts.X, (Slot / SlotCounts.X) % SlotCounts.Y, Slot / (SlotCounts.X * SlotCounts.Y));
+		IndirectionUpdates.Add(TPair<int32, FColor>(BrickIndex, FColor(SlotCoords.X, SlotCoords.Y, SlotCoords.Z, 255)));
+		Uploads.Add(FRaymarchBrickUpload{ SlotCoords * Padded, Data });
+	}
+	if (Uploads.Num() == 0)
+	{
+		return;
+	}
+
+	// Updates go in order with the draws, so the indirection never points a draw at a slot that's still being filled.
+	FRaymarchVolumeRenderDataPtr PagedVolume = Volume;
+	const int32 PagedTicket = Ticket;
+	const FRaymarchBrickLayout Layout = Cache->GetLayout();
+	ENQUEUE_RENDER_COMMAND(PageBricksCommand)(
+		[PagedVolume, PagedTicket, Layout, Uploads, IndirectionUpdates](FRHICommandListImmediate& RHICmdList)
+	{
+		// A later load replaced the atlas, or the volume got released.
+		if (PagedVolume->GetShownTicket_RenderThread() != PagedTicket || !PagedVolume->VolumeTexture.IsValid())
+		{
+			return;
+		}
+		RAYMARCH_SCOPED_STAGE(RHICmdList, Upload);
+
+		const int32 Padded = Layout.GetPaddedBrickSize();
+		const uint32 VoxelSize = GPixelFormats[PagedVolume->VolumeTexture->GetFormat()].BlockBytes;
+		for (const FRaymarchBrickUpload& Upload : Uploads)
+		{
+			FRaymarchProfiler::Get().AddUploadedBytes_RenderThread(Upload.Data->Num());
+			const FUpdateTextureRegion3D UpdateRegion(Upload.SlotOrigin, FIntVector::ZeroValue, FIntVector(Padded));
+			RHIUpdateTexture3D(PagedVolume->VolumeTexture, 0, UpdateRegion, Padded * VoxelSize, Padded * Padded * VoxelSize, Upload.Data->GetData());
+		}
+		// Only the texels of the bricks that moved, the indirection of a big volume is too large to go up every frame.
+		const FIntVector& Counts = Layout.BrickCounts;
+		for (const TPair<int32, FColor>& Entry : IndirectionUpdates)
+		{
+			const FIntVector Brick(Entry.Key % Counts.X, (Entry.Key / Counts.X) % Counts.Y, Entry.Key / (Counts.X * Counts.Y));
+			const FUpdateTextureRegion3D UpdateRegion(Brick, FIntVector::ZeroValue, FIntVector(1));
+			RHIUpdateTexture3D(PagedVolume->BrickIndirectionTexture, 0, UpdateRegion, sizeof(FColor), sizeof(FColor),
+				reinterpret_cast<const uint8*>(&Entry.Value));
+		}
+	});
+}
+
+int32 FRaymarchBrickPager::FindSlotToReplace() const
+{
+	int32 OldestSlot = INDEX_NONE;
+	for (int32 Slot = 0; Slot < SlotBricks.Num(); ++Slot)
+	{
+		if (SlotBricks[Slot] == INDEX_NONE)
+		{
+			return Slot;
+		}
+		if (SlotLastVisibleFrames[Slot] != GFrameCounter
+			&& (OldestSlot == INDEX_NONE || SlotLastVisibleFrames[Slot] < SlotLastVisibleFrames[OldestSlot]))
+		{
+			OldestSlot = Slot;
+		}
+	}
+	return OldestSlot;
+}
@@ -0,0 +1,206 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchBrickPool.h"
+#include "../Public/Raymarcher.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+#include "Async/ParallelFor.h"
+
+FRaymarchBrickLayout PartitionIntoBricks(FIntVector VolumeDimensions, int32 BrickSize, int32 Apron)
+{
+	check(BrickSize > 0 && Apron >= 0);
+	FRaymarchBrickLayout Layout;
+	Layout.VolumeDimensions = VolumeDimensions;
+	Layout.BrickSize = BrickSize;
+	Layout.Apron = Apron;
+	Layout.BrickCounts = FIntVector(
+		FMath::DivideAndRoundUp(VolumeDimensions.X, BrickSize),
+		FMath::DivideAndRoundUp(VolumeDimensions.Y, BrickSize),
+		FMath::DivideAndRoundUp(VolumeDimensions.Z, BrickSize));
+	return Layout;
+}
+
+template<typename TexelType>
+static void ClassifyBricksTyped(const TexelType* Volume, const FRaymarchBrickLayout& Layout, float EmptyThreshold, TArray<bool>& OutOccupied)
+{
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+	const FIntVector& Counts = Layout.BrickCounts;
+
+	// Every brick is only written by one task. Voxels in the apron are read by up to 8 tasks, which is fine.
+	ParallelFor(Layout.GetBrickCount(), [&](int32 BrickIndex)
+	{
+		const FIntVector Brick(BrickIndex % Counts.X, (BrickIndex / Counts.X) % Counts.Y, BrickIndex / (Counts.X * Counts.Y));
+		const FIntVector First(
+			FMath::Max(Brick.X * Layout.BrickSize - Layout.Apron, 0),
+			FMath::Max(Brick.Y * Layout.BrickSize - Layout.Apron, 0),
+			FMath::Max(Brick.Z * Layout.BrickSize - Layout.Apron, 0));
+		const FIntVector Last(
+			FMath::Min((Brick.X + 1) * Layout.BrickSize + Layout.Apron, Dimensions.X) - 1,
+			FMath::Min((Brick.Y + 1) * Layout.BrickSize + Layout.Apron, Dimensions.Y) - 1,
+			FMath::Min((Brick.Z + 1) * Layout.BrickSize + Layout.Apron, Dimensions.Z) - 1);
+
+		bool bOccupied = false;
+		for (int32 Z = First.Z; Z <= Last.Z && !bOccupied; ++Z)
+		{
+			for (int32 Y = First.Y; Y <= Last.Y && !bOccupied; ++Y)
+			{
+				const TexelType* Row = Volume + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z);
+				for (int32 X = First.X; X <= Last.X; ++X)
+				{
+					if (ToSampledValue(Row[X]) > EmptyThreshold)
+					{
+						bOccupied = true;
+						break;
+					}
+				}
+			}
+		}
+		OutOccupied[BrickIndex] = bOccupied;
+	});
+}
+
+void ClassifyBricks(const void* Volume, EPixelFormat PixelFormat, const FRaymarchBrickLayout& Layout, float EmptyThreshold, TArray<bool>& OutOccupied)
+{
+	OutOccupied.SetNumUninitialized(Layout.GetBrickCount());
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		ClassifyBricksTyped(reinterpret_cast<const uint8*>(Volume), Layout, EmptyThreshold, OutOccupied);
+		break;
+	case PF_G16:
+		ClassifyBricksTyped(reinterpret_cast<const uint16*>(Volume), Layout, EmptyThreshold, OutOccupied);
+		break;
+	case PF_R16F:
+		ClassifyBricksTyped(reinterpret_cast<const FFloat16*>(Volume), Layout, EmptyThreshold, OutOccupied);
+		break;
+	case PF_R32_FLOAT:
+		ClassifyBricksTyped(reinterpret_cast<const float*>(Volume), Layout, EmptyThreshold, OutOccupied);
+		break;
+	default:
+		checkNoEntry();
+	}
+}
+
+FIntVector GetAtlasSlotCounts(int32 OccupiedBrickCount)
+{
+	if (OccupiedBrickCount <= 0)
+	{
+		return FIntVector::ZeroValue;
+	}
+	// Cube root along X, then square root of the rest along Y and whatever is left along Z.
+	const int32 X = FMath::CeilToInt(FMath::Pow(float(OccupiedBrickCount), 1.0f / 3.0f) - KINDA_SMALL_NUMBER);
+	const int32 Y = FMath::CeilToInt(FMath::Sqrt(float(FMath::DivideAndRoundUp(OccupiedBrickCount, X))) - KINDA_SMALL_NUMBER);
+	const int32 Z = FMath::DivideAndRoundUp(OccupiedBrickCount, X * Y);
+	return FIntVector(X, Y, Z);
+}
+
+void PackBrickAtlas(const void* Volume, EPixelFormat PixelFormat, const FRaymarchBrickLayout& Layout, const TArray<bool>& Occupied,
+	FRaymarchBrickAtlas& OutAtlas, int32 Alignment)
+{
+	check(Occupied.Num() == Layout.GetBrickCount());
+	const int32 TexelBytes = GPixelFormats[PixelFormat].BlockBytes;
+	const int32 Padded = Layout.GetPaddedBrickSize();
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+
+	// Slots are handed out in brick order, so the atlas keeps some of the spatial locality of the volume.
+	OutAtlas.BrickSlots.SetNumUninitialized(Occupied.Num());
+	OutAtlas.OccupiedBrickCount = 0;
+	for (bool bOccupied : Occupied)
+	{
+		OutAtlas.OccupiedBrickCount += bOccupied ? 1 : 0;
+	}
+	// Keep at least one (zeroed) slot, so a completely empty volume still gets a valid texture.
+	OutAtlas.SlotCounts = GetAtlasSlotCounts(FMath::Max(OutAtlas.OccupiedBrickCount, 1));
+	OutAtlas.AtlasDimensions = OutAtlas.SlotCounts * Padded;
+	// The shader addresses the atlas in voxels, so the extra ones past the last slots just stay unused (and zero).
+	Alignment = FMath::Max(Alignment, 1);
+	OutAtlas.AtlasDimensions.X = FMath::DivideAndRoundUp(OutAtlas.AtlasDimensions.X, Alignment) * Alignment;
+	OutAtlas.AtlasDimensions.Y = FMath::DivideAndRoundUp(OutAtlas.AtlasDimensions.Y, Alignment) * Alignment;
+
+	int32 NextSlot = 0;
+	for (int32 BrickIndex = 0; BrickIndex < Occupied.Num(); ++BrickIndex)
+	{
+		if (Occupied[BrickIndex])
+		{
+			const FIntVector& Slots = OutAtlas.SlotCounts;
+			OutAtlas.BrickSlots[BrickIndex] = FIntVector(NextSlot % Slots.X, (NextSlot / Slots.X) % Slots.Y, NextSlot / (Slots.X * Slots.Y));
+			++NextSlot;
+		}
+		else
+		{
+			OutAtlas.BrickSlots[BrickIndex] = RAYMARCH_EMPTY_BRICK_SLOT;
+		}
+	}
+
+	const FIntVector& AtlasDimensions = OutAtlas.AtlasDimensions;
+	// Unused slots at the end stay zero.
+	OutAtlas.AtlasData.SetNumZeroed(int64(AtlasDimensions.X) * AtlasDimensions.Y * AtlasDimensions.Z * TexelBytes);
+	if (OutAtlas.OccupiedBrickCount == 0)
+	{
+		return;
+	}
+
+	const uint8* Source = reinterpret_cast<const uint8*>(Volume);
+	uint8* Destination = OutAtlas.AtlasData.GetData();
+	const FIntVector& Counts = Layout.BrickCounts;
+
+	ParallelFor(Occupied.Num(), [&](int32 BrickIndex)
+	{
+		const FIntVector Slot = OutAtlas.BrickSlots[BrickIndex];
+		if (Slot == RAYMARCH_EMPTY_BRICK_SLOT)
+		{
+			return;
+		}
+		const FIntVector Brick(BrickIndex % Counts.X, (BrickIndex / Counts.X) % Counts.Y, BrickIndex / (Counts.X * Counts.Y));
+		const FIntVector Origin = Brick * Layout.BrickSize - FIntVector(Layout.Apron);
+		const FIntVector AtlasOrigin = Slot * Padded;
+
+		for (int32 LocalZ = 0; LocalZ < Padded; ++LocalZ)
+		{
+			const int32 Z = FMath::Clamp(Origin.Z + LocalZ, 0, Dimensions.Z - 1);
+			for (int32 LocalY = 0; LocalY < Padded; ++LocalY)
+			{
+				const int32 Y = FMath::Clamp(Origin.Y + LocalY, 0, Dimensions.Y - 1);
+				const uint8* SourceRow = Source + (int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)) * TexelBytes;
+				uint8* DestinationRow = Destination + (AtlasOrigin.X + int64(AtlasDimensions.X) *
+					(AtlasOrigin.Y + LocalY + int64(AtlasDimensions.Y) * (AtlasOrigin.Z + LocalZ))) * TexelBytes;
+
+				// Copy the part of the row inside the volume in one go and clamp the ends (apron and bricks reaching past the volume).
+				const int32 FirstInside = FMath::Clamp(-Origin.X, 0, Padded);
+				const int32 EndInside = FMath::Clamp(Dimensions.X - Origin.X, FirstInside, Padded);
+				for (int32 LocalX = 0; LocalX < FirstInside; ++LocalX)
+				{
+					FMemory::Memcpy(DestinationRow + LocalX * TexelBytes, SourceRow, TexelBytes);
+				}
+				FMemory::Memcpy(DestinationRow + FirstInside * TexelBytes, SourceRow + (Origin.X + FirstInside) * int64(TexelBytes),
+					(EndInside - FirstInside) * TexelBytes);
+				for (int32 LocalX = EndInside; LocalX < Padded; ++LocalX)
+				{
+					FMemory::Memcpy(DestinationRow + LocalX * TexelBytes, SourceRow + (Dimensions.X - 1) * int64(TexelBytes), TexelBytes);
+				}
+			}
+		}
+	});
+}
+
+void BuildBrickIndirection(const FRaymarchBrickLayout& Layout, const FRaymarchBrickAtlas& Atlas, TArray<FColor>& OutIndirection)
+{
+	check(Atlas.SlotCounts.GetMax() <= 255);
+	OutIndirection.SetNumUninitialized(Atlas.BrickSlots.Num());
+	for (int32 BrickIndex = 0; BrickIndex < Atlas.BrickSlots.Num(); ++BrickIndex)
+	{
+		const FIntVector& Slot = Atlas.BrickSlots[BrickIndex];
+		OutIndirection[BrickIndex] = Slot == RAYMARCH_EMPTY_BRICK_SLOT ? FColor(0, 0, 0, 0) : FColor(Slot.X, Slot.Y, Slot.Z, 255);
+	}
+}
+
+void LogBrickAtlasMemory(const FString& VolumeName, const FRaymarchBrickLayout& Layout, const FRaymarchBrickAtlas& Atlas, EPixelFormat PixelFormat)
+{
+	const FIntVector& Dimensions = Layout.VolumeDimensions;
+	const int64 DenseBytes = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z * GPixelFormats[PixelFormat].BlockBytes;
+	const int64 BrickedBytes = Atlas.AtlasData.Num() + Atlas.GetIndirectionBytes();
+	UE_LOG(LogRaymarch, Log, TEXT("%s: %d of %d bricks (%d^3 + %d apron) occupied, atlas %dx%dx%d. Dense %.1f MB, bricked %.1f MB, saved %.1f%%."),
+		*VolumeName, Atlas.OccupiedBrickCount, Layout.GetBrickCount(), Layout.BrickSize, Layout.Apron,
+		Atlas.AtlasDimensions.X, Atlas.AtlasDimensions.Y, Atlas.AtlasDimensions.Z,
+		DenseBytes / (1024.0 * 1024.0), BrickedBytes / (1024.0 * 1024.0), 100.0 * (1.0 - double(BrickedBytes) / FMath::Max<int64>(DenseBytes, 1)));
+}
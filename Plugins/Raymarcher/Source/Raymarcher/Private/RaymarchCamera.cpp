@@ -0,0 +1,141 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchCamera.h"
+
+#include "Engine/Engine.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/LocalPlayer.h"
+#include "Engine/World.h"
+#include "SceneView.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+// Swaps the engine's X forward, Y right, Z up into view space X right, Y up, Z forward.
+static const FMatrix GViewAxisSwap(
+	FPlane(0, 0, 1, 0),
+	FPlane(1, 0, 0, 0),
+	FPlane(0, 1, 0, 0),
+	FPlane(0, 0, 0, 1));
+
+FCompiledCameraModel FRaymarchView::CompileCameraModel(const FTransform& VolumeTransform) const
+{
+	FCompiledCameraModel CameraModel;
+	CameraModel.ModelMatrix = VolumeTransform.ToMatrixWithScale();
+	CameraModel.ViewMatrix = ViewMatrix;
+	CameraModel.ProjectionMatrix = ProjectionMatrix;
+	// Need to put RayOrigin to camera position in Model Space
+	CameraModel.RayOrigin = VolumeTransform.ToInverseMatrixWithScale().TransformPosition(ViewLocation);
+	return CameraModel;
+}
+
+// A player view computed in some frame.
+struct FRaymarchCachedPlayerView
+{
+	TWeakObjectPtr<UWorld> World;
+	int32 PlayerIndex;
+	EStereoscopicPass Pass;
+	uint64 FrameNumber;
+	FRaymarchView View;
+};
+
+// Only touched on the game thread. There's one entry per player that drew anything, so a linear search is fine.
+static TArray<FRaymarchCachedPlayerView> GCachedPlayerViews;
+static int64 GPlayerViewComputeCount = 0;
+
+// Returns the view of one pass (the whole view or one eye) of a local player, cached for the rest of the frame.
+static bool GetPlayerPassView_GameThread(UWorld* World, int32 PlayerIndex, EStereoscopicPass Pass, FRaymarchView& OutView)
+{
+	check(IsInGameThread());
+
+	FRaymarchCachedPlayerView* Cached = GCachedPlayerViews.FindByPredicate([World, PlayerIndex, Pass](const FRaymarchCachedPlayerView& Entry)
+	{
+		return Entry.World.Get() == World && Entry.PlayerIndex == PlayerIndex && Entry.Pass == Pass;
+	});
+	if (Cached && Cached->FrameNumber == GFrameCounter)
+	{
+		OutView = Cached->View;
+		return true;
+	}
+
+	// Only the projection data is needed, so instead of building a whole scene view family and calling CalcSceneView
+	// (which also gathers post process settings, view state and show flags), ask the player for just that.
+	ULocalPlayer* LocalPlayer = World && GEngine ? GEngine->GetGamePlayer(World, PlayerIndex) : nullptr;
+	if (!LocalPlayer || !LocalPlayer->ViewportClient || !LocalPlayer->ViewportClient->Viewport)
+	{
+		return false;
+	}
+	FSceneViewProjectionData ProjectionData;
+	// For an eye, the player offsets the view by half the eye distance and asks the HMD for its projection.
+	if (!LocalPlayer->GetProjectionData(LocalPlayer->ViewportClient->Viewport, Pass, ProjectionData))
+	{
+		return false;
+	}
+	++GPlayerViewComputeCount;
+
+	FRaymarchView View;
+	View.ViewMatrix = FTranslationMatrix(-ProjectionData.ViewOrigin) * ProjectionData.ViewRotationMatrix;
+	View.ProjectionMatrix = ProjectionData.ProjectionMatrix;
+	View.ViewLocation = ProjectionData.ViewOrigin;
+	// Z of the view space is forward, the rotation matrix is orthonormal so its transpose takes it back to the world.
+	View.ViewDirection = ProjectionData.ViewRotationMatrix.GetTransposed().TransformVector(FVector(0.0f, 0.0f, 1.0f));
+
+	if (!Cached)
+	{
+		// Drop entries of worlds that are gone (i.e. after PIE ended) while adding a new one.
+		GCachedPlayerViews.RemoveAll([](const FRaymarchCachedPlayerView& Entry) { return !Entry.World.IsValid(); });
+		Cached = &GCachedPlayerViews[GCachedPlayerViews.AddDefaulted()];
+		Cached->World = World;
+		Cached->PlayerIndex = PlayerIndex;
+		Cached->Pass = Pass;
+	}
+	Cached->FrameNumber = GFrameCounter;
+	Cached->View = View;
+
+	OutView = View;
+	return true;
+}
+
+bool FRaymarchCameraModelProvider::GetPlayerView_GameThread(UWorld* World, int32 PlayerIndex, FRaymarchView& OutView)
+{
+	return GetPlayerPassView_GameThread(World, PlayerIndex, eSSP_FULL, OutView);
+}
+
+bool FRaymarchCameraModelProvider::GetPlayerStereoViews_GameThread(UWorld* World, int32 PlayerIndex, FRaymarchView& OutLeft, FRaymarchView& OutRight)
+{
+	if (!GEngine || !GEngine->IsStereoscopic3D())
+	{
+		return false;
+	}
+	return GetPlayerPassView_GameThread(World, PlayerIndex, eSSP_LEFT_EYE, OutLeft)
+		&& GetPlayerPassView_GameThread(World, PlayerIndex, eSSP_RIGHT_EYE, OutRight);
+}
+
+FRaymarchView FRaymarchCameraModelProvider::MakeView(const FTransform& CameraTransform, float FieldOfView, FIntPoint ViewSize)
+{
+	const FMatrix ViewRotationMatrix = FInverseRotationMatrix(CameraTransform.Rotator()) * GViewAxisSwap;
+	const FMatrix ViewMatrix = FTranslationMatrix(-CameraTransform.GetLocation()) * ViewRotationMatrix;
+
+	// Same projection the engine uses for scene captures - horizontal FOV, aspect ratio from the target, reversed Z.
+	const float HalfFOV = FMath::DegreesToRadians(FMath::Clamp(FieldOfView, 0.001f, 179.0f)) * 0.5f;
+	const FMatrix ProjectionMatrix = FReversedZPerspectiveMatrix(HalfFOV, FMath::Max(ViewSize.X, 1), FMath::Max(ViewSize.Y, 1), GNearClippingPlane);
+
+	return MakeView(ViewMatrix, ProjectionMatrix);
+}
+
+FRaymarchView FRaymarchCameraModelProvider::MakeView(const FMatrix& ViewMatrix, const FMatrix& ProjectionMatrix)
+{
+	FRaymarchView View;
+	View.ViewMatrix = ViewMatrix;
+	View.ProjectionMatrix = ProjectionMatrix;
+	const FMatrix InverseViewMatrix = ViewMatrix.Inverse();
+	View.ViewLocation = InverseViewMatrix.GetOrigin();
+	View.ViewDirection = InverseViewMatrix.TransformVector(FVector(0.0f, 0.0f, 1.0f)).GetSafeNormal();
+	return View;
+}
+
+int64 FRaymarchCameraModelProvider::GetPlayerViewComputeCount()
+{
+	return GPlayerViewComputeCount;
+}
+
+#undef LOCTEXT_NAMESPACE
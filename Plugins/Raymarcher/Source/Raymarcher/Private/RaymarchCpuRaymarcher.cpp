@@ -0,0 +1,855 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchCpuRaymarcher.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+
+// Rays marched side by side in a packet.
+#define RAYMARCH_CPU_PACKET_SIZE 4
+
+// "RMGI" - first word of golden image files.
+static const uint32 GoldenImageMagic = 0x49474D52;
+
+/** Everything that is the same for all rays of an image - what the shader gets in its parameters. */
+struct FRaymarchCpuRayConstants
+{
+	// Inverse of Model * View * Projection, from clip space back to the [-1,1] cube of the volume.
+	FMatrix ClipToObject;
+	// Model * View, for the view depth along the rays.
+	FMatrix ObjectToView;
+	FVector RayOrigin;
+	FIntPoint ImageSize;
+	float StepSize;
+	float StepInVoxels;
+	float TerminationThreshold;
+	int32 MaxSamples;
+	ERaymarchCompositingMode CompositingMode;
+	bool bFrontToBack;
+	bool bUseMacroCells;
+	bool bUseTransferFunction;
+	bool bPreIntegrate;
+	FVector CellCount;
+	// View depth of the slab center and the slab thickness, rays aren't clipped with a thickness of 0.
+	float SlabCenter;
+	float SlabThickness;
+};
+
+static FRaymarchCpuRayConstants MakeRayConstants(
+	const FRaymarchCpuVolume& Volume,
+	const FCompiledCameraModel& CameraModel,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint ImageSize)
+{
+	// Same as FRaymarchShader::SetRaymarchParameters and MainPS.
+	FRaymarchCpuRayConstants Constants;
+	Constants.ClipToObject = (CameraModel.ModelMatrix * CameraModel.ViewMatrix * CameraModel.ProjectionMatrix).Inverse();
+	Constants.ObjectToView = CameraModel.ModelMatrix * CameraModel.ViewMatrix;
+	Constants.RayOrigin = CameraModel.RayOrigin;
+	Constants.ImageSize = ImageSize;
+	const float Quality = FMath::Max(Settings.Quality, 0.05f);
+	Constants.StepSize = (1.0f / FMath::Max(Volume.Dimensions.GetMax(), 1)) / Quality;
+	Constants.StepInVoxels = 1.0f / Quality;
+	Constants.MaxSamples = FMath::CeilToInt(1.7321f / Constants.StepSize) + 1;
+	Constants.CompositingMode = Settings.CompositingMode;
+	Constants.bFrontToBack = Settings.CompositingMode == ERaymarchCompositingMode::FrontToBack;
+	// See FRaymarchShader::SetWindow - projections are done at the darkest or brightest windowed value of the volume.
+	const FVector2D ValueRange = Volume.MacroCells.GetValueRange();
+	const float WindowedMin = FMath::Clamp(ValueRange.X * Volume.WindowScaleBias.X + Volume.WindowScaleBias.Y, 0.0f, 1.0f);
+	const float WindowedMax = FMath::Clamp(ValueRange.Y * Volume.WindowScaleBias.X + Volume.WindowScaleBias.Y, 0.0f, 1.0f);
+	switch (Settings.CompositingMode)
+	{
+	case ERaymarchCompositingMode::FrontToBack:
+		Constants.TerminationThreshold = Settings.EarlyTerminationThreshold;
+		break;
+	case ERaymarchCompositingMode::MaximumIntensity:
+		Constants.TerminationThreshold = FMath::Max(WindowedMin, WindowedMax);
+		break;
+	case ERaymarchCompositingMode::MinimumIntensity:
+		Constants.TerminationThreshold = 1.0f - FMath::Min(WindowedMin, WindowedMax);
+		break;
+	case ERaymarchCompositingMode::AverageIntensity:
+		Constants.TerminationThreshold = 1e30f;
+		break;
+	default:
+		Constants.TerminationThreshold = 1.0f;
+		break;
+	}
+	Constants.bUseTransferFunction = Volume.Lut.Num() > 1;
+	Constants.bPreIntegrate = Constants.bUseTransferFunction && Settings.bPreIntegrate
+		&& Volume.PreIntegrationTable.Num() == Volume.Lut.Num() * Volume.Lut.Num();
+	// Only front to back compositing classifies samples, which needs the opacity range of every cell.
+	Constants.bUseMacroCells = Volume.MacroCells.IsValid() && (!Constants.bFrontToBack || !Constants.bUseTransferFunction
+		|| Volume.MaxOpacityTable.Num() == Volume.Lut.Num() * Volume.Lut.Num());
+	Constants.CellCount = Constants.bUseMacroCells ? FVector(Volume.MacroCells.CellDimensions) : FVector(1.0f, 1.0f, 1.0f);
+	Constants.SlabCenter = Constants.ObjectToView.M[3][2] + Settings.SlabOffset;
+	Constants.SlabThickness = FMath::Max(Settings.SlabThickness, 0.0f);
+	return Constants;
+}
+
+/** Intersects the ray through the center of a pixel with the volume, as rasterizing its cube and IntersectBox do.
+* Returns false if the pixel isn't covered, otherwise the texture space start, direction and length of the ray.
+*/
+static bool SetupRay(const FRaymarchCpuRayConstants& Constants, int32 X, int32 Y, FVector& OutStart, FVector& OutDirection, float& OutTravel)
+{
+	const float ClipX = (X + 0.5f) * 2.0f / Constants.ImageSize.X - 1.0f;
+	const float ClipY = 1.0f - (Y + 0.5f) * 2.0f / Constants.ImageSize.Y;
+	const FVector4 Point = Constants.ClipToObject.TransformFVector4(FVector4(ClipX, ClipY, 0.5f, 1.0f));
+	if (FMath::Abs(Point.W) < SMALL_NUMBER)
+	{
+		return false;
+	}
+	const FVector Direction = (FVector(Point) / Point.W - Constants.RayOrigin).GetSafeNormal();
+	if (Direction.IsZero())
+	{
+		return false;
+	}
+
+	const FVector InvDirection(1.0f / Direction.X, 1.0f / Direction.Y, 1.0f / Direction.Z);
+	const FVector TBottom = InvDirection * (FVector(-1.0f) - Constants.RayOrigin);
+	const FVector TTop = InvDirection * (FVector(1.0f) - Constants.RayOrigin);
+	const FVector TMin = TTop.ComponentMin(TBottom);
+	const FVector TMax = TTop.ComponentMax(TBottom);
+	float TNear = FMath::Max3(TMin.X, TMin.Y, TMin.Z);
+	const float TFar = FMath::Min3(TMax.X, TMax.Y, TMax.Z);
+	// Rays missing the cube, or with the cube behind them, belong to pixels the cube doesn't cover.
+	if (!(TNear <= TFar) || TFar <= 0.0f)
+	{
+		return false;
+	}
+	TNear = FMath::Max(TNear, 0.0f);
+	float ClippedFar = TFar;
+	if (Constants.SlabThickness > 0.0f)
+	{
+		// Same as GetSlabDistances.
+		const float Depth = Constants.ObjectToView.TransformPosition(Constants.RayOrigin).Z;
+		const float DepthPerDistance = Constants.ObjectToView.TransformVector(Direction).Z;
+		if (DepthPerDistance <= 0.0f)
+		{
+			if (FMath::Abs(Depth - Constants.SlabCenter) > 0.5f * Constants.SlabThickness)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			TNear = FMath::Max(TNear, (Constants.SlabCenter - 0.5f * Constants.SlabThickness - Depth) / DepthPerDistance);
+			ClippedFar = FMath::Min(ClippedFar, (Constants.SlabCenter + 0.5f * Constants.SlabThickness - Depth) / DepthPerDistance);
+		}
+		// Outside of the slab, MainPS returns transparent black.
+		if (ClippedFar <= TNear)
+		{
+			return false;
+		}
+	}
+
+	OutStart = 0.5f * (Constants.RayOrigin + Direction * TNear + 1.0f);
+	const FVector Stop = 0.5f * (Constants.RayOrigin + Direction * ClippedFar + 1.0f);
+	const FVector Difference = OutStart - Stop;
+	OutTravel = FMath::Sqrt(Difference.X * Difference.X + Difference.Y * Difference.Y + Difference.Z * Difference.Z);
+	OutDirection = Direction;
+	return true;
+}
+
+// Written out the same way in the scalar and packet paths, so that both round the same.
+static FORCEINLINE float LerpExact(float A, float B, float Alpha)
+{
+	return A + (B - A) * Alpha;
+}
+
+static FORCEINLINE FLinearColor LerpExact(const FLinearColor& A, const FLinearColor& B, float Alpha)
+{
+	return FLinearColor(LerpExact(A.R, B.R, Alpha), LerpExact(A.G, B.G, Alpha), LerpExact(A.B, B.B, Alpha), LerpExact(A.A, B.A, Alpha));
+}
+
+/** Fetches the 8 voxels around a trilinear sample, Low and High being the clamped voxel coordinates around it. */
+static FORCEINLINE void GatherCorners(const FRaymarchCpuVolume& Volume, const int32 Low[3], const int32 High[3], float OutCorners[8])
+{
+	const float* Voxels = Volume.Voxels.GetData();
+	const int64 SizeX = Volume.Dimensions.X;
+	const int64 SliceSize = SizeX * Volume.Dimensions.Y;
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const int64 X = (Corner & 1) ? High[0] : Low[0];
+		const int64 Y = (Corner & 2) ? High[1] : Low[1];
+		const int64 Z = (Corner & 4) ? High[2] : Low[2];
+		OutCorners[Corner] = Voxels[X + SizeX * Y + SliceSize * Z];
+	}
+}
+
+/** Trilinear sample at a texture space position, like a 3D texture with clamped addressing. */
+static float SampleTrilinear(const FRaymarchCpuVolume& Volume, const FVector& Position)
+{
+	int32 Low[3];
+	int32 High[3];
+	float Fraction[3];
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		// Texel centers are at (i + 0.5) / Size.
+		const float Size = float(Volume.Dimensions[Axis]);
+		const float Coordinate = Position[Axis] * Size - 0.5f;
+		const float Floor = FMath::FloorToFloat(Coordinate);
+		Fraction[Axis] = Coordinate - Floor;
+		Low[Axis] = int32(FMath::Clamp(Floor, 0.0f, Size - 1.0f));
+		High[Axis] = int32(FMath::Clamp(Floor + 1.0f, 0.0f, Size - 1.0f));
+	}
+	float Corners[8];
+	GatherCorners(Volume, Low, High, Corners);
+	const float C00 = LerpExact(Corners[0], Corners[1], Fraction[0]);
+	const float C10 = LerpExact(Corners[2], Corners[3], Fraction[0]);
+	const float C01 = LerpExact(Corners[4], Corners[5], Fraction[0]);
+	const float C11 = LerpExact(Corners[6], Corners[7], Fraction[0]);
+	const float C0 = LerpExact(C00, C10, Fraction[1]);
+	const float C1 = LerpExact(C01, C11, Fraction[1]);
+	return LerpExact(C0, C1, Fraction[2]);
+}
+
+/** Linear lookup of a [0,1] coordinate in a table, mapped onto the texel centers like Classify does. */
+static FORCEINLINE void GetTableTexels(float Coordinate, int32 Size, int32& OutLow, int32& OutHigh, float& OutFraction)
+{
+	const float Texel = Coordinate * (Size - 1);
+	const float Floor = FMath::FloorToFloat(Texel);
+	OutFraction = Texel - Floor;
+	OutLow = FMath::Clamp(int32(Floor), 0, Size - 1);
+	OutHigh = FMath::Min(OutLow + 1, Size - 1);
+}
+
+/** Color and opacity (for a one voxel step) of the ray segment between two windowed intensities. */
+static FLinearColor Classify(const FRaymarchCpuVolume& Volume, const FRaymarchCpuRayConstants& Constants, float FrontIntensity, float BackIntensity)
+{
+	const int32 Size = Volume.Lut.Num();
+	int32 BackLow, BackHigh;
+	float BackFraction;
+	GetTableTexels(BackIntensity, Size, BackLow, BackHigh, BackFraction);
+	if (Constants.bPreIntegrate)
+	{
+		// Rows are the back intensity, columns the front one, see BuildPreIntegrationTable.
+		int32 FrontLow, FrontHigh;
+		float FrontFraction;
+		GetTableTexels(FrontIntensity, Size, FrontLow, FrontHigh, FrontFraction);
+		const FLinearColor* Table = Volume.PreIntegrationTable.GetData();
+		const FLinearColor Low = LerpExact(Table[FrontLow + BackLow * Size], Table[FrontHigh + BackLow * Size], FrontFraction);
+		const FLinearColor High = LerpExact(Table[FrontLow + BackHigh * Size], Table[FrontHigh + BackHigh * Size], FrontFraction);
+		return LerpExact(Low, High, BackFraction);
+	}
+	return LerpExact(Volume.Lut[BackLow], Volume.Lut[BackHigh], BackFraction);
+}
+
+/** Classifies a sample and corrects its opacity for the step length. Returns premultiplied color and opacity. */
+static FORCEINLINE FLinearColor ClassifySample(const FRaymarchCpuVolume& Volume, const FRaymarchCpuRayConstants& Constants, float PreviousIntensity, float Intensity)
+{
+	FLinearColor Classified(0.8f, 0.8f, 0.8f, Intensity);
+	if (Constants.bUseTransferFunction)
+	{
+		Classified = Classify(Volume, Constants, PreviousIntensity < 0.0f ? Intensity : PreviousIntensity, Intensity);
+	}
+	const float SampleAlpha = 1.0f - FMath::Pow(1.0f - FMath::Clamp(Classified.A, 0.0f, 1.0f), Constants.StepInVoxels);
+	return FLinearColor(Classified.R * SampleAlpha, Classified.G * SampleAlpha, Classified.B * SampleAlpha, SampleAlpha);
+}
+
+/** True if nothing in the macro cell with the given (clamped) coordinates can change what a ray accumulated, see CanSkipMacroCell.
+* OutCellIntensity receives an intensity inside the windowed range of the cell.
+*/
+static FORCEINLINE bool CanSkipMacroCell(const FRaymarchCpuVolume& Volume, const FRaymarchCpuRayConstants& Constants,
+	float CellX, float CellY, float CellZ, float Accumulated, float& OutCellIntensity)
+{
+	const FVector2D& MinMax = Volume.MacroCells.MinMax[Volume.MacroCells.GetCellIndex(int32(CellX), int32(CellY), int32(CellZ))];
+	const float WindowedMin = FMath::Clamp(MinMax.X * Volume.WindowScaleBias.X + Volume.WindowScaleBias.Y, 0.0f, 1.0f);
+	const float WindowedMax = MinMax.Y * Volume.WindowScaleBias.X + Volume.WindowScaleBias.Y;
+	OutCellIntensity = WindowedMin;
+	switch (Constants.CompositingMode)
+	{
+	case ERaymarchCompositingMode::MaximumIntensity:
+		return WindowedMax <= Accumulated;
+	case ERaymarchCompositingMode::MinimumIntensity:
+		return 1.0f - WindowedMin <= Accumulated;
+	default:
+		// Only front to back classifies samples, additive and average add up the windowed intensity.
+		if (Constants.bFrontToBack && Constants.bUseTransferFunction)
+		{
+			const int32 Size = Volume.Lut.Num();
+			const int32 Lower = FMath::FloorToInt(WindowedMin * (Size - 1));
+			const int32 Upper = FMath::CeilToInt(FMath::Clamp(WindowedMax, 0.0f, 1.0f) * (Size - 1));
+			return Volume.MaxOpacityTable[Lower + Upper * Size] <= 0.0f;
+		}
+		return WindowedMax <= 0.0f;
+	}
+}
+
+/** Samples along a whole ray of given length, the ones skipped included - what the average intensity projection divides by. */
+static FORCEINLINE float GetRaySampleCount(const FRaymarchCpuRayConstants& Constants, float Travel)
+{
+	return FMath::Min(FMath::CeilToFloat(Travel / Constants.StepSize), float(Constants.MaxSamples));
+}
+
+/** Steps to the first sample behind the macro cell a ray is in. */
+static FORCEINLINE int32 GetSkippedSteps(float DistanceToExit, float StepSize)
+{
+	return FMath::Max(1, FMath::CeilToInt(DistanceToExit / StepSize));
+}
+
+/** Premultiplied color and opacity of a marched ray, like the blend state puts MainPS output over transparent black. */
+static FORCEINLINE FLinearColor ResolveRay(const FRaymarchCpuRayConstants& Constants, float R, float G, float B, float A, float SampleCount)
+{
+	float Alpha = FMath::Clamp(A, 0.0f, 1.0f);
+	if (Constants.CompositingMode == ERaymarchCompositingMode::MinimumIntensity)
+	{
+		Alpha = 1.0f - Alpha;
+	}
+	else if (Constants.CompositingMode == ERaymarchCompositingMode::AverageIntensity)
+	{
+		Alpha = FMath::Clamp(A / FMath::Max(SampleCount, 1.0f), 0.0f, 1.0f);
+	}
+	if (!Constants.bFrontToBack)
+	{
+		return FLinearColor(0.8f * Alpha, 0.8f * Alpha, 0.8f * Alpha, Alpha);
+	}
+	const float InvOpacity = 1.0f / FMath::Max(A, 0.0001f);
+	return FLinearColor(R * InvOpacity * Alpha, G * InvOpacity * Alpha, B * InvOpacity * Alpha, Alpha);
+}
+
+/** Marches one ray set up by SetupRay, the same way MainPS does. */
+static FLinearColor MarchRay(
+	const FRaymarchCpuVolume& Volume,
+	const FRaymarchCpuRayConstants& Constants,
+	FVector Position,
+	const FVector& Direction,
+	float Travel,
+	FRaymarchCpuStats& Stats)
+{
+	const FVector Step = Direction * Constants.StepSize;
+	const FVector InvDirection(1.0f / Direction.X, 1.0f / Direction.Y, 1.0f / Direction.Z);
+	const FVector2D& WindowScaleBias = Volume.WindowScaleBias;
+	FLinearColor Accumulated(0.0f, 0.0f, 0.0f, 0.0f);
+	float PreviousIntensity = -1.0f;
+	const float SampleCount = GetRaySampleCount(Constants, Travel);
+
+	int32 i = 0;
+	while (i < Constants.MaxSamples && Travel > 0.0f && Accumulated.A < Constants.TerminationThreshold)
+	{
+		if (Constants.bUseMacroCells)
+		{
+			const FVector Cell(
+				FMath::Clamp(FMath::FloorToFloat(Position.X * Constants.CellCount.X), 0.0f, Constants.CellCount.X - 1.0f),
+				FMath::Clamp(FMath::FloorToFloat(Position.Y * Constants.CellCount.Y), 0.0f, Constants.CellCount.Y - 1.0f),
+				FMath::Clamp(FMath::FloorToFloat(Position.Z * Constants.CellCount.Z), 0.0f, Constants.CellCount.Z - 1.0f));
+			float CellIntensity;
+			if (CanSkipMacroCell(Volume, Constants, Cell.X, Cell.Y, Cell.Z, Accumulated.A, CellIntensity))
+			{
+				const FVector CellMin = Cell / Constants.CellCount;
+				const FVector CellMax = (Cell + 1.0f) / Constants.CellCount;
+				const FVector TExit = ((CellMin - Position) * InvDirection).ComponentMax((CellMax - Position) * InvDirection);
+				const int32 SkippedSteps = GetSkippedSteps(FMath::Min3(TExit.X, TExit.Y, TExit.Z), Constants.StepSize);
+				i += SkippedSteps;
+				Stats.SkippedSamples += SkippedSteps;
+				Position += Step * float(SkippedSteps);
+				Travel -= Constants.StepSize * float(SkippedSteps);
+				PreviousIntensity = CellIntensity;
+				continue;
+			}
+		}
+
+		const float Intensity = FMath::Clamp(SampleTrilinear(Volume, Position) * WindowScaleBias.X + WindowScaleBias.Y, 0.0f, 1.0f);
+		if (Constants.bFrontToBack)
+		{
+			const FLinearColor Sample = ClassifySample(Volume, Constants, PreviousIntensity, Intensity);
+			const float Transmittance = 1.0f - Accumulated.A;
+			Accumulated.R = Accumulated.R + Transmittance * Sample.R;
+			Accumulated.G = Accumulated.G + Transmittance * Sample.G;
+			Accumulated.B = Accumulated.B + Transmittance * Sample.B;
+			Accumulated.A = Accumulated.A + Transmittance * Sample.A;
+		}
+		else if (Constants.CompositingMode == ERaymarchCompositingMode::MaximumIntensity)
+		{
+			Accumulated.A = FMath::Max(Accumulated.A, Intensity);
+		}
+		else if (Constants.CompositingMode == ERaymarchCompositingMode::MinimumIntensity)
+		{
+			// 1 - minimum, like MainPS.
+			Accumulated.A = FMath::Max(Accumulated.A, 1.0f - Intensity);
+		}
+		else if (Constants.CompositingMode == ERaymarchCompositingMode::AverageIntensity)
+		{
+			Accumulated.A = Accumulated.A + Intensity;
+		}
+		else
+		{
+			Accumulated.A = Accumulated.A + Intensity * Constants.StepInVoxels;
+		}
+		PreviousIntensity = Intensity;
+		++Stats.Samples;
+		++i;
+		Position += Step;
+		Travel -= Constants.StepSize;
+	}
+
+	++Stats.Rays;
+	return ResolveRay(Constants, Accumulated.R, Accumulated.G, Accumulated.B, Accumulated.A, SampleCount);
+}
+
+#if RAYMARCH_USE_SSE2
+// Lanes of a packet as plain floats, for the parts that fetch from memory one lane at a time.
+struct alignas(16) FRaymarchLanes
+{
+	float V[RAYMARCH_CPU_PACKET_SIZE];
+};
+
+static FORCEINLINE __m128 MaskFromLanes(int32 Lanes)
+{
+	return _mm_castsi128_ps(_mm_set_epi32((Lanes & 8) ? -1 : 0, (Lanes & 4) ? -1 : 0, (Lanes & 2) ? -1 : 0, (Lanes & 1) ? -1 : 0));
+}
+
+static FORCEINLINE __m128 Select(__m128 Mask, __m128 A, __m128 B)
+{
+	return _mm_or_ps(_mm_and_ps(Mask, A), _mm_andnot_ps(Mask, B));
+}
+
+// floor() without SSE4.1. Exact for the magnitudes of texture space positions times volume sizes.
+static FORCEINLINE __m128 Floor(__m128 X)
+{
+	const __m128 Truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(X));
+	return _mm_sub_ps(Truncated, _mm_and_ps(_mm_cmpgt_ps(Truncated, X), _mm_set1_ps(1.0f)));
+}
+
+static FORCEINLINE __m128 Clamp(__m128 X, __m128 Min, __m128 Max)
+{
+	return _mm_min_ps(_mm_max_ps(X, Min), Max);
+}
+
+static FORCEINLINE __m128 Lerp(__m128 A, __m128 B, __m128 Alpha)
+{
+	return _mm_add_ps(A, _mm_mul_ps(_mm_sub_ps(B, A), Alpha));
+}
+
+/** Marches up to four rays side by side. Stepping, cell tests, trilinear weights and compositing are vectorized;
+* voxel, cell and table fetches and the opacity correction go lane by lane. Rounds exactly like MarchRay.
+* @param bHit Lanes with a ray, the others stay untouched.
+*/
+static void MarchRayPacket(
+	const FRaymarchCpuVolume& Volume,
+	const FRaymarchCpuRayConstants& Constants,
+	const bool bHit[RAYMARCH_CPU_PACKET_SIZE],
+	const FVector Starts[RAYMARCH_CPU_PACKET_SIZE],
+	const FVector Directions[RAYMARCH_CPU_PACKET_SIZE],
+	const float Travels[RAYMARCH_CPU_PACKET_SIZE],
+	FLinearColor OutColors[RAYMARCH_CPU_PACKET_SIZE],
+	FRaymarchCpuStats& Stats)
+{
+	FRaymarchLanes Lanes[8];
+	for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+	{
+		const FVector Direction = bHit[Lane] ? Directions[Lane] : FVector(1.0f, 1.0f, 1.0f);
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Lanes[Axis].V[Lane] = bHit[Lane] ? Starts[Lane][Axis] : 0.0f;
+			Lanes[3 + Axis].V[Lane] = Direction[Axis];
+		}
+		Lanes[6].V[Lane] = bHit[Lane] ? Travels[Lane] : 0.0f;
+		Lanes[7].V[Lane] = bHit[Lane] ? 1.0f : 0.0f;
+	}
+
+	__m128 Position[3];
+	__m128 Step[3];
+	__m128 InvDirection[3];
+	const __m128 StepSize = _mm_set1_ps(Constants.StepSize);
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		Position[Axis] = _mm_load_ps(Lanes[Axis].V);
+		const __m128 Direction = _mm_load_ps(Lanes[3 + Axis].V);
+		Step[Axis] = _mm_mul_ps(Direction, StepSize);
+		InvDirection[Axis] = _mm_div_ps(_mm_set1_ps(1.0f), Direction);
+	}
+	__m128 Travel = _mm_load_ps(Lanes[6].V);
+	const __m128 HitMask = _mm_cmpgt_ps(_mm_load_ps(Lanes[7].V), _mm_setzero_ps());
+
+	const __m128 Zero = _mm_setzero_ps();
+	const __m128 One = _mm_set1_ps(1.0f);
+	const __m128 MaxSamples = _mm_set1_ps(float(Constants.MaxSamples));
+	const __m128 TerminationThreshold = _mm_set1_ps(Constants.TerminationThreshold);
+	const __m128 WindowScale = _mm_set1_ps(Volume.WindowScaleBias.X);
+	const __m128 WindowBias = _mm_set1_ps(Volume.WindowScaleBias.Y);
+	const __m128 StepInVoxels = _mm_set1_ps(Constants.StepInVoxels);
+	const __m128 VolumeSize[3] = {
+		_mm_set1_ps(float(Volume.Dimensions.X)), _mm_set1_ps(float(Volume.Dimensions.Y)), _mm_set1_ps(float(Volume.Dimensions.Z)) };
+	const __m128 CellCount[3] = {
+		_mm_set1_ps(Constants.CellCount.X), _mm_set1_ps(Constants.CellCount.Y), _mm_set1_ps(Constants.CellCount.Z) };
+
+	__m128 Accumulated[4] = { Zero, Zero, Zero, Zero };
+	__m128 PreviousIntensity = _mm_set1_ps(-1.0f);
+	// Sample index, as float - exact far beyond any MaxSamples.
+	__m128 Index = Zero;
+
+	for (;;)
+	{
+		const __m128 Active = _mm_and_ps(_mm_and_ps(HitMask, _mm_cmplt_ps(Index, MaxSamples)),
+			_mm_and_ps(_mm_cmpgt_ps(Travel, Zero), _mm_cmplt_ps(Accumulated[3], TerminationThreshold)));
+		const int32 ActiveLanes = _mm_movemask_ps(Active);
+		if (ActiveLanes == 0)
+		{
+			break;
+		}
+
+		// Steps taken by every lane in this iteration - 1 for a sample, more for a skipped cell, 0 when done.
+		FRaymarchLanes Advance = {};
+		int32 SampledLanes = ActiveLanes;
+		if (Constants.bUseMacroCells)
+		{
+			__m128 Cell[3];
+			FRaymarchLanes CellLanes[3];
+			for (int32 Axis = 0; Axis < 3; ++Axis)
+			{
+				Cell[Axis] = Clamp(Floor(_mm_mul_ps(Position[Axis], CellCount[Axis])), Zero, _mm_sub_ps(CellCount[Axis], One));
+				_mm_store_ps(CellLanes[Axis].V, Cell[Axis]);
+			}
+			FRaymarchLanes AccumulatedLanes;
+			_mm_store_ps(AccumulatedLanes.V, Accumulated[3]);
+			FRaymarchLanes CellIntensity;
+			int32 SkippedLanes = 0;
+			for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+			{
+				CellIntensity.V[Lane] = 0.0f;
+				if ((ActiveLanes & (1 << Lane))
+					&& CanSkipMacroCell(Volume, Constants, CellLanes[0].V[Lane], CellLanes[1].V[Lane], CellLanes[2].V[Lane], AccumulatedLanes.V[Lane], CellIntensity.V[Lane]))
+				{
+					SkippedLanes |= 1 << Lane;
+				}
+			}
+			if (SkippedLanes)
+			{
+				__m128 TExit[3];
+				for (int32 Axis = 0; Axis < 3; ++Axis)
+				{
+					const __m128 CellMin = _mm_div_ps(Cell[Axis], CellCount[Axis]);
+					const __m128 CellMax = _mm_div_ps(_mm_add_ps(Cell[Axis], One), CellCount[Axis]);
+					TExit[Axis] = _mm_max_ps(
+						_mm_mul_ps(_mm_sub_ps(CellMin, Position[Axis]), InvDirection[Axis]),
+						_mm_mul_ps(_mm_sub_ps(CellMax, Position[Axis]), InvDirection[Axis]));
+				}
+				FRaymarchLanes Distance;
+				_mm_store_ps(Distance.V, _mm_min_ps(_mm_min_ps(TExit[0], TExit[1]), TExit[2]));
+				for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+				{
+					if (SkippedLanes & (1 << Lane))
+					{
+						const int32 SkippedSteps = GetSkippedSteps(Distance.V[Lane], Constants.StepSize);
+						Advance.V[Lane] = float(SkippedSteps);
+						Stats.SkippedSamples += SkippedSteps;
+					}
+				}
+				SampledLanes &= ~SkippedLanes;
+				// Only front to back looks at it, any intensity of the skipped cell is as good as the last skipped sample.
+				PreviousIntensity = Select(MaskFromLanes(SkippedLanes), _mm_load_ps(CellIntensity.V), PreviousIntensity);
+			}
+		}
+
+		if (SampledLanes)
+		{
+			// Trilinear weights and clamped corner coordinates of all lanes at once, see SampleTrilinear.
+			__m128 Fraction[3];
+			FRaymarchLanes LowLanes[3];
+			FRaymarchLanes HighLanes[3];
+			for (int32 Axis = 0; Axis < 3; ++Axis)
+			{
+				const __m128 Coordinate = _mm_sub_ps(_mm_mul_ps(Position[Axis], VolumeSize[Axis]), _mm_set1_ps(0.5f));
+				const __m128 CoordinateFloor = Floor(Coordinate);
+				const __m128 MaxCoordinate = _mm_sub_ps(VolumeSize[Axis], One);
+				Fraction[Axis] = _mm_sub_ps(Coordinate, CoordinateFloor);
+				_mm_store_ps(LowLanes[Axis].V, Clamp(CoordinateFloor, Zero, MaxCoordinate));
+				_mm_store_ps(HighLanes[Axis].V, Clamp(_mm_add_ps(CoordinateFloor, One), Zero, MaxCoordinate));
+			}
+			FRaymarchLanes CornerLanes[8] = {};
+			for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+			{
+				if (SampledLanes & (1 << Lane))
+				{
+					const int32 Low[3] = { int32(LowLanes[0].V[Lane]), int32(LowLanes[1].V[Lane]), int32(LowLanes[2].V[Lane]) };
+					const int32 High[3] = { int32(HighLanes[0].V[Lane]), int32(HighLanes[1].V[Lane]), int32(HighLanes[2].V[Lane]) };
+					float Corners[8];
+					GatherCorners(Volume, Low, High, Corners);
+					for (int32 Corner = 0; Corner < 8; ++Corner)
+					{
+						CornerLanes[Corner].V[Lane] = Corners[Corner];
+					}
+				}
+			}
+			const __m128 C00 = Lerp(_mm_load_ps(CornerLanes[0].V), _mm_load_ps(CornerLanes[1].V), Fraction[0]);
+			const __m128 C10 = Lerp(_mm_load_ps(CornerLanes[2].V), _mm_load_ps(CornerLanes[3].V), Fraction[0]);
+			const __m128 C01 = Lerp(_mm_load_ps(CornerLanes[4].V), _mm_load_ps(CornerLanes[5].V), Fraction[0]);
+			const __m128 C11 = Lerp(_mm_load_ps(CornerLanes[6].V), _mm_load_ps(CornerLanes[7].V), Fraction[0]);
+			const __m128 Value = Lerp(Lerp(C00, C10, Fraction[1]), Lerp(C01, C11, Fraction[1]), Fraction[2]);
+			const __m128 Intensity = Clamp(_mm_add_ps(_mm_mul_ps(Value, WindowScale), WindowBias), Zero, One);
+
+			for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+			{
+				if (SampledLanes & (1 << Lane))
+				{
+					Advance.V[Lane] = 1.0f;
+					++Stats.Samples;
+				}
+			}
+			const __m128 SampledMask = MaskFromLanes(SampledLanes);
+
+			if (Constants.bFrontToBack)
+			{
+				FRaymarchLanes IntensityLanes;
+				FRaymarchLanes PreviousLanes;
+				_mm_store_ps(IntensityLanes.V, Intensity);
+				_mm_store_ps(PreviousLanes.V, PreviousIntensity);
+				FRaymarchLanes SampleLanes[4] = {};
+				for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+				{
+					if (SampledLanes & (1 << Lane))
+					{
+						const FLinearColor Sample = ClassifySample(Volume, Constants, PreviousLanes.V[Lane], IntensityLanes.V[Lane]);
+						SampleLanes[0].V[Lane] = Sample.R;
+						SampleLanes[1].V[Lane] = Sample.G;
+						SampleLanes[2].V[Lane] = Sample.B;
+						SampleLanes[3].V[Lane] = Sample.A;
+					}
+				}
+				const __m128 Transmittance = _mm_sub_ps(One, Accumulated[3]);
+				for (int32 Channel = 0; Channel < 4; ++Channel)
+				{
+					const __m128 Composited = _mm_add_ps(Accumulated[Channel], _mm_mul_ps(Transmittance, _mm_load_ps(SampleLanes[Channel].V)));
+					Accumulated[Channel] = Select(SampledMask, Composited, Accumulated[Channel]);
+				}
+			}
+			else if (Constants.CompositingMode == ERaymarchCompositingMode::MaximumIntensity)
+			{
+				Accumulated[3] = Select(SampledMask, _mm_max_ps(Accumulated[3], Intensity), Accumulated[3]);
+			}
+			else if (Constants.CompositingMode == ERaymarchCompositingMode::MinimumIntensity)
+			{
+				Accumulated[3] = Select(SampledMask, _mm_max_ps(Accumulated[3], _mm_sub_ps(One, Intensity)), Accumulated[3]);
+			}
+			else if (Constants.CompositingMode == ERaymarchCompositingMode::AverageIntensity)
+			{
+				Accumulated[3] = Select(SampledMask, _mm_add_ps(Accumulated[3], Intensity), Accumulated[3]);
+			}
+			else
+			{
+				Accumulated[3] = Select(SampledMask, _mm_add_ps(Accumulated[3], _mm_mul_ps(Intensity, StepInVoxels)), Accumulated[3]);
+			}
+			PreviousIntensity = Select(SampledMask, Intensity, PreviousIntensity);
+		}
+
+		const __m128 Steps = _mm_load_ps(Advance.V);
+		Index = _mm_add_ps(Index, Steps);
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Position[Axis] = _mm_add_ps(Position[Axis], _mm_mul_ps(Step[Axis], Steps));
+		}
+		Travel = _mm_sub_ps(Travel, _mm_mul_ps(StepSize, Steps));
+	}
+
+	FRaymarchLanes Result[4];
+	for (int32 Channel = 0; Channel < 4; ++Channel)
+	{
+		_mm_store_ps(Result[Channel].V, Accumulated[Channel]);
+	}
+	for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+	{
+		if (bHit[Lane])
+		{
+			++Stats.Rays;
+			OutColors[Lane] = ResolveRay(Constants, Result[0].V[Lane], Result[1].V[Lane], Result[2].V[Lane], Result[3].V[Lane],
+				GetRaySampleCount(Constants, Travels[Lane]));
+		}
+	}
+}
+#endif
+
+/** Marches the pixels of one tile, four neighbours in a row at a time. */
+static void MarchTile(
+	const FRaymarchCpuVolume& Volume,
+	const FRaymarchCpuRayConstants& Constants,
+	FIntRect Tile,
+	TArray<FLinearColor>& OutImage,
+	FRaymarchCpuStats& Stats)
+{
+	for (int32 Y = Tile.Min.Y; Y < Tile.Max.Y; ++Y)
+	{
+		FLinearColor* Row = OutImage.GetData() + int64(Y) * Constants.ImageSize.X;
+#if RAYMARCH_USE_SSE2
+		for (int32 X = Tile.Min.X; X < Tile.Max.X; X += RAYMARCH_CPU_PACKET_SIZE)
+		{
+			bool bHit[RAYMARCH_CPU_PACKET_SIZE];
+			FVector Starts[RAYMARCH_CPU_PACKET_SIZE];
+			FVector Directions[RAYMARCH_CPU_PACKET_SIZE];
+			float Travels[RAYMARCH_CPU_PACKET_SIZE];
+			FLinearColor Colors[RAYMARCH_CPU_PACKET_SIZE];
+			bool bAnyHit = false;
+			for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE; ++Lane)
+			{
+				bHit[Lane] = X + Lane < Tile.Max.X && SetupRay(Constants, X + Lane, Y, Starts[Lane], Directions[Lane], Travels[Lane]);
+				bAnyHit |= bHit[Lane];
+			}
+			if (bAnyHit)
+			{
+				MarchRayPacket(Volume, Constants, bHit, Starts, Directions, Travels, Colors, Stats);
+			}
+			for (int32 Lane = 0; Lane < RAYMARCH_CPU_PACKET_SIZE && X + Lane < Tile.Max.X; ++Lane)
+			{
+				Row[X + Lane] = bHit[Lane] ? Colors[Lane] : FLinearColor::Transparent;
+			}
+		}
+#else
+		for (int32 X = Tile.Min.X; X < Tile.Max.X; ++X)
+		{
+			FVector Start, Direction;
+			float Travel;
+			Row[X] = SetupRay(Constants, X, Y, Start, Direction, Travel)
+				? MarchRay(Volume, Constants, Start, Direction, Travel, Stats)
+				: FLinearColor::Transparent;
+		}
+#endif
+	}
+}
+
+static bool IsVolumeValid(const FRaymarchCpuVolume& Volume, FIntPoint ImageSize)
+{
+	const int64 VoxelCount = int64(Volume.Dimensions.X) * Volume.Dimensions.Y * Volume.Dimensions.Z;
+	return ImageSize.X > 0 && ImageSize.Y > 0 && VoxelCount > 0 && Volume.Voxels.Num() == VoxelCount;
+}
+
+void RaymarchVolume_Cpu(
+	const FRaymarchCpuVolume& Volume,
+	const FCompiledCameraModel& CameraModel,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint ImageSize,
+	TArray<FLinearColor>& OutImage,
+	FRaymarchCpuStats* OutStats)
+{
+	if (!IsVolumeValid(Volume, ImageSize))
+	{
+		OutImage.Reset();
+		return;
+	}
+	OutImage.SetNumUninitialized(ImageSize.X * ImageSize.Y);
+	const FRaymarchCpuRayConstants Constants = MakeRayConstants(Volume, CameraModel, Settings, ImageSize);
+
+	const FIntPoint TileCount(
+		FMath::DivideAndRoundUp(ImageSize.X, RAYMARCH_CPU_TILE_SIZE),
+		FMath::DivideAndRoundUp(ImageSize.Y, RAYMARCH_CPU_TILE_SIZE));
+	// One set of counters per tile, summed up at the end, so that the workers never share a cache line while marching.
+	TArray<FRaymarchCpuStats> TileStats;
+	TileStats.SetNum(TileCount.X * TileCount.Y);
+	ParallelFor(TileStats.Num(), [&](int32 TileIndex)
+	{
+		const FIntPoint Min((TileIndex % TileCount.X) * RAYMARCH_CPU_TILE_SIZE, (TileIndex / TileCount.X) * RAYMARCH_CPU_TILE_SIZE);
+		const FIntRect Tile(Min, FIntPoint(FMath::Min(Min.X + RAYMARCH_CPU_TILE_SIZE, ImageSize.X), FMath::Min(Min.Y + RAYMARCH_CPU_TILE_SIZE, ImageSize.Y)));
+		FRaymarchCpuStats Stats;
+		MarchTile(Volume, Constants, Tile, OutImage, Stats);
+		TileStats[TileIndex] = Stats;
+	});
+
+	if (OutStats)
+	{
+		*OutStats = FRaymarchCpuStats();
+		for (const FRaymarchCpuStats& Stats : TileStats)
+		{
+			OutStats->Rays += Stats.Rays;
+			OutStats->Samples += Stats.Samples;
+			OutStats->SkippedSamples += Stats.SkippedSamples;
+		}
+	}
+}
+
+void RaymarchVolume_CpuScalar(
+	const FRaymarchCpuVolume& Volume,
+	const FCompiledCameraModel& CameraModel,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint ImageSize,
+	TArray<FLinearColor>& OutImage,
+	FRaymarchCpuStats* OutStats)
+{
+	if (!IsVolumeValid(Volume, ImageSize))
+	{
+		OutImage.Reset();
+		return;
+	}
+	OutImage.SetNumUninitialized(ImageSize.X * ImageSize.Y);
+	const FRaymarchCpuRayConstants Constants = MakeRayConstants(Volume, CameraModel, Settings, ImageSize);
+
+	FRaymarchCpuStats Stats;
+	for (int32 Y = 0; Y < ImageSize.Y; ++Y)
+	{
+		for (int32 X = 0; X < ImageSize.X; ++X)
+		{
+			FVector Start, Direction;
+			float Travel;
+			OutImage[X + Y * ImageSize.X] = SetupRay(Constants, X, Y, Start, Direction, Travel)
+				? MarchRay(Volume, Constants, Start, Direction, Travel, Stats)
+				: FLinearColor::Transparent;
+		}
+	}
+	if (OutStats)
+	{
+		*OutStats = Stats;
+	}
+}
+
+FRaymarchImageDifference CompareRaymarchImages(const TArray<FLinearColor>& A, const TArray<FLinearColor>& B, float Tolerance)
+{
+	FRaymarchImageDifference Difference;
+	if (A.Num() != B.Num())
+	{
+		Difference.MaxDifference = MAX_flt;
+		Difference.RootMeanSquare = MAX_flt;
+		Difference.DifferingPixels = FMath::Max(A.Num(), B.Num());
+		return Difference;
+	}
+
+	double SquareSum = 0.0;
+	for (int32 i = 0; i < A.Num(); ++i)
+	{
+		const float Channels[4] = { A[i].R - B[i].R, A[i].G - B[i].G, A[i].B - B[i].B, A[i].A - B[i].A };
+		float PixelDifference = 0.0f;
+		for (float Channel : Channels)
+		{
+			PixelDifference = FMath::Max(PixelDifference, FMath::Abs(Channel));
+			SquareSum += Channel * Channel;
+		}
+		Difference.MaxDifference = FMath::Max(Difference.MaxDifference, PixelDifference);
+		Difference.DifferingPixels += PixelDifference > Tolerance ? 1 : 0;
+	}
+	Difference.RootMeanSquare = A.Num() > 0 ? float(FMath::Sqrt(SquareSum / (4.0 * A.Num()))) : 0.0f;
+	return Difference;
+}
+
+bool SaveRaymarchGoldenImage(const FString& Filename, FIntPoint Size, const TArray<FLinearColor>& Image)
+{
+	if (Image.Num() != Size.X * Size.Y)
+	{
+		return false;
+	}
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileWriter(*Filename));
+	if (!File)
+	{
+		return false;
+	}
+	uint32 Magic = GoldenImageMagic;
+	*File << Magic << Size.X << Size.Y;
+	File->Serialize(const_cast<FLinearColor*>(Image.GetData()), Image.Num() * sizeof(FLinearColor));
+	return File->Close();
+}
+
+bool LoadRaymarchGoldenImage(const FString& Filename, FIntPoint& OutSize, TArray<FLinearColor>& OutImage)
+{
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileReader(*Filename));
+	if (!File)
+	{
+		return false;
+	}
+	uint32 Magic = 0;
+	*File << Magic << OutSize.X << OutSize.Y;
+	const int64 ExpectedSize = int64(sizeof(uint32)) * 3 + int64(OutSize.X) * OutSize.Y * sizeof(FLinearColor);
+	if (Magic != GoldenImageMagic || OutSize.X <= 0 || OutSize.Y <= 0 || File->TotalSize() != ExpectedSize)
+	{
+		return false;
+	}
+	OutImage.SetNumUninitialized(OutSize.X * OutSize.Y);
+	File->Serialize(OutImage.GetData(), OutImage.Num() * sizeof(FLinearColor));
+	return !File->IsError();
+}
@@ -0,0 +1,220 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchFilterPipeline.h"
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchProfiling.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+IMPLEMENT_SHADER_TYPE(, FRaymarchGaussianFilterCS, TEXT("/Plugin/Raymarcher/Private/RaymarchFilters.usf"), TEXT("GaussianCS"), SF_Compute)
+IMPLEMENT_SHADER_TYPE(, FRaymarchMedianFilterCS, TEXT("/Plugin/Raymarcher/Private/RaymarchFilters.usf"), TEXT("MedianCS"), SF_Compute)
+IMPLEMENT_SHADER_TYPE(, FRaymarchVesselnessFilterCS, TEXT("/Plugin/Raymarcher/Private/RaymarchFilters.usf"), TEXT("VesselnessCS"), SF_Compute)
+IMPLEMENT_SHADER_TYPE(, FRaymarchMacroCellCS, TEXT("/Plugin/Raymarcher/Private/RaymarchFilters.usf"), TEXT("MacroCellCS"), SF_Compute)
+IMPLEMENT_SHADER_TYPE(, FRaymarchGradientCS, TEXT("/Plugin/Raymarcher/Private/RaymarchFilters.usf"), TEXT("GradientCS"), SF_Compute)
+
+// Creates a 3D texture the compute shaders can both read and write.
+static FTexture3DRHIRef CreateFilterTexture_RenderThread(FIntVector Dimensions, EPixelFormat PixelFormat)
+{
+	FRHIResourceCreateInfo CreateInfo;
+	return RHICreateTexture3D(Dimensions.X, Dimensions.Y, Dimensions.Z, PixelFormat, 1,
+		TexCreate_ShaderResource | TexCreate_UAV, CreateInfo);
+}
+
+static FIntVector GetGroupCount(FIntVector Size)
+{
+	return FIntVector(
+		FMath::DivideAndRoundUp(Size.X, RAYMARCH_FILTER_THREADGROUP_SIZE),
+		FMath::DivideAndRoundUp(Size.Y, RAYMARCH_FILTER_THREADGROUP_SIZE),
+		FMath::DivideAndRoundUp(Size.Z, RAYMARCH_FILTER_THREADGROUP_SIZE));
+}
+
+/** Pair of float volumes the passes alternate between, so a chain of any length needs just two. */
+struct FFilterPingPong
+{
+	FTexture3DRHIRef Textures[2];
+	FUnorderedAccessViewRHIRef UAVs[2];
+	// Volume the next pass reads. Starts as the original volume texture.
+	FTexture3DRHIRef Current;
+	// Index of the texture the next pass writes.
+	int32 Target = 0;
+
+	FFilterPingPong(FTexture3DRHIRef Source, FIntVector Dimensions)
+		: Current(Source)
+	{
+		for (int32 i = 0; i < 2; ++i)
+		{
+			Textures[i] = CreateFilterTexture_RenderThread(Dimensions, PF_R32_FLOAT);
+			UAVs[i] = RHICreateUnorderedAccessView(Textures[i], 0);
+		}
+	}
+
+	/** Runs one pass from Current into the target and makes the result Current.
+	* @param SetPassParameters Sets everything specific to the pass, the volumes are set already.
+	*/
+	template<typename ShaderType, typename FunctionType>
+	void Dispatch(FRHICommandListImmediate& RHICmdList, ShaderType* Shader, FIntVector Dimensions, FunctionType SetPassParameters)
+	{
+		RHICmdList.TransitionResource(EResourceTransitionAccess::ERWBarrier, EResourceTransitionPipeline::EComputeToCompute, UAVs[Target]);
+		RHICmdList.SetComputeShader(Shader->GetComputeShader());
+		Shader->SetVolumes(RHICmdList, Current, UAVs[Target], Dimensions);
+		SetPassParameters(Shader);
+		const FIntVector Groups = GetGroupCount(Dimensions);
+		DispatchComputeShader(RHICmdList, Shader, Groups.X, Groups.Y, Groups.Z);
+		Shader->UnbindOutput(RHICmdList);
+		RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, EResourceTransitionPipeline::EComputeToCompute, UAVs[Target]);
+
+		Current = Textures[Target];
+		Target ^= 1;
+	}
+};
+
+void ApplyVolumeFilters_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchVolumeRenderData& Volume,
+	const TArray<FRaymarchFilterSettings>& Filters,
+	ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+
+	if (!Volume.VolumeTexture)
+	{
+		UE_LOG(LogRaymarch, Warning, TEXT("Trying to filter a volume with nothing loaded!"));
+		return;
+	}
+	if (Volume.BrickIndirectionTexture)
+	{
+		// Bricks are resident one by one and their aprons would have to be refiltered with the neighbours.
+		UE_LOG(LogRaymarch, Warning, TEXT("Filtering bricked volumes isn't supported, the volume was left as it was."));
+		return;
+	}
+	if (Filters.Num() == 0)
+	{
+		return;
+	}
+	RAYMARCH_SCOPED_STAGE(RHICmdList, Filter);
+
+	TShaderMap<FGlobalShaderType>* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
+	TShaderMapRef<FRaymarchGaussianFilterCS> GaussianShader(GlobalShaderMap);
+	TShaderMapRef<FRaymarchMedianFilterCS> MedianShader(GlobalShaderMap);
+	TShaderMapRef<FRaymarchVesselnessFilterCS> VesselnessShader(GlobalShaderMap);
+	TShaderMapRef<FRaymarchMacroCellCS> MacroCellShader(GlobalShaderMap);
+	TShaderMapRef<FRaymarchGradientCS> GradientShader(GlobalShaderMap);
+
+	const FIntVector Dimensions = Volume.VolumeDimensions;
+	FFilterPingPong PingPong(Volume.VolumeTexture, Dimensions);
+
+	// Three passes, one per axis, just like GaussianFilter.
+	auto DispatchGaussian = [&](float Sigma)
+	{
+		TArray<float> Weights;
+		BuildGaussianKernel(Sigma, Weights);
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			PingPong.Dispatch(RHICmdList, *GaussianShader, Dimensions, [&](FRaymarchGaussianFilterCS* Shader)
+			{
+				Shader->SetKernel(RHICmdList, Weights, Axis);
+			});
+		}
+	};
+
+	bool bNormalized = false;
+	for (const FRaymarchFilterSettings& Settings : Filters)
+	{
+		switch (Settings.Filter)
+		{
+		case ERaymarchFilter::Gaussian:
+			DispatchGaussian(Settings.Sigma);
+			break;
+		case ERaymarchFilter::Median:
+			PingPong.Dispatch(RHICmdList, *MedianShader, Dimensions, [](FRaymarchMedianFilterCS*) {});
+			break;
+		case ERaymarchFilter::Vesselness:
+			DispatchGaussian(Settings.Sigma);
+			PingPong.Dispatch(RHICmdList, *VesselnessShader, Dimensions, [&](FRaymarchVesselnessFilterCS* Shader)
+			{
+				Shader->SetConstants(RHICmdList, FVesselnessConstants(Settings));
+			});
+			bNormalized = true;
+			break;
+		default:
+			checkNoEntry();
+		}
+	}
+
+	// Cells of the filtered volume, same layout as the CPU-built ones.
+	const int32 CellSize = RAYMARCH_DEFAULT_MACRO_CELL_SIZE;
+	const FIntVector CellDimensions(
+		FMath::DivideAndRoundUp(Dimensions.X, CellSize),
+		FMath::DivideAndRoundUp(Dimensions.Y, CellSize),
+		FMath::DivideAndRoundUp(Dimensions.Z, CellSize));
+	FTexture3DRHIRef MacroCells = CreateFilterTexture_RenderThread(CellDimensions, PF_G32R32F);
+	FUnorderedAccessViewRHIRef MacroCellUAV = RHICreateUnorderedAccessView(MacroCells, 0);
+	RHICmdList.SetComputeShader(MacroCellShader->GetComputeShader());
+	MacroCellShader->SetVolumes(RHICmdList, PingPong.Current, FUnorderedAccessViewRHIRef(), Dimensions);
+	MacroCellShader->SetCells(RHICmdList, MacroCellUAV, CellSize);
+	const FIntVector Groups = GetGroupCount(CellDimensions);
+	DispatchComputeShader(RHICmdList, *MacroCellShader, Groups.X, Groups.Y, Groups.Z);
+	MacroCellShader->UnbindCells(RHICmdList);
+	RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, EResourceTransitionPipeline::EComputeToGfx, MacroCellUAV);
+
+	// Draws enqueued before still use the unfiltered volume, so the filtered one gets swapped in like a load.
+	FRaymarchVolumeDataset Filtered = Volume;
+	Filtered.VolumeTexture = PingPong.Current;
+	Filtered.MacroCellTexture = MacroCells;
+	// The new cells never leave the GPU, so the range of the filtered volume isn't known.
+	Filtered.ValueRange = FVector2D(-MAX_flt, MAX_flt);
+	if (bNormalized)
+	{
+		Filtered.WindowScaleBias = FVector2D(1.0f, 0.0f);
+	}
+
+	// Gradients of the old volume would shade the filtered one with its noise still in, so build new ones.
+	if (Filtered.GradientTexture)
+	{
+		FTexture3DRHIRef Gradients = CreateFilterTexture_RenderThread(Dimensions, PF_R8G8B8A8);
+		FUnorderedAccessViewRHIRef GradientUAV = RHICreateUnorderedAccessView(Gradients, 0);
+		RHICmdList.SetComputeShader(GradientShader->GetComputeShader());
+		GradientShader->SetVolumes(RHICmdList, PingPong.Current, FUnorderedAccessViewRHIRef(), Dimensions);
+		GradientShader->SetGradients(RHICmdList, GradientUAV, Filtered.WindowScaleBias);
+		const FIntVector GradientGroups = GetGroupCount(Dimensions);
+		DispatchComputeShader(RHICmdList, *GradientShader, GradientGroups.X, GradientGroups.Y, GradientGroups.Z);
+		GradientShader->UnbindGradients(RHICmdList);
+		RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, EResourceTransitionPipeline::EComputeToGfx, GradientUAV);
+		Filtered.GradientTexture = Gradients;
+	}
+
+	// Under the ticket of what was filtered, so a load started meanwhile isn't overwritten by the volume it replaces.
+	if (!Volume.SwapDataset_RenderThread(MoveTemp(Filtered), Volume.GetShownTicket_RenderThread()))
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("A load into the filtered volume was started meanwhile, dropping the filtered volume."));
+	}
+}
+
+void ApplyVolumeFilters_GameThread(
+	UWorld* World,
+	FRaymarchVolumeRenderDataPtr Volume,
+	const TArray<FRaymarchFilterSettings>& Filters)
+{
+	check(IsInGameThread());
+
+	if (!Volume.IsValid() || !World || !World->Scene)
+	{
+		MY_LOG("Trying to filter a volume without a volume or a world!");
+		return;
+	}
+	const ERHIFeatureLevel::Type FeatureLevel = World->Scene->GetFeatureLevel();
+	if (FeatureLevel < ERHIFeatureLevel::SM5)
+	{
+		MY_LOG("Volume filters need a feature level of SM5!");
+		return;
+	}
+
+	ENQUEUE_RENDER_COMMAND(FilterVolumeCommand)(
+		[Volume, Filters, FeatureLevel](FRHICommandListImmediate& RHICmdList)
+		{
+			ApplyVolumeFilters_RenderThread(RHICmdList, *Volume, Filters, FeatureLevel);
+		}
+	);
+}
+
+#undef LOCTEXT_NAMESPACE
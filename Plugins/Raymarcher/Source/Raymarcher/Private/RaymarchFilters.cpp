@@ -0,0 +1,438 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchFilters.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+#include "Async/ParallelFor.h"
+#include "Templates/Sorting.h"
+
+// Index of a voxel with coordinates clamped into the volume (voxels outside repeat the closest border voxel).
+static FORCEINLINE int64 GetClampedIndex(FIntVector Dimensions, int32 X, int32 Y, int32 Z)
+{
+	X = FMath::Clamp(X, 0, Dimensions.X - 1);
+	Y = FMath::Clamp(Y, 0, Dimensions.Y - 1);
+	Z = FMath::Clamp(Z, 0, Dimensions.Z - 1);
+	return X + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z);
+}
+
+static FORCEINLINE int64 GetVoxelCount(FIntVector Dimensions)
+{
+	return int64(Dimensions.X) * Dimensions.Y * Dimensions.Z;
+}
+
+void BuildGaussianKernel(float Sigma, TArray<float>& OutWeights)
+{
+	Sigma = FMath::Max(Sigma, 0.1f);
+	const int32 Radius = FMath::Min(FMath::CeilToInt(3.0f * Sigma), RAYMARCH_MAX_GAUSSIAN_RADIUS);
+	OutWeights.SetNumUninitialized(2 * Radius + 1);
+	float Sum = 0.0f;
+	for (int32 i = -Radius; i <= Radius; ++i)
+	{
+		const float Weight = FMath::Exp(-(i * i) / (2.0f * Sigma * Sigma));
+		OutWeights[i + Radius] = Weight;
+		Sum += Weight;
+	}
+	for (float& Weight : OutWeights)
+	{
+		Weight /= Sum;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+// Gaussian
+// ------------------------------------------------------------------------------------------------------------------
+
+// Convolves the whole volume along one axis (0 = X, 1 = Y, 2 = Z), plain loops on one thread.
+static void ConvolveAxis_Scalar(const float* Source, float* Destination, FIntVector Dimensions, const TArray<float>& Weights, int32 Axis)
+{
+	const int32 Radius = Weights.Num() / 2;
+	const FIntVector Step(Axis == 0 ? 1 : 0, Axis == 1 ? 1 : 0, Axis == 2 ? 1 : 0);
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		{
+			for (int32 X = 0; X < Dimensions.X; ++X)
+			{
+				float Sum = 0.0f;
+				for (int32 k = 0; k < Weights.Num(); ++k)
+				{
+					const int32 Offset = k - Radius;
+					Sum += Weights[k] * Source[GetClampedIndex(Dimensions, X + Step.X * Offset, Y + Step.Y * Offset, Z + Step.Z * Offset)];
+				}
+				Destination[GetClampedIndex(Dimensions, X, Y, Z)] = Sum;
+			}
+		}
+	}
+}
+
+// Convolves one row (along X) of the volume along the X axis.
+static void ConvolveRowAlongX(const float* SourceRow, float* DestinationRow, int32 Width, const TArray<float>& Weights)
+{
+	const int32 Radius = Weights.Num() / 2;
+	// Voxels whose kernel reaches past the row are done one by one with clamping.
+	auto ConvolveClamped = [&](int32 X)
+	{
+		float Sum = 0.0f;
+		for (int32 k = 0; k < Weights.Num(); ++k)
+		{
+			Sum += Weights[k] * SourceRow[FMath::Clamp(X + k - Radius, 0, Width - 1)];
+		}
+		DestinationRow[X] = Sum;
+	};
+
+	int32 X = 0;
+	for (const int32 HeadEnd = FMath::Min(Radius, Width); X < HeadEnd; ++X)
+	{
+		ConvolveClamped(X);
+	}
+#if RAYMARCH_USE_SSE2
+	// Four voxels at once, the taps are unaligned loads shifted by one voxel each.
+	for (; X + 3 + Radius < Width; X += 4)
+	{
+		__m128 Sum = _mm_setzero_ps();
+		for (int32 k = 0; k < Weights.Num(); ++k)
+		{
+			Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(Weights[k]), _mm_loadu_ps(SourceRow + X + k - Radius)));
+		}
+		_mm_storeu_ps(DestinationRow + X, Sum);
+	}
+#endif
+	for (; X < Width; ++X)
+	{
+		ConvolveClamped(X);
+	}
+}
+
+// Convolves one row (along X) of the volume along the Y or Z axis, Taps being the (clamped) source rows of the kernel.
+static void ConvolveRowAcross(const float* const* Taps, float* DestinationRow, int32 Width, const TArray<float>& Weights)
+{
+	int32 X = 0;
+#if RAYMARCH_USE_SSE2
+	// All taps are at the same X, so the whole row vectorizes without any special cases.
+	for (; X + 4 <= Width; X += 4)
+	{
+		__m128 Sum = _mm_setzero_ps();
+		for (int32 k = 0; k < Weights.Num(); ++k)
+		{
+			Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(Weights[k]), _mm_loadu_ps(Taps[k] + X)));
+		}
+		_mm_storeu_ps(DestinationRow + X, Sum);
+	}
+#endif
+	for (; X < Width; ++X)
+	{
+		float Sum = 0.0f;
+		for (int32 k = 0; k < Weights.Num(); ++k)
+		{
+			Sum += Weights[k] * Taps[k][X];
+		}
+		DestinationRow[X] = Sum;
+	}
+}
+
+// Convolves the whole volume along one axis, rows in parallel.
+static void ConvolveAxis(const float* Source, float* Destination, FIntVector Dimensions, const TArray<float>& Weights, int32 Axis)
+{
+	const int32 Radius = Weights.Num() / 2;
+	ParallelFor(Dimensions.Y * Dimensions.Z, [&](int32 RowIndex)
+	{
+		const int32 Y = RowIndex % Dimensions.Y;
+		const int32 Z = RowIndex / Dimensions.Y;
+		const int64 RowOffset = GetClampedIndex(Dimensions, 0, Y, Z);
+		if (Axis == 0)
+		{
+			ConvolveRowAlongX(Source + RowOffset, Destination + RowOffset, Dimensions.X, Weights);
+			return;
+		}
+		const float* Taps[2 * RAYMARCH_MAX_GAUSSIAN_RADIUS + 1];
+		for (int32 k = 0; k < Weights.Num(); ++k)
+		{
+			const int32 Offset = k - Radius;
+			Taps[k] = Source + (Axis == 1 ? GetClampedIndex(Dimensions, 0, Y + Offset, Z) : GetClampedIndex(Dimensions, 0, Y, Z + Offset));
+		}
+		ConvolveRowAcross(Taps, Destination + RowOffset, Dimensions.X, Weights);
+	});
+}
+
+void GaussianFilter(const float* Source, float* Destination, FIntVector Dimensions, float Sigma)
+{
+	TArray<float> Weights;
+	BuildGaussianKernel(Sigma, Weights);
+	TArray<float> PassX, PassY;
+	PassX.SetNumUninitialized(GetVoxelCount(Dimensions));
+	PassY.SetNumUninitialized(GetVoxelCount(Dimensions));
+	ConvolveAxis(Source, PassX.GetData(), Dimensions, Weights, 0);
+	ConvolveAxis(PassX.GetData(), PassY.GetData(), Dimensions, Weights, 1);
+	ConvolveAxis(PassY.GetData(), Destination, Dimensions, Weights, 2);
+}
+
+void GaussianFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions, float Sigma)
+{
+	TArray<float> Weights;
+	BuildGaussianKernel(Sigma, Weights);
+	TArray<float> PassX, PassY;
+	PassX.SetNumUninitialized(GetVoxelCount(Dimensions));
+	PassY.SetNumUninitialized(GetVoxelCount(Dimensions));
+	ConvolveAxis_Scalar(Source, PassX.GetData(), Dimensions, Weights, 0);
+	ConvolveAxis_Scalar(PassX.GetData(), PassY.GetData(), Dimensions, Weights, 1);
+	ConvolveAxis_Scalar(PassY.GetData(), Destination, Dimensions, Weights, 2);
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+// Median
+// ------------------------------------------------------------------------------------------------------------------
+
+static FORCEINLINE float MinOf(float A, float B) { return FMath::Min(A, B); }
+static FORCEINLINE float MaxOf(float A, float B) { return FMath::Max(A, B); }
+#if RAYMARCH_USE_SSE2
+static FORCEINLINE __m128 MinOf(__m128 A, __m128 B) { return _mm_min_ps(A, B); }
+static FORCEINLINE __m128 MaxOf(__m128 A, __m128 B) { return _mm_max_ps(A, B); }
+#endif
+
+// Median of 27 values by forgetful selection. The minimum and maximum of any 15 of the values can't be the median, so
+// they're dropped and the next value takes their place until 3 are left. Only min/max without branches, so it works
+// the same on single floats and on registers of 4 independent voxels.
+template<typename ValueType>
+static FORCEINLINE ValueType MedianOf27(const ValueType (&Values)[27])
+{
+	ValueType Window[15];
+	for (int32 i = 0; i < 15; ++i)
+	{
+		Window[i] = Values[i];
+	}
+	int32 Count = 15;
+	for (int32 Next = 15; ; ++Next)
+	{
+		// Move the minimum to the front and the maximum to the back.
+		for (int32 i = 1; i < Count; ++i)
+		{
+			const ValueType Low = MinOf(Window[0], Window[i]);
+			Window[i] = MaxOf(Window[0], Window[i]);
+			Window[0] = Low;
+		}
+		for (int32 i = 1; i < Count - 1; ++i)
+		{
+			const ValueType High = MaxOf(Window[Count - 1], Window[i]);
+			Window[i] = MinOf(Window[Count - 1], Window[i]);
+			Window[Count - 1] = High;
+		}
+		if (Next == 27)
+		{
+			// Three values left, sorted at both ends.
+			return Window[1];
+		}
+		// Drop the maximum by shrinking the window and the minimum by overwriting it.
+		Window[0] = Values[Next];
+		--Count;
+	}
+}
+
+// Gathers the 3x3x3 neighbourhood of a voxel, Z outermost and X innermost.
+static FORCEINLINE void GatherNeighbourhood(const float* Source, FIntVector Dimensions, int32 X, int32 Y, int32 Z, float (&OutValues)[27])
+{
+	int32 i = 0;
+	for (int32 DZ = -1; DZ <= 1; ++DZ)
+	{
+		for (int32 DY = -1; DY <= 1; ++DY)
+		{
+			for (int32 DX = -1; DX <= 1; ++DX)
+			{
+				OutValues[i++] = Source[GetClampedIndex(Dimensions, X + DX, Y + DY, Z + DZ)];
+			}
+		}
+	}
+}
+
+void MedianFilter(const float* Source, float* Destination, FIntVector Dimensions)
+{
+	check(Source != Destination);
+	ParallelFor(Dimensions.Y * Dimensions.Z, [&](int32 RowIndex)
+	{
+		const int32 Y = RowIndex % Dimensions.Y;
+		const int32 Z = RowIndex / Dimensions.Y;
+		float* DestinationRow = Destination + GetClampedIndex(Dimensions, 0, Y, Z);
+		float Values[27];
+
+		// The first voxel and whatever doesn't fill a whole register at the end of the row.
+		int32 X = 0;
+		auto FilterSingle = [&](int32 SingleX)
+		{
+			GatherNeighbourhood(Source, Dimensions, SingleX, Y, Z, Values);
+			DestinationRow[SingleX] = MedianOf27(Values);
+		};
+		FilterSingle(X++);
+#if RAYMARCH_USE_SSE2
+		// Rows above and below are clamped once, X-1..X+4 is inside the row for all four voxels.
+		const float* Rows[9];
+		for (int32 DZ = -1, i = 0; DZ <= 1; ++DZ)
+		{
+			for (int32 DY = -1; DY <= 1; ++DY)
+			{
+				Rows[i++] = Source + GetClampedIndex(Dimensions, 0, Y + DY, Z + DZ);
+			}
+		}
+		for (; X + 4 < Dimensions.X; X += 4)
+		{
+			__m128 Vectors[27];
+			for (int32 Row = 0; Row < 9; ++Row)
+			{
+				Vectors[Row * 3 + 0] = _mm_loadu_ps(Rows[Row] + X - 1);
+				Vectors[Row * 3 + 1] = _mm_loadu_ps(Rows[Row] + X);
+				Vectors[Row * 3 + 2] = _mm_loadu_ps(Rows[Row] + X + 1);
+			}
+			_mm_storeu_ps(DestinationRow + X, MedianOf27(Vectors));
+		}
+#endif
+		for (; X < Dimensions.X; ++X)
+		{
+			FilterSingle(X);
+		}
+	});
+}
+
+void MedianFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions)
+{
+	check(Source != Destination);
+	float Values[27];
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		{
+			for (int32 X = 0; X < Dimensions.X; ++X)
+			{
+				GatherNeighbourhood(Source, Dimensions, X, Y, Z, Values);
+				Sort(Values, 27);
+				Destination[GetClampedIndex(Dimensions, X, Y, Z)] = Values[13];
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+// Vesselness
+// ------------------------------------------------------------------------------------------------------------------
+
+// Eigenvalues of a symmetric 3x3 matrix, analytically (trigonometric solution of the characteristic polynomial).
+// The compute shader uses the same formulas.
+static void GetSymmetricEigenvalues(float A11, float A22, float A33, float A12, float A13, float A23, float& OutE1, float& OutE2, float& OutE3)
+{
+	const float OffDiagonal = A12 * A12 + A13 * A13 + A23 * A23;
+	const float Q = (A11 + A22 + A33) / 3.0f;
+	const float B11 = A11 - Q;
+	const float B22 = A22 - Q;
+	const float B33 = A33 - Q;
+	const float P = FMath::Sqrt((B11 * B11 + B22 * B22 + B33 * B33 + 2.0f * OffDiagonal) / 6.0f);
+	if (P < 1e-12f)
+	{
+		OutE1 = OutE2 = OutE3 = Q;
+		return;
+	}
+	// Half the determinant of (A - Q * I) / P.
+	const float Determinant = B11 * (B22 * B33 - A23 * A23) - A12 * (A12 * B33 - A23 * A13) + A13 * (A12 * A23 - B22 * A13);
+	const float R = FMath::Clamp(Determinant / (2.0f * P * P * P), -1.0f, 1.0f);
+	const float Phi = FMath::Acos(R) / 3.0f;
+	OutE1 = Q + 2.0f * P * FMath::Cos(Phi);
+	OutE3 = Q + 2.0f * P * FMath::Cos(Phi + (2.0f * PI / 3.0f));
+	OutE2 = 3.0f * Q - OutE1 - OutE3;
+}
+
+// Frangi's vesselness of one voxel of a smoothed volume.
+static float ComputeVesselness(const float* Smoothed, FIntVector Dimensions, int32 X, int32 Y, int32 Z, const FVesselnessConstants& Constants)
+{
+	auto V = [&](int32 DX, int32 DY, int32 DZ) { return Smoothed[GetClampedIndex(Dimensions, X + DX, Y + DY, Z + DZ)]; };
+
+	// Hessian by central differences.
+	const float Center = V(0, 0, 0);
+	const float Hxx = (V(1, 0, 0) - 2.0f * Center + V(-1, 0, 0)) * Constants.HessianScale;
+	const float Hyy = (V(0, 1, 0) - 2.0f * Center + V(0, -1, 0)) * Constants.HessianScale;
+	const float Hzz = (V(0, 0, 1) - 2.0f * Center + V(0, 0, -1)) * Constants.HessianScale;
+	const float Hxy = (V(1, 1, 0) - V(1, -1, 0) - V(-1, 1, 0) + V(-1, -1, 0)) * 0.25f * Constants.HessianScale;
+	const float Hxz = (V(1, 0, 1) - V(1, 0, -1) - V(-1, 0, 1) + V(-1, 0, -1)) * 0.25f * Constants.HessianScale;
+	const float Hyz = (V(0, 1, 1) - V(0, 1, -1) - V(0, -1, 1) + V(0, -1, -1)) * 0.25f * Constants.HessianScale;
+
+	float L1, L2, L3;
+	GetSymmetricEigenvalues(Hxx, Hyy, Hzz, Hxy, Hxz, Hyz, L1, L2, L3);
+	// Sort by magnitude, |L1| <= |L2| <= |L3|.
+	if (FMath::Abs(L1) > FMath::Abs(L2)) Swap(L1, L2);
+	if (FMath::Abs(L2) > FMath::Abs(L3)) Swap(L2, L3);
+	if (FMath::Abs(L1) > FMath::Abs(L2)) Swap(L1, L2);
+
+	// Bright vessels have strongly negative curvature across them (dark ones positive).
+	if (Constants.Polarity * L2 > 0.0f || Constants.Polarity * L3 > 0.0f || FMath::Abs(L2 * L3) < 1e-20f)
+	{
+		return 0.0f;
+	}
+	const float PlateRatio = (L2 * L2) / (L3 * L3);
+	const float BlobRatio = (L1 * L1) / FMath::Abs(L2 * L3);
+	const float Structure = L1 * L1 + L2 * L2 + L3 * L3;
+	return (1.0f - FMath::Exp(-PlateRatio * Constants.AlphaFactor)) * FMath::Exp(-BlobRatio * Constants.BetaFactor) *
+		(1.0f - FMath::Exp(-Structure * Constants.StructureFactor));
+}
+
+void VesselnessFilter(const float* Source, float* Destination, FIntVector Dimensions, const FRaymarchFilterSettings& Settings)
+{
+	check(Source != Destination);
+	TArray<float> Smoothed;
+	Smoothed.SetNumUninitialized(GetVoxelCount(Dimensions));
+	GaussianFilter(Source, Smoothed.GetData(), Dimensions, Settings.Sigma);
+
+	// The eigenanalysis is branchy and needs acos/cos, so it's only parallelized, not vectorized.
+	const FVesselnessConstants Constants(Settings);
+	ParallelFor(Dimensions.Y * Dimensions.Z, [&](int32 RowIndex)
+	{
+		const int32 Y = RowIndex % Dimensions.Y;
+		const int32 Z = RowIndex / Dimensions.Y;
+		float* DestinationRow = Destination + GetClampedIndex(Dimensions, 0, Y, Z);
+		for (int32 X = 0; X < Dimensions.X; ++X)
+		{
+			DestinationRow[X] = ComputeVesselness(Smoothed.GetData(), Dimensions, X, Y, Z, Constants);
+		}
+	});
+}
+
+void VesselnessFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions, const FRaymarchFilterSettings& Settings)
+{
+	check(Source != Destination);
+	TArray<float> Smoothed;
+	Smoothed.SetNumUninitialized(GetVoxelCount(Dimensions));
+	GaussianFilter_Scalar(Source, Smoothed.GetData(), Dimensions, Settings.Sigma);
+
+	const FVesselnessConstants Constants(Settings);
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		{
+			for (int32 X = 0; X < Dimensions.X; ++X)
+			{
+				Destination[GetClampedIndex(Dimensions, X, Y, Z)] = ComputeVesselness(Smoothed.GetData(), Dimensions, X, Y, Z, Constants);
+			}
+		}
+	}
+}
+
+void ApplyFilters(TArray<float>& Volume, FIntVector Dimensions, const TArray<FRaymarchFilterSettings>& Filters)
+{
+	check(Volume.Num() == GetVoxelCount(Dimensions));
+	TArray<float> Scratch;
+	for (const FRaymarchFilterSettings& Settings : Filters)
+	{
+		switch (Settings.Filter)
+		{
+		case ERaymarchFilter::Gaussian:
+			GaussianFilter(Volume.GetData(), Volume.GetData(), Dimensions, Settings.Sigma);
+			break;
+		case ERaymarchFilter::Median:
+			Scratch.SetNumUninitialized(Volume.Num());
+			MedianFilter(Volume.GetData(), Scratch.GetData(), Dimensions);
+			Swap(Volume, Scratch);
+			break;
+		case ERaymarchFilter::Vesselness:
+			Scratch.SetNumUninitialized(Volume.Num());
+			VesselnessFilter(Volume.GetData(), Scratch.GetData(), Dimensions, Settings);
+			Swap(Volume, Scratch);
+			break;
+		default:
+			checkNoEntry();
+		}
+	}
+}
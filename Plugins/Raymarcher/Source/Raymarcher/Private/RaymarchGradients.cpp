@@ -0,0 +1,213 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchGradients.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+#include "Async/ParallelFor.h"
+
+template<typename VoxelType>
+static void ConvertToWindowedIntensity(const VoxelType* Voxels, int64 VoxelCount, FVector2D WindowScaleBias, float* OutIntensities)
+{
+	for (int64 i = 0; i < VoxelCount; ++i)
+	{
+		OutIntensities[i] = FMath::Clamp(ToSampledValue(Voxels[i]) * WindowScaleBias.X + WindowScaleBias.Y, 0.0f, 1.0f);
+	}
+}
+
+void ConvertToWindowedIntensity(const void* Voxels, EPixelFormat PixelFormat, int64 VoxelCount, FVector2D WindowScaleBias, float* OutIntensities)
+{
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		ConvertToWindowedIntensity(reinterpret_cast<const uint8*>(Voxels), VoxelCount, WindowScaleBias, OutIntensities);
+		break;
+	case PF_G16:
+		ConvertToWindowedIntensity(reinterpret_cast<const uint16*>(Voxels), VoxelCount, WindowScaleBias, OutIntensities);
+		break;
+	case PF_R16F:
+		ConvertToWindowedIntensity(reinterpret_cast<const FFloat16*>(Voxels), VoxelCount, WindowScaleBias, OutIntensities);
+		break;
+	case PF_R32_FLOAT:
+		ConvertToWindowedIntensity(reinterpret_cast<const float*>(Voxels), VoxelCount, WindowScaleBias, OutIntensities);
+		break;
+	default:
+		checkNoEntry();
+	}
+}
+
+/** Rows of the neighbourhood of one row of the volume, border rows repeated. */
+struct FGradientRows
+{
+	const float* Center;
+	const float* Below;	// Y - 1
+	const float* Above;	// Y + 1
+	const float* Back;	// Z - 1
+	const float* Front;	// Z + 1
+
+	FGradientRows(const float* Intensities, int32 IntensitySlice, FIntVector Dimensions, int32 Y, int32 Z)
+	{
+		auto GetRow = [&](int32 RowY, int32 RowZ)
+		{
+			RowY = FMath::Clamp(RowY, 0, Dimensions.Y - 1);
+			RowZ = FMath::Clamp(RowZ, 0, Dimensions.Z - 1);
+			return Intensities + (int64(RowZ - IntensitySlice) * Dimensions.Y + RowY) * Dimensions.X;
+		};
+		Center = GetRow(Y, Z);
+		Below = GetRow(Y - 1, Z);
+		Above = GetRow(Y + 1, Z);
+		Back = GetRow(Y, Z - 1);
+		Front = GetRow(Y, Z + 1);
+	}
+};
+
+// Packs the central differences of one voxel. The vectorized path does exactly the same operations in the same order.
+static FORCEINLINE FColor PackGradient(float Gx, float Gy, float Gz, const FVector& DirectionScale)
+{
+	const float Magnitude = FMath::Sqrt(Gx * Gx + Gy * Gy + Gz * Gz);
+	// A voxel is 2 / Dimension long in object space, so the object space gradient is the voxel one times Dimension / 2.
+	const float Nx = Gx * DirectionScale.X;
+	const float Ny = Gy * DirectionScale.Y;
+	const float Nz = Gz * DirectionScale.Z;
+	const float Length = FMath::Sqrt(Nx * Nx + Ny * Ny + Nz * Nz);
+	const float InvLength = Length > 1e-8f ? 1.0f / Length : 0.0f;
+	// [-1,1] to [0,255], +0.5 for rounding by truncation is folded into the bias.
+	return FColor(
+		uint8(Nx * InvLength * 127.5f + 128.0f),
+		uint8(Ny * InvLength * 127.5f + 128.0f),
+		uint8(Nz * InvLength * 127.5f + 128.0f),
+		uint8(FMath::Min(Magnitude * RAYMARCH_GRADIENT_MAGNITUDE_SCALE, 1.0f) * 255.0f + 0.5f));
+}
+
+static FORCEINLINE FColor ComputeGradient(const FGradientRows& Rows, int32 X, int32 Width, const FVector& DirectionScale)
+{
+	const float Gx = (Rows.Center[FMath::Min(X + 1, Width - 1)] - Rows.Center[FMath::Max(X - 1, 0)]) * 0.5f;
+	const float Gy = (Rows.Above[X] - Rows.Below[X]) * 0.5f;
+	const float Gz = (Rows.Front[X] - Rows.Back[X]) * 0.5f;
+	return PackGradient(Gx, Gy, Gz, DirectionScale);
+}
+
+#if RAYMARCH_USE_SSE2
+
+// Converts 4 floats in [0,255.5] to ints by truncation.
+static FORCEINLINE __m128i ToInt(__m128 Values)
+{
+	return _mm_cvttps_epi32(Values);
+}
+
+// Computes gradients of 4 voxels starting at X, all of which have both X neighbours inside the row.
+static FORCEINLINE void ComputeGradients_SSE2(const FGradientRows& Rows, int32 X, __m128 DirectionScaleX, __m128 DirectionScaleY,
+	__m128 DirectionScaleZ, FColor* Out)
+{
+	const __m128 Half = _mm_set1_ps(0.5f);
+	const __m128 Gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(Rows.Center + X + 1), _mm_loadu_ps(Rows.Center + X - 1)), Half);
+	const __m128 Gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(Rows.Above + X), _mm_loadu_ps(Rows.Below + X)), Half);
+	const __m128 Gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(Rows.Front + X), _mm_loadu_ps(Rows.Back + X)), Half);
+
+	const __m128 Magnitude = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Gx, Gx), _mm_mul_ps(Gy, Gy)), _mm_mul_ps(Gz, Gz)));
+	const __m128 Nx = _mm_mul_ps(Gx, DirectionScaleX);
+	const __m128 Ny = _mm_mul_ps(Gy, DirectionScaleY);
+	const __m128 Nz = _mm_mul_ps(Gz, DirectionScaleZ);
+	const __m128 Length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Nx, Nx), _mm_mul_ps(Ny, Ny)), _mm_mul_ps(Nz, Nz)));
+	// 1 / Length where it's big enough, 0 elsewhere (the max only keeps the division from producing infinities).
+	const __m128 InvLength = _mm_and_ps(_mm_cmpgt_ps(Length, _mm_set1_ps(1e-8f)), _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(Length, _mm_set1_ps(1e-8f))));
+
+	const __m128 Scale = _mm_set1_ps(127.5f);
+	const __m128 Bias = _mm_set1_ps(128.0f);
+	const __m128i R = ToInt(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(Nx, InvLength), Scale), Bias));
+	const __m128i G = ToInt(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(Ny, InvLength), Scale), Bias));
+	const __m128i B = ToInt(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(Nz, InvLength), Scale), Bias));
+	const __m128 ScaledMagnitude = _mm_min_ps(_mm_mul_ps(Magnitude, _mm_set1_ps(RAYMARCH_GRADIENT_MAGNITUDE_SCALE)), _mm_set1_ps(1.0f));
+	const __m128i A = ToInt(_mm_add_ps(_mm_mul_ps(ScaledMagnitude, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+
+	// FColor is BGRA in memory, so B goes to the lowest byte of every little-endian dword.
+	const __m128i Packed = _mm_or_si128(_mm_or_si128(B, _mm_slli_epi32(G, 8)), _mm_or_si128(_mm_slli_epi32(R, 16), _mm_slli_epi32(A, 24)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(Out), Packed);
+}
+
+#endif
+
+void BuildGradientSlab(const float* Intensities, int32 IntensitySlice, FIntVector Dimensions, int32 FirstSlice, int32 SliceCount, FColor* OutGradients)
+{
+	const FVector DirectionScale(Dimensions);
+	const int32 Width = Dimensions.X;
+#if RAYMARCH_USE_SSE2
+	const __m128 DirectionScaleX = _mm_set1_ps(DirectionScale.X);
+	const __m128 DirectionScaleY = _mm_set1_ps(DirectionScale.Y);
+	const __m128 DirectionScaleZ = _mm_set1_ps(DirectionScale.Z);
+#endif
+
+	ParallelFor(Dimensions.Y * SliceCount, [&](int32 RowIndex)
+	{
+		const int32 Y = RowIndex % Dimensions.Y;
+		const int32 Z = FirstSlice + RowIndex / Dimensions.Y;
+		const FGradientRows Rows(Intensities, IntensitySlice, Dimensions, Y, Z);
+		FColor* OutRow = OutGradients + int64(RowIndex) * Width;
+
+		int32 X = 0;
+#if RAYMARCH_USE_SSE2
+		// First and last voxel need their X neighbour clamped, the ones in between go four at a time.
+		OutRow[0] = ComputeGradient(Rows, 0, Width, DirectionScale);
+		for (X = 1; X + 4 < Width; X += 4)
+		{
+			ComputeGradients_SSE2(Rows, X, DirectionScaleX, DirectionScaleY, DirectionScaleZ, OutRow + X);
+		}
+#endif
+		for (; X < Width; ++X)
+		{
+			OutRow[X] = ComputeGradient(Rows, X, Width, DirectionScale);
+		}
+	});
+}
+
+void BuildGradientSlab_Scalar(const float* Intensities, int32 IntensitySlice, FIntVector Dimensions, int32 FirstSlice, int32 SliceCount, FColor* OutGradients)
+{
+	const FVector DirectionScale(Dimensions);
+	for (int32 Z = FirstSlice; Z < FirstSlice + SliceCount; ++Z)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		{
+			const FGradientRows Rows(Intensities, IntensitySlice, Dimensions, Y, Z);
+			for (int32 X = 0; X < Dimensions.X; ++X)
+			{
+				*OutGradients++ = ComputeGradient(Rows, X, Dimensions.X, DirectionScale);
+			}
+		}
+	}
+}
+
+void FRaymarchGradientSlabBuilder::Init(FIntVector InDimensions)
+{
+	Dimensions = InDimensions;
+	Window.Reset();
+	WindowSlice = 0;
+	NextSlice = 0;
+	AddedSlices = 0;
+	ReadySlices = 0;
+}
+
+int32 FRaymarchGradientSlabBuilder::AddSlab(const float* Intensities, int32 SliceCount)
+{
+	check(AddedSlices + SliceCount <= Dimensions.Z);
+	Window.Append(Intensities, Dimensions.X * Dimensions.Y * SliceCount);
+	AddedSlices += SliceCount;
+	// Every slice but the last one added has its upper neighbour now. The last slice of the volume doesn't need one.
+	const int32 ReadyEnd = AddedSlices == Dimensions.Z ? Dimensions.Z : AddedSlices - 1;
+	ReadySlices = FMath::Max(ReadyEnd - NextSlice, 0);
+	return ReadySlices;
+}
+
+void FRaymarchGradientSlabBuilder::BuildReadySlices(FColor* OutGradients)
+{
+	if (ReadySlices == 0)
+	{
+		return;
+	}
+	BuildGradientSlab(Window.GetData(), WindowSlice, Dimensions, NextSlice, ReadySlices, OutGradients);
+	NextSlice += ReadySlices;
+	ReadySlices = 0;
+
+	// Only the lower neighbour of the next slice to build is needed from what's been built.
+	const int32 KeepSlice = FMath::Max(NextSlice - 1, WindowSlice);
+	Window.RemoveAt(0, (KeepSlice - WindowSlice) * Dimensions.X * Dimensions.Y, false);
+	WindowSlice = KeepSlice;
+}
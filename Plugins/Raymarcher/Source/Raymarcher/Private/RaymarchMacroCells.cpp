@@ -0,0 +1,160 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchMacroCells.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+#include "Async/ParallelFor.h"
+
+// First and last (inclusive) voxel covered by a cell along one axis, including the apron.
+static FORCEINLINE void GetCellVoxelRange(int32 Cell, int32 CellSize, int32 VolumeSize, int32& OutFirst, int32& OutLast)
+{
+	OutFirst = FMath::Max(Cell * CellSize - 1, 0);
+	OutLast = FMath::Min((Cell + 1) * CellSize, VolumeSize - 1);
+}
+
+void FRaymarchMacroCellGrid::Init(FIntVector InVolumeDimensions, int32 InCellSize)
+{
+	check(InCellSize > 0);
+	VolumeDimensions = InVolumeDimensions;
+	CellSize = InCellSize;
+	CellDimensions = FIntVector(
+		FMath::DivideAndRoundUp(VolumeDimensions.X, CellSize),
+		FMath::DivideAndRoundUp(VolumeDimensions.Y, CellSize),
+		FMath::DivideAndRoundUp(VolumeDimensions.Z, CellSize));
+	MinMax.Init(FVector2D(MAX_flt, -MAX_flt), CellDimensions.X * CellDimensions.Y * CellDimensions.Z);
+}
+
+FVector2D FRaymarchMacroCellGrid::GetValueRange() const
+{
+	if (!IsValid())
+	{
+		return FVector2D(-MAX_flt, MAX_flt);
+	}
+	FVector2D Range(MAX_flt, -MAX_flt);
+	for (const FVector2D& Cell : MinMax)
+	{
+		Range.X = FMath::Min(Range.X, Cell.X);
+		Range.Y = FMath::Max(Range.Y, Cell.Y);
+	}
+	return Range;
+}
+
+template<typename TexelType>
+static void AccumulateSlabTyped(FRaymarchMacroCellGrid& Grid, const TexelType* SlabData, int32 FirstSlice, int32 SliceCount)
+{
+	const FIntVector& Dimensions = Grid.VolumeDimensions;
+	const FIntVector& CellDimensions = Grid.CellDimensions;
+	const int32 CellSize = Grid.CellSize;
+	const int32 LastSlice = FirstSlice + SliceCount - 1;
+	const int64 SliceVoxels = int64(Dimensions.X) * Dimensions.Y;
+
+	// Rows of cells (along Z) whose apron-extended range touches the slab.
+	const int32 FirstRow = FMath::Max((FirstSlice + CellSize - 1) / CellSize - 1, 0);
+	const int32 LastRow = FMath::Min((LastSlice + 1) / CellSize, CellDimensions.Z - 1);
+	const int32 CellsPerRow = CellDimensions.X * CellDimensions.Y;
+
+	// Every cell is only written by one task, so no synchronization is needed.
+	ParallelFor(CellsPerRow * (LastRow - FirstRow + 1), [&](int32 TaskIndex)
+	{
+		const int32 CellX = TaskIndex % CellDimensions.X;
+		const int32 CellY = (TaskIndex / CellDimensions.X) % CellDimensions.Y;
+		const int32 CellZ = FirstRow + TaskIndex / CellsPerRow;
+
+		int32 FirstX, LastX, FirstY, LastY, FirstZ, LastZ;
+		GetCellVoxelRange(CellX, CellSize, Dimensions.X, FirstX, LastX);
+		GetCellVoxelRange(CellY, CellSize, Dimensions.Y, FirstY, LastY);
+		GetCellVoxelRange(CellZ, CellSize, Dimensions.Z, FirstZ, LastZ);
+		// Only the part of the cell that's in this slab.
+		FirstZ = FMath::Max(FirstZ, FirstSlice);
+		LastZ = FMath::Min(LastZ, LastSlice);
+
+		float Min = MAX_flt;
+		float Max = -MAX_flt;
+		for (int32 Z = FirstZ; Z <= LastZ; ++Z)
+		{
+			for (int32 Y = FirstY; Y <= LastY; ++Y)
+			{
+				const TexelType* Row = SlabData + (Z - FirstSlice) * SliceVoxels + int64(Y) * Dimensions.X;
+				for (int32 X = FirstX; X <= LastX; ++X)
+				{
+					const float Value = ToSampledValue(Row[X]);
+					Min = FMath::Min(Min, Value);
+					Max = FMath::Max(Max, Value);
+				}
+			}
+		}
+
+		FVector2D& Cell = Grid.MinMax[Grid.GetCellIndex(CellX, CellY, CellZ)];
+		Cell.X = FMath::Min(Cell.X, Min);
+		Cell.Y = FMath::Max(Cell.Y, Max);
+	});
+}
+
+void FRaymarchMacroCellGrid::AccumulateSlab(const void* SlabData, EPixelFormat PixelFormat, int32 FirstSlice, int32 SliceCount)
+{
+	check(IsValid());
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		AccumulateSlabTyped(*this, reinterpret_cast<const uint8*>(SlabData), FirstSlice, SliceCount);
+		break;
+	case PF_G16:
+		AccumulateSlabTyped(*this, reinterpret_cast<const uint16*>(SlabData), FirstSlice, SliceCount);
+		break;
+	case PF_R16F:
+		AccumulateSlabTyped(*this, reinterpret_cast<const FFloat16*>(SlabData), FirstSlice, SliceCount);
+		break;
+	case PF_R32_FLOAT:
+		AccumulateSlabTyped(*this, reinterpret_cast<const float*>(SlabData), FirstSlice, SliceCount);
+		break;
+	default:
+		checkNoEntry();
+	}
+}
+
+template<typename TexelType>
+static void BuildMacroCellsTyped_Reference(const TexelType* VolumeData, FRaymarchMacroCellGrid& Grid)
+{
+	const FIntVector& Dimensions = Grid.VolumeDimensions;
+	for (int32 CellZ = 0; CellZ < Grid.CellDimensions.Z; ++CellZ)
+	for (int32 CellY = 0; CellY < Grid.CellDimensions.Y; ++CellY)
+	for (int32 CellX = 0; CellX < Grid.CellDimensions.X; ++CellX)
+	{
+		int32 FirstX, LastX, FirstY, LastY, FirstZ, LastZ;
+		GetCellVoxelRange(CellX, Grid.CellSize, Dimensions.X, FirstX, LastX);
+		GetCellVoxelRange(CellY, Grid.CellSize, Dimensions.Y, FirstY, LastY);
+		GetCellVoxelRange(CellZ, Grid.CellSize, Dimensions.Z, FirstZ, LastZ);
+
+		FVector2D& Cell = Grid.MinMax[Grid.GetCellIndex(CellX, CellY, CellZ)];
+		for (int32 Z = FirstZ; Z <= LastZ; ++Z)
+		for (int32 Y = FirstY; Y <= LastY; ++Y)
+		for (int32 X = FirstX; X <= LastX; ++X)
+		{
+			const float Value = ToSampledValue(VolumeData[X + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)]);
+			Cell.X = FMath::Min(Cell.X, Value);
+			Cell.Y = FMath::Max(Cell.Y, Value);
+		}
+	}
+}
+
+void BuildMacroCells_Reference(const void* VolumeData, EPixelFormat PixelFormat, FIntVector VolumeDimensions, int32 CellSize, FRaymarchMacroCellGrid& OutGrid)
+{
+	OutGrid.Init(VolumeDimensions, CellSize);
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		BuildMacroCellsTyped_Reference(reinterpret_cast<const uint8*>(VolumeData), OutGrid);
+		break;
+	case PF_G16:
+		BuildMacroCellsTyped_Reference(reinterpret_cast<const uint16*>(VolumeData), OutGrid);
+		break;
+	case PF_R16F:
+		BuildMacroCellsTyped_Reference(reinterpret_cast<const FFloat16*>(VolumeData), OutGrid);
+		break;
+	case PF_R32_FLOAT:
+		BuildMacroCellsTyped_Reference(reinterpret_cast<const float*>(VolumeData), OutGrid);
+		break;
+	default:
+		checkNoEntry();
+	}
+}
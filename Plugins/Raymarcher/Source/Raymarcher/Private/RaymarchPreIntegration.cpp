@@ -0,0 +1,119 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchPreIntegration.h"
+
+#include "Async/ParallelFor.h"
+
+// Opacity of one voxel converted to extinction per voxel. Fully opaque entries are clamped to keep the logarithm finite.
+static FORCEINLINE float OpacityToExtinction(float Opacity)
+{
+	return -FMath::Loge(1.0f - FMath::Clamp(Opacity, 0.0f, 0.9999f));
+}
+
+// Table entry of a segment with given mean extinction and mean extinction-weighted color.
+static FORCEINLINE FLinearColor MakeSegment(float MeanExtinction, const FLinearColor& MeanWeightedColor, const FLinearColor& FallbackColor)
+{
+	// Fully transparent segments have no weighted color, use the plain one so that filtering between entries stays smooth.
+	FLinearColor Color = MeanExtinction > SMALL_NUMBER ? MeanWeightedColor / MeanExtinction : FallbackColor;
+	Color.A = 1.0f - FMath::Exp(-MeanExtinction);
+	return Color;
+}
+
+void BuildPreIntegrationTable(const TArray<FLinearColor>& Lut, TArray<FLinearColor>& OutTable)
+{
+	const int32 Size = Lut.Num();
+	check(Size > 0);
+
+	// Extinction is linear between the entries and so is the color. Running integrals (in units of entries) of the
+	// extinction and of the extinction-weighted color turn every segment into a difference of two values.
+	TArray<float> Extinction;
+	Extinction.SetNumUninitialized(Size);
+	for (int32 i = 0; i < Size; ++i)
+	{
+		Extinction[i] = OpacityToExtinction(Lut[i].A);
+	}
+	TArray<float> ExtinctionIntegral;
+	TArray<FLinearColor> ColorIntegral;
+	ExtinctionIntegral.SetNumUninitialized(Size);
+	ColorIntegral.SetNumUninitialized(Size);
+	ExtinctionIntegral[0] = 0.0f;
+	ColorIntegral[0] = FLinearColor::Transparent;
+	for (int32 i = 1; i < Size; ++i)
+	{
+		const float T0 = Extinction[i - 1];
+		const float T1 = Extinction[i];
+		const FLinearColor& C0 = Lut[i - 1];
+		const FLinearColor& C1 = Lut[i];
+		ExtinctionIntegral[i] = ExtinctionIntegral[i - 1] + (T0 + T1) * 0.5f;
+		// Exact integral of the product of two linear functions over one entry.
+		ColorIntegral[i] = ColorIntegral[i - 1] + (C0 * T0 + C1 * T1) * (1.0f / 3.0f) + (C1 * T0 + C0 * T1) * (1.0f / 6.0f);
+	}
+
+	OutTable.SetNumUninitialized(Size * Size);
+	ParallelFor(Size, [&](int32 Back)
+	{
+		FLinearColor* Row = OutTable.GetData() + Back * Size;
+		for (int32 Front = 0; Front < Size; ++Front)
+		{
+			const FLinearColor FallbackColor = (Lut[Front] + Lut[Back]) * 0.5f;
+			if (Front == Back)
+			{
+				Row[Front] = MakeSegment(Extinction[Front], Lut[Front] * Extinction[Front], FallbackColor);
+				continue;
+			}
+			// Same formula for both directions, the signs of the differences and the length cancel out.
+			const float InvLength = 1.0f / (Back - Front);
+			const float MeanExtinction = (ExtinctionIntegral[Back] - ExtinctionIntegral[Front]) * InvLength;
+			const FLinearColor MeanWeightedColor = (ColorIntegral[Back] - ColorIntegral[Front]) * InvLength;
+			Row[Front] = MakeSegment(MeanExtinction, MeanWeightedColor, FallbackColor);
+		}
+	});
+}
+
+void BuildPreIntegrationTable_Reference(const TArray<FLinearColor>& Lut, int32 SubSteps, TArray<FLinearColor>& OutTable)
+{
+	const int32 Size = Lut.Num();
+	check(Size > 0 && SubSteps > 0);
+
+	OutTable.SetNumUninitialized(Size * Size);
+	for (int32 Back = 0; Back < Size; ++Back)
+	{
+		for (int32 Front = 0; Front < Size; ++Front)
+		{
+			const int32 Steps = SubSteps * FMath::Max(FMath::Abs(Back - Front), 1);
+			float ExtinctionSum = 0.0f;
+			FLinearColor ColorSum = FLinearColor::Transparent;
+			for (int32 Step = 0; Step < Steps; ++Step)
+			{
+				// Midpoint rule along the segment, the transfer function is interpolated linearly like the GPU does.
+				const float Position = FMath::Lerp(float(Front), float(Back), (Step + 0.5f) / Steps);
+				const int32 Lower = FMath::Min(FMath::FloorToInt(Position), Size - 1);
+				const int32 Upper = FMath::Min(Lower + 1, Size - 1);
+				const float Alpha = Position - Lower;
+				const float Extinction = FMath::Lerp(OpacityToExtinction(Lut[Lower].A), OpacityToExtinction(Lut[Upper].A), Alpha);
+				ExtinctionSum += Extinction;
+				ColorSum += FMath::Lerp(Lut[Lower], Lut[Upper], Alpha) * Extinction;
+			}
+			OutTable[Front + Back * Size] = MakeSegment(ExtinctionSum / Steps, ColorSum / Steps, (Lut[Front] + Lut[Back]) * 0.5f);
+		}
+	}
+}
+
+void BuildMaxOpacityTable(const TArray<float>& Opacities, TArray<float>& OutTable)
+{
+	const int32 Size = Opacities.Num();
+	check(Size > 0);
+
+	// A running maximum along every row, mirrored so that the order of the ends doesn't matter.
+	OutTable.SetNumUninitialized(Size * Size);
+	for (int32 Min = 0; Min < Size; ++Min)
+	{
+		float MaxOpacity = 0.0f;
+		for (int32 Max = Min; Max < Size; ++Max)
+		{
+			MaxOpacity = FMath::Max(MaxOpacity, Opacities[Max]);
+			OutTable[Min + Max * Size] = MaxOpacity;
+			OutTable[Max + Min * Size] = MaxOpacity;
+		}
+	}
+}
@@ -0,0 +1,312 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchProfiling.h"
+#include "../Public/Raymarcher.h"
+
+#include "ClearQuad.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+IMPLEMENT_SHADER_TYPE(, FRaymarchReduceCountersCS, TEXT("/Plugin/Raymarcher/Private/RaymarchProfiling.usf"), TEXT("ReduceCountersCS"), SF_Compute)
+
+DEFINE_STAT(STAT_RaymarchUpload);
+DEFINE_STAT(STAT_RaymarchFilter);
+DEFINE_STAT(STAT_RaymarchDraw);
+DEFINE_STAT(STAT_RaymarchReconstruct);
+DEFINE_STAT(STAT_RaymarchUploadGpu);
+DEFINE_STAT(STAT_RaymarchFilterGpu);
+DEFINE_STAT(STAT_RaymarchDrawGpu);
+DEFINE_STAT(STAT_RaymarchReconstructGpu);
+DEFINE_STAT(STAT_RaymarchVolumesDrawn);
+DEFINE_STAT(STAT_RaymarchUploadedMB);
+DEFINE_STAT(STAT_RaymarchRays);
+DEFINE_STAT(STAT_RaymarchTerminatedRays);
+DEFINE_STAT(STAT_RaymarchSamples);
+DEFINE_STAT(STAT_RaymarchSkippedSamples);
+DEFINE_STAT(STAT_RaymarchSequenceDroppedFrames);
+DEFINE_STAT(STAT_RaymarchSequenceLatency);
+
+static TAutoConsoleVariable<int32> CVarRaymarchStats(
+	TEXT("r.Raymarch.Stats"),
+	0,
+	TEXT("What the raymarcher measures besides render thread time (see stat Raymarcher).\n")
+	TEXT(" 0: nothing (default)\n")
+	TEXT(" 1: GPU time of the stages\n")
+	TEXT(" 2: GPU time and samples per frame. Every draw is repeated by a counting pass, so it costs about as much again."),
+	ECVF_RenderThreadSafe);
+
+// Counters of FRaymarchSampleCounts, two words each.
+static const int32 CounterWordCount = 8;
+
+FRaymarchProfiler& FRaymarchProfiler::Get()
+{
+	check(IsInRenderingThread());
+	static FRaymarchProfiler Profiler;
+	return Profiler;
+}
+
+bool FRaymarchProfiler::ShouldTimeGpu_RenderThread() const
+{
+	return GSupportsTimestampRenderQueries && (CVarRaymarchStats.GetValueOnRenderThread() > 0 || CsvFile.IsValid());
+}
+
+bool FRaymarchProfiler::ShouldCountSamples_RenderThread() const
+{
+	return CVarRaymarchStats.GetValueOnRenderThread() > 1 && GMaxRHIFeatureLevel >= ERHIFeatureLevel::SM5;
+}
+
+FRenderQueryRHIRef FRaymarchProfiler::AllocateQuery_RenderThread()
+{
+	if (FreeQueries.Num() > 0)
+	{
+		return FreeQueries.Pop(false);
+	}
+	return RHICreateRenderQuery(RQT_AbsoluteTime);
+}
+
+void FRaymarchProfiler::BeginStage_RenderThread(FRHICommandListImmediate& RHICmdList, ERaymarchStage Stage)
+{
+	const int32 StageIndex = (int32)Stage;
+	StageStartCycles[StageIndex] = FPlatformTime::Cycles64();
+	if (ShouldTimeGpu_RenderThread())
+	{
+		OpenQueries[StageIndex] = AllocateQuery_RenderThread();
+		RHICmdList.EndRenderQuery(OpenQueries[StageIndex]);
+	}
+}
+
+void FRaymarchProfiler::EndStage_RenderThread(FRHICommandListImmediate& RHICmdList, ERaymarchStage Stage)
+{
+	const int32 StageIndex = (int32)Stage;
+	CurrentFrame.CpuMilliseconds[StageIndex] += FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StageStartCycles[StageIndex]);
+	if (OpenQueries[StageIndex])
+	{
+		FTimerQuery Query;
+		Query.Stage = Stage;
+		Query.Begin = OpenQueries[StageIndex];
+		Query.End = AllocateQuery_RenderThread();
+		RHICmdList.EndRenderQuery(Query.End);
+		CurrentFrame.Queries.Add(Query);
+		OpenQueries[StageIndex] = FRenderQueryRHIRef();
+	}
+}
+
+void FRaymarchProfiler::AddVolumesDrawn_RenderThread(int32 Count)
+{
+	CurrentFrame.VolumesDrawn += Count;
+}
+
+void FRaymarchProfiler::AddUploadedBytes_RenderThread(uint64 Bytes)
+{
+	CurrentFrame.UploadedBytes += Bytes;
+}
+
+void FRaymarchProfiler::BeginCounting_RenderThread(FRHICommandListImmediate& RHICmdList, FIntPoint Size)
+{
+	check(IsInRenderingThread());
+
+	const int32 Slot = FrameIndex % RAYMARCH_PROFILER_LATENCY;
+	if (!CounterTextures[Slot])
+	{
+		FRHIResourceCreateInfo CreateInfo;
+		CounterTextures[Slot] = RHICreateTexture2D(CounterWordCount, 1, PF_R32_UINT, 1, 1, TexCreate_UAV | TexCreate_ShaderResource, CreateInfo);
+		CounterUAVs[Slot] = RHICreateUnorderedAccessView(CounterTextures[Slot]);
+		CounterStagingTextures[Slot] = RHICreateTexture2D(CounterWordCount, 1, PF_R32_UINT, 1, 1, TexCreate_CPUReadback, CreateInfo);
+	}
+	if (CurrentFrame.CounterSlot == INDEX_NONE)
+	{
+		// All draws of the frame add into the same counters.
+		static const uint32 Zeros[4] = { 0, 0, 0, 0 };
+		ClearUAV(RHICmdList, CounterTextures[Slot], CounterUAVs[Slot], Zeros);
+		CurrentFrame.CounterSlot = Slot;
+	}
+
+	if (!CountingTarget || CountingTarget->GetSizeXY() != Size)
+	{
+		FRHIResourceCreateInfo CreateInfo;
+		CreateInfo.ClearValueBinding = FClearValueBinding::Transparent;
+		CountingTarget = RHICreateTexture2D(Size.X, Size.Y, PF_A32B32G32R32F, 1, 1, TexCreate_RenderTargetable | TexCreate_ShaderResource, CreateInfo);
+	}
+	FRHIRenderTargetView View(CountingTarget, ERenderTargetLoadAction::EClear);
+	RHICmdList.SetRenderTargetsAndClear(FRHISetRenderTargetsInfo(1, &View, FRHIDepthRenderTargetView()));
+}
+
+void FRaymarchProfiler::EndCounting_RenderThread(FRHICommandListImmediate& RHICmdList, ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+	check(CurrentFrame.CounterSlot != INDEX_NONE);
+
+	RHICmdList.CopyToResolveTarget(CountingTarget, CountingTarget, true, FResolveParams());
+
+	TShaderMapRef<FRaymarchReduceCountersCS> ReduceShader(GetGlobalShaderMap(FeatureLevel));
+	FUnorderedAccessViewRHIParamRef CounterUAV = CounterUAVs[CurrentFrame.CounterSlot];
+	const FIntPoint Size = CountingTarget->GetSizeXY();
+	RHICmdList.TransitionResource(EResourceTransitionAccess::ERWBarrier, EResourceTransitionPipeline::EGfxToCompute, CounterUAV);
+	RHICmdList.SetComputeShader(ReduceShader->GetComputeShader());
+	ReduceShader->SetCounters(RHICmdList, CountingTarget, Size, CounterUAV);
+	DispatchComputeShader(RHICmdList, *ReduceShader,
+		FMath::DivideAndRoundUp(Size.X, RAYMARCH_COUNTER_THREADGROUP_SIZE), FMath::DivideAndRoundUp(Size.Y, RAYMARCH_COUNTER_THREADGROUP_SIZE), 1);
+	ReduceShader->UnbindCounters(RHICmdList);
+	RHICmdList.TransitionResource(EResourceTransitionAccess::EReadable, EResourceTransitionPipeline::EComputeToGfx, CounterUAV);
+
+	// Mapping the counters themselves would wait for the GPU, the staging copy gets mapped once the frame is done.
+	// Later draws of the frame copy again, the last copy has all of them.
+	RHICmdList.CopyToResolveTarget(CounterTextures[CurrentFrame.CounterSlot], CounterStagingTextures[CurrentFrame.CounterSlot], true, FResolveParams());
+}
+
+void FRaymarchProfiler::ReadFrame_RenderThread(FFrame& Frame)
+{
+	double GpuMilliseconds[(int32)ERaymarchStage::Count] = {};
+	for (const FTimerQuery& Query : Frame.Queries)
+	{
+		// Old enough to be done, waiting is only a safety net.
+		uint64 Begin = 0;
+		uint64 End = 0;
+		if (RHIGetRenderQueryResult(Query.Begin, Begin, true) && RHIGetRenderQueryResult(Query.End, End, true) && End > Begin)
+		{
+			GpuMilliseconds[(int32)Query.Stage] += (End - Begin) / 1000.0;
+		}
+		FreeQueries.Add(Query.Begin);
+		FreeQueries.Add(Query.End);
+	}
+
+	FRaymarchSampleCounts Counts;
+	if (Frame.CounterSlot != INDEX_NONE)
+	{
+		void* Data = nullptr;
+		int32 Width = 0;
+		int32 Height = 0;
+		RHIMapStagingSurface(CounterStagingTextures[Frame.CounterSlot], Data, Width, Height);
+		if (Data)
+		{
+			const uint32* Words = static_cast<const uint32*>(Data);
+			auto ReadCounter = [Words](int32 Index) { return uint64(Words[Index * 2]) | (uint64(Words[Index * 2 + 1]) << 32); };
+			Counts.Rays = ReadCounter(0);
+			Counts.Samples = ReadCounter(1);
+			Counts.SkippedSamples = ReadCounter(2);
+			Counts.TerminatedRays = ReadCounter(3);
+			RHIUnmapStagingSurface(CounterStagingTextures[Frame.CounterSlot]);
+		}
+	}
+
+	SET_FLOAT_STAT(STAT_RaymarchUploadGpu, GpuMilliseconds[(int32)ERaymarchStage::Upload]);
+	SET_FLOAT_STAT(STAT_RaymarchFilterGpu, GpuMilliseconds[(int32)ERaymarchStage::Filter]);
+	SET_FLOAT_STAT(STAT_RaymarchDrawGpu, GpuMilliseconds[(int32)ERaymarchStage::Draw]);
+	SET_FLOAT_STAT(STAT_RaymarchReconstructGpu, GpuMilliseconds[(int32)ERaymarchStage::Reconstruct]);
+	SET_DWORD_STAT(STAT_RaymarchRays, uint32(Counts.Rays));
+	SET_DWORD_STAT(STAT_RaymarchTerminatedRays, uint32(Counts.TerminatedRays));
+	SET_FLOAT_STAT(STAT_RaymarchSamples, Counts.Samples / 1e6);
+	SET_FLOAT_STAT(STAT_RaymarchSkippedSamples, Counts.SkippedSamples / 1e6);
+
+	if (CsvFile.IsValid())
+	{
+		FString Line = FString::Printf(TEXT("%u"), Frame.FrameNumber);
+		for (double Milliseconds : Frame.CpuMilliseconds)
+		{
+			Line += FString::Printf(TEXT(",%.4f"), Milliseconds);
+		}
+		for (double Milliseconds : GpuMilliseconds)
+		{
+			Line += FString::Printf(TEXT(",%.4f"), Milliseconds);
+		}
+		Line += FString::Printf(TEXT(",%d,%llu,%llu,%llu,%llu,%llu\n"), Frame.VolumesDrawn, Frame.UploadedBytes,
+			Counts.Rays, Counts.Samples, Counts.SkippedSamples, Counts.TerminatedRays);
+		FTCHARToUTF8 Utf8(*Line);
+		CsvFile->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+	}
+}
+
+void FRaymarchProfiler::EndFrame_RenderThread()
+{
+	check(IsInRenderingThread());
+
+	// Render thread times are known right away.
+	SET_DWORD_STAT(STAT_RaymarchVolumesDrawn, CurrentFrame.VolumesDrawn);
+	SET_FLOAT_STAT(STAT_RaymarchUploadedMB, CurrentFrame.UploadedBytes / (1024.0 * 1024.0));
+
+	CurrentFrame.FrameNumber = GFrameNumberRenderThread;
+	PendingFrames.Add(MoveTemp(CurrentFrame));
+	CurrentFrame = FFrame();
+	++FrameIndex;
+
+	// Read the frame RAYMARCH_PROFILER_LATENCY - 1 frames back. Its counter textures get reused by the next frame.
+	while (PendingFrames.Num() >= RAYMARCH_PROFILER_LATENCY)
+	{
+		ReadFrame_RenderThread(PendingFrames[0]);
+		PendingFrames.RemoveAt(0, 1, false);
+	}
+}
+
+void FRaymarchProfiler::SetCsvFile_RenderThread(const FString& Filename)
+{
+	check(IsInRenderingThread());
+
+	CsvFile.Reset();
+	if (Filename.IsEmpty())
+	{
+		return;
+	}
+	CsvFile.Reset(IFileManager::Get().CreateFileWriter(*Filename));
+	if (!CsvFile.IsValid())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Can't write the raymarching stats to %s."), *Filename);
+		return;
+	}
+	const FString Header = TEXT("Frame,UploadCpuMs,FilterCpuMs,DrawCpuMs,ReconstructCpuMs,UploadGpuMs,FilterGpuMs,DrawGpuMs,ReconstructGpuMs,")
+		TEXT("VolumesDrawn,UploadedBytes,Rays,Samples,SkippedSamples,TerminatedRays\n");
+	FTCHARToUTF8 Utf8(*Header);
+	CsvFile->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+}
+
+void FRaymarchProfiler::Release_RenderThread()
+{
+	check(IsInRenderingThread());
+
+	// The frame in progress keeps its CPU timings, its queries and counters are gone though.
+	CurrentFrame.Queries.Empty();
+	CurrentFrame.CounterSlot = INDEX_NONE;
+	PendingFrames.Empty();
+	FreeQueries.Empty();
+	for (FRenderQueryRHIRef& Query : OpenQueries)
+	{
+		Query.SafeRelease();
+	}
+	for (int32 Slot = 0; Slot < RAYMARCH_PROFILER_LATENCY; ++Slot)
+	{
+		CounterTextures[Slot].SafeRelease();
+		CounterUAVs[Slot].SafeRelease();
+		CounterStagingTextures[Slot].SafeRelease();
+	}
+	CountingTarget.SafeRelease();
+	CsvFile.Reset();
+}
+
+static void RecordStats(const TArray<FString>& Args)
+{
+	const FString Filename = Args.Num() > 0 ? FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / Args[0]) : FString();
+	ENQUEUE_RENDER_COMMAND(RecordRaymarchStatsCommand)(
+		[Filename](FRHICommandListImmediate& RHICmdList)
+		{
+			FRaymarchProfiler::Get().SetCsvFile_RenderThread(Filename);
+		}
+	);
+	if (Filename.IsEmpty())
+	{
+		MY_LOG("Stopped recording the raymarching stats.");
+	}
+	else
+	{
+		MY_LOG("Recording the raymarching stats.");
+	}
+}
+
+static FAutoConsoleCommand RecordStatsCommand(
+	TEXT("Raymarch.RecordStats"),
+	TEXT("Writes the timings and counters of every frame to a CSV file (GPU times even without r.Raymarch.Stats, samples only with 2). ")
+	TEXT("Argument: file relative to Saved, no argument stops recording."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&RecordStats));
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,229 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchReconstruction.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+IMPLEMENT_SHADER_TYPE(, FRaymarchResolveVS, TEXT("/Plugin/Raymarcher/Private/RaymarchReconstruction.usf"), TEXT("MainVS"), SF_Vertex)
+IMPLEMENT_SHADER_TYPE(, FRaymarchResolvePS, TEXT("/Plugin/Raymarcher/Private/RaymarchReconstruction.usf"), TEXT("MainPS"), SF_Pixel)
+
+// Reconstruction of a render target, kept for as long as the target lives.
+struct FRaymarchReconstructionEntry
+{
+	TWeakObjectPtr<UTextureRenderTarget2D> Target;
+	// Number of frames drawn so far, indexes the jitter sequences.
+	uint32 FrameIndex;
+	FRaymarchReconstructionPtr Reconstruction;
+};
+
+// Only touched on the game thread. There's one entry per render target drawn at reduced resolution, so a linear search is fine.
+static TArray<FRaymarchReconstructionEntry> GReconstructions;
+
+// Radical inverse of Index in the given base, a low-discrepancy sequence in [0,1).
+static float Halton(uint32 Index, uint32 Base)
+{
+	float Result = 0.0f;
+	float Fraction = 1.0f / Base;
+	while (Index > 0)
+	{
+		Result += (Index % Base) * Fraction;
+		Index /= Base;
+		Fraction /= Base;
+	}
+	return Result;
+}
+
+FMatrix FRaymarchReconstructionFrame::JitterProjection(const FMatrix& Projection) const
+{
+	// Clip space W is the view depth, so adding to the Z row shifts NDC by a constant.
+	FMatrix Jittered = Projection;
+	Jittered.M[2][0] += ProjectionJitter.X;
+	Jittered.M[2][1] += ProjectionJitter.Y;
+	return Jittered;
+}
+
+FRaymarchReconstructionPtr FRaymarchReconstruction::BeginFrame_GameThread(
+	UTextureRenderTarget2D* Target,
+	const FRaymarchRenderSettings& Settings,
+	const FMatrix& ProjectionMatrix,
+	FRaymarchReconstructionFrame& OutFrame)
+{
+	check(IsInGameThread());
+	check(Settings.Resolution != ERaymarchResolution::Full);
+
+	FRaymarchReconstructionEntry* Entry = GReconstructions.FindByPredicate([Target](const FRaymarchReconstructionEntry& Candidate)
+	{
+		return Candidate.Target.Get() == Target;
+	});
+	if (!Entry)
+	{
+		// Drop reconstructions of targets that are gone while adding a new one.
+		GReconstructions.RemoveAll([](const FRaymarchReconstructionEntry& Candidate) { return !Candidate.Target.IsValid(); });
+		Entry = &GReconstructions[GReconstructions.AddDefaulted()];
+		Entry->Target = Target;
+		Entry->FrameIndex = 0;
+		Entry->Reconstruction = MakeShareable(new FRaymarchReconstruction());
+	}
+	const uint32 FrameIndex = Entry->FrameIndex++;
+
+	const int32 Downsample = Settings.Resolution == ERaymarchResolution::Quarter ? 4 : 2;
+	OutFrame.OutputSize = FIntPoint(FMath::Max(Target->SizeX, 1), FMath::Max(Target->SizeY, 1));
+	OutFrame.LowResSize = FIntPoint(FMath::DivideAndRoundUp(OutFrame.OutputSize.X, Downsample), FMath::DivideAndRoundUp(OutFrame.OutputSize.Y, Downsample));
+	// Halton (2,3) within a low resolution pixel, so that over the sequence the history sees all of its full resolution pixels.
+	const uint32 JitterIndex = FrameIndex % RAYMARCH_JITTER_SEQUENCE_LENGTH + 1;
+	const FVector2D Jitter(Halton(JitterIndex, 2) - 0.5f, Halton(JitterIndex, 3) - 0.5f);
+	OutFrame.ProjectionJitter = FVector2D(2.0f * Jitter.X / OutFrame.LowResSize.X, -2.0f * Jitter.Y / OutFrame.LowResSize.Y);
+	// Golden ratio steps, so that no two nearby frames start their rays at about the same offset.
+	OutFrame.RayJitter = FMath::Frac(FrameIndex * 0.618034f);
+	OutFrame.HistoryWeight = FMath::Clamp(Settings.TemporalAccumulation, 0.0f, 0.98f);
+	OutFrame.ProjectionMatrix = ProjectionMatrix;
+	OutFrame.Volumes.Reset();
+	return Entry->Reconstruction;
+}
+
+void FRaymarchReconstruction::ReleaseAll_GameThread()
+{
+	check(IsInGameThread());
+	TArray<FRaymarchReconstructionPtr> Released;
+	for (FRaymarchReconstructionEntry& Entry : GReconstructions)
+	{
+		Released.Add(Entry.Reconstruction);
+	}
+	GReconstructions.Empty();
+	if (Released.Num() == 0)
+	{
+		return;
+	}
+	// After the draws still using them. A reconstruction that gets drawn with again just creates its targets anew.
+	ENQUEUE_RENDER_COMMAND(ReleaseRaymarchReconstructionsCommand)(
+		[Released](FRHICommandListImmediate& RHICmdList) mutable
+	{
+		for (FRaymarchReconstructionPtr& Reconstruction : Released)
+		{
+			Reconstruction->Release_RenderThread();
+		}
+		Released.Empty();
+	});
+}
+
+void FRaymarchReconstruction::Release_RenderThread()
+{
+	check(IsInRenderingThread());
+	LowResColor.SafeRelease();
+	LowResDepth.SafeRelease();
+	History[0].SafeRelease();
+	History[1].SafeRelease();
+	bHistoryValid = false;
+	PreviousVolumes.Empty();
+}
+
+// Creates a 2D texture the volumes can be drawn into and read from afterwards.
+static FTexture2DRHIRef CreateReconstructionTexture_RenderThread(FIntPoint Size)
+{
+	FRHIResourceCreateInfo CreateInfo;
+	CreateInfo.ClearValueBinding = FClearValueBinding::Transparent;
+	return RHICreateTexture2D(Size.X, Size.Y, PF_FloatRGBA, 1, 1, TexCreate_RenderTargetable | TexCreate_ShaderResource, CreateInfo);
+}
+
+void FRaymarchReconstruction::BeginLowResolution_RenderThread(FRHICommandListImmediate& RHICmdList, const FRaymarchReconstructionFrame& Frame)
+{
+	check(IsInRenderingThread());
+
+	if (!LowResColor || LowResColor->GetSizeXY() != Frame.LowResSize)
+	{
+		LowResColor = CreateReconstructionTexture_RenderThread(Frame.LowResSize);
+		LowResDepth = CreateReconstructionTexture_RenderThread(Frame.LowResSize);
+	}
+	if (!History[0] || History[0]->GetSizeXY() != Frame.OutputSize)
+	{
+		History[0] = CreateReconstructionTexture_RenderThread(Frame.OutputSize);
+		History[1] = CreateReconstructionTexture_RenderThread(Frame.OutputSize);
+		bHistoryValid = false;
+	}
+
+	FRHIRenderTargetView Views[2] =
+	{
+		FRHIRenderTargetView(LowResColor, ERenderTargetLoadAction::EClear),
+		FRHIRenderTargetView(LowResDepth, ERenderTargetLoadAction::EClear)
+	};
+	RHICmdList.SetRenderTargetsAndClear(FRHISetRenderTargetsInfo(ARRAY_COUNT(Views), Views, FRHIDepthRenderTargetView()));
+}
+
+void FRaymarchReconstruction::Resolve_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const FRaymarchReconstructionFrame& Frame,
+	FTextureRenderTargetResource* Output,
+	FTextureRenderTargetResource* SceneDepth,
+	ERaymarchSceneDepthChannel SceneDepthChannel,
+	ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+
+	// Done drawing into the low resolution targets, make them readable.
+	RHICmdList.CopyToResolveTarget(LowResColor, LowResColor, true, FResolveParams());
+	RHICmdList.CopyToResolveTarget(LowResDepth, LowResDepth, true, FResolveParams());
+
+	// A point at a known view depth of this frame goes back into the volume's object space through the current camera
+	// model and out into the previous frame's clip space through the previous one. Volumes that weren't there get
+	// a zero matrix, the shader takes that as no history.
+	TArray<FMatrix> Reprojections;
+	for (int32 i = 0; i < FMath::Min(Frame.Volumes.Num(), RAYMARCH_MAX_RECONSTRUCTION_VOLUMES); ++i)
+	{
+		const FRaymarchReprojectedVolume& Current = Frame.Volumes[i];
+		const FRaymarchReprojectedVolume* Previous = PreviousVolumes.FindByPredicate([&Current](const FRaymarchReprojectedVolume& Candidate)
+		{
+			return Candidate.Volume == Current.Volume;
+		});
+		FMatrix Reprojection(ForceInitToZero);
+		if (Previous)
+		{
+			const FCompiledCameraModel& Now = Current.CameraModel;
+			const FCompiledCameraModel& Before = Previous->CameraModel;
+			Reprojection = (Now.ModelMatrix * Now.ViewMatrix).Inverse() * Before.ModelMatrix * Before.ViewMatrix * Before.ProjectionMatrix;
+		}
+		Reprojections.Add(Reprojection);
+	}
+
+	const int32 WriteHistory = CurrentHistory ^ 1;
+	FTextureRHIParamRef Targets[2] = { Output->GetRenderTargetTexture(), History[WriteHistory] };
+	SetRenderTargets(RHICmdList, ARRAY_COUNT(Targets), Targets, FTextureRHIRef(), 0, nullptr);
+	RHICmdList.SetViewport(0, 0, 0.f, Frame.OutputSize.X, Frame.OutputSize.Y, 1.f);
+
+	TShaderMap<FGlobalShaderType>* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
+	TShaderMapRef<FRaymarchResolveVS> VertexShader(GlobalShaderMap);
+	TShaderMapRef<FRaymarchResolvePS> PixelShader(GlobalShaderMap);
+
+	// Every pixel is overwritten, nothing to blend or test.
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+	GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_None>::GetRHI();
+	GraphicsPSOInit.PrimitiveType = PT_TriangleStrip;
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = GETSAFERHISHADER_VERTEX(*VertexShader);
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = GETSAFERHISHADER_PIXEL(*PixelShader);
+	SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+	PixelShader->SetImages(RHICmdList, LowResColor, LowResDepth, History[CurrentHistory], Frame.LowResSize, Frame.OutputSize, Frame.ProjectionJitter);
+	PixelShader->SetSceneDepth(RHICmdList, SceneDepth ? SceneDepth->TextureRHI.GetReference() : nullptr, SceneDepthChannel);
+	PixelShader->SetReprojection(RHICmdList, Frame.ProjectionMatrix, Reprojections, bHistoryValid ? Frame.HistoryWeight : 0.0f);
+
+	static const FVector4 Quad[4] =
+	{
+		FVector4(-1.0f, 1.0f, 0.0f, 1.0f),
+		FVector4(1.0f, 1.0f, 0.0f, 1.0f),
+		FVector4(-1.0f, -1.0f, 0.0f, 1.0f),
+		FVector4(1.0f, -1.0f, 0.0f, 1.0f)
+	};
+	DrawPrimitiveUP(RHICmdList, PT_TriangleStrip, 2, Quad, sizeof(FVector4));
+
+	RHICmdList.CopyToResolveTarget(Output->GetRenderTargetTexture(), Output->TextureRHI, false, FResolveParams());
+	RHICmdList.CopyToResolveTarget(History[WriteHistory], History[WriteHistory], true, FResolveParams());
+
+	CurrentHistory = WriteHistory;
+	bHistoryValid = true;
+	PreviousVolumes = Frame.Volumes;
+}
+
+#undef LOCTEXT_NAMESPACE
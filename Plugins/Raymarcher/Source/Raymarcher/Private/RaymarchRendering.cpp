@@ -1,105 +1,504 @@
 // Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
 
 #include "../Public/RaymarchRendering.h"
+#include "../Public/RaymarchBrickPager.h"
+#include "../Public/RaymarchReconstruction.h"
+#include "../Public/RaymarchProfiling.h"
+#include "../Public/Raymarcher.h"
+
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
 
 #define LOCTEXT_NAMESPACE "RaymarchPlugin"
 
 IMPLEMENT_SHADER_TYPE(, FRaymarchVS, TEXT("/Plugin/Raymarcher/Private/RaymarchShader.usf"), TEXT("MainVS"), SF_Vertex)
 IMPLEMENT_SHADER_TYPE(, FRaymarchPS, TEXT("/Plugin/Raymarcher/Private/RaymarchShader.usf"), TEXT("MainPS"), SF_Pixel)
+IMPLEMENT_SHADER_TYPE(, FRaymarchCountingPS, TEXT("/Plugin/Raymarcher/Private/RaymarchShader.usf"), TEXT("MainPS"), SF_Pixel)
 
 // Initialize static RenderThreadResources members.
 FVector4 RenderThreadResources::CubeVertices[CUBE_VERTEX_CNT] = {};
 FIntVector RenderThreadResources::CubeElements[CUBE_TRIANGLE_CNT] = {};
 bool RenderThreadResources::initialized = false;
-FTexture3DRHIRef RenderThreadResources::VolumeTextureRef = nullptr;
-FTexture2DRHIRef RenderThreadResources::DepthTextureRef = nullptr;
 
-// The render thread side of creating a 3d texture. Done on the render thread because it's a render thread resource being set.
-void Create3DTexture_RenderThread(
+/** Keeps a dataset that was swapped out of a volume alive until the frames still drawing it are done. */
+struct FRaymarchDatasetCleanup : public FDeferredCleanupInterface
+{
+	explicit FRaymarchDatasetCleanup(FRaymarchVolumeDataset&& InDataset)
+		: Dataset(MoveTemp(InDataset))
+	{ }
+
+	FRaymarchVolumeDataset Dataset;
+};
+
+FRaymarchVolumeRenderData::~FRaymarchVolumeRenderData()
+{
+	// Owners release the volume on the render thread before letting go of it, see ReleaseDefaultRaymarchVolume_GameThread.
+	check(!IsInitialized());
+}
+
+void FRaymarchVolumeRenderData::ReleaseRHI()
+{
+	// Loads still running get dropped once they're done.
+	LatestTicket.Increment();
+	BeginCleanup(new FRaymarchDatasetCleanup(MoveTemp(static_cast<FRaymarchVolumeDataset&>(*this))));
+	static_cast<FRaymarchVolumeDataset&>(*this) = FRaymarchVolumeDataset();
+}
+
+bool FRaymarchVolumeRenderData::SwapDataset_RenderThread(FRaymarchVolumeDataset&& Dataset, int32 Ticket)
+{
+	check(IsInRenderingThread());
+	if (!IsInitialized() || IsSuperseded_AnyThread(Ticket))
+	{
+		return false;
+	}
+
+	// Draws already enqueued may still be using the previous textures, the cleanup lets go of them a frame later.
+	BeginCleanup(new FRaymarchDatasetCleanup(MoveTemp(static_cast<FRaymarchVolumeDataset&>(*this))));
+	static_cast<FRaymarchVolumeDataset&>(*this) = MoveTemp(Dataset);
+	ShownTicket = Ticket;
+	return true;
+}
+
+FTexture3DRHIRef CreateEmpty3DTexture_RenderThread(
 	FRHICommandListImmediate& RHICmdList,
-	uint8* RawData,
-	FIntVector DataDimensions) {
+	FIntVector Dimensions,
+	EPixelFormat PixelFormat,
+	uint32 NumMips) {
 
 	check(IsInRenderingThread());
 
 	FRHIResourceCreateInfo CreateInfo;
-	RenderThreadResources::VolumeTextureRef = RHICreateTexture3D(
-		DataDimensions.X, // Dimension X
-		DataDimensions.Y, // Dimension Y
-		DataDimensions.Z, // Dimension Z
-		PF_G8,		// Pixel format G8 (unsigned byte)
-		1,			// Mipmaps (just one)
+	return RHICreateTexture3D(
+		Dimensions.X, // Dimension X
+		Dimensions.Y, // Dimension Y
+		Dimensions.Z, // Dimension Z
+		PixelFormat,	// Pixel format (G8, G16, R16F, R32F or BC4)
+		NumMips,	// Mipmaps
 		TexCreate_ShaderResource, // Flags - don't know if this is necessary, but the flag is there and it works...
 		CreateInfo);
+}
+
+void Update3DTextureSlab_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FTexture3DRHIParamRef Texture,
+	const uint8* SlabData,
+	int32 FirstSlice,
+	int32 SliceCount,
+	uint32 MipLevel) {
+
+	check(IsInRenderingThread());
+	RAYMARCH_SCOPED_STAGE(RHICmdList, Upload);
 
-	// Size of an U8 (surprisingy equals one, just keeping this here to remember that the strides are in bytes).
-	unsigned u8size = 1;
-	// Now actually fill it with data. There is also updateBegin/End functions for incremental update, but since we have the whole chunk of
-	// data, just fill it in one go.
-	const FUpdateTextureRegion3D UpdateRegion(FIntVector::ZeroValue, FIntVector::ZeroValue, DataDimensions);
-	RHIUpdateTexture3D(RenderThreadResources::VolumeTextureRef, 0, UpdateRegion, DataDimensions.X * u8size, DataDimensions.X * DataDimensions.Y * u8size, RawData);
+	// The strides are in bytes, and in rows of blocks for block compressed formats (a block is one voxel otherwise).
+	const FPixelFormatInfo& Format = GPixelFormats[Texture->GetFormat()];
+	const FIntVector Size(FMath::Max(Texture->GetSizeX() >> MipLevel, 1u), FMath::Max(Texture->GetSizeY() >> MipLevel, 1u), SliceCount);
+	const uint32 RowPitch = FMath::DivideAndRoundUp(Size.X, Format.BlockSizeX) * Format.BlockBytes;
+	const uint32 DepthPitch = FMath::DivideAndRoundUp(Size.Y, Format.BlockSizeY) * RowPitch;
+	FRaymarchProfiler::Get().AddUploadedBytes_RenderThread(uint64(DepthPitch) * Size.Z);
+	// Only update the slices of this slab - destination starts at FirstSlice, source is the start of the slab.
+	const FUpdateTextureRegion3D UpdateRegion(FIntVector(0, 0, FirstSlice), FIntVector::ZeroValue, Size);
+	RHIUpdateTexture3D(Texture, MipLevel, UpdateRegion, RowPitch, DepthPitch, SlabData);
 }
 
-// Performs actual pipeline settings and rendering commands to draw the raymarched volume.
-static void RenderRaymarchToRenderTarget_RenderThread(
+void Update3DTextureBricks_RenderThread(
 	FRHICommandListImmediate& RHICmdList,
-	const FCompiledCameraModel& CompiledCameraModel,
-	const FName& TextureRenderTargetName,
-	FTextureRenderTargetResource* OutTextureRenderTargetResource,
-	ERHIFeatureLevel::Type FeatureLevel)
+	FTexture3DRHIParamRef Texture,
+	const uint8* VolumeData,
+	int32 BrickSize,
+	const TArray<FIntVector>& Bricks) {
+
+	check(IsInRenderingThread());
+	RAYMARCH_SCOPED_STAGE(RHICmdList, Upload);
+
+	const uint32 VoxelSize = GPixelFormats[Texture->GetFormat()].BlockBytes;
+	const FIntVector Dimensions(Texture->GetSizeX(), Texture->GetSizeY(), Texture->GetSizeZ());
+	const uint32 RowPitch = Dimensions.X * VoxelSize;
+	const uint32 DepthPitch = Dimensions.Y * RowPitch;
+	for (int32 First = 0; First < Bricks.Num();)
+	{
+		// Bricks in a row along X go up in one box.
+		int32 Last = First;
+		while (Last + 1 < Bricks.Num() && Bricks[Last + 1] == Bricks[Last] + FIntVector(1, 0, 0))
+		{
+			++Last;
+		}
+
+		const FIntVector Origin = Bricks[First] * BrickSize;
+		const FIntVector End(FMath::Min((Bricks[Last].X + 1) * BrickSize, Dimensions.X),
+			FMath::Min(Origin.Y + BrickSize, Dimensions.Y), FMath::Min(Origin.Z + BrickSize, Dimensions.Z));
+		const FIntVector Size = End - Origin;
+		FRaymarchProfiler::Get().AddUploadedBytes_RenderThread(uint64(Size.X) * Size.Y * Size.Z * VoxelSize);
+		// The source starts at the box and keeps the pitches of the whole volume.
+		const uint8* Source = VolumeData + Origin.X * VoxelSize + Origin.Y * uint64(RowPitch) + Origin.Z * uint64(DepthPitch);
+		const FUpdateTextureRegion3D UpdateRegion(Origin, FIntVector::ZeroValue, Size);
+		RHIUpdateTexture3D(Texture, 0, UpdateRegion, RowPitch, DepthPitch, Source);
+		First = Last + 1;
+	}
+}
+
+FTexture3DRHIRef CreateMacroCellTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const FRaymarchMacroCellGrid& Grid) {
+
+	check(IsInRenderingThread());
+	check(Grid.IsValid());
+
+	FRHIResourceCreateInfo CreateInfo;
+	FTexture3DRHIRef Texture = RHICreateTexture3D(
+		Grid.CellDimensions.X,
+		Grid.CellDimensions.Y,
+		Grid.CellDimensions.Z,
+		PF_G32R32F,	// (Min, Max) as floats, so it works for any volume format.
+		1,
+		TexCreate_ShaderResource,
+		CreateInfo);
+
+	// FVector2D is exactly two floats, so the array can be uploaded as is.
+	const FUpdateTextureRegion3D UpdateRegion(FIntVector::ZeroValue, FIntVector::ZeroValue, Grid.CellDimensions);
+	RHIUpdateTexture3D(Texture, 0, UpdateRegion, Grid.CellDimensions.X * sizeof(FVector2D),
+		Grid.CellDimensions.X * Grid.CellDimensions.Y * sizeof(FVector2D), reinterpret_cast<const uint8*>(Grid.MinMax.GetData()));
+	return Texture;
+}
+
+FTexture3DRHIRef CreateBrickIndirectionTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const FRaymarchBrickLayout& Layout,
+	const TArray<FColor>& Indirection) {
+
+	check(IsInRenderingThread());
+	check(Indirection.Num() == Layout.GetBrickCount());
+
+	FRHIResourceCreateInfo CreateInfo;
+	FTexture3DRHIRef Texture = RHICreateTexture3D(
+		Layout.BrickCounts.X,
+		Layout.BrickCounts.Y,
+		Layout.BrickCounts.Z,
+		PF_B8G8R8A8,	// FColor's memory layout, so the shader gets slot XYZ in RGB.
+		1,
+		TexCreate_ShaderResource,
+		CreateInfo);
+
+	const FUpdateTextureRegion3D UpdateRegion(FIntVector::ZeroValue, FIntVector::ZeroValue, Layout.BrickCounts);
+	RHIUpdateTexture3D(Texture, 0, UpdateRegion, Layout.BrickCounts.X * sizeof(FColor),
+		Layout.BrickCounts.X * Layout.BrickCounts.Y * sizeof(FColor), reinterpret_cast<const uint8*>(Indirection.GetData()));
+	return Texture;
+}
+
+FTexture3DRHIRef CreateGradientTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FIntVector Dimensions,
+	const FColor* Gradients) {
+
+	check(IsInRenderingThread());
+
+	// FColor's memory layout, so the shader gets the direction in RGB and the magnitude in A.
+	FTexture3DRHIRef Texture = CreateEmpty3DTexture_RenderThread(RHICmdList, Dimensions, PF_B8G8R8A8);
+	if (Gradients)
+	{
+		Update3DTextureSlab_RenderThread(RHICmdList, Texture, reinterpret_cast<const uint8*>(Gradients), 0, Dimensions.Z);
+	}
+	return Texture;
+}
+
+// Creates a 2D texture if the existing one doesn't have the right size or format and fills it with tightly packed texels.
+template<typename TexelType>
+static void UpdateTexture2D_RenderThread(FTexture2DRHIRef& Texture, int32 SizeX, int32 SizeY, EPixelFormat Format, const TArray<TexelType>& Texels)
 {
+	check(Texels.Num() == SizeX * SizeY);
+	check(GPixelFormats[Format].BlockBytes == sizeof(TexelType));
+	if (!Texture || Texture->GetSizeX() != SizeX || Texture->GetSizeY() != SizeY || Texture->GetFormat() != Format)
+	{
+		FRHIResourceCreateInfo CreateInfo;
+		Texture = RHICreateTexture2D(SizeX, SizeY, Format, 1, 1, TexCreate_ShaderResource, CreateInfo);
+	}
+	const FUpdateTextureRegion2D UpdateRegion(0, 0, 0, 0, SizeX, SizeY);
+	RHIUpdateTexture2D(Texture, 0, UpdateRegion, SizeX * sizeof(TexelType), reinterpret_cast<const uint8*>(Texels.GetData()));
+}
+
+void UpdateTransferFunctionTextures_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchTransferFunctionRenderData& TransferFunction,
+	const TArray<FFloat16Color>& Lut,
+	const TArray<FFloat16Color>& PreIntegrationTable,
+	const TArray<FFloat16Color>& Lut2D,
+	int32 GradientSize) {
+
 	check(IsInRenderingThread());
+	check(PreIntegrationTable.Num() == Lut.Num() * Lut.Num());
+	check(Lut2D.Num() == 0 || Lut2D.Num() == Lut.Num() * GradientSize);
 
-	// Set render target to our color texture, depth RT to our depth texture.
-	SetRenderTarget(
-		RHICmdList,
-		OutTextureRenderTargetResource->GetRenderTargetTexture(),	// Color render target - our texture
-		RenderThreadResources::DepthTextureRef,						// Depth render target - our created depth texture
-		ESimpleRenderTargetMode::EClearColorAndDepth);				// Clear both color and depth
+	UpdateTexture2D_RenderThread(TransferFunction.LutTexture, Lut.Num(), 1, PF_FloatRGBA, Lut);
+	UpdateTexture2D_RenderThread(TransferFunction.PreIntegrationTexture, Lut.Num(), Lut.Num(), PF_FloatRGBA, PreIntegrationTable);
+	if (Lut2D.Num() > 0)
+	{
+		UpdateTexture2D_RenderThread(TransferFunction.Lut2DTexture, Lut.Num(), GradientSize, PF_FloatRGBA, Lut2D);
+	}
+	else
+	{
+		TransferFunction.Lut2DTexture.SafeRelease();
+	}
 
-	// Set viewport size.
-	RHICmdList.SetViewport(
-		0, 0, 0.f, OutTextureRenderTargetResource->GetSizeX(), OutTextureRenderTargetResource->GetSizeY(), 1.f);
-	
-	// Get shaders.
+	// Skipping has to hold for whichever table the shader ends up classifying with, so take the highest opacity of
+	// every intensity over the 1D table and all rows of the 2D one.
+	TArray<float> Opacities;
+	Opacities.SetNumUninitialized(Lut.Num());
+	for (int32 i = 0; i < Lut.Num(); ++i)
+	{
+		Opacities[i] = Lut[i].A.GetFloat();
+	}
+	for (int32 i = 0; i < Lut2D.Num(); ++i)
+	{
+		float& Opacity = Opacities[i % Lut.Num()];
+		Opacity = FMath::Max(Opacity, Lut2D[i].A.GetFloat());
+	}
+	TArray<float> MaxOpacityTable;
+	BuildMaxOpacityTable(Opacities, MaxOpacityTable);
+	TArray<FFloat16> MaxOpacityTexels;
+	MaxOpacityTexels.Reserve(MaxOpacityTable.Num());
+	for (float Opacity : MaxOpacityTable)
+	{
+		MaxOpacityTexels.Add(FFloat16(Opacity));
+	}
+	UpdateTexture2D_RenderThread(TransferFunction.MaxOpacityTexture, Lut.Num(), Lut.Num(), PF_R16F, MaxOpacityTexels);
+}
+
+/** One volume of a batch, ready for the render thread. */
+struct FRaymarchVolumeDrawInstance
+{
+	FRaymarchVolumeRenderDataPtr Volume;
+	// Null for the plain grey volume.
+	FRaymarchTransferFunctionRenderDataPtr TransferFunction;
+	// Camera relative to this volume (model matrix and ray origin differ between volumes), one per view.
+	TArray<FCompiledCameraModel, TInlineAllocator<2>> CameraModels;
+};
+
+// Every compositing mode can skip with macro cells, only what counts as empty differs (see CanSkipMacroCell): front to
+// back skips cells the transfer function maps to zero opacity (see MaxOpacityTexture), additive and average cells
+// windowed to zero, and the projections cells that can't change the ray anymore.
+static bool CanSkipEmptySpace(const FRaymarchVolumeDrawInstance& Draw)
+{
+	return Draw.Volume->MacroCellTexture.IsValid();
+}
+
+// Picks the pixel shader permutation that draws a volume with the given settings.
+static FRaymarchShader::FPixelPermutationDomain GetRaymarchPermutation(
+	const FRaymarchVolumeDrawInstance& Draw,
+	const FRaymarchRenderSettings& Settings)
+{
+	FRaymarchShader::FPixelPermutationDomain PermutationVector;
+	PermutationVector.Set<FRaymarchShader::FCompositingModeDim>(int32(Settings.CompositingMode));
+	PermutationVector.Set<FRaymarchShader::FBrickPoolDim>(Draw.Volume->BrickIndirectionTexture.IsValid());
+	PermutationVector.Set<FRaymarchShader::FEmptySpaceSkippingDim>(CanSkipEmptySpace(Draw));
+	PermutationVector.Set<FRaymarchShader::FShadingDim>(Settings.bShading && Draw.Volume->GradientTexture.IsValid()
+		&& Settings.CompositingMode == ERaymarchCompositingMode::FrontToBack);
+	return PermutationVector;
+}
+
+// Sets everything that differs between volumes but not between views. The shared state (pipeline, render target) has to be set already.
+static void SetVolumeParameters_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchShader* PixelShader,
+	const FRaymarchVolumeDrawInstance& Draw,
+	const FRaymarchRenderSettings& Settings)
+{
+	const FRaymarchVolumeRenderData& Volume = *Draw.Volume;
+	const FRaymarchTransferFunctionRenderData* TransferFunction = Draw.TransferFunction.Get();
+
+	PixelShader->SetRaymarchParameters(RHICmdList, PixelShader->GetPixelShader(), Settings, Volume.VolumeDimensions);
+	// Set the actual volume texture to the Pixel shader.
+	PixelShader->SetTexture(RHICmdList, PixelShader->GetPixelShader(), Volume.VolumeTexture);
+	PixelShader->SetWindow(RHICmdList, PixelShader->GetPixelShader(), Volume.WindowScaleBias, Volume.ValueRange);
+	PixelShader->SetMacroCells(RHICmdList, PixelShader->GetPixelShader(), CanSkipEmptySpace(Draw) ? Volume.MacroCellTexture : FTexture3DRHIRef());
+	PixelShader->SetBrickPool(RHICmdList, PixelShader->GetPixelShader(), Volume.BrickIndirectionTexture,
+		Volume.BrickLayout, Volume.BrickAtlasDimensions);
+	PixelShader->SetTransferFunction(RHICmdList, PixelShader->GetPixelShader(), TransferFunction, Settings.bPreIntegrate);
+	PixelShader->SetGradients(RHICmdList, PixelShader->GetPixelShader(), Volume.GradientTexture, Settings);
+}
+
+// Sets the camera of one view of a volume.
+static void SetViewParameters_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchVS* VertexShader,
+	FRaymarchShader* PixelShader,
+	const FRaymarchVolumeRenderData& Volume,
+	const FCompiledCameraModel& CameraModel,
+	int32 ViewportHeight)
+{
+	// Update shader uniform parameters. It looks like we're setting all paramaters to both shaders, but unused stuff gets optimized out.
+	VertexShader->SetParameters(RHICmdList, VertexShader->GetVertexShader(), CameraModel);
+	PixelShader->SetParameters(RHICmdList, PixelShader->GetPixelShader(), CameraModel);
+	PixelShader->SetLodParameters(RHICmdList, PixelShader->GetPixelShader(), CameraModel.ProjectionMatrix,
+		ViewportHeight, Volume.VolumeDimensions, Volume.VolumeTexture->GetNumMips());
+}
+
+// Draws the volumes into the render targets that are set, every view into its own viewport. Draws are expected back to front.
+// Volumes are the outer loop, so their textures are bound once for all views. Viewports don't overlap, so every one of them
+// still sees the volumes back to front.
+// Every volume is drawn with the pixel shader permutation for its configuration. The pipeline state only changes when a
+// volume needs another permutation than the one before, so batches of alike volumes still share one.
+// TPixelShader is FRaymarchPS, or FRaymarchCountingPS for the counting pass of the profiler (with its own blend state).
+template<typename TPixelShader>
+static void DrawRaymarchVolumesWithShader_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const TArray<FRaymarchVolumeDrawInstance>& Draws,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint TargetSize,
+	const TArray<FIntRect>& Viewports,
+	FTextureRenderTargetResource* SceneDepthResource,
+	const FRaymarchReconstructionFrame* Reconstruction,
+	FBlendStateRHIParamRef BlendState,
+	ERHIFeatureLevel::Type FeatureLevel)
+{
+	// Set viewport size. With a single view it stays for all volumes.
+	RHICmdList.SetViewport(Viewports[0].Min.X, Viewports[0].Min.Y, 0.f, Viewports[0].Max.X, Viewports[0].Max.Y, 1.f);
+
+	// Get shaders. The pixel shader depends on the volume.
 	TShaderMap<FGlobalShaderType>* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
 	TShaderMapRef< FRaymarchVS > VertexShader(GlobalShaderMap);
-	TShaderMapRef< FRaymarchPS > PixelShader(GlobalShaderMap);
 
-	// Set the graphic pipeline state.
+	// Set up the graphic pipeline state. Everything but the pixel shader is the same for all volumes.
 	FGraphicsPipelineStateInitializer GraphicsPSOInit;
 	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
-	// Enable depth-test with NearOrEqual condition.
-	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<true, CF_DepthNearOrEqual>::GetRHI();
-	// Enable blend for colors & alpha, mixed by adding source/dest alpha
-	GraphicsPSOInit.BlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_SourceAlpha, BF_DestAlpha>::GetRHI();
+	// No depth test, volumes are blended over each other instead (a cube in front doesn't hide the one behind it).
+	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+	GraphicsPSOInit.BlendState = BlendState;
 	// Rasterizer settings - solid fill & culling CW triangles ( CW == only render back-faces -> singlepass raycasting works inside the volume too! )
 	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI();
 	// Rendering a list of triangles.
 	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
 	// Declare that vertices are 4 float vectors
 	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
-	// Bind shaders to the pipeline we're creating.
 	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = GETSAFERHISHADER_VERTEX(*VertexShader);
-	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = GETSAFERHISHADER_PIXEL(*PixelShader);
-	// Apply all the initializer settings.
-	SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
-	
-	// Update shader uniform parameters. It looks like we're setting all paramaters to both shaders, but unused stuff gets optimized out.
-	VertexShader->SetParameters(RHICmdList, VertexShader->GetVertexShader(), CompiledCameraModel);
-	PixelShader->SetParameters(RHICmdList, PixelShader->GetPixelShader(), CompiledCameraModel);
 
-	if (RenderThreadResources::VolumeTextureRef) {
-		// Set the actual volume texture to the Pixel shader.
-		PixelShader->SetTexture(RHICmdList, PixelShader->GetPixelShader(), RenderThreadResources::VolumeTextureRef);
+	TPixelShader* PixelShader = nullptr;
+	int32 BoundPermutationId = INDEX_NONE;
+	for (int32 DrawIndex = 0; DrawIndex < Draws.Num(); ++DrawIndex)
+	{
+		const FRaymarchVolumeDrawInstance& Draw = Draws[DrawIndex];
+		// Volumes that are still loading have nothing to draw.
+		if (!Draw.Volume->VolumeTexture)
+		{
+			continue;
+		}
+
+		const typename TPixelShader::FPermutationDomain PermutationVector = GetRaymarchPermutation(Draw, Settings);
+		if (PermutationVector.ToDimensionValueId() != BoundPermutationId)
+		{
+			TShaderMapRef< TPixelShader > PermutationShader(GlobalShaderMap, PermutationVector);
+			PixelShader = *PermutationShader;
+			BoundPermutationId = PermutationVector.ToDimensionValueId();
+			// Bind shaders to the pipeline and apply all the initializer settings.
+			GraphicsPSOInit.BoundShaderState.PixelShaderRHI = GETSAFERHISHADER_PIXEL(PixelShader);
+			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
+
+			// The scene depth is the same for all volumes, the shader converts it into each one's object space on its own.
+			// It covers the whole target like the views do, so it's looked up by the pixel position in the target.
+			// Parameters belong to the shader, so they're set again for every permutation.
+			PixelShader->SetSceneDepth(RHICmdList, PixelShader->GetPixelShader(),
+				SceneDepthResource ? SceneDepthResource->TextureRHI.GetReference() : nullptr, Settings.SceneDepthChannel, TargetSize);
+			PixelShader->SetReducedResolution(RHICmdList, PixelShader->GetPixelShader(),
+				Reconstruction != nullptr, Reconstruction ? Reconstruction->RayJitter : 0.0f);
+		}
+
+		SetVolumeParameters_RenderThread(RHICmdList, PixelShader, Draw, Settings);
+		PixelShader->SetVolumeIndex(RHICmdList, PixelShader->GetPixelShader(), DrawIndex);
+
+		for (int32 ViewIndex = 0; ViewIndex < Viewports.Num(); ++ViewIndex)
+		{
+			const FIntRect& Viewport = Viewports[ViewIndex];
+			if (Viewports.Num() > 1)
+			{
+				RHICmdList.SetViewport(Viewport.Min.X, Viewport.Min.Y, 0.f, Viewport.Max.X, Viewport.Max.Y, 1.f);
+			}
+			SetViewParameters_RenderThread(RHICmdList, *VertexShader, PixelShader, *Draw.Volume, Draw.CameraModels[ViewIndex], Viewport.Height());
+
+			// Let the magic happen.
+			DrawIndexedPrimitiveUP(RHICmdList, PT_TriangleList, 0, CUBE_VERTEX_CNT, CUBE_TRIANGLE_CNT, RenderThreadResources::CubeElements, sizeof(FIntVector), RenderThreadResources::CubeVertices, sizeof(FVector4));
+		}
 	}
-	else {
-		// Fallback - If the texture doesn't exist, set black.
-		PixelShader->SetTexture(RHICmdList, PixelShader->GetPixelShader(), (FTexture3DRHIParamRef)(FTextureRHIParamRef)GBlackVolumeTexture->TextureRHI);
+}
+
+// Draws the volumes into the render targets that are set, see DrawRaymarchVolumesWithShader_RenderThread. When the profiler
+// counts samples, the draws are repeated into its counting target afterwards (so the targets that are set change).
+static void DrawRaymarchVolumes_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const TArray<FRaymarchVolumeDrawInstance>& Draws,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint TargetSize,
+	const TArray<FIntRect>& Viewports,
+	FTextureRenderTargetResource* SceneDepthResource,
+	const FRaymarchReconstructionFrame* Reconstruction,
+	ERHIFeatureLevel::Type FeatureLevel)
+{
+	{
+		RAYMARCH_SCOPED_STAGE(RHICmdList, Draw);
+		// Blend volumes back to front with the "over" operator. With a single volume over a cleared target, it's the same as plain source alpha.
+		// The second target (reduced resolution only) gets replaced wherever a volume covers it, so the front-most one stays.
+		DrawRaymarchVolumesWithShader_RenderThread<FRaymarchPS>(RHICmdList, Draws, Settings, TargetSize, Viewports, SceneDepthResource,
+			Reconstruction, TStaticBlendState<
+				CW_RGBA, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha, BO_Add, BF_One, BF_InverseSourceAlpha,
+				CW_RGBA, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha, BO_Add, BF_One, BF_InverseSourceAlpha>::GetRHI(),
+			FeatureLevel);
+	}
+
+	FRaymarchProfiler& Profiler = FRaymarchProfiler::Get();
+	int32 VolumesDrawn = 0;
+	for (const FRaymarchVolumeDrawInstance& Draw : Draws)
+	{
+		VolumesDrawn += Draw.Volume->VolumeTexture ? Viewports.Num() : 0;
+	}
+	Profiler.AddVolumesDrawn_RenderThread(VolumesDrawn);
+	if (Profiler.ShouldCountSamples_RenderThread())
+	{
+		// Counts of all pixels of all volumes add up, wherever they overlap.
+		SCOPED_DRAW_EVENT(RHICmdList, RaymarchCountSamples);
+		Profiler.BeginCounting_RenderThread(RHICmdList, TargetSize);
+		DrawRaymarchVolumesWithShader_RenderThread<FRaymarchCountingPS>(RHICmdList, Draws, Settings, TargetSize, Viewports, SceneDepthResource,
+			Reconstruction, TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI(), FeatureLevel);
+		Profiler.EndCounting_RenderThread(RHICmdList, FeatureLevel);
+	}
+}
+
+// Performs actual pipeline settings and rendering commands to draw the raymarched volumes. Draws are expected back to front.
+// With a reconstruction, they're drawn at reduced resolution and upsampled into the render target.
+static void RenderRaymarchVolumesToRenderTarget_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const TArray<FRaymarchVolumeDrawInstance>& Draws,
+	const FRaymarchRenderSettings& Settings,
+	FTextureRenderTargetResource* OutTextureRenderTargetResource,
+	const TArray<FIntRect>& Viewports,
+	FTextureRenderTargetResource* SceneDepthResource,
+	FRaymarchReconstructionPtr Reconstruction,
+	const FRaymarchReconstructionFrame& ReconstructionFrame,
+	ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+
+	if (Reconstruction.IsValid())
+	{
+		Reconstruction->BeginLowResolution_RenderThread(RHICmdList, ReconstructionFrame);
+		// Only single views are reconstructed, they cover the whole target.
+		TArray<FIntRect> LowResViewports;
+		LowResViewports.Add(FIntRect(FIntPoint::ZeroValue, ReconstructionFrame.LowResSize));
+		DrawRaymarchVolumes_RenderThread(RHICmdList, Draws, Settings, ReconstructionFrame.LowResSize, LowResViewports, SceneDepthResource,
+			&ReconstructionFrame, FeatureLevel);
+		RAYMARCH_SCOPED_STAGE(RHICmdList, Reconstruct);
+		Reconstruction->Resolve_RenderThread(RHICmdList, ReconstructionFrame, OutTextureRenderTargetResource,
+			SceneDepthResource, Settings.SceneDepthChannel, FeatureLevel);
+		return;
 	}
 
-	// Let the magic happen. 
-	DrawIndexedPrimitiveUP(RHICmdList, PT_TriangleList, 0, CUBE_VERTEX_CNT, CUBE_TRIANGLE_CNT, RenderThreadResources::CubeElements, sizeof(FIntVector), RenderThreadResources::CubeVertices, sizeof(FVector4));
+	// Set render target to our color texture. Volumes are blended over each other instead of depth-tested, so there's no depth target.
+	SetRenderTarget(
+		RHICmdList,
+		OutTextureRenderTargetResource->GetRenderTargetTexture(),	// Color render target - our texture
+		FTextureRHIRef(),											// No depth render target
+		ESimpleRenderTargetMode::EClearColorExistingDepth);			// Clear color
+
+	DrawRaymarchVolumes_RenderThread(RHICmdList, Draws, Settings,
+		FIntPoint(OutTextureRenderTargetResource->GetSizeX(), OutTextureRenderTargetResource->GetSizeY()), Viewports, SceneDepthResource,
+		nullptr, FeatureLevel);
 
 	// Resolve render target.
 	RHICmdList.CopyToResolveTarget(
@@ -108,65 +507,280 @@ static void RenderRaymarchToRenderTarget_RenderThread(
 		false, FResolveParams());
 }
 
+// File the camera path is written to while recording, null when not recording. Kept open for the whole recording.
+static TUniquePtr<FArchive> GRaymarchCameraPathWriter;
+// Frame the last line was recorded in, so that frames with several draws get a single line.
+static uint64 GRaymarchCameraPathFrame = 0;
+
+static void RecordCameraPath(const TArray<FString>& Args)
+{
+	// Closing the previous recording flushes it.
+	GRaymarchCameraPathWriter.Reset();
+	if (Args.Num() == 0)
+	{
+		MY_LOG("Stopped recording the camera path.");
+		return;
+	}
+
+	const FString PathFile = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / Args[0]);
+	GRaymarchCameraPathWriter.Reset(IFileManager::Get().CreateFileWriter(*PathFile));
+	if (!GRaymarchCameraPathWriter)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Couldn't open %s to record the camera path."), *PathFile);
+		return;
+	}
+	GRaymarchCameraPathFrame = GFrameCounter - 1;
+	MY_LOG("Recording the camera path.");
+}
+
+static FAutoConsoleCommand RecordCameraPathCommand(
+	TEXT("Raymarch.RecordCameraPath"),
+	TEXT("Records the camera relative to the drawn volume every frame, for replaying with Raymarch.Benchmark.BrickCache. ")
+	TEXT("Argument: file relative to Saved, no argument stops recording."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&RecordCameraPath));
+
+// Volume of the single-volume API, lives until the module shuts down.
+static FRaymarchVolumeRenderDataPtr GRaymarchDefaultVolume;
+
+FRaymarchVolumeRenderDataPtr GetDefaultRaymarchVolume_GameThread()
+{
+	check(IsInGameThread());
+	if (!GRaymarchDefaultVolume.IsValid())
+	{
+		GRaymarchDefaultVolume = MakeShareable(new FRaymarchVolumeRenderData());
+		BeginInitResource(GRaymarchDefaultVolume.Get());
+	}
+	return GRaymarchDefaultVolume;
+}
+
+void ReleaseDefaultRaymarchVolume_GameThread()
+{
+	check(IsInGameThread());
+	if (!GRaymarchDefaultVolume.IsValid())
+	{
+		return;
+	}
+	FRaymarchVolumeRenderDataPtr ReleasedVolume = GRaymarchDefaultVolume;
+	GRaymarchDefaultVolume.Reset();
+	ENQUEUE_RENDER_COMMAND(ReleaseDefaultRaymarchVolumeCommand)(
+		[ReleasedVolume](FRHICommandListImmediate& RHICmdList) mutable
+	{
+		ReleasedVolume->ReleaseResource();
+		ReleasedVolume.Reset();
+	});
+}
+
 // CPU-side of getting uniforms ready for the shader.
 void DrawRaymarchToRenderTarget_GameThread(
 	UWorld* World,
 	UTextureRenderTarget2D* OutputRenderTarget,
-	const FTransform Transform)
+	const FTransform Transform,
+	const FRaymarchRenderSettings& Settings)
+{
+	TArray<FRaymarchVolumeDrawDesc> Volumes;
+	Volumes.Add(FRaymarchVolumeDrawDesc{ GetDefaultRaymarchVolume_GameThread(), Transform });
+	DrawRaymarchVolumesToRenderTarget_GameThread(World, OutputRenderTarget, Volumes, Settings);
+}
+
+void DrawRaymarchVolumesToRenderTarget_GameThread(
+	UWorld* World,
+	UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings)
 {
 	check(IsInGameThread());
 
+	// The view is computed once per frame, no matter how many times the volumes get drawn.
+	FRaymarchView View;
+	if (!FRaymarchCameraModelProvider::GetPlayerView_GameThread(World, 0, View))
+	{
+		MY_LOG("Trying to render raymarch without a local player to see it!");
+		return;
+	}
+	DrawRaymarchVolumesFromView_GameThread(World, OutputRenderTarget, Volumes, Settings, View);
+}
+
+void DrawRaymarchVolumesFromView_GameThread(
+	UWorld* World,
+	UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const FRaymarchView& View)
+{
+	TArray<FRaymarchView> Views;
+	Views.Add(View);
+	DrawRaymarchVolumesFromViews_GameThread(World, OutputRenderTarget, Volumes, Settings, Views);
+}
+
+TArray<FIntRect> GetRaymarchViewGrid(FIntPoint TargetSize, int32 ViewCount)
+{
+	// As square as it gets, filled row by row. Two views end up side by side, like the eyes of an HMD.
+	const int32 Columns = FMath::Max(FMath::CeilToInt(FMath::Sqrt(float(ViewCount))), 1);
+	const int32 Rows = FMath::Max(FMath::DivideAndRoundUp(ViewCount, Columns), 1);
+	TArray<FIntRect> Viewports;
+	for (int32 ViewIndex = 0; ViewIndex < ViewCount; ++ViewIndex)
+	{
+		const int32 Column = ViewIndex % Columns;
+		const int32 Row = ViewIndex / Columns;
+		Viewports.Add(FIntRect(
+			TargetSize.X * Column / Columns, TargetSize.Y * Row / Rows,
+			TargetSize.X * (Column + 1) / Columns, TargetSize.Y * (Row + 1) / Rows));
+	}
+	return Viewports;
+}
+
+void DrawRaymarchVolumesFromViews_GameThread(
+	UWorld* World,
+	UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const TArray<FRaymarchView>& Views,
+	const TArray<FIntRect>& InViewports)
+{
+	check(IsInGameThread());
+
+	if (Views.Num() == 0)
+	{
+		return;
+	}
+	if (InViewports.Num() > 0 && InViewports.Num() != Views.Num())
+	{
+		MY_LOG("Trying to render raymarch with a different number of views and viewports!");
+		return;
+	}
+	if (!World || !World->Scene)
+	{
+		MY_LOG("Trying to render raymarch without a world!");
+		return;
+	}
+
 	if (!OutputRenderTarget)
 	{
 		if (GEngine)
 			GEngine->AddOnScreenDebugMessage(-1, 15.0f, FColor::Yellow, TEXT("Trying to render raymarch with render target not set!"));
+		return;
 	}
 
-	// Get texture resource to pass to render thread.
-	const FName TextureRenderTargetName = OutputRenderTarget->GetFName();
+	// Get texture resource to pass to render thread. Render targets that were never initialized (or got released) have none.
 	FTextureRenderTargetResource* TextureRenderTargetResource = OutputRenderTarget->GameThread_GetRenderTargetResource();
-	
-	// The following part is a rudiculously complicated way of getting the view and projection matrices of the FirstPlayer camera.
-	// To be honest, everything except the CalcSceneView could probably be done beforehand instead of every tick.
-	APlayerCameraManager* Manager = World->GetFirstPlayerController()->PlayerCameraManager;
-	ULocalPlayer* LocalPlayer = World->GetFirstLocalPlayerFromController();
-
-	FSceneViewFamilyContext ViewFamily(FSceneViewFamily::ConstructionValues(
-		LocalPlayer->ViewportClient->Viewport,
-		World->Scene, 
-		LocalPlayer->ViewportClient->EngineShowFlags)
-		.SetRealtimeUpdate(true));
-
-	FVector ViewLocation;
-	FRotator ViewRotation;
-	FSceneView* SceneView = LocalPlayer->CalcSceneView(&ViewFamily, ViewLocation, ViewRotation, LocalPlayer->ViewportClient->Viewport);
-
-	// Create a struct with uniforms to pass to shaders on render thread, fill with calculated values.
-	FCompiledCameraModel CompiledCameraModel;
-
-	CompiledCameraModel.ModelMatrix = Transform.ToMatrixWithScale();
-	CompiledCameraModel.ViewMatrix = SceneView->ViewMatrices.GetViewMatrix();
-	CompiledCameraModel.ProjectionMatrix = SceneView->ViewMatrices.GetProjectionMatrix();
-	// Need to put RayOrigin to camera position in Model Space
-	CompiledCameraModel.RayOrigin = Transform.ToInverseMatrixWithScale().TransformPosition(ViewLocation);
+	if (!TextureRenderTargetResource)
+	{
+		MY_LOG("Trying to render raymarch to a render target without a resource!");
+		return;
+	}
+	FTextureRenderTargetResource* SceneDepthResource = nullptr;
+	if (Settings.SceneDepth == OutputRenderTarget)
+	{
+		MY_LOG("Can't clip raymarched volumes against the depth of the render target they're drawn to!");
+	}
+	else if (Settings.SceneDepth)
+	{
+		SceneDepthResource = Settings.SceneDepth->GameThread_GetRenderTargetResource();
+	}
+
+	const FIntPoint TargetSize(OutputRenderTarget->SizeX, OutputRenderTarget->SizeY);
+	const TArray<FIntRect> Viewports = InViewports.Num() > 0 ? InViewports : GetRaymarchViewGrid(TargetSize, Views.Num());
+
+	// All views share one order. Views of one batch are close to each other (eyes, a camera rig), so they'd hardly ever
+	// disagree on it, sorting from their center keeps the order fair to all of them.
+	FVector SortLocation = FVector::ZeroVector;
+	for (const FRaymarchView& View : Views)
+	{
+		SortLocation += View.ViewLocation / Views.Num();
+	}
+
+	// Sort back to front by the distance of the volume centers, so that blending composes them correctly.
+	TArray<TPair<float, FRaymarchVolumeDrawInstance>> SortedDraws;
+	for (const FRaymarchVolumeDrawDesc& Desc : Volumes)
+	{
+		if (!Desc.Volume.IsValid())
+		{
+			continue;
+		}
+		// Create a struct with uniforms to pass to shaders on render thread, only the model part differs between volumes.
+		FRaymarchVolumeDrawInstance Draw;
+		Draw.Volume = Desc.Volume;
+		Draw.TransferFunction = Desc.TransferFunction;
+		for (const FRaymarchView& View : Views)
+		{
+			Draw.CameraModels.Add(View.CompileCameraModel(Desc.Transform));
+		}
+		if (Desc.Pager.IsValid())
+		{
+			// The first view decides which bricks get paged in, views of one batch see about the same anyway.
+			Desc.Pager->Update_GameThread(Draw.CameraModels[0]);
+		}
+		SortedDraws.Add(TPair<float, FRaymarchVolumeDrawInstance>(FVector::DistSquared(Desc.Transform.GetLocation(), SortLocation), Draw));
+	}
+	SortedDraws.Sort([](const TPair<float, FRaymarchVolumeDrawInstance>& A, const TPair<float, FRaymarchVolumeDrawInstance>& B)
+	{
+		return A.Key > B.Key;
+	});
+	TArray<FRaymarchVolumeDrawInstance> Draws;
+	for (const TPair<float, FRaymarchVolumeDrawInstance>& SortedDraw : SortedDraws)
+	{
+		Draws.Add(SortedDraw.Value);
+	}
+
+	// At reduced resolution, the history is reprojected by the camera models as they are, but the rays are shot through
+	// pixel centers that move around a bit every frame.
+	FRaymarchReconstructionPtr Reconstruction;
+	FRaymarchReconstructionFrame ReconstructionFrame;
+	if (Settings.Resolution != ERaymarchResolution::Full && Views.Num() > 1)
+	{
+		// The history is kept for a single view covering the whole target.
+		static bool bWarned = false;
+		if (!bWarned)
+		{
+			UE_LOG(LogRaymarch, Warning, TEXT("Reduced resolution raymarching only works with a single view, drawing %d views at full resolution."), Views.Num());
+			bWarned = true;
+		}
+	}
+	else if (Settings.Resolution != ERaymarchResolution::Full)
+	{
+		Reconstruction = FRaymarchReconstruction::BeginFrame_GameThread(OutputRenderTarget, Settings, Views[0].ProjectionMatrix, ReconstructionFrame);
+		for (FRaymarchVolumeDrawInstance& Draw : Draws)
+		{
+			FCompiledCameraModel& CameraModel = Draw.CameraModels[0];
+			ReconstructionFrame.Volumes.Add(FRaymarchReprojectedVolume{ Draw.Volume.Get(), CameraModel });
+			CameraModel.ProjectionMatrix = ReconstructionFrame.JitterProjection(CameraModel.ProjectionMatrix);
+		}
+	}
+
+	if (GRaymarchCameraPathWriter && Volumes.Num() > 0 && GRaymarchCameraPathFrame != GFrameCounter)
+	{
+		// Eye and view direction of the first view in the object space of the (first) volume, from the first draw of
+		// every frame, one frame per line.
+		GRaymarchCameraPathFrame = GFrameCounter;
+		const FRaymarchView& View = Views[0];
+		const FTransform& Transform = Volumes[0].Transform;
+		const FVector Eye = Transform.ToInverseMatrixWithScale().TransformPosition(View.ViewLocation);
+		const FVector Direction = Transform.InverseTransformVector(View.ViewDirection).GetSafeNormal();
+		const FString Line = FString::Printf(TEXT("%f,%f,%f,%f,%f,%f\n"), Eye.X, Eye.Y, Eye.Z, Direction.X, Direction.Y, Direction.Z);
+		FTCHARToUTF8 LineUTF8(*Line);
+		GRaymarchCameraPathWriter->Serialize(const_cast<ANSICHAR*>(LineUTF8.Get()), LineUTF8.Length());
+	}
 	
 	ERHIFeatureLevel::Type FeatureLevel = World->Scene->GetFeatureLevel();
 
 	// Call the actual rendering code on RenderThread.
 	ENQUEUE_RENDER_COMMAND(CaptureCommand)(
-		[CompiledCameraModel, TextureRenderTargetResource, TextureRenderTargetName, FeatureLevel](FRHICommandListImmediate& RHICmdList)
+		[Draws, Settings, TextureRenderTargetResource, Viewports, SceneDepthResource, Reconstruction, ReconstructionFrame, FeatureLevel](FRHICommandListImmediate& RHICmdList)
 		{
-			RenderRaymarchToRenderTarget_RenderThread(
+			RenderRaymarchVolumesToRenderTarget_RenderThread(
 				RHICmdList,
-				CompiledCameraModel,
-				TextureRenderTargetName,
+				Draws,
+				Settings,
 				TextureRenderTargetResource,
+				Viewports,
+				SceneDepthResource,
+				Reconstruction,
+				ReconstructionFrame,
 				FeatureLevel);
 		}
 	);
 }
 
-
 void InitializeResources_RenderThread(FRHICommandListImmediate& RHICmdList, FTextureRenderTargetResource* TextureRenderTargetResource) {
 	check(IsInRenderingThread());
 
@@ -202,18 +816,6 @@ void InitializeResources_RenderThread(FRHICommandListImmediate& RHICmdList, FTex
 	RenderThreadResources::CubeElements[11] = FIntVector(6, 7, 3);
 	// @note - Triangles are clockwise facing outside -> Cull CCW to render front faces.
 	
-	// Set clear color for the depth render-target texture (DepthFar, so that everything passes the depth-test on a cleared texture).
-	FRHIResourceCreateInfo CreateInfo(FClearValueBinding::DepthFar);
-	// Create the actual depth texture. Same size as the output render target. Notice format == PF_DepthStencil and flags == TexCreate_DepthStencilTargetable
-	RenderThreadResources::DepthTextureRef =
-		RHICmdList.CreateTexture2D(	TextureRenderTargetResource->GetSizeX(),
-									TextureRenderTargetResource->GetSizeY(),
-									PF_DepthStencil,
-									1,
-									1,
-									TexCreate_DepthStencilTargetable,
-									CreateInfo);
-
 	RenderThreadResources::initialized = true;
 }
 
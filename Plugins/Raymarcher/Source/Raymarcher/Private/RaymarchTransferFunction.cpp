@@ -0,0 +1,108 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchTransferFunction.h"
+
+#include "Curves/CurveLinearColor.h"
+#include "Curves/CurveFloat.h"
+#include "RenderingThread.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+URaymarchTransferFunction::URaymarchTransferFunction()
+	: RenderData(MakeShareable(new FRaymarchTransferFunctionRenderData()))
+{ }
+
+void URaymarchTransferFunction::BeginDestroy()
+{
+	Super::BeginDestroy();
+
+	// Let go of our reference on the render thread, after all draws that could still be using the tables.
+	if (RenderData.IsValid())
+	{
+		FRaymarchTransferFunctionRenderDataPtr ReleasedData = RenderData;
+		RenderData.Reset();
+		ENQUEUE_RENDER_COMMAND(ReleaseRaymarchTransferFunctionCommand)(
+			[ReleasedData](FRHICommandListImmediate& RHICmdList) mutable
+		{
+			ReleasedData.Reset();
+		});
+	}
+}
+
+void URaymarchTransferFunction::SetCurve(UCurveLinearColor* InCurve)
+{
+	if (InCurve)
+	{
+		Curve = InCurve;
+		Refresh();
+	}
+}
+
+void URaymarchTransferFunction::SetGradientOpacityCurve(UCurveFloat* InGradientOpacityCurve)
+{
+	GradientOpacityCurve = InGradientOpacityCurve;
+	Refresh();
+}
+
+void URaymarchTransferFunction::Refresh()
+{
+	check(IsInGameThread());
+	if (!Curve || !RenderData.IsValid())
+	{
+		return;
+	}
+
+	// Sample the curve at the centers of the texels the shader maps [0,1] onto.
+	const int32 Size = RAYMARCH_TRANSFER_FUNCTION_SIZE;
+	TArray<FLinearColor> Lut;
+	Lut.SetNumUninitialized(Size);
+	for (int32 i = 0; i < Size; ++i)
+	{
+		FLinearColor Color = Curve->GetLinearColorValue(float(i) / (Size - 1));
+		Color.A = FMath::Clamp(Color.A, 0.0f, 1.0f);
+		Lut[i] = Color;
+	}
+	TArray<FLinearColor> PreIntegrationTable;
+	BuildPreIntegrationTable(Lut, PreIntegrationTable);
+
+	// Half floats are plenty for colors and opacities and halve the upload.
+	TArray<FFloat16Color> LutTexels;
+	TArray<FFloat16Color> PreIntegrationTexels;
+	LutTexels.Reserve(Lut.Num());
+	PreIntegrationTexels.Reserve(PreIntegrationTable.Num());
+	for (const FLinearColor& Color : Lut)
+	{
+		LutTexels.Add(FFloat16Color(Color));
+	}
+	for (const FLinearColor& Color : PreIntegrationTable)
+	{
+		PreIntegrationTexels.Add(FFloat16Color(Color));
+	}
+
+	// Rows of the 2D table are the 1D one with opacities scaled by the gradient curve, sampled at texel centers as well.
+	const int32 GradientSize = RAYMARCH_TRANSFER_FUNCTION_GRADIENT_SIZE;
+	TArray<FFloat16Color> Lut2DTexels;
+	if (GradientOpacityCurve)
+	{
+		Lut2DTexels.Reserve(Size * GradientSize);
+		for (int32 g = 0; g < GradientSize; ++g)
+		{
+			const float OpacityScale = FMath::Max(GradientOpacityCurve->GetFloatValue(float(g) / (GradientSize - 1)), 0.0f);
+			for (const FLinearColor& Color : Lut)
+			{
+				FLinearColor Scaled = Color;
+				Scaled.A = FMath::Min(Color.A * OpacityScale, 1.0f);
+				Lut2DTexels.Add(FFloat16Color(Scaled));
+			}
+		}
+	}
+
+	FRaymarchTransferFunctionRenderDataPtr TransferFunction = RenderData;
+	ENQUEUE_RENDER_COMMAND(UpdateRaymarchTransferFunctionCommand)(
+		[TransferFunction, LutTexels, PreIntegrationTexels, Lut2DTexels, GradientSize](FRHICommandListImmediate& RHICmdList)
+	{
+		UpdateTransferFunctionTextures_RenderThread(RHICmdList, *TransferFunction, LutTexels, PreIntegrationTexels, Lut2DTexels, GradientSize);
+	});
+}
+
+#undef LOCTEXT_NAMESPACE
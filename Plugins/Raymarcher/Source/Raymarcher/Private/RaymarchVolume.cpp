@@ -0,0 +1,45 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVolume.h"
+
+#include "RenderingThread.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+URaymarchVolume::URaymarchVolume()
+	: RenderData(MakeShareable(new FRaymarchVolumeRenderData()))
+{
+	// The class default object is never drawn. Releasing an uninitialized resource does nothing, so BeginDestroy doesn't care.
+	if (!HasAnyFlags(RF_ClassDefaultObject))
+	{
+		BeginInitResource(RenderData.Get());
+	}
+}
+
+void URaymarchVolume::BeginDestroy()
+{
+	Super::BeginDestroy();
+	Pager.Reset();
+
+	// Release and let go of our reference on the render thread, after all draws that could still be using the volume.
+	// Loads that are still running hold their own reference, they get dropped once they're done and release it then.
+	if (RenderData.IsValid())
+	{
+		FRaymarchVolumeRenderDataPtr ReleasedData = RenderData;
+		RenderData.Reset();
+		ENQUEUE_RENDER_COMMAND(ReleaseRaymarchVolumeCommand)(
+			[ReleasedData](FRHICommandListImmediate& RHICmdList) mutable
+		{
+			ReleasedData->ReleaseResource();
+			ReleasedData.Reset();
+		});
+		ReleaseFence.BeginFence();
+	}
+}
+
+bool URaymarchVolume::IsReadyForFinishDestroy()
+{
+	return Super::IsReadyForFinishDestroy() && ReleaseFence.IsFenceComplete();
+}
+
+#undef LOCTEXT_NAMESPACE
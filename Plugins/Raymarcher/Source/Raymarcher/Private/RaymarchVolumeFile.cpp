@@ -0,0 +1,369 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVolumeFile.h"
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchVoxelConversion.h"
+
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+// "RVOL" - first word of every volume file.
+static const uint32 VolumeFileMagic = 0x4C4F5652;
+static const uint32 VolumeFileVersion = 1;
+// Zlib, tuned for speed - decompression is just as fast either way, and it keeps the converter fast too.
+static const ECompressionFlags VolumeFileCompression = ECompressionFlags(COMPRESS_ZLIB | COMPRESS_BiasSpeed);
+
+int64 FRaymarchVolumeFileHeader::GetChunkBytes(int32 ChunkIndex) const
+{
+	const int32 FirstSlice = ChunkIndex * ChunkDepth;
+	const int32 SliceCount = FMath::Min(ChunkDepth, Dimensions.Z - FirstSlice);
+	return int64(Dimensions.X) * Dimensions.Y * SliceCount * GetVoxelByteSize(VoxelFormat);
+}
+
+// Reads or writes the header (everything before the chunk table). Returns false if a read header isn't valid.
+static bool SerializeHeader(FArchive& Ar, FRaymarchVolumeFileHeader& Header)
+{
+	uint32 Magic = VolumeFileMagic;
+	uint32 Version = VolumeFileVersion;
+	uint8 VoxelFormat = uint8(Header.VoxelFormat);
+	Ar << Magic << Version << Header.Dimensions << VoxelFormat << Header.Spacing << Header.ChunkDepth;
+	Header.VoxelFormat = ERaymarchVoxelFormat(VoxelFormat);
+
+	// Chunks borders have to stay aligned with mip slabs (see LoadRawVolumeStreaming_GameThread), so chunks are a power of two deep.
+	return !Ar.IsError() && Magic == VolumeFileMagic && Version == VolumeFileVersion && Header.Dimensions.GetMin() > 0
+		&& VoxelFormat <= uint8(ERaymarchVoxelFormat::F32) && Header.ChunkDepth > 0 && FMath::IsPowerOfTwo(Header.ChunkDepth);
+}
+
+// Puts the Nth byte of every voxel together (all first bytes, then all second bytes...), so runs of equal high bytes
+// end up next to each other for the compressor.
+static void SplitBytePlanes(const uint8* Voxels, int64 VoxelCount, int32 VoxelBytes, uint8* OutPlanes)
+{
+	for (int32 Byte = 0; Byte < VoxelBytes; ++Byte)
+	{
+		uint8* Plane = OutPlanes + Byte * VoxelCount;
+		const uint8* Source = Voxels + Byte;
+		for (int64 i = 0; i < VoxelCount; ++i)
+		{
+			Plane[i] = Source[i * VoxelBytes];
+		}
+	}
+}
+
+// Reverse of SplitBytePlanes.
+static void MergeBytePlanes(const uint8* Planes, int64 VoxelCount, int32 VoxelBytes, uint8* OutVoxels)
+{
+	for (int32 Byte = 0; Byte < VoxelBytes; ++Byte)
+	{
+		const uint8* Plane = Planes + Byte * VoxelCount;
+		uint8* Destination = OutVoxels + Byte;
+		for (int64 i = 0; i < VoxelCount; ++i)
+		{
+			Destination[i * VoxelBytes] = Plane[i];
+		}
+	}
+}
+
+// Decompresses one chunk as stored in the file into voxels.
+static bool DecompressChunk(const uint8* Stored, int64 StoredBytes, int64 ChunkBytes, int32 VoxelBytes, uint8* OutVoxels)
+{
+	if (VoxelBytes == 1)
+	{
+		if (StoredBytes == ChunkBytes)
+		{
+			FMemory::Memcpy(OutVoxels, Stored, ChunkBytes);
+			return true;
+		}
+		return FCompression::UncompressMemory(VolumeFileCompression, OutVoxels, int32(ChunkBytes), Stored, int32(StoredBytes));
+	}
+
+	TArray<uint8> Planes;
+	const uint8* PlaneData = Stored;
+	if (StoredBytes != ChunkBytes)
+	{
+		Planes.SetNumUninitialized(ChunkBytes);
+		if (!FCompression::UncompressMemory(VolumeFileCompression, Planes.GetData(), int32(ChunkBytes), Stored, int32(StoredBytes)))
+		{
+			return false;
+		}
+		PlaneData = Planes.GetData();
+	}
+	MergeBytePlanes(PlaneData, ChunkBytes / VoxelBytes, VoxelBytes, OutVoxels);
+	return true;
+}
+
+// Compresses one chunk of voxels into what gets stored in the file.
+static void CompressChunk(const uint8* Voxels, int64 ChunkBytes, int32 VoxelBytes, TArray<uint8>& OutStored)
+{
+	TArray<uint8> Planes;
+	const uint8* Source = Voxels;
+	if (VoxelBytes > 1)
+	{
+		Planes.SetNumUninitialized(ChunkBytes);
+		SplitBytePlanes(Voxels, ChunkBytes / VoxelBytes, VoxelBytes, Planes.GetData());
+		Source = Planes.GetData();
+	}
+
+	int32 CompressedBytes = FCompression::CompressMemoryBound(VolumeFileCompression, int32(ChunkBytes));
+	OutStored.SetNumUninitialized(CompressedBytes);
+	if (FCompression::CompressMemory(VolumeFileCompression, OutStored.GetData(), CompressedBytes, Source, int32(ChunkBytes)) && CompressedBytes < ChunkBytes)
+	{
+		OutStored.SetNum(CompressedBytes, false);
+	}
+	else
+	{
+		// Noise doesn't compress, store it as it is (the reader tells by the size).
+		OutStored.SetNumUninitialized(ChunkBytes);
+		FMemory::Memcpy(OutStored.GetData(), Source, ChunkBytes);
+	}
+}
+
+TUniquePtr<FRaymarchVolumeFileReader> FRaymarchVolumeFileReader::Open(const FString& FullPath)
+{
+	TUniquePtr<FRaymarchVolumeFileReader> Reader(new FRaymarchVolumeFileReader());
+	Reader->FullPath = FullPath;
+	Reader->File.Reset(IFileManager::Get().CreateFileReader(*FullPath));
+	if (!Reader->File)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be opened."), *FullPath);
+		return nullptr;
+	}
+
+	FArchive& File = *Reader->File;
+	FRaymarchVolumeFileHeader& Header = Reader->Header;
+	int32 ChunkCount = 0;
+	const bool bValidHeader = SerializeHeader(File, Header);
+	File << ChunkCount;
+	if (!bValidHeader || File.IsError() || ChunkCount != Header.GetChunkCount())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("%s is not a valid volume file."), *FullPath);
+		return nullptr;
+	}
+
+	Reader->Chunks.SetNum(ChunkCount);
+	const int64 FileSize = File.TotalSize();
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunkCount; ++ChunkIndex)
+	{
+		FRaymarchVolumeFileChunk& Chunk = Reader->Chunks[ChunkIndex];
+		File << Chunk.Offset << Chunk.CompressedBytes;
+		if (File.IsError() || Chunk.Offset < 0 || Chunk.CompressedBytes <= 0 || Chunk.Offset + Chunk.CompressedBytes > FileSize
+			|| Chunk.CompressedBytes > Header.GetChunkBytes(ChunkIndex))
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("Chunk %d of %s is damaged or the file is truncated."), ChunkIndex, *FullPath);
+			return nullptr;
+		}
+	}
+	return Reader;
+}
+
+bool FRaymarchVolumeFileReader::ReadSlices(int32 FirstSlice, int32 SliceCount, uint8* OutVoxels)
+{
+	const int32 LastSlice = FirstSlice + SliceCount;
+	if (SliceCount <= 0 || FirstSlice % Header.ChunkDepth != 0 || LastSlice > Header.Dimensions.Z
+		|| (LastSlice % Header.ChunkDepth != 0 && LastSlice != Header.Dimensions.Z))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Slices %d-%d of %s don't start and end at chunk borders."), FirstSlice, LastSlice - 1, *FullPath);
+		return false;
+	}
+
+	// Chunks are stored in order, so the compressed data of consecutive chunks is one block of the file.
+	const int32 FirstChunk = FirstSlice / Header.ChunkDepth;
+	const int32 ChunkCount = FMath::DivideAndRoundUp(SliceCount, Header.ChunkDepth);
+	const int64 BlockStart = Chunks[FirstChunk].Offset;
+	const int64 BlockBytes = Chunks[FirstChunk + ChunkCount - 1].Offset + Chunks[FirstChunk + ChunkCount - 1].CompressedBytes - BlockStart;
+	CompressedBuffer.SetNumUninitialized(BlockBytes, false);
+	File->Seek(BlockStart);
+	File->Serialize(CompressedBuffer.GetData(), BlockBytes);
+	if (File->IsError())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Reading slices %d-%d of %s failed."), FirstSlice, LastSlice - 1, *FullPath);
+		return false;
+	}
+	BytesRead += BlockBytes;
+
+	const int32 VoxelBytes = GetVoxelByteSize(Header.VoxelFormat);
+	const int64 ChunkStride = int64(Header.Dimensions.X) * Header.Dimensions.Y * Header.ChunkDepth * VoxelBytes;
+	FThreadSafeCounter Failures;
+	ParallelFor(ChunkCount, [&](int32 i)
+	{
+		const FRaymarchVolumeFileChunk& Chunk = Chunks[FirstChunk + i];
+		const uint8* Stored = CompressedBuffer.GetData() + (Chunk.Offset - BlockStart);
+		if (!DecompressChunk(Stored, Chunk.CompressedBytes, Header.GetChunkBytes(FirstChunk + i), VoxelBytes, OutVoxels + i * ChunkStride))
+		{
+			Failures.Increment();
+		}
+	});
+	if (Failures.GetValue() > 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("%d chunks of slices %d-%d of %s couldn't be decompressed."), Failures.GetValue(), FirstSlice, LastSlice - 1, *FullPath);
+		return false;
+	}
+	return true;
+}
+
+bool IsRaymarchVolumeFile(const FString& FullPath)
+{
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileReader(*FullPath, FILEREAD_Silent));
+	uint32 Magic = 0;
+	if (File && File->TotalSize() >= int64(sizeof(Magic)))
+	{
+		*File << Magic;
+	}
+	return Magic == VolumeFileMagic;
+}
+
+bool ReadRaymarchVolumeFileHeader(const FString& FullPath, FRaymarchVolumeFileHeader& OutHeader)
+{
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileReader(*FullPath, FILEREAD_Silent));
+	return File && SerializeHeader(*File, OutHeader);
+}
+
+bool ConvertRawToRaymarchVolumeFile(const FString& RawPath, const FRaymarchVolumeFileHeader& InHeader, const FString& OutputPath,
+	FRaymarchVolumeFileStats* OutStats)
+{
+	FRaymarchVolumeFileHeader Header = InHeader;
+	const int32 VoxelBytes = GetVoxelByteSize(Header.VoxelFormat);
+	const int64 SliceBytes = int64(Header.Dimensions.X) * Header.Dimensions.Y * VoxelBytes;
+	if (Header.Dimensions.GetMin() <= 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Volume dimensions have to be positive!"));
+		return false;
+	}
+	// Compression works on int32 sizes, keep chunks well below that.
+	Header.ChunkDepth = FMath::RoundUpToPowerOfTwo(FMath::Clamp(Header.ChunkDepth, 1, Header.Dimensions.Z));
+	while (Header.ChunkDepth > 1 && SliceBytes * Header.ChunkDepth > MAX_int32 / 2)
+	{
+		Header.ChunkDepth /= 2;
+	}
+	if (SliceBytes > MAX_int32 / 2)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Slices of %s are too big to be compressed."), *RawPath);
+		return false;
+	}
+
+	TUniquePtr<FArchive> RawFile(IFileManager::Get().CreateFileReader(*RawPath));
+	if (!RawFile || RawFile->TotalSize() < SliceBytes * Header.Dimensions.Z)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be opened or is smaller than expected."), *RawPath);
+		return false;
+	}
+	TUniquePtr<FArchive> OutputFile(IFileManager::Get().CreateFileWriter(*OutputPath));
+	if (!OutputFile)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be written."), *OutputPath);
+		return false;
+	}
+
+	// The chunk table is written with zeros first and filled in at the end, once the sizes are known.
+	const int32 ChunkCount = Header.GetChunkCount();
+	TArray<FRaymarchVolumeFileChunk> Chunks;
+	Chunks.SetNum(ChunkCount);
+	SerializeHeader(*OutputFile, Header);
+	int32 ChunkCountToWrite = ChunkCount;
+	*OutputFile << ChunkCountToWrite;
+	const int64 ChunkTableOffset = OutputFile->Tell();
+	for (FRaymarchVolumeFileChunk& Chunk : Chunks)
+	{
+		*OutputFile << Chunk.Offset << Chunk.CompressedBytes;
+	}
+
+	// As many chunks at once as there are threads to compress them, but not more than fit into one array.
+	const int64 ChunkBytes = SliceBytes * Header.ChunkDepth;
+	const int32 BatchSize = FMath::Max<int64>(FMath::Min<int64>(FTaskGraphInterface::Get().GetNumWorkerThreads(), (MAX_int32 / 2) / ChunkBytes), 1);
+	TArray<uint8> RawBatch;
+	TArray<TArray<uint8>> StoredChunks;
+	StoredChunks.SetNum(BatchSize);
+	for (int32 FirstChunk = 0; FirstChunk < ChunkCount; FirstChunk += BatchSize)
+	{
+		const int32 BatchChunks = FMath::Min(BatchSize, ChunkCount - FirstChunk);
+		const int32 FirstSlice = FirstChunk * Header.ChunkDepth;
+		const int32 BatchSlices = FMath::Min(BatchChunks * Header.ChunkDepth, Header.Dimensions.Z - FirstSlice);
+		RawBatch.SetNumUninitialized(SliceBytes * BatchSlices, false);
+		RawFile->Serialize(RawBatch.GetData(), RawBatch.Num());
+		if (RawFile->IsError())
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("Reading slices %d-%d of %s failed."), FirstSlice, FirstSlice + BatchSlices - 1, *RawPath);
+			return false;
+		}
+
+		ParallelFor(BatchChunks, [&](int32 i)
+		{
+			CompressChunk(RawBatch.GetData() + i * ChunkBytes, Header.GetChunkBytes(FirstChunk + i), VoxelBytes, StoredChunks[i]);
+		});
+
+		for (int32 i = 0; i < BatchChunks; ++i)
+		{
+			Chunks[FirstChunk + i].Offset = OutputFile->Tell();
+			Chunks[FirstChunk + i].CompressedBytes = StoredChunks[i].Num();
+			OutputFile->Serialize(StoredChunks[i].GetData(), StoredChunks[i].Num());
+		}
+	}
+
+	const int64 FileSize = OutputFile->Tell();
+	OutputFile->Seek(ChunkTableOffset);
+	for (FRaymarchVolumeFileChunk& Chunk : Chunks)
+	{
+		*OutputFile << Chunk.Offset << Chunk.CompressedBytes;
+	}
+	if (!OutputFile->Close())
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Writing %s failed."), *OutputPath);
+		return false;
+	}
+
+	if (OutStats)
+	{
+		OutStats->RawBytes = SliceBytes * Header.Dimensions.Z;
+		OutStats->CompressedBytes = FileSize;
+	}
+	return true;
+}
+
+static void ConvertRawVolume(const TArray<FString>& Args)
+{
+	if (Args.Num() < 4)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Usage: Raymarch.ConvertRawVolume <RAW file relative to Content> <X> <Y> <Z> [U8|U16|S16|F16|F32] [SpacingX SpacingY SpacingZ] [Output file relative to Content]"));
+		return;
+	}
+
+	const FString RawPath = FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir() / Args[0]);
+	FRaymarchVolumeFileHeader Header;
+	Header.Dimensions = FIntVector(FCString::Atoi(*Args[1]), FCString::Atoi(*Args[2]), FCString::Atoi(*Args[3]));
+	const UEnum* FormatEnum = FindObject<UEnum>(ANY_PACKAGE, TEXT("ERaymarchVoxelFormat"), true);
+	const int64 FormatValue = Args.Num() > 4 ? FormatEnum->GetValueByNameString(Args[4]) : int64(ERaymarchVoxelFormat::U8);
+	if (FormatValue == INDEX_NONE || Header.Dimensions.GetMin() <= 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Invalid voxel format or dimensions."));
+		return;
+	}
+	Header.VoxelFormat = ERaymarchVoxelFormat(FormatValue);
+	if (Args.Num() > 7)
+	{
+		Header.Spacing = FVector(FCString::Atof(*Args[5]), FCString::Atof(*Args[6]), FCString::Atof(*Args[7]));
+	}
+	const FString OutputPath = Args.Num() > 8 ? FPaths::ConvertRelativePathToFull(FPaths::ProjectContentDir() / Args[8])
+		: FPaths::ChangeExtension(RawPath, TEXT("rvol"));
+
+	FRaymarchVolumeFileStats Stats;
+	const double Start = FPlatformTime::Seconds();
+	if (ConvertRawToRaymarchVolumeFile(RawPath, Header, OutputPath, &Stats))
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("Converted %s to %s in %.2f s, %.1f MB -> %.1f MB (ratio %.2f)."), *RawPath, *OutputPath,
+			FPlatformTime::Seconds() - Start, Stats.RawBytes / (1024.0 * 1024.0), Stats.CompressedBytes / (1024.0 * 1024.0), Stats.GetRatio());
+	}
+}
+
+static FAutoConsoleCommand ConvertRawVolumeCommand(
+	TEXT("Raymarch.ConvertRawVolume"),
+	TEXT("Converts a RAW volume into a compressed volume file that LoadRawTexture3DAsync and LoadRaymarchVolumeFileAsync can load. ")
+	TEXT("Arguments: RAW file relative to Content, X, Y, Z, voxel format (default U8), voxel spacing in mm (default 1 1 1), ")
+	TEXT("output file relative to Content (default: the RAW file with .rvol extension)."),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&ConvertRawVolume));
+
+#undef LOCTEXT_NAMESPACE
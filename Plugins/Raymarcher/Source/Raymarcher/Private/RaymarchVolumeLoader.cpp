@@ -0,0 +1,724 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVolumeLoader.h"
+#include "../Public/RaymarchRendering.h"
+#include "../Public/Raymarcher.h"
+#include "../Public/RaymarchVoxelConversion.h"
+#include "../Public/RaymarchVolumeMips.h"
+#include "../Public/RaymarchBrickPool.h"
+#include "../Public/RaymarchGradients.h"
+#include "../Public/RaymarchVolumeFile.h"
+#include "../Public/RaymarchBlockCompression.h"
+
+#include "Async/Async.h"
+#include "HAL/PlatformFilemanager.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "RenderingThread.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+/**
+* Shared state of one streaming load. Owned jointly by the worker task and all the game/render thread commands
+* it spawns, so it lives until the last of them is done.
+*/
+struct FRaymarchStreamingLoad
+{
+	FRaymarchVolumeLoadRequest Request;
+	// Ticket of the load in the volume, see FRaymarchVolumeRenderData::BeginLoad_AnyThread.
+	int32 Ticket = 0;
+	// Texture being filled. Only touched on the render thread.
+	FTexture3DRHIRef Texture;
+	// Pixel format of the texture.
+	EPixelFormat PixelFormat = PF_G8;
+	// If true, the voxels are compressed to BC4 on the worker before upload (PixelFormat is PF_G8 then).
+	bool bCompressBC4 = false;
+	// Size and error of what was compressed so far. Only touched by the worker.
+	FRaymarchBlockCompressionStats CompressionStats;
+	// Scale and bias for the shader to apply the window to sampled values.
+	FVector2D WindowScaleBias = FVector2D(1.0f, 0.0f);
+	// Empty-space skipping cells. Filled by the worker, read on the render thread once all slabs are through.
+	FRaymarchMacroCellGrid MacroCells;
+	// Bytes that were read from the file and not uploaded yet.
+	FThreadSafeCounter64 StagedBytes;
+	// Number of mip levels of the texture.
+	int32 MipCount = 1;
+	// Z-slices per chunk of a compressed volume file, 0 for RAW files.
+	int32 ChunkDepth = 0;
+	// Number of Z-slices in one slab. A multiple of 2^(MipCount - 1), so that every slab can be downsampled on its own,
+	// and of ChunkDepth, so that every slab is made of whole chunks.
+	int32 SlabDepth = 1;
+	// Number of slabs the volume is split into.
+	int32 SlabCount = 0;
+	// Number of slabs already uploaded. Only touched on the render thread.
+	int32 UploadedSlabs = 0;
+	// Gradients being filled (if requested). Only touched on the render thread.
+	FTexture3DRHIRef GradientTexture;
+	// Builds the gradients as slabs come in. Only touched by the worker.
+	FRaymarchGradientSlabBuilder GradientBuilder;
+	// Bricked loads only - filled by the worker, uploaded and emptied on the render thread.
+	FRaymarchBrickLayout BrickLayout;
+	FRaymarchBrickAtlas BrickAtlas;
+	TArray<FColor> BrickIndirection;
+	// Gradients of the occupied bricks, same layout as BrickAtlas. Empty if not requested.
+	FRaymarchBrickAtlas GradientAtlas;
+
+	/** Format of the volume texture on the GPU. */
+	EPixelFormat GetTextureFormat() const { return bCompressBC4 ? PF_BC4 : PixelFormat; }
+};
+
+typedef TSharedPtr<FRaymarchStreamingLoad, ESPMode::ThreadSafe> FRaymarchStreamingLoadPtr;
+
+/** One block of slices of one mip level, waiting for upload. */
+struct FRaymarchSlabUpload
+{
+	// Voxels in the texture's format. Allocated with FMemory::Malloc, freed once uploaded.
+	uint8* Data;
+	int32 FirstSlice;
+	int32 SliceCount;
+	int64 Bytes;
+	int32 MipLevel;
+	// If true, the slices are gradients and go into the gradient texture.
+	bool bGradients;
+};
+
+// Executes the loaded callback on the game thread.
+static void FinishLoad_AnyThread(FRaymarchStreamingLoadPtr Load, bool bSuccess)
+{
+	AsyncTask(ENamedThreads::GameThread, [Load, bSuccess]()
+	{
+		Load->Request.OnLoaded.ExecuteIfBound(bSuccess);
+	});
+}
+
+// True if a later load into the same volume was started, in which case this one gives up (and reports failure).
+static bool AbortIfSuperseded_AnyThread(FRaymarchStreamingLoadPtr Load)
+{
+	if (!Load->Request.Volume->IsSuperseded_AnyThread(Load->Ticket))
+	{
+		return false;
+	}
+	UE_LOG(LogRaymarch, Display, TEXT("Load of %s was superseded by a later one."), *Load->Request.FullPath);
+	FinishLoad_AnyThread(Load, false);
+	return true;
+}
+
+// Shows a loaded dataset in the volume, unless a later load was started meanwhile, and reports back.
+static void SwapLoadedDataset_RenderThread(FRaymarchStreamingLoadPtr Load, FRaymarchVolumeDataset&& Dataset)
+{
+	const bool bShown = Load->Request.Volume->SwapDataset_RenderThread(MoveTemp(Dataset), Load->Ticket);
+	if (!bShown)
+	{
+		UE_LOG(LogRaymarch, Display, TEXT("Load of %s was superseded by a later one."), *Load->Request.FullPath);
+	}
+	FinishLoad_AnyThread(Load, bShown);
+}
+
+// Hands a slab that was read over to the render thread. The slab memory is freed after upload.
+static void EnqueueSlabUpload_AnyThread(FRaymarchStreamingLoadPtr Load, const FRaymarchSlabUpload& Upload)
+{
+	// Render commands are only enqueued from the game thread, so go through it (this also keeps the order of the slabs).
+	AsyncTask(ENamedThreads::GameThread, [Load, Upload]()
+	{
+		ENQUEUE_RENDER_COMMAND(UploadVolumeSlabCommand)(
+			[Load, Upload](FRHICommandListImmediate& RHICmdList)
+		{
+			// Slabs of superseded loads would never be shown, don't spend the bandwidth on them.
+			const bool bSuperseded = Load->Request.Volume->IsSuperseded_AnyThread(Load->Ticket);
+			if (!bSuperseded)
+			{
+				FTexture3DRHIRef& Target = Upload.bGradients ? Load->GradientTexture : Load->Texture;
+				Update3DTextureSlab_RenderThread(RHICmdList, Target, Upload.Data, Upload.FirstSlice, Upload.SliceCount, Upload.MipLevel);
+			}
+			FMemory::Free(Upload.Data);
+			Load->StagedBytes.Subtract(Upload.Bytes);
+
+			// Mip levels and gradients just come along with each slab, so only the full resolution ones count as progress.
+			if (bSuperseded || Upload.MipLevel != 0 || Upload.bGradients)
+			{
+				return;
+			}
+			const float Progress = float(++Load->UploadedSlabs) / Load->SlabCount;
+			AsyncTask(ENamedThreads::GameThread, [Load, Progress]()
+			{
+				Load->Request.OnProgress.ExecuteIfBound(Progress);
+			});
+		});
+	});
+}
+
+// Swaps the fully uploaded texture in for rendering. Enqueued after all slab uploads, so it executes after them too - the
+// volume never shows a partly uploaded texture.
+static void EnqueueFinalize_AnyThread(FRaymarchStreamingLoadPtr Load)
+{
+	AsyncTask(ENamedThreads::GameThread, [Load]()
+	{
+		ENQUEUE_RENDER_COMMAND(FinalizeVolumeLoadCommand)(
+			[Load](FRHICommandListImmediate& RHICmdList)
+		{
+			FRaymarchVolumeDataset Dataset;
+			if (!Load->Request.Volume->IsSuperseded_AnyThread(Load->Ticket))
+			{
+				Dataset.VolumeTexture = Load->Texture;
+				Dataset.VolumeDimensions = Load->Request.Dimensions;
+				Dataset.GradientTexture = Load->GradientTexture;
+				Dataset.WindowScaleBias = Load->WindowScaleBias;
+				Dataset.MacroCellTexture = Load->MacroCells.IsValid() ?
+					CreateMacroCellTexture_RenderThread(RHICmdList, Load->MacroCells) : nullptr;
+				Dataset.ValueRange = Load->MacroCells.GetValueRange();
+			}
+			// Drop our references, the textures are owned by the volume now (or released with the dropped dataset).
+			Load->Texture.SafeRelease();
+			Load->GradientTexture.SafeRelease();
+			SwapLoadedDataset_RenderThread(Load, MoveTemp(Dataset));
+		});
+	});
+}
+
+/** Where the slabs of a load come from - a RAW file read as it is, or a compressed volume file decompressed chunk by chunk. */
+struct FRaymarchVolumeSource
+{
+	TUniquePtr<IFileHandle> RawFile;
+	TUniquePtr<FRaymarchVolumeFileReader> VolumeFile;
+};
+
+// Opens the file of a request and checks it's big enough for the requested volume (or that it's the volume file it was
+// when the load started). Returns false on failure.
+static bool OpenVolumeFile_AnyThread(const FRaymarchStreamingLoad& Load, FRaymarchVolumeSource& OutSource)
+{
+	const FRaymarchVolumeLoadRequest& Request = Load.Request;
+	const FIntVector& Dimensions = Request.Dimensions;
+	if (Load.ChunkDepth > 0)
+	{
+		OutSource.VolumeFile = FRaymarchVolumeFileReader::Open(Request.FullPath);
+		if (!OutSource.VolumeFile)
+		{
+			return false;
+		}
+		const FRaymarchVolumeFileHeader& Header = OutSource.VolumeFile->GetHeader();
+		if (Header.Dimensions != Dimensions || Header.VoxelFormat != Request.VoxelFormat || Header.ChunkDepth != Load.ChunkDepth)
+		{
+			UE_LOG(LogRaymarch, Error, TEXT("File %s changed while loading."), *Request.FullPath);
+			return false;
+		}
+		return true;
+	}
+
+	const int64 TotalBytes = int64(Dimensions.X) * Dimensions.Y * Dimensions.Z * GetVoxelByteSize(Request.VoxelFormat);
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	OutSource.RawFile.Reset(PlatformFile.OpenRead(*Request.FullPath));
+	if (!OutSource.RawFile)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s could not be opened."), *Request.FullPath);
+		return false;
+	}
+
+	if (OutSource.RawFile->Size() < TotalBytes)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("File %s is smaller than expected, quitting to avoid segfaults."), *Request.FullPath);
+		return false;
+	}
+	else if (OutSource.RawFile->Size() > TotalBytes)
+	{
+		UE_LOG(LogRaymarch, Warning, TEXT("File %s is larger than expected, check your dimensions and pixel format."), *Request.FullPath);
+	}
+	return true;
+}
+
+// Reads the next slab of slices from the file (decompressing the chunks of volume files in parallel) and converts it
+// into the texture's format. ScratchBuffer has to hold the whole slab as stored in the file when quantizing, it's unused otherwise.
+static bool ReadSlab_AnyThread(FRaymarchVolumeSource& Source, const FRaymarchVolumeLoadRequest& Request, int32 FirstSlice, int32 SliceCount,
+	uint8* ScratchBuffer, uint8* OutSlabData)
+{
+	const int64 SlabVoxels = int64(Request.Dimensions.X) * Request.Dimensions.Y * SliceCount;
+	uint8* ReadTarget = Request.bQuantizeTo8Bit ? ScratchBuffer : OutSlabData;
+	if (Source.VolumeFile)
+	{
+		// The reader logs what went wrong.
+		if (!Source.VolumeFile->ReadSlices(FirstSlice, SliceCount, ReadTarget))
+		{
+			return false;
+		}
+	}
+	else if (!Source.RawFile->Read(ReadTarget, SlabVoxels * GetVoxelByteSize(Request.VoxelFormat)))
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Reading slices %d-%d of %s failed."), FirstSlice, FirstSlice + SliceCount - 1, *Request.FullPath);
+		return false;
+	}
+
+	// Convert into something the GPU can sample.
+	if (Request.bQuantizeTo8Bit)
+	{
+		QuantizeWindowed(ReadTarget, Request.VoxelFormat, SlabVoxels, Request.WindowCenter, Request.WindowWidth, OutSlabData);
+	}
+	else if (Request.VoxelFormat == ERaymarchVoxelFormat::S16)
+	{
+		ConvertSignedToUnsigned16(reinterpret_cast<int16*>(OutSlabData), SlabVoxels);
+	}
+	return true;
+}
+
+bool ReadVolumeFile_AnyThread(const FRaymarchVolumeLoadRequest& Request, TArray<uint8>& OutVoxels, FIntVector& OutDimensions)
+{
+	FRaymarchStreamingLoad Load;
+	Load.Request = Request;
+	FRaymarchVolumeFileHeader FileHeader;
+	if (ReadRaymarchVolumeFileHeader(Request.FullPath, FileHeader))
+	{
+		Load.Request.Dimensions = FileHeader.Dimensions;
+		Load.Request.VoxelFormat = FileHeader.VoxelFormat;
+		Load.ChunkDepth = FileHeader.ChunkDepth;
+	}
+	OutDimensions = Load.Request.Dimensions;
+	if (OutDimensions.GetMin() <= 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Volume dimensions of %s have to be positive."), *Request.FullPath);
+		return false;
+	}
+
+	FRaymarchVolumeSource Source;
+	if (!OpenVolumeFile_AnyThread(Load, Source))
+	{
+		return false;
+	}
+
+	// The whole volume is one slab.
+	const int64 VoxelCount = int64(OutDimensions.X) * OutDimensions.Y * OutDimensions.Z;
+	const int32 FileVoxelBytes = GetVoxelByteSize(Load.Request.VoxelFormat);
+	TArray<uint8> ScratchBuffer;
+	if (Request.bQuantizeTo8Bit)
+	{
+		ScratchBuffer.SetNumUninitialized(VoxelCount * FileVoxelBytes);
+	}
+	OutVoxels.SetNumUninitialized(VoxelCount * (Request.bQuantizeTo8Bit ? 1 : FileVoxelBytes), false);
+	return ReadSlab_AnyThread(Source, Load.Request, 0, OutDimensions.Z, ScratchBuffer.GetData(), OutVoxels.GetData());
+}
+
+// Replaces the voxels of a slab upload by their BC4 blocks.
+static void CompressSlabUpload_AnyThread(FRaymarchStreamingLoad& Load, FRaymarchSlabUpload& Upload)
+{
+	const FIntVector MipDimensions = GetVolumeMipDimensions(Load.Request.Dimensions, Upload.MipLevel);
+	const int64 CompressedBytes = GetBC4SlabBytes(MipDimensions.X, MipDimensions.Y, Upload.SliceCount);
+	uint8* Blocks = reinterpret_cast<uint8*>(FMemory::Malloc(CompressedBytes));
+	FRaymarchBlockCompressionStats Stats;
+	CompressSlabBC4(Upload.Data, MipDimensions.X, MipDimensions.Y, Upload.SliceCount, Blocks, &Stats);
+	Load.CompressionStats.Accumulate(Stats);
+	FMemory::Free(Upload.Data);
+	Upload.Data = Blocks;
+	Upload.Bytes = CompressedBytes;
+}
+
+// Worker-thread part of the load - reads the file slab by slab, never holding more than the budget in memory.
+static void StreamRawVolume_AnyThread(FRaymarchStreamingLoadPtr Load)
+{
+	const FRaymarchVolumeLoadRequest& Request = Load->Request;
+	const FIntVector& Dimensions = Request.Dimensions;
+	const int64 SliceVoxels = int64(Dimensions.X) * Dimensions.Y;
+	const int64 SliceBytes = SliceVoxels * GetVoxelByteSize(Request.VoxelFormat);
+	// Uploaded slices are smaller than the read ones when quantizing.
+	const int64 UploadSliceBytes = SliceVoxels * GPixelFormats[Load->PixelFormat].BlockBytes;
+	const int64 GradientSliceBytes = SliceVoxels * sizeof(FColor);
+
+	// When quantizing, slabs are read into a scratch buffer that's reused for all of them. It's part of the budget too.
+	TArray<uint8> ScratchBuffer;
+	int64 UploadBudget = Request.SlabBudgetBytes;
+	if (Request.bQuantizeTo8Bit)
+	{
+		ScratchBuffer.SetNumUninitialized(SliceBytes * Load->SlabDepth);
+		UploadBudget -= ScratchBuffer.Num();
+	}
+
+	FRaymarchVolumeSource Source;
+	if (!OpenVolumeFile_AnyThread(*Load, Source))
+	{
+		FinishLoad_AnyThread(Load, false);
+		return;
+	}
+
+	for (int32 SlabIndex = 0; SlabIndex < Load->SlabCount; ++SlabIndex)
+	{
+		const int32 FirstSlice = SlabIndex * Load->SlabDepth;
+		const int32 SliceCount = FMath::Min(Load->SlabDepth, Dimensions.Z - FirstSlice);
+		const int64 UploadBytes = UploadSliceBytes * SliceCount;
+		// The whole mip chain of a slab is at most 1/7 of the slab itself.
+		int64 UploadBytesWithExtras = Load->MipCount > 1 ? UploadBytes + UploadBytes / 7 + Load->MipCount : UploadBytes;
+		if (Request.bComputeGradients)
+		{
+			// Gradients lag a slice behind, so the last slab has one more.
+			UploadBytesWithExtras += GradientSliceBytes * (SliceCount + 1);
+		}
+
+		// Wait for the render thread to upload enough of the previous slabs to stay in budget.
+		// Always let at least one slab through, otherwise a budget smaller than a slab would deadlock us.
+		while (Load->StagedBytes.GetValue() > 0 && Load->StagedBytes.GetValue() + UploadBytesWithExtras > UploadBudget)
+		{
+			FPlatformProcess::Sleep(0.001f);
+		}
+		if (AbortIfSuperseded_AnyThread(Load))
+		{
+			return;
+		}
+
+		uint8* SlabData = reinterpret_cast<uint8*>(FMemory::Malloc(UploadBytes));
+		if (!ReadSlab_AnyThread(Source, Request, FirstSlice, SliceCount, ScratchBuffer.GetData(), SlabData))
+		{
+			FMemory::Free(SlabData);
+			FinishLoad_AnyThread(Load, false);
+			return;
+		}
+
+		if (Load->MacroCells.IsValid())
+		{
+			Load->MacroCells.AccumulateSlab(SlabData, Load->PixelFormat, FirstSlice, SliceCount);
+		}
+
+		// Downsample the slab through the mip chain, every level is built from the previous one. Nothing is handed over
+		// to the render thread (which frees the memory after upload) before the whole chain is done.
+		TArray<FRaymarchSlabUpload, TInlineAllocator<16>> Uploads;
+		Uploads.Add(FRaymarchSlabUpload{ SlabData, FirstSlice, SliceCount, UploadBytes, 0, false });
+		for (int32 MipLevel = 1; MipLevel < Load->MipCount; ++MipLevel)
+		{
+			const FRaymarchSlabUpload& Source = Uploads.Last();
+			const FIntVector SourceDimensions = GetVolumeMipDimensions(Dimensions, MipLevel - 1);
+			const FIntVector MipDimensions = GetVolumeMipDimensions(Dimensions, MipLevel);
+
+			FRaymarchSlabUpload Mip;
+			Mip.MipLevel = MipLevel;
+			Mip.bGradients = false;
+			GetDownsampledSliceRange(Source.FirstSlice, Source.SliceCount, SourceDimensions.Z, Mip.FirstSlice, Mip.SliceCount);
+			if (Mip.SliceCount == 0)
+			{
+				// Short last slab, its contribution to the coarse levels was already made by the previous slab.
+				break;
+			}
+			Mip.Bytes = int64(MipDimensions.X) * MipDimensions.Y * Mip.SliceCount * GPixelFormats[Load->PixelFormat].BlockBytes;
+			Mip.Data = reinterpret_cast<uint8*>(FMemory::Malloc(Mip.Bytes));
+			DownsampleVolumeSlab(Source.Data, Load->PixelFormat, SourceDimensions, Source.FirstSlice, Source.SliceCount, Mip.Data);
+			Uploads.Add(Mip);
+		}
+
+		if (Request.bComputeGradients)
+		{
+			TArray<float> Intensities;
+			Intensities.SetNumUninitialized(SliceVoxels * SliceCount);
+			ConvertToWindowedIntensity(SlabData, Load->PixelFormat, Intensities.Num(), Load->WindowScaleBias, Intensities.GetData());
+			const int32 ReadySlices = Load->GradientBuilder.AddSlab(Intensities.GetData(), SliceCount);
+			if (ReadySlices > 0)
+			{
+				FRaymarchSlabUpload Gradients;
+				Gradients.FirstSlice = Load->GradientBuilder.GetFirstReadySlice();
+				Gradients.SliceCount = ReadySlices;
+				Gradients.Bytes = GradientSliceBytes * ReadySlices;
+				Gradients.MipLevel = 0;
+				Gradients.bGradients = true;
+				Gradients.Data = reinterpret_cast<uint8*>(FMemory::Malloc(Gradients.Bytes));
+				Load->GradientBuilder.BuildReadySlices(reinterpret_cast<FColor*>(Gradients.Data));
+				Uploads.Add(Gradients);
+			}
+		}
+
+		if (Load->bCompressBC4)
+		{
+			// Only now that the whole mip chain was built from the exact voxels.
+			for (FRaymarchSlabUpload& Upload : Uploads)
+			{
+				if (!Upload.bGradients)
+				{
+					CompressSlabUpload_AnyThread(*Load, Upload);
+				}
+			}
+		}
+
+		for (const FRaymarchSlabUpload& Upload : Uploads)
+		{
+			Load->StagedBytes.Add(Upload.Bytes);
+			EnqueueSlabUpload_AnyThread(Load, Upload);
+		}
+	}
+
+	if (Load->bCompressBC4)
+	{
+		LogBlockCompressionStats(Request.FullPath, Load->CompressionStats);
+	}
+	EnqueueFinalize_AnyThread(Load);
+}
+
+// Uploads the brick atlas and its indirection and swaps them in for rendering.
+static void EnqueueBrickedFinalize_AnyThread(FRaymarchStreamingLoadPtr Load)
+{
+	AsyncTask(ENamedThreads::GameThread, [Load]()
+	{
+		ENQUEUE_RENDER_COMMAND(FinalizeBrickedVolumeLoadCommand)(
+			[Load](FRHICommandListImmediate& RHICmdList)
+		{
+			FRaymarchVolumeDataset Dataset;
+			if (!Load->Request.Volume->IsSuperseded_AnyThread(Load->Ticket))
+			{
+				const FRaymarchBrickAtlas& Atlas = Load->BrickAtlas;
+				Dataset.VolumeTexture = CreateEmpty3DTexture_RenderThread(RHICmdList, Atlas.AtlasDimensions, Load->GetTextureFormat());
+				Update3DTextureSlab_RenderThread(RHICmdList, Dataset.VolumeTexture, Atlas.AtlasData.GetData(), 0, Atlas.AtlasDimensions.Z);
+				if (Load->GradientAtlas.AtlasData.Num() > 0)
+				{
+					Dataset.GradientTexture = CreateGradientTexture_RenderThread(RHICmdList, Atlas.AtlasDimensions,
+						reinterpret_cast<const FColor*>(Load->GradientAtlas.AtlasData.GetData()));
+				}
+				Dataset.VolumeDimensions = Load->Request.Dimensions;
+				Dataset.BrickIndirectionTexture =
+					CreateBrickIndirectionTexture_RenderThread(RHICmdList, Load->BrickLayout, Load->BrickIndirection);
+				Dataset.BrickLayout = Load->BrickLayout;
+				Dataset.BrickAtlasDimensions = Atlas.AtlasDimensions;
+				Dataset.WindowScaleBias = Load->WindowScaleBias;
+				Dataset.MacroCellTexture = Load->MacroCells.IsValid() ?
+					CreateMacroCellTexture_RenderThread(RHICmdList, Load->MacroCells) : nullptr;
+				Dataset.ValueRange = Load->MacroCells.GetValueRange();
+			}
+
+			// The upload copied everything, no need to keep the host copies around until the last reference to Load dies.
+			Load->BrickAtlas.AtlasData.Empty();
+			Load->GradientAtlas.AtlasData.Empty();
+			Load->BrickIndirection.Empty();
+			SwapLoadedDataset_RenderThread(Load, MoveTemp(Dataset));
+		});
+	});
+}
+
+// Worker-thread part of a bricked load. Bricks can only be classified and packed with the whole volume at hand,
+// so unlike the streaming path, this one reads everything into memory first (the slab budget doesn't apply).
+static void LoadBrickedVolume_AnyThread(FRaymarchStreamingLoadPtr Load)
+{
+	const FRaymarchVolumeLoadRequest& Request = Load->Request;
+	const FIntVector& Dimensions = Request.Dimensions;
+	const int64 SliceVoxels = int64(Dimensions.X) * Dimensions.Y;
+	const int64 UploadSliceBytes = SliceVoxels * GPixelFormats[Load->PixelFormat].BlockBytes;
+
+	FRaymarchVolumeSource Source;
+	if (!OpenVolumeFile_AnyThread(*Load, Source))
+	{
+		FinishLoad_AnyThread(Load, false);
+		return;
+	}
+
+	TArray<uint8> ScratchBuffer;
+	if (Request.bQuantizeTo8Bit)
+	{
+		ScratchBuffer.SetNumUninitialized(SliceVoxels * GetVoxelByteSize(Request.VoxelFormat) * Load->SlabDepth);
+	}
+
+	// Still read in slabs, so that quantizing needs only a slab-sized scratch buffer and progress can be reported.
+	TArray<uint8> Volume;
+	Volume.SetNumUninitialized(UploadSliceBytes * Dimensions.Z);
+	for (int32 SlabIndex = 0; SlabIndex < Load->SlabCount; ++SlabIndex)
+	{
+		if (AbortIfSuperseded_AnyThread(Load))
+		{
+			return;
+		}
+		const int32 FirstSlice = SlabIndex * Load->SlabDepth;
+		const int32 SliceCount = FMath::Min(Load->SlabDepth, Dimensions.Z - FirstSlice);
+		uint8* SlabData = Volume.GetData() + FirstSlice * UploadSliceBytes;
+		if (!ReadSlab_AnyThread(Source, Request, FirstSlice, SliceCount, ScratchBuffer.GetData(), SlabData))
+		{
+			FinishLoad_AnyThread(Load, false);
+			return;
+		}
+
+		if (Load->MacroCells.IsValid())
+		{
+			Load->MacroCells.AccumulateSlab(SlabData, Load->PixelFormat, FirstSlice, SliceCount);
+		}
+
+		const float Progress = float(SlabIndex + 1) / Load->SlabCount;
+		AsyncTask(ENamedThreads::GameThread, [Load, Progress]()
+		{
+			Load->Request.OnProgress.ExecuteIfBound(Progress);
+		});
+	}
+	Source.RawFile.Reset();
+	Source.VolumeFile.Reset();
+	// Packing takes a while, no need to start it if the volume will never be shown.
+	if (AbortIfSuperseded_AnyThread(Load))
+	{
+		return;
+	}
+
+	// A brick is empty when its maximum gets windowed to zero, like the shader tests macro cells without a transfer function - bricks don't depend on it.
+	const float EmptyThreshold = -Load->WindowScaleBias.Y / Load->WindowScaleBias.X;
+
+	Load->BrickLayout = PartitionIntoBricks(Dimensions, Request.BrickSize);
+	TArray<bool> Occupied;
+	ClassifyBricks(Volume.GetData(), Load->PixelFormat, Load->BrickLayout, EmptyThreshold, Occupied);
+	// Both atlases are sampled at the same coordinates, so the gradients get the alignment of the compressed one too.
+	const int32 AtlasAlignment = Load->bCompressBC4 ? RAYMARCH_BC4_BLOCK_SIZE : 1;
+	PackBrickAtlas(Volume.GetData(), Load->PixelFormat, Load->BrickLayout, Occupied, Load->BrickAtlas, AtlasAlignment);
+	if (Request.bComputeGradients)
+	{
+		// Gradients of the whole volume, so the bricks get the right ones at their borders and aprons too, then packed
+		// into a second atlas the shader samples at the same coordinates.
+		TArray<float> Intensities;
+		Intensities.SetNumUninitialized(SliceVoxels * Dimensions.Z);
+		ConvertToWindowedIntensity(Volume.GetData(), Load->PixelFormat, Intensities.Num(), Load->WindowScaleBias, Intensities.GetData());
+		TArray<FColor> Gradients;
+		Gradients.SetNumUninitialized(Intensities.Num());
+		BuildGradientSlab(Intensities.GetData(), 0, Dimensions, 0, Dimensions.Z, Gradients.GetData());
+		Intensities.Empty();
+		PackBrickAtlas(reinterpret_cast<const uint8*>(Gradients.GetData()), PF_B8G8R8A8, Load->BrickLayout, Occupied, Load->GradientAtlas,
+			AtlasAlignment);
+	}
+
+	const FRaymarchBrickAtlas& Atlas = Load->BrickAtlas;
+	if (Atlas.AtlasDimensions.GetMax() > GMaxVolumeTextureDimensions || Atlas.SlotCounts.GetMax() > 255)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Brick atlas of %s would be %dx%dx%d, that's more than the GPU supports. Try bigger bricks."),
+			*Request.FullPath, Atlas.AtlasDimensions.X, Atlas.AtlasDimensions.Y, Atlas.AtlasDimensions.Z);
+		FinishLoad_AnyThread(Load, false);
+		return;
+	}
+	BuildBrickIndirection(Load->BrickLayout, Atlas, Load->BrickIndirection);
+	LogBrickAtlasMemory(Request.FullPath, Load->BrickLayout, Atlas, Load->PixelFormat);
+	if (Load->bCompressBC4)
+	{
+		TArray<uint8> Blocks;
+		Blocks.SetNumUninitialized(GetBC4SlabBytes(Atlas.AtlasDimensions.X, Atlas.AtlasDimensions.Y, Atlas.AtlasDimensions.Z));
+		CompressSlabBC4(Atlas.AtlasData.GetData(), Atlas.AtlasDimensions.X, Atlas.AtlasDimensions.Y, Atlas.AtlasDimensions.Z,
+			Blocks.GetData(), &Load->CompressionStats);
+		Load->BrickAtlas.AtlasData = MoveTemp(Blocks);
+		LogBlockCompressionStats(Request.FullPath, Load->CompressionStats);
+	}
+
+	EnqueueBrickedFinalize_AnyThread(Load);
+}
+
+void LoadRawVolumeStreaming_GameThread(const FRaymarchVolumeLoadRequest& InRequest)
+{
+	check(IsInGameThread());
+
+	FRaymarchStreamingLoadPtr Load = MakeShareable(new FRaymarchStreamingLoad());
+	Load->Request = InRequest;
+	FRaymarchVolumeLoadRequest& Request = Load->Request;
+	if (!Request.Volume.IsValid())
+	{
+		Request.Volume = GetDefaultRaymarchVolume_GameThread();
+	}
+
+	// Compressed volume files describe themselves. Only the header is read here, it's tiny.
+	FRaymarchVolumeFileHeader FileHeader;
+	if (ReadRaymarchVolumeFileHeader(Request.FullPath, FileHeader))
+	{
+		Request.Dimensions = FileHeader.Dimensions;
+		Request.VoxelFormat = FileHeader.VoxelFormat;
+		Load->ChunkDepth = FileHeader.ChunkDepth;
+	}
+
+	const FIntVector& Dimensions = Request.Dimensions;
+	if (Dimensions.X <= 0 || Dimensions.Y <= 0 || Dimensions.Z <= 0)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Volume dimensions of %s have to be positive."), *Request.FullPath);
+		Request.OnLoaded.ExecuteIfBound(false);
+		return;
+	}
+
+	if (Request.bQuantizeTo8Bit && Request.WindowWidth <= 0.0f)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("Quantizing %s to 8 bits needs a positive window width."), *Request.FullPath);
+		Request.OnLoaded.ExecuteIfBound(false);
+		return;
+	}
+
+	if (Request.bQuantizeTo8Bit)
+	{
+		// Window is baked into the data already.
+		Load->PixelFormat = PF_G8;
+		Load->WindowScaleBias = FVector2D(1.0f, 0.0f);
+	}
+	else
+	{
+		Load->PixelFormat = GetVoxelPixelFormat(Request.VoxelFormat);
+		Load->WindowScaleBias = GetWindowScaleBias(Request.VoxelFormat, Request.WindowCenter, Request.WindowWidth);
+	}
+
+	if (Request.Compression == ERaymarchVolumeCompression::BC4)
+	{
+		if (Load->PixelFormat != PF_G8)
+		{
+			UE_LOG(LogRaymarch, Warning, TEXT("BC4 needs 8-bit voxels, quantize %s to compress it. Loading it uncompressed."), *Request.FullPath);
+		}
+		else if (!GPixelFormats[PF_BC4].Supported)
+		{
+			UE_LOG(LogRaymarch, Warning, TEXT("BC4 textures aren't supported by this RHI. Loading %s uncompressed."), *Request.FullPath);
+		}
+		else if (Request.BrickSize <= 0 && !CanCompressVolumeBC4(Dimensions))
+		{
+			UE_LOG(LogRaymarch, Warning, TEXT("BC4 needs whole 4x4 blocks, but %s is %dx%d voxels per slice. Loading it uncompressed."),
+				*Request.FullPath, Dimensions.X, Dimensions.Y);
+		}
+		else
+		{
+			Load->bCompressBC4 = true;
+		}
+	}
+
+	if (Request.MacroCellSize > 0)
+	{
+		Load->MacroCells.Init(Dimensions, Request.MacroCellSize);
+	}
+	if (Request.bComputeGradients)
+	{
+		Load->GradientBuilder.Init(Dimensions);
+	}
+
+	// Two slabs have to fit in the budget - one being read and one being uploaded.
+	const int64 SliceBytes = int64(Dimensions.X) * Dimensions.Y * GetVoxelByteSize(Request.VoxelFormat);
+	Load->SlabDepth = FMath::Clamp<int64>(Request.SlabBudgetBytes / (2 * SliceBytes), 1, Dimensions.Z);
+	if (Load->ChunkDepth > 0 && Load->SlabDepth < Dimensions.Z)
+	{
+		// Chunks are decompressed as a whole, so slabs are made of whole chunks even if that exceeds the budget. As chunks
+		// are a power of two deep, the mip alignment below keeps slabs made of whole chunks.
+		Load->SlabDepth = FMath::Max(Load->SlabDepth / Load->ChunkDepth, 1) * Load->ChunkDepth;
+	}
+	if (Request.bGenerateMips && Request.BrickSize > 0)
+	{
+		UE_LOG(LogRaymarch, Warning, TEXT("Bricked volumes have no mip chain, ignoring bGenerateMips for %s."), *Request.FullPath);
+	}
+	else if (Request.bGenerateMips)
+	{
+		Load->MipCount = GetMaxVolumeMipCount(Dimensions);
+		if (Load->SlabDepth < Dimensions.Z)
+		{
+			// Every slab but the last has to start and end at a multiple of 2^(MipCount - 1) to be downsampled on its own.
+			Load->MipCount = FMath::Min(Load->MipCount, int32(FMath::FloorLog2(Load->SlabDepth)) + 1);
+			const int32 Alignment = 1 << (Load->MipCount - 1);
+			Load->SlabDepth = (Load->SlabDepth / Alignment) * Alignment;
+		}
+	}
+	Load->SlabCount = FMath::DivideAndRoundUp(Dimensions.Z, Load->SlabDepth);
+
+	// Only now that the request is known to be good, so a broken one doesn't stop the load it was meant to replace.
+	Load->Ticket = Request.Volume->BeginLoad_AnyThread();
+
+	if (Request.BrickSize > 0)
+	{
+		// Bricked volumes are created and uploaded in one go once packed, there's nothing to create up front.
+		Async<void>(EAsyncExecution::ThreadPool, [Load]()
+		{
+			LoadBrickedVolume_AnyThread(Load);
+		});
+		return;
+	}
+
+	// Create the (empty) texture first. Uploads are enqueued later from the game thread, so they come after this.
+	ENQUEUE_RENDER_COMMAND(CreateStreamedVolumeCommand)(
+		[Load](FRHICommandListImmediate& RHICmdList)
+	{
+		Load->Texture = CreateEmpty3DTexture_RenderThread(RHICmdList, Load->Request.Dimensions, Load->GetTextureFormat(), Load->MipCount);
+		if (Load->Request.bComputeGradients)
+		{
+			Load->GradientTexture = CreateGradientTexture_RenderThread(RHICmdList, Load->Request.Dimensions, nullptr);
+		}
+	});
+
+	Async<void>(EAsyncExecution::ThreadPool, [Load]()
+	{
+		StreamRawVolume_AnyThread(Load);
+	});
+}
+
+#undef LOCTEXT_NAMESPACE
@@ -0,0 +1,197 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVolumeMips.h"
+
+#include "Async/ParallelFor.h"
+
+// Averages 8 texels of given type. Integers are rounded to nearest, halfs are averaged as floats.
+static FORCEINLINE uint8 Average8(const uint8* Values[8])
+{
+	uint32 Sum = 4;
+	for (int32 i = 0; i < 8; ++i) Sum += *Values[i];
+	return uint8(Sum / 8);
+}
+
+static FORCEINLINE uint16 Average8(const uint16* Values[8])
+{
+	uint32 Sum = 4;
+	for (int32 i = 0; i < 8; ++i) Sum += *Values[i];
+	return uint16(Sum / 8);
+}
+
+static FORCEINLINE FFloat16 Average8(const FFloat16* Values[8])
+{
+	float Sum = 0.0f;
+	for (int32 i = 0; i < 8; ++i) Sum += Values[i]->GetFloat();
+	return FFloat16(Sum / 8);
+}
+
+static FORCEINLINE float Average8(const float* Values[8])
+{
+	float Sum = 0.0f;
+	for (int32 i = 0; i < 8; ++i) Sum += *Values[i];
+	return Sum / 8;
+}
+
+FIntVector GetVolumeMipDimensions(FIntVector Dimensions, int32 MipLevel)
+{
+	return FIntVector(
+		FMath::Max(Dimensions.X >> MipLevel, 1),
+		FMath::Max(Dimensions.Y >> MipLevel, 1),
+		FMath::Max(Dimensions.Z >> MipLevel, 1));
+}
+
+int32 GetMaxVolumeMipCount(FIntVector Dimensions)
+{
+	return FMath::FloorLog2(FMath::Max(Dimensions.GetMax(), 1)) + 1;
+}
+
+void GetDownsampledSliceRange(int32 SourceFirstSlice, int32 SourceSliceCount, int32 SourceDepth, int32& OutFirstSlice, int32& OutSliceCount)
+{
+	const int32 Depth = FMath::Max(SourceDepth >> 1, 1);
+	const int32 SourceEnd = SourceFirstSlice + SourceSliceCount;
+	// The last slab also produces the slices that only have one source slice (odd depths, depth 1).
+	const int32 End = SourceEnd >= SourceDepth ? Depth : SourceEnd / 2;
+	OutFirstSlice = SourceFirstSlice / 2;
+	OutSliceCount = FMath::Max(End - OutFirstSlice, 0);
+}
+
+// Index of the two source voxels a destination voxel is built from along one axis (the same one twice at the border).
+static FORCEINLINE void GetSourcePair(int32 Destination, int32 SourceSize, int32& OutFirst, int32& OutSecond)
+{
+	OutFirst = FMath::Min(Destination * 2, SourceSize - 1);
+	OutSecond = FMath::Min(Destination * 2 + 1, SourceSize - 1);
+}
+
+template<typename TexelType>
+static void DownsampleSlabTyped(const TexelType* Source, FIntVector SourceDimensions, int32 SourceFirstSlice, int32 SourceSliceCount,
+	int32 FirstSlice, int32 SliceCount, TexelType* Destination)
+{
+	const FIntVector Dimensions = GetVolumeMipDimensions(SourceDimensions, 1);
+	const int64 SourceSliceSize = int64(SourceDimensions.X) * SourceDimensions.Y;
+	const int64 SliceSize = int64(Dimensions.X) * Dimensions.Y;
+	const int32 SourceLastSlice = SourceFirstSlice + SourceSliceCount - 1;
+
+	ParallelFor(SliceCount, [&](int32 LocalZ)
+	{
+		int32 Z0, Z1;
+		GetSourcePair(FirstSlice + LocalZ, SourceDimensions.Z, Z0, Z1);
+		// Slab-local source slices (clamping only ever matters at the end of the volume, where the slab ends too).
+		const TexelType* Slices[2] = {
+			Source + (FMath::Min(Z0, SourceLastSlice) - SourceFirstSlice) * SourceSliceSize,
+			Source + (FMath::Min(Z1, SourceLastSlice) - SourceFirstSlice) * SourceSliceSize };
+		TexelType* Output = Destination + LocalZ * SliceSize;
+
+		for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+		{
+			int32 Y0, Y1;
+			GetSourcePair(Y, SourceDimensions.Y, Y0, Y1);
+			const int64 Rows[2] = { Y0 * int64(SourceDimensions.X), Y1 * int64(SourceDimensions.X) };
+			for (int32 X = 0; X < Dimensions.X; ++X)
+			{
+				int32 X0, X1;
+				GetSourcePair(X, SourceDimensions.X, X0, X1);
+				const TexelType* Values[8] = {
+					Slices[0] + Rows[0] + X0, Slices[0] + Rows[0] + X1, Slices[0] + Rows[1] + X0, Slices[0] + Rows[1] + X1,
+					Slices[1] + Rows[0] + X0, Slices[1] + Rows[0] + X1, Slices[1] + Rows[1] + X0, Slices[1] + Rows[1] + X1 };
+				Output[Y * int64(Dimensions.X) + X] = Average8(Values);
+			}
+		}
+	});
+}
+
+void DownsampleVolumeSlab(const void* SourceSlab, EPixelFormat PixelFormat, FIntVector SourceDimensions,
+	int32 SourceFirstSlice, int32 SourceSliceCount, void* OutSlab)
+{
+	int32 FirstSlice, SliceCount;
+	GetDownsampledSliceRange(SourceFirstSlice, SourceSliceCount, SourceDimensions.Z, FirstSlice, SliceCount);
+
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		DownsampleSlabTyped(reinterpret_cast<const uint8*>(SourceSlab), SourceDimensions, SourceFirstSlice, SourceSliceCount,
+			FirstSlice, SliceCount, reinterpret_cast<uint8*>(OutSlab));
+		break;
+	case PF_G16:
+		DownsampleSlabTyped(reinterpret_cast<const uint16*>(SourceSlab), SourceDimensions, SourceFirstSlice, SourceSliceCount,
+			FirstSlice, SliceCount, reinterpret_cast<uint16*>(OutSlab));
+		break;
+	case PF_R16F:
+		DownsampleSlabTyped(reinterpret_cast<const FFloat16*>(SourceSlab), SourceDimensions, SourceFirstSlice, SourceSliceCount,
+			FirstSlice, SliceCount, reinterpret_cast<FFloat16*>(OutSlab));
+		break;
+	case PF_R32_FLOAT:
+		DownsampleSlabTyped(reinterpret_cast<const float*>(SourceSlab), SourceDimensions, SourceFirstSlice, SourceSliceCount,
+			FirstSlice, SliceCount, reinterpret_cast<float*>(OutSlab));
+		break;
+	default:
+		checkNoEntry();
+	}
+}
+
+void GenerateVolumeMips(const void* Volume, EPixelFormat PixelFormat, FIntVector Dimensions, int32 MipCount, TArray<TArray<uint8>>& OutMips)
+{
+	const int32 MaxMipCount = GetMaxVolumeMipCount(Dimensions);
+	MipCount = MipCount <= 0 ? MaxMipCount : FMath::Min(MipCount, MaxMipCount);
+
+	OutMips.SetNum(MipCount);
+	OutMips[0].SetNumUninitialized(int64(Dimensions.X) * Dimensions.Y * Dimensions.Z * GPixelFormats[PixelFormat].BlockBytes);
+	FMemory::Memcpy(OutMips[0].GetData(), Volume, OutMips[0].Num());
+	for (int32 Level = 1; Level < MipCount; ++Level)
+	{
+		const FIntVector SourceDimensions = GetVolumeMipDimensions(Dimensions, Level - 1);
+		const FIntVector LevelDimensions = GetVolumeMipDimensions(Dimensions, Level);
+		OutMips[Level].SetNumUninitialized(int64(LevelDimensions.X) * LevelDimensions.Y * LevelDimensions.Z * GPixelFormats[PixelFormat].BlockBytes);
+		// The whole level is one big slab.
+		DownsampleVolumeSlab(OutMips[Level - 1].GetData(), PixelFormat, SourceDimensions, 0, SourceDimensions.Z, OutMips[Level].GetData());
+	}
+}
+
+template<typename TexelType>
+static void DownsampleTyped_Reference(const TexelType* Source, FIntVector SourceDimensions, TexelType* Destination)
+{
+	const FIntVector Dimensions = GetVolumeMipDimensions(SourceDimensions, 1);
+	auto SourceAt = [&](int32 X, int32 Y, int32 Z)
+	{
+		X = FMath::Min(X, SourceDimensions.X - 1);
+		Y = FMath::Min(Y, SourceDimensions.Y - 1);
+		Z = FMath::Min(Z, SourceDimensions.Z - 1);
+		return Source + X + int64(SourceDimensions.X) * (Y + int64(SourceDimensions.Y) * Z);
+	};
+
+	for (int32 Z = 0; Z < Dimensions.Z; ++Z)
+	for (int32 Y = 0; Y < Dimensions.Y; ++Y)
+	for (int32 X = 0; X < Dimensions.X; ++X)
+	{
+		const TexelType* Values[8];
+		for (int32 i = 0; i < 8; ++i)
+		{
+			Values[i] = SourceAt(2 * X + (i & 1), 2 * Y + ((i >> 1) & 1), 2 * Z + (i >> 2));
+		}
+		Destination[X + int64(Dimensions.X) * (Y + int64(Dimensions.Y) * Z)] = Average8(Values);
+	}
+}
+
+void DownsampleVolume_Reference(const void* Source, EPixelFormat PixelFormat, FIntVector SourceDimensions, TArray<uint8>& OutVolume)
+{
+	const FIntVector Dimensions = GetVolumeMipDimensions(SourceDimensions, 1);
+	OutVolume.SetNumUninitialized(int64(Dimensions.X) * Dimensions.Y * Dimensions.Z * GPixelFormats[PixelFormat].BlockBytes);
+
+	switch (PixelFormat)
+	{
+	case PF_G8:
+		DownsampleTyped_Reference(reinterpret_cast<const uint8*>(Source), SourceDimensions, reinterpret_cast<uint8*>(OutVolume.GetData()));
+		break;
+	case PF_G16:
+		DownsampleTyped_Reference(reinterpret_cast<const uint16*>(Source), SourceDimensions, reinterpret_cast<uint16*>(OutVolume.GetData()));
+		break;
+	case PF_R16F:
+		DownsampleTyped_Reference(reinterpret_cast<const FFloat16*>(Source), SourceDimensions, reinterpret_cast<FFloat16*>(OutVolume.GetData()));
+		break;
+	case PF_R32_FLOAT:
+		DownsampleTyped_Reference(reinterpret_cast<const float*>(Source), SourceDimensions, reinterpret_cast<float*>(OutVolume.GetData()));
+		break;
+	default:
+		checkNoEntry();
+	}
+}
@@ -0,0 +1,581 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVolumeSequence.h"
+#include "../Public/RaymarchVolume.h"
+#include "../Public/RaymarchVolumeFile.h"
+#include "../Public/RaymarchVoxelConversion.h"
+#include "../Public/RaymarchProfiling.h"
+#include "../Public/Raymarcher.h"
+
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "RenderingThread.h"
+
+#define LOCTEXT_NAMESPACE "RaymarchPlugin"
+
+/**
+* One texture of the ring and the frame in it. Frame and flags are game thread only. The host copy and macro cells are
+* written by the load filling the slot and read by its upload, and a slot is only handed to a new load once the
+* previous one reported back.
+*/
+struct URaymarchVolumeSequence::FSlot
+{
+	// The frame as it gets drawn, swapped into the drawn volume when shown. Only touched on the render thread.
+	FRaymarchVolumeDataset Dataset;
+	// Copy of what the texture holds, for delta uploads to compare against. Empty without delta uploads.
+	TArray<uint8> ResidentVoxels;
+	// Built from ResidentVoxels, so skipping matches what the texture holds even with a delta tolerance.
+	FRaymarchMacroCellGrid MacroCells;
+	// Frame held or being loaded, INDEX_NONE if none.
+	int32 Frame = INDEX_NONE;
+	bool bLoading = false;
+	// True once Frame is completely uploaded.
+	bool bReady = false;
+};
+
+// Value of a stored voxel, in the units the tolerance is given in.
+template <typename VoxelType>
+static FORCEINLINE float GetStoredVoxelValue(VoxelType Voxel)
+{
+	return float(Voxel);
+}
+
+static FORCEINLINE float GetStoredVoxelValue(FFloat16 Voxel)
+{
+	return Voxel.GetFloat();
+}
+
+// True if any voxel of the rows differs by more than Tolerance.
+template <typename VoxelType>
+static bool RowDiffers(const uint8* Resident, const uint8* Frame, int32 VoxelCount, float Tolerance)
+{
+	const VoxelType* ResidentVoxels = reinterpret_cast<const VoxelType*>(Resident);
+	const VoxelType* FrameVoxels = reinterpret_cast<const VoxelType*>(Frame);
+	for (int32 Index = 0; Index < VoxelCount; ++Index)
+	{
+		if (FMath::Abs(GetStoredVoxelValue(FrameVoxels[Index]) - GetStoredVoxelValue(ResidentVoxels[Index])) > Tolerance)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void UpdateChangedBricks(TArray<uint8>& Resident, const TArray<uint8>& Frame, FIntVector Dimensions, EPixelFormat PixelFormat,
+	int32 BrickSize, float Tolerance, TArray<FIntVector>& OutChangedBricks)
+{
+	check(Resident.Num() == Frame.Num() && BrickSize > 0);
+	const int32 VoxelSize = GPixelFormats[PixelFormat].BlockBytes;
+	const int64 RowPitch = int64(Dimensions.X) * VoxelSize;
+	const int64 DepthPitch = RowPitch * Dimensions.Y;
+	const FIntVector BrickCounts(FMath::DivideAndRoundUp(Dimensions.X, BrickSize), FMath::DivideAndRoundUp(Dimensions.Y, BrickSize),
+		FMath::DivideAndRoundUp(Dimensions.Z, BrickSize));
+	const int32 BrickCount = BrickCounts.X * BrickCounts.Y * BrickCounts.Z;
+
+	TArray<bool> Changed;
+	Changed.SetNumZeroed(BrickCount);
+	// Every brick only touches its own voxels, so bricks are compared and copied in parallel.
+	ParallelFor(BrickCount, [&](int32 BrickIndex)
+	{
+		const FIntVector Origin = FIntVector(BrickIndex % BrickCounts.X, (BrickIndex / BrickCounts.X) % BrickCounts.Y,
+			BrickIndex / (BrickCounts.X * BrickCounts.Y)) * BrickSize;
+		const FIntVector End(FMath::Min(Origin.X + BrickSize, Dimensions.X), FMath::Min(Origin.Y + BrickSize, Dimensions.Y),
+			FMath::Min(Origin.Z + BrickSize, Dimensions.Z));
+		const int32 RowVoxels = End.X - Origin.X;
+
+		bool bChanged = false;
+		for (int32 Z = Origin.Z; Z < End.Z && !bChanged; ++Z)
+		{
+			for (int32 Y = Origin.Y; Y < End.Y && !bChanged; ++Y)
+			{
+				const int64 Offset = Origin.X * VoxelSize + Y * RowPitch + Z * DepthPitch;
+				const uint8* ResidentRow = Resident.GetData() + Offset;
+				const uint8* FrameRow = Frame.GetData() + Offset;
+				if (Tolerance <= 0.0f)
+				{
+					bChanged = FMemory::Memcmp(ResidentRow, FrameRow, RowVoxels * VoxelSize) != 0;
+					continue;
+				}
+				switch (PixelFormat)
+				{
+				case PF_G8: bChanged = RowDiffers<uint8>(ResidentRow, FrameRow, RowVoxels, Tolerance); break;
+				case PF_G16: bChanged = RowDiffers<uint16>(ResidentRow, FrameRow, RowVoxels, Tolerance); break;
+				case PF_R16F: bChanged = RowDiffers<FFloat16>(ResidentRow, FrameRow, RowVoxels, Tolerance); break;
+				case PF_R32_FLOAT: bChanged = RowDiffers<float>(ResidentRow, FrameRow, RowVoxels, Tolerance); break;
+				default: bChanged = FMemory::Memcmp(ResidentRow, FrameRow, RowVoxels * VoxelSize) != 0; break;
+				}
+			}
+		}
+
+		if (bChanged)
+		{
+			Changed[BrickIndex] = true;
+			for (int32 Z = Origin.Z; Z < End.Z; ++Z)
+			{
+				for (int32 Y = Origin.Y; Y < End.Y; ++Y)
+				{
+					const int64 Offset = Origin.X * VoxelSize + Y * RowPitch + Z * DepthPitch;
+					FMemory::Memcpy(Resident.GetData() + Offset, Frame.GetData() + Offset, RowVoxels * VoxelSize);
+				}
+			}
+		}
+	});
+
+	// X-major like the bricks were numbered, so neighbors along X can be uploaded together.
+	OutChangedBricks.Reset();
+	for (int32 BrickIndex = 0; BrickIndex < BrickCount; ++BrickIndex)
+	{
+		if (Changed[BrickIndex])
+		{
+			OutChangedBricks.Add(FIntVector(BrickIndex % BrickCounts.X, (BrickIndex / BrickCounts.X) % BrickCounts.Y,
+				BrickIndex / (BrickCounts.X * BrickCounts.Y)));
+		}
+	}
+}
+
+URaymarchVolumeSequence::URaymarchVolumeSequence()
+{
+	Volume = CreateDefaultSubobject<URaymarchVolume>(TEXT("Volume"));
+}
+
+void URaymarchVolumeSequence::BeginDestroy()
+{
+	Super::BeginDestroy();
+	ReleaseSlots_GameThread();
+}
+
+void URaymarchVolumeSequence::ReleaseSlots_GameThread()
+{
+	if (Slots.Num() == 0)
+	{
+		return;
+	}
+
+	// The drawn volume keeps its own references to the shown frame, so it stays drawable until the next one comes.
+	TArray<FSlotPtr> ReleasedSlots = MoveTemp(Slots);
+	Slots.Reset();
+	ShownSlot.Reset();
+	ENQUEUE_RENDER_COMMAND(ReleaseRaymarchSequenceCommand)(
+		[ReleasedSlots](FRHICommandListImmediate& RHICmdList) mutable
+	{
+		ReleasedSlots.Reset();
+	});
+}
+
+bool URaymarchVolumeSequence::IsTickable() const
+{
+	return !HasAnyFlags(RF_ClassDefaultObject) && !IsPendingKill() && Frames.Num() > 0;
+}
+
+TStatId URaymarchVolumeSequence::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(URaymarchVolumeSequence, STATGROUP_Tickables);
+}
+
+bool URaymarchVolumeSequence::Open(const TArray<FString>& FileNames, FIntVector InDimensions, ERaymarchVoxelFormat InVoxelFormat,
+	float InWindowCenter, float InWindowWidth, bool bInQuantizeTo8Bit)
+{
+	ReleaseSlots_GameThread();
+	Frames.Reset();
+	FailedFrames.Reset();
+	bPlaying = false;
+	ShownFrame = INDEX_NONE;
+
+	if (FileNames.Num() == 0)
+	{
+		MY_LOG("A volume sequence needs at least one file!");
+		return false;
+	}
+
+	FString RelativePath = FPaths::GameContentDir();
+	const FString ContentDir = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*RelativePath);
+	TArray<FString> FullPaths;
+	for (const FString& FileName : FileNames)
+	{
+		FullPaths.Add(ContentDir + FileName);
+	}
+
+	// Compressed volume files describe themselves, the first one stands for the whole sequence.
+	FRaymarchVolumeFileHeader FileHeader;
+	if (ReadRaymarchVolumeFileHeader(FullPaths[0], FileHeader))
+	{
+		InDimensions = FileHeader.Dimensions;
+		InVoxelFormat = FileHeader.VoxelFormat;
+	}
+	if (InDimensions.X <= 0 || InDimensions.Y <= 0 || InDimensions.Z <= 0)
+	{
+		MY_LOG("Volume dimensions have to be positive!");
+		return false;
+	}
+	if (bInQuantizeTo8Bit && InWindowWidth <= 0.0f)
+	{
+		MY_LOG("Quantizing a volume to 8 bits needs a positive window width!");
+		return false;
+	}
+
+	Frames = MoveTemp(FullPaths);
+	Dimensions = InDimensions;
+	VoxelFormat = InVoxelFormat;
+	WindowCenter = InWindowCenter;
+	WindowWidth = InWindowWidth;
+	bQuantizeTo8Bit = bInQuantizeTo8Bit;
+	if (bQuantizeTo8Bit)
+	{
+		// Window is baked into the data already.
+		PixelFormat = PF_G8;
+		WindowScaleBias = FVector2D(1.0f, 0.0f);
+	}
+	else
+	{
+		PixelFormat = GetVoxelPixelFormat(VoxelFormat);
+		WindowScaleBias = GetWindowScaleBias(VoxelFormat, WindowCenter, WindowWidth);
+	}
+
+	bRingDeltaUploads = bDeltaUploads;
+	RingBrickSize = FMath::Max(DeltaBrickSize, 4);
+	for (int32 SlotIndex = 0; SlotIndex < FMath::Max(RingSize, 2); ++SlotIndex)
+	{
+		Slots.Add(MakeShareable(new FSlot()));
+	}
+
+	StartFrame = 0;
+	PlaybackTime = 0.0;
+	LastTargetFrame = 0;
+	ResetStats();
+	Prefetch_GameThread();
+	return true;
+}
+
+void URaymarchVolumeSequence::Play()
+{
+	if (!bLoop && GetTargetFrame() == Frames.Num() - 1)
+	{
+		SetFrame(0);
+	}
+	StartFrame = GetTargetFrame();
+	PlaybackTime = 0.0;
+	bPlaying = true;
+}
+
+void URaymarchVolumeSequence::Pause()
+{
+	StartFrame = GetTargetFrame();
+	PlaybackTime = 0.0;
+	bPlaying = false;
+}
+
+void URaymarchVolumeSequence::SetFrame(int32 Frame)
+{
+	if (Frames.Num() == 0)
+	{
+		return;
+	}
+
+	// Jumps don't count as dropping the frames in between.
+	StartFrame = FMath::Clamp(Frame, 0, Frames.Num() - 1);
+	PlaybackTime = 0.0;
+	LastTargetFrame = StartFrame;
+	for (const FSlotPtr& Slot : Slots)
+	{
+		if (Slot->bReady && Slot->Frame == StartFrame && Slot != ShownSlot)
+		{
+			ShowSlot_GameThread(Slot);
+		}
+	}
+	Prefetch_GameThread();
+}
+
+void URaymarchVolumeSequence::ResetStats()
+{
+	Stats = FRaymarchSequenceStats();
+	LatencySumMs = 0.0;
+}
+
+int32 URaymarchVolumeSequence::GetTargetFrame() const
+{
+	if (Frames.Num() == 0)
+	{
+		return 0;
+	}
+	const int32 Played = FMath::FloorToInt(float(PlaybackTime * FramesPerSecond));
+	return bLoop ? (StartFrame + Played) % Frames.Num() : FMath::Min(StartFrame + Played, Frames.Num() - 1);
+}
+
+void URaymarchVolumeSequence::Tick(float DeltaTime)
+{
+	if (bPlaying)
+	{
+		PlaybackTime += DeltaTime;
+	}
+	const int32 TargetFrame = GetTargetFrame();
+	if (bPlaying && !bLoop && TargetFrame == Frames.Num() - 1)
+	{
+		Pause();
+	}
+
+	if (TargetFrame != LastTargetFrame)
+	{
+		// The clock moved on - every frame it passed without showing it was dropped, including the one it just left.
+		const int32 Steps = bLoop ? (TargetFrame - LastTargetFrame + Frames.Num()) % Frames.Num() : TargetFrame - LastTargetFrame;
+		const int32 Dropped = FMath::Max(Steps - 1, 0) + (ShownFrame != LastTargetFrame ? 1 : 0);
+		Stats.FramesDropped += Dropped;
+		INC_DWORD_STAT_BY(STAT_RaymarchSequenceDroppedFrames, Dropped);
+		LastTargetFrame = TargetFrame;
+	}
+
+	if (ShownFrame != TargetFrame)
+	{
+		for (const FSlotPtr& Slot : Slots)
+		{
+			if (Slot->bReady && Slot->Frame == TargetFrame)
+			{
+				ShowSlot_GameThread(Slot);
+				break;
+			}
+		}
+	}
+
+	Prefetch_GameThread();
+}
+
+void URaymarchVolumeSequence::ShowSlot_GameThread(const FSlotPtr& Slot)
+{
+	ShownSlot = Slot;
+	ShownFrame = Slot->Frame;
+	++Stats.FramesShown;
+
+	// Swapping is copying a few references, the uploads are long done. Every frame is a load of its own, so showing one
+	// supersedes whatever was loaded into the volume before.
+	FRaymarchVolumeRenderDataPtr Target = Volume ? Volume->GetRenderData() : nullptr;
+	if (Target.IsValid())
+	{
+		const int32 Ticket = Target->BeginLoad_AnyThread();
+		ENQUEUE_RENDER_COMMAND(ShowRaymarchSequenceFrameCommand)(
+			[Target, Slot, Ticket](FRHICommandListImmediate& RHICmdList)
+		{
+			FRaymarchVolumeDataset Frame = Slot->Dataset;
+			Target->SwapDataset_RenderThread(MoveTemp(Frame), Ticket);
+		});
+	}
+}
+
+void URaymarchVolumeSequence::Prefetch_GameThread()
+{
+	if (Frames.Num() == 0 || Slots.Num() == 0)
+	{
+		return;
+	}
+
+	const int32 TargetFrame = GetTargetFrame();
+	// Frames the ring should hold - as many as there are slots, starting at the target. A shown slot holding an older
+	// frame is pinned and takes one of them.
+	const int32 WindowSize = FMath::Min(Slots.Num() - (ShownSlot.IsValid() && ShownFrame != TargetFrame ? 1 : 0), Frames.Num());
+	auto IsWanted = [&](int32 Frame)
+	{
+		const int32 Distance = bLoop ? (Frame - TargetFrame + Frames.Num()) % Frames.Num() : Frame - TargetFrame;
+		return Distance >= 0 && Distance < WindowSize;
+	};
+
+	int32 Loads = 0;
+	for (const FSlotPtr& Slot : Slots)
+	{
+		Loads += Slot->bLoading ? 1 : 0;
+	}
+
+	for (int32 Step = 0; Step < WindowSize && Loads < MaxConcurrentLoads; ++Step)
+	{
+		const int32 Frame = bLoop ? (TargetFrame + Step) % Frames.Num() : TargetFrame + Step;
+		if (Frame >= Frames.Num())
+		{
+			break;
+		}
+		if (FailedFrames.Contains(Frame) || Slots.ContainsByPredicate([Frame](const FSlotPtr& Slot) { return Slot->Frame == Frame; }))
+		{
+			continue;
+		}
+
+		// Slots holding nothing come first, then ones holding a frame that's behind the clock already. With delta
+		// uploads, a slot that held frame F thus gets about frame F + RingSize, and only the bricks changed since go up.
+		FSlotPtr FreeSlot;
+		for (const FSlotPtr& Slot : Slots)
+		{
+			if (!Slot->bLoading && Slot != ShownSlot && (Slot->Frame == INDEX_NONE || !IsWanted(Slot->Frame)))
+			{
+				FreeSlot = Slot;
+				if (Slot->Frame == INDEX_NONE)
+				{
+					break;
+				}
+			}
+		}
+		if (!FreeSlot.IsValid())
+		{
+			break;
+		}
+
+		FreeSlot->Frame = Frame;
+		FreeSlot->bLoading = true;
+		FreeSlot->bReady = false;
+		++Loads;
+
+		FRaymarchVolumeLoadRequest Request;
+		Request.FullPath = Frames[Frame];
+		Request.Dimensions = Dimensions;
+		Request.VoxelFormat = VoxelFormat;
+		Request.WindowCenter = WindowCenter;
+		Request.WindowWidth = WindowWidth;
+		Request.bQuantizeTo8Bit = bQuantizeTo8Bit;
+
+		TWeakObjectPtr<URaymarchVolumeSequence> Sequence(this);
+		const int32 BrickSize = bRingDeltaUploads ? RingBrickSize : 0;
+		const float Tolerance = DeltaTolerance;
+		const FIntVector FrameDimensions = Dimensions;
+		const EPixelFormat FramePixelFormat = PixelFormat;
+		const FVector2D FrameWindowScaleBias = WindowScaleBias;
+		const double QueueTime = FPlatformTime::Seconds();
+		Async<void>(EAsyncExecution::ThreadPool, [Sequence, FreeSlot, Request, BrickSize, Tolerance, FrameDimensions, FramePixelFormat,
+			FrameWindowScaleBias, QueueTime]()
+		{
+			LoadFrame_AnyThread(Sequence, FreeSlot, Request, BrickSize, Tolerance, FrameDimensions, FramePixelFormat, FrameWindowScaleBias, QueueTime);
+		});
+	}
+}
+
+void URaymarchVolumeSequence::LoadFrame_AnyThread(TWeakObjectPtr<URaymarchVolumeSequence> Sequence, FSlotPtr Slot,
+	FRaymarchVolumeLoadRequest Request, int32 BrickSize, float Tolerance, FIntVector Dimensions, EPixelFormat PixelFormat,
+	FVector2D WindowScaleBias, double QueueTime)
+{
+	TArray<uint8> Voxels;
+	FIntVector FrameDimensions;
+	bool bSuccess = ReadVolumeFile_AnyThread(Request, Voxels, FrameDimensions);
+	if (bSuccess && FrameDimensions != Dimensions)
+	{
+		UE_LOG(LogRaymarch, Error, TEXT("%s is %dx%dx%d voxels, the sequence is %dx%dx%d."), *Request.FullPath,
+			FrameDimensions.X, FrameDimensions.Y, FrameDimensions.Z, Dimensions.X, Dimensions.Y, Dimensions.Z);
+		bSuccess = false;
+	}
+	if (!bSuccess)
+	{
+		AsyncTask(ENamedThreads::GameThread, [Sequence, Slot]()
+		{
+			if (URaymarchVolumeSequence* This = Sequence.Get())
+			{
+				This->OnFrameLoaded_GameThread(Slot, false, 0.0, 0, 0, 0);
+			}
+		});
+		return;
+	}
+
+	// A slot without the frame before (or without delta uploads) gets the whole volume, others only the changed bricks.
+	const int32 VoxelSize = GPixelFormats[PixelFormat].BlockBytes;
+	const bool bFullUpload = BrickSize <= 0 || Slot->ResidentVoxels.Num() != Voxels.Num();
+	TArray<FIntVector> ChangedBricks;
+	int32 BricksUploaded = 0;
+	int32 BricksSkipped = 0;
+	int64 UploadedBytes = 0;
+	if (bFullUpload)
+	{
+		Slot->ResidentVoxels = MoveTemp(Voxels);
+		UploadedBytes = Slot->ResidentVoxels.Num();
+		if (BrickSize > 0)
+		{
+			BricksUploaded = FMath::DivideAndRoundUp(Dimensions.X, BrickSize) * FMath::DivideAndRoundUp(Dimensions.Y, BrickSize) *
+				FMath::DivideAndRoundUp(Dimensions.Z, BrickSize);
+		}
+	}
+	else
+	{
+		UpdateChangedBricks(Slot->ResidentVoxels, Voxels, Dimensions, PixelFormat, BrickSize, Tolerance, ChangedBricks);
+		BricksUploaded = ChangedBricks.Num();
+		BricksSkipped = FMath::DivideAndRoundUp(Dimensions.X, BrickSize) * FMath::DivideAndRoundUp(Dimensions.Y, BrickSize) *
+			FMath::DivideAndRoundUp(Dimensions.Z, BrickSize) - BricksUploaded;
+		for (const FIntVector& Brick : ChangedBricks)
+		{
+			const FIntVector Origin = Brick * BrickSize;
+			UploadedBytes += int64(FMath::Min(BrickSize, Dimensions.X - Origin.X)) * FMath::Min(BrickSize, Dimensions.Y - Origin.Y) *
+				FMath::Min(BrickSize, Dimensions.Z - Origin.Z) * VoxelSize;
+		}
+	}
+
+	Slot->MacroCells.Init(Dimensions, RAYMARCH_DEFAULT_MACRO_CELL_SIZE);
+	Slot->MacroCells.AccumulateSlab(Slot->ResidentVoxels.GetData(), PixelFormat, 0, Dimensions.Z);
+
+	AsyncTask(ENamedThreads::GameThread, [=]()
+	{
+		ENQUEUE_RENDER_COMMAND(UploadRaymarchSequenceFrameCommand)(
+			[=](FRHICommandListImmediate& RHICmdList)
+		{
+			FRaymarchVolumeDataset& Frame = Slot->Dataset;
+			if (!Frame.VolumeTexture)
+			{
+				Frame.VolumeTexture = CreateEmpty3DTexture_RenderThread(RHICmdList, Dimensions, PixelFormat);
+			}
+			if (bFullUpload)
+			{
+				Update3DTextureSlab_RenderThread(RHICmdList, Frame.VolumeTexture, Slot->ResidentVoxels.GetData(), 0, Dimensions.Z);
+			}
+			else if (ChangedBricks.Num() > 0)
+			{
+				Update3DTextureBricks_RenderThread(RHICmdList, Frame.VolumeTexture, Slot->ResidentVoxels.GetData(), BrickSize, ChangedBricks);
+			}
+			Frame.VolumeDimensions = Dimensions;
+			Frame.WindowScaleBias = WindowScaleBias;
+			Frame.MacroCellTexture = CreateMacroCellTexture_RenderThread(RHICmdList, Slot->MacroCells);
+			Frame.ValueRange = Slot->MacroCells.GetValueRange();
+			if (BrickSize <= 0)
+			{
+				// Nothing to compare against later, don't keep a second copy of the frame around.
+				Slot->ResidentVoxels.Empty();
+			}
+
+			AsyncTask(ENamedThreads::GameThread, [=]()
+			{
+				if (URaymarchVolumeSequence* This = Sequence.Get())
+				{
+					This->OnFrameLoaded_GameThread(Slot, true, FPlatformTime::Seconds() - QueueTime, BricksUploaded, BricksSkipped, UploadedBytes);
+				}
+			});
+		});
+	});
+}
+
+void URaymarchVolumeSequence::OnFrameLoaded_GameThread(FSlotPtr Slot, bool bSuccess, double LatencySeconds, int32 BricksUploaded,
+	int32 BricksSkipped, int64 UploadedBytes)
+{
+	if (!Slots.Contains(Slot))
+	{
+		// A load of a sequence opened before.
+		return;
+	}
+
+	Slot->bLoading = false;
+	if (!bSuccess)
+	{
+		FailedFrames.Add(Slot->Frame);
+		Slot->Frame = INDEX_NONE;
+		Prefetch_GameThread();
+		return;
+	}
+
+	Slot->bReady = true;
+	const float LatencyMs = float(LatencySeconds * 1000.0);
+	++Stats.FramesPrefetched;
+	LatencySumMs += LatencyMs;
+	Stats.AverageLatencyMs = float(LatencySumMs / Stats.FramesPrefetched);
+	Stats.MaxLatencyMs = FMath::Max(Stats.MaxLatencyMs, LatencyMs);
+	Stats.BricksUploaded += BricksUploaded;
+	Stats.BricksSkipped += BricksSkipped;
+	Stats.UploadedMB += float(UploadedBytes / (1024.0 * 1024.0));
+	SET_FLOAT_STAT(STAT_RaymarchSequenceLatency, LatencyMs);
+
+	// Don't wait for the next tick if the clock is at this frame already.
+	if (Slot->Frame == GetTargetFrame() && ShownFrame != Slot->Frame)
+	{
+		ShowSlot_GameThread(Slot);
+	}
+	Prefetch_GameThread();
+}
+
+#undef LOCTEXT_NAMESPACE
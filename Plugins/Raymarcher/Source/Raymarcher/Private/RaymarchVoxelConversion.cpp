@@ -0,0 +1,228 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#include "../Public/RaymarchVoxelConversion.h"
+#include "RaymarchVoxelConversionPrivate.h"
+
+int32 GetVoxelByteSize(ERaymarchVoxelFormat Format)
+{
+	switch (Format)
+	{
+	case ERaymarchVoxelFormat::U8:
+		return 1;
+	case ERaymarchVoxelFormat::U16:
+	case ERaymarchVoxelFormat::S16:
+	case ERaymarchVoxelFormat::F16:
+		return 2;
+	case ERaymarchVoxelFormat::F32:
+		return 4;
+	default:
+		checkNoEntry();
+		return 1;
+	}
+}
+
+EPixelFormat GetVoxelPixelFormat(ERaymarchVoxelFormat Format)
+{
+	switch (Format)
+	{
+	case ERaymarchVoxelFormat::U8:
+		return PF_G8;
+	case ERaymarchVoxelFormat::U16:
+	case ERaymarchVoxelFormat::S16: // Gets shifted to unsigned when loading.
+		return PF_G16;
+	case ERaymarchVoxelFormat::F16:
+		return PF_R16F;
+	case ERaymarchVoxelFormat::F32:
+		return PF_R32_FLOAT;
+	default:
+		checkNoEntry();
+		return PF_G8;
+	}
+}
+
+float GetNormalizedVoxelValue(ERaymarchVoxelFormat Format, float RawValue)
+{
+	switch (Format)
+	{
+	case ERaymarchVoxelFormat::U8:
+		return RawValue / 255.0f;
+	case ERaymarchVoxelFormat::U16:
+		return RawValue / 65535.0f;
+	case ERaymarchVoxelFormat::S16:
+		return (RawValue + 32768.0f) / 65535.0f;
+	default:
+		return RawValue;
+	}
+}
+
+FVector2D GetWindowScaleBias(ERaymarchVoxelFormat Format, float WindowCenter, float WindowWidth)
+{
+	if (WindowWidth <= 0.0f)
+	{
+		return FVector2D(1.0f, 0.0f);
+	}
+	// Window bounds as the shader sees them, then map [Low, High] -> [0, 1].
+	const float Low = GetNormalizedVoxelValue(Format, WindowCenter - WindowWidth / 2);
+	const float High = GetNormalizedVoxelValue(Format, WindowCenter + WindowWidth / 2);
+	const float Scale = 1.0f / (High - Low);
+	return FVector2D(Scale, -Low * Scale);
+}
+
+void ConvertSignedToUnsigned16(int16* Voxels, int64 VoxelCount)
+{
+	// Adding 32768 to a two's complement short is the same as flipping its top bit.
+	uint16* Data = reinterpret_cast<uint16*>(Voxels);
+	int64 i = 0;
+#if RAYMARCH_USE_SSE2
+	const __m128i SignBit = _mm_set1_epi16(int16(0x8000));
+	for (; i + 8 <= VoxelCount; i += 8)
+	{
+		__m128i* Ptr = reinterpret_cast<__m128i*>(Data + i);
+		_mm_storeu_si128(Ptr, _mm_xor_si128(_mm_loadu_si128(Ptr), SignBit));
+	}
+#endif
+	for (; i < VoxelCount; ++i)
+	{
+		Data[i] ^= 0x8000;
+	}
+}
+
+// Reads a single voxel of any format as a float.
+static FORCEINLINE float ReadVoxel(const void* Source, ERaymarchVoxelFormat Format, int64 Index)
+{
+	switch (Format)
+	{
+	case ERaymarchVoxelFormat::U8:
+		return reinterpret_cast<const uint8*>(Source)[Index];
+	case ERaymarchVoxelFormat::U16:
+		return reinterpret_cast<const uint16*>(Source)[Index];
+	case ERaymarchVoxelFormat::S16:
+		return reinterpret_cast<const int16*>(Source)[Index];
+	case ERaymarchVoxelFormat::F16:
+		return reinterpret_cast<const FFloat16*>(Source)[Index].GetFloat();
+	case ERaymarchVoxelFormat::F32:
+		return reinterpret_cast<const float*>(Source)[Index];
+	default:
+		return 0.0f;
+	}
+}
+
+// Converts voxels [Start, End) with plain scalar code. Scale and bias map the window to [0, 255].
+static void QuantizeRange_Scalar(const void* Source, ERaymarchVoxelFormat Format, int64 Start, int64 End, float Scale, float Bias, uint8* Destination)
+{
+	for (int64 i = Start; i < End; ++i)
+	{
+		// +0.5 and truncation == rounding, as the value is never negative after clamping.
+		// (Bias + 0.5f) is grouped the same way as in the vectorized path, so that both give identical results.
+		const float Value = FMath::Clamp(ReadVoxel(Source, Format, i) * Scale + (Bias + 0.5f), 0.0f, 255.0f);
+		Destination[i] = uint8(Value);
+	}
+}
+
+void QuantizeWindowed_Scalar(const void* Source, ERaymarchVoxelFormat Format, int64 VoxelCount, float WindowCenter, float WindowWidth, uint8* Destination)
+{
+	const float Scale = 255.0f / FMath::Max(WindowWidth, SMALL_NUMBER);
+	const float Bias = -(WindowCenter - WindowWidth / 2) * Scale;
+	QuantizeRange_Scalar(Source, Format, 0, VoxelCount, Scale, Bias, Destination);
+}
+
+#if RAYMARCH_USE_SSE2
+
+// Windows 4 floats and converts them to clamped, rounded ints.
+static FORCEINLINE __m128i WindowToInt(__m128 Values, __m128 Scale, __m128 Bias)
+{
+	const __m128 Windowed = _mm_add_ps(_mm_mul_ps(Values, Scale), Bias);
+	const __m128 Clamped = _mm_min_ps(_mm_max_ps(Windowed, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+	return _mm_cvttps_epi32(Clamped);
+}
+
+// Windows 16 floats (in 4 registers) and packs them into 16 bytes.
+static FORCEINLINE __m128i WindowToBytes(__m128 A, __m128 B, __m128 C, __m128 D, __m128 Scale, __m128 Bias)
+{
+	const __m128i Low = _mm_packs_epi32(WindowToInt(A, Scale, Bias), WindowToInt(B, Scale, Bias));
+	const __m128i High = _mm_packs_epi32(WindowToInt(C, Scale, Bias), WindowToInt(D, Scale, Bias));
+	return _mm_packus_epi16(Low, High);
+}
+
+// Widens 8 unsigned shorts to two registers of floats.
+static FORCEINLINE void UnpackU16(__m128i Shorts, __m128& OutLow, __m128& OutHigh)
+{
+	OutLow = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Shorts, _mm_setzero_si128()));
+	OutHigh = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Shorts, _mm_setzero_si128()));
+}
+
+// Widens 8 signed shorts to two registers of floats (duplicate into the top half, then arithmetic shift to sign-extend).
+static FORCEINLINE void UnpackS16(__m128i Shorts, __m128& OutLow, __m128& OutHigh)
+{
+	OutLow = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(Shorts, Shorts), 16));
+	OutHigh = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(Shorts, Shorts), 16));
+}
+
+// Converts as many whole blocks of 16 voxels as possible, returns the number of voxels converted.
+static int64 QuantizeBlocks_SSE2(const void* Source, ERaymarchVoxelFormat Format, int64 VoxelCount, float ScaleScalar, float BiasScalar, uint8* Destination)
+{
+	// Rounding is folded into the bias.
+	const __m128 Scale = _mm_set1_ps(ScaleScalar);
+	const __m128 Bias = _mm_set1_ps(BiasScalar + 0.5f);
+	const int64 BlockEnd = VoxelCount & ~int64(15);
+	__m128 A, B, C, D;
+
+	switch (Format)
+	{
+	case ERaymarchVoxelFormat::U8:
+		for (int64 i = 0; i < BlockEnd; i += 16)
+		{
+			const __m128i Bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reinterpret_cast<const uint8*>(Source) + i));
+			UnpackU16(_mm_unpacklo_epi8(Bytes, _mm_setzero_si128()), A, B);
+			UnpackU16(_mm_unpackhi_epi8(Bytes, _mm_setzero_si128()), C, D);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Destination + i), WindowToBytes(A, B, C, D, Scale, Bias));
+		}
+		return BlockEnd;
+	case ERaymarchVoxelFormat::U16:
+	case ERaymarchVoxelFormat::S16:
+		for (int64 i = 0; i < BlockEnd; i += 16)
+		{
+			const __m128i* Ptr = reinterpret_cast<const __m128i*>(reinterpret_cast<const uint16*>(Source) + i);
+			if (Format == ERaymarchVoxelFormat::U16)
+			{
+				UnpackU16(_mm_loadu_si128(Ptr), A, B);
+				UnpackU16(_mm_loadu_si128(Ptr + 1), C, D);
+			}
+			else
+			{
+				UnpackS16(_mm_loadu_si128(Ptr), A, B);
+				UnpackS16(_mm_loadu_si128(Ptr + 1), C, D);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Destination + i), WindowToBytes(A, B, C, D, Scale, Bias));
+		}
+		return BlockEnd;
+	case ERaymarchVoxelFormat::F32:
+		for (int64 i = 0; i < BlockEnd; i += 16)
+		{
+			const float* Ptr = reinterpret_cast<const float*>(Source) + i;
+			A = _mm_loadu_ps(Ptr);
+			B = _mm_loadu_ps(Ptr + 4);
+			C = _mm_loadu_ps(Ptr + 8);
+			D = _mm_loadu_ps(Ptr + 12);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Destination + i), WindowToBytes(A, B, C, D, Scale, Bias));
+		}
+		return BlockEnd;
+	default:
+		// Half floats need F16C to be converted in registers, which we can't count on. Leave them to the scalar path.
+		return 0;
+	}
+}
+
+#endif
+
+void QuantizeWindowed(const void* Source, ERaymarchVoxelFormat Format, int64 VoxelCount, float WindowCenter, float WindowWidth, uint8* Destination)
+{
+	const float Scale = 255.0f / FMath::Max(WindowWidth, SMALL_NUMBER);
+	const float Bias = -(WindowCenter - WindowWidth / 2) * Scale;
+	int64 Converted = 0;
+#if RAYMARCH_USE_SSE2
+	Converted = QuantizeBlocks_SSE2(Source, Format, VoxelCount, Scale, Bias, Destination);
+#endif
+	// Leftovers (or everything, if there is no vectorized path).
+	QuantizeRange_Scalar(Source, Format, Converted, VoxelCount, Scale, Bias, Destination);
+}
@@ -0,0 +1,19 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// SSE2 paths of the CPU side voxel processing, with scalar fallbacks elsewhere.
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define RAYMARCH_USE_SSE2 1
+#else
+#define RAYMARCH_USE_SSE2 0
+#endif
+
+// Value the shader gets when sampling a texel of given type (normalized formats are divided by their max).
+FORCEINLINE float ToSampledValue(uint8 Value) { return Value / 255.0f; }
+FORCEINLINE float ToSampledValue(uint16 Value) { return Value / 65535.0f; }
+FORCEINLINE float ToSampledValue(FFloat16 Value) { return Value.GetFloat(); }
+FORCEINLINE float ToSampledValue(float Value) { return Value; }
@@ -1,18 +1,39 @@
 // Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
 
 #include "Raymarcher.h"
+#include "RaymarchProfiling.h"
+#include "RaymarchRendering.h"
+#include "RaymarchReconstruction.h"
+#include "Misc/CoreDelegates.h"
 
 #define LOCTEXT_NAMESPACE "FRaymarcherModule"
 
+DEFINE_LOG_CATEGORY(LogRaymarch);
+
 void FRaymarcherModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+	EndFrameHandle = FCoreDelegates::OnEndFrameRT.AddLambda([]()
+	{
+		FRaymarchProfiler::Get().EndFrame_RenderThread();
+	});
 }
 
 void FRaymarcherModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	FCoreDelegates::OnEndFrameRT.Remove(EndFrameHandle);
+	ReleaseDefaultRaymarchVolume_GameThread();
+	FRaymarchReconstruction::ReleaseAll_GameThread();
+
+	// Statics are destroyed after the RHI is gone, so whatever they hold has to go now.
+	ENQUEUE_RENDER_COMMAND(ReleaseRaymarchProfilerCommand)(
+		[](FRHICommandListImmediate& RHICmdList)
+	{
+		FRaymarchProfiler::Get().Release_RenderThread();
+	});
+	FlushRenderingCommands();
 }
 
 #undef LOCTEXT_NAMESPACE
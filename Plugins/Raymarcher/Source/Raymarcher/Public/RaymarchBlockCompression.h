@@ -0,0 +1,53 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Edge length of a BC4 block in voxels, along X and Y. Every Z-slice is compressed on its own.
+#define RAYMARCH_BC4_BLOCK_SIZE 4
+// Size of a compressed BC4 block in bytes - half a byte per voxel.
+#define RAYMARCH_BC4_BLOCK_BYTES 8
+
+/** Size and error of voxels compressed to BC4. Errors are in 8-bit units (0-255). */
+struct FRaymarchBlockCompressionStats
+{
+	int64 Voxels = 0;
+	// Size of the voxels as uncompressed G8.
+	int64 SourceBytes = 0;
+	int64 CompressedBytes = 0;
+	double SquaredErrorSum = 0.0;
+	float MaxError = 0.0f;
+
+	void Accumulate(const FRaymarchBlockCompressionStats& Other);
+
+	float GetRatio() const { return CompressedBytes > 0 ? float(double(SourceBytes) / CompressedBytes) : 0.0f; }
+	double GetRootMeanSquareError() const { return Voxels > 0 ? FMath::Sqrt(SquaredErrorSum / Voxels) : 0.0; }
+	/** Peak signal to noise ratio in dB, infinite for lossless compression. */
+	double GetPeakSignalToNoiseRatio() const;
+};
+
+/** True if a volume of given dimensions can be a BC4 texture (the GPU needs whole blocks in X and Y at the top level). */
+bool CanCompressVolumeBC4(FIntVector Dimensions);
+
+/** Size of BC4 compressed slices. Blocks at the upper X and Y borders are partial, but take a whole block. */
+int64 GetBC4SlabBytes(int32 SizeX, int32 SizeY, int32 SliceCount);
+
+/**
+* Compresses 8-bit voxels to BC4 in the layout RHIUpdateTexture3D expects (rows of blocks, slice after slice), in
+* parallel over rows of blocks. Every block keeps its minimum and maximum exactly (or 0 and 255 in blocks using the
+* 6-value mode), so macro cells and bricks built from the uncompressed voxels still tell empty regions right.
+* @param Voxels Slices of SizeX * SizeY voxels, tightly packed.
+* @param OutBlocks Receives GetBC4SlabBytes(SizeX, SizeY, SliceCount) bytes.
+* @param OutStats Optional, receives size and error of the compressed voxels.
+*/
+void CompressSlabBC4(const uint8* Voxels, int32 SizeX, int32 SizeY, int32 SliceCount, uint8* OutBlocks,
+	FRaymarchBlockCompressionStats* OutStats = nullptr);
+
+/** Decodes slices compressed with CompressSlabBC4 the way the GPU samples them, rounded to 8 bits. */
+void DecompressSlabBC4(const uint8* Blocks, int32 SizeX, int32 SizeY, int32 SliceCount, uint8* OutVoxels);
+
+/** Logs how much GPU memory compressing saved and what it cost in precision.
+* @param VolumeName Name to log the numbers under (i.e. path of the file).
+*/
+void LogBlockCompressionStats(const FString& VolumeName, const FRaymarchBlockCompressionStats& Stats);
@@ -7,28 +7,213 @@
 #include "Classes/Kismet/BlueprintFunctionLibrary.h"
 #include "RHI.h"
 #include "RHIResources.h"
+#include "RaymarchTypes.h"
+#include "RaymarchVolume.h"
+#include "RaymarchTransferFunction.h"
+#include "RaymarchVolumeSequence.h"
 #include "RaymarchBlueprintLibrary.generated.h"
 
+/** Blueprint callback for streaming loads - called every time a part of the volume got uploaded. */
+DECLARE_DYNAMIC_DELEGATE_OneParam(FRaymarchLoadProgressEvent, float, Progress);
+/** Blueprint callback for streaming loads - called when the volume is ready to be drawn (or the load failed). */
+DECLARE_DYNAMIC_DELEGATE_OneParam(FRaymarchLoadCompletedEvent, bool, bSuccess);
+
 UCLASS(MinimalAPI)
 class URaymarchBlueprintLibrary : public UBlueprintFunctionLibrary
 {
 	GENERATED_UCLASS_BODY()
 	/** Draws the raymarched volume .
 	 * @param OutputRenderTarget The render target to draw to. Don't necessarily need to have same resolution or aspect ratio as distorted render.
+	 * @param Settings Compositing mode (or intensity projection and its slab), sampling rate and early ray termination -
+	 *                 lower quality for shorter frame times.
 	 */
-	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
 	static void DrawRaymarchToRenderTarget(
 		const UObject* WorldContextObject,
 		class UTextureRenderTarget2D* OutputRenderTarget,
-		const FTransform Transform);
+		const FTransform Transform,
+		const FRaymarchRenderSettings& Settings);
 	
-	/** Loads a RAW 3D texture into this classes FRHITexture3D member. Will output error log messages and return if unsuccessful */
+	/** Draws several volumes into one render target in a single pass, blended back to front.
+	 * @param OutputRenderTarget The render target to draw to.
+	 * @param Volumes Volumes to draw with their transforms.
+	 * @param Settings Compositing mode, sampling rate and early ray termination, shared by all volumes.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
+	static void DrawRaymarchVolumesToRenderTarget(
+		const UObject* WorldContextObject,
+		class UTextureRenderTarget2D* OutputRenderTarget,
+		const TArray<FRaymarchVolumeDraw>& Volumes,
+		const FRaymarchRenderSettings& Settings);
+
+	/** Draws several volumes like DrawRaymarchVolumesToRenderTarget, but from any camera instead of the player's.
+	 * @param CameraTransform Location and rotation of the camera in the world, it looks along its X axis.
+	 * @param FieldOfView Horizontal field of view in degrees. The aspect ratio is the render target's.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
+	static void DrawRaymarchVolumesFromCamera(
+		const UObject* WorldContextObject,
+		class UTextureRenderTarget2D* OutputRenderTarget,
+		const TArray<FRaymarchVolumeDraw>& Volumes,
+		const FRaymarchRenderSettings& Settings,
+		const FTransform& CameraTransform,
+		float FieldOfView = 90.0f);
+
+	/** Draws several volumes from several cameras (eyes, a camera array...) into viewports of one render target, in one
+	 * submission. The views are laid out in a grid, as many columns as rows (or one more), filled row by row.
+	 * @param ViewMatrices World to view space per camera (engine conventions - X right, Y up, Z forward).
+	 * @param ProjectionMatrices View to clip space per camera, as many as there are view matrices.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
+	static void DrawRaymarchVolumesFromViews(
+		const UObject* WorldContextObject,
+		class UTextureRenderTarget2D* OutputRenderTarget,
+		const TArray<FRaymarchVolumeDraw>& Volumes,
+		const FRaymarchRenderSettings& Settings,
+		const TArray<FMatrix>& ViewMatrices,
+		const TArray<FMatrix>& ProjectionMatrices);
+
+	/** Draws several volumes as seen by both eyes of the first player's HMD, left eye into the left half of the target.
+	 * Without stereo rendering, draws the player's view over the whole target instead.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
+	static void DrawRaymarchVolumesStereo(
+		const UObject* WorldContextObject,
+		class UTextureRenderTarget2D* OutputRenderTarget,
+		const TArray<FRaymarchVolumeDraw>& Volumes,
+		const FRaymarchRenderSettings& Settings);
+
+	/** Draws several volumes as seen by a scene capture, i.e. to composite them over what the capture rendered.
+	 * @param SceneCapture Capture to take the transform and field of view from. Has to use a perspective projection.
+	 *                     Captures of SceneColor and SceneDepth also clip the volumes against their depth (unless Settings
+	 *                     have a scene depth of their own).
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject", AutoCreateRefTerm = "Settings"))
+	static void DrawRaymarchVolumesFromSceneCapture(
+		const UObject* WorldContextObject,
+		class UTextureRenderTarget2D* OutputRenderTarget,
+		const TArray<FRaymarchVolumeDraw>& Volumes,
+		const FRaymarchRenderSettings& Settings,
+		class USceneCaptureComponent2D* SceneCapture);
+
+	/** Creates an empty volume to load a RAW file into with LoadRawTexture3DAsync. */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+	static URaymarchVolume* CreateRaymarchVolume(const UObject* WorldContextObject);
+
+	/** Creates a player for a time series of volumes. Open it, draw its volume (GetVolume) and keep a reference to it,
+	 * it ticks on its own while referenced.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+	static URaymarchVolumeSequence* CreateRaymarchVolumeSequence(const UObject* WorldContextObject);
+
+	/** Creates a transfer function out of a color curve (alpha being the opacity of one voxel) over the windowed intensity [0,1].
+	 * Edit the curve and call Refresh on the result to update it - only the small lookup tables get uploaded again.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+	static URaymarchTransferFunction* CreateRaymarchTransferFunction(const UObject* WorldContextObject, class UCurveLinearColor* Curve);
+
+	/** Runs a chain of preprocessing filters (denoising, vessel enhancement...) over a loaded volume with compute shaders.
+	 * The volume gets replaced by the filtered one (a float texture without mips) and its empty-space skipping cells rebuilt.
+	 * Needs SM5, bricked volumes aren't supported.
+	 * @param Volume Volume to filter. None filters the default one drawn by DrawRaymarchToRenderTarget.
+	 * @param Filters Filters to run, in order.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+	static void FilterRaymarchVolume(const UObject* WorldContextObject, URaymarchVolume* Volume, const TArray<FRaymarchFilterSettings>& Filters);
+
+	/** Loads a RAW U8 3D texture into the default volume without blocking. The previous volume is drawn until it's loaded.
+	 * Will output error log messages if unsuccessful. */
 	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
 		static void LoadRawTexture3D(
 			const UObject* WorldContextObject,
 			FString textureName, int xDim, int yDim, int zDim);
 
-	/** Initializes resources for rendering. Only needs the renderTarget to create a matching DepthTexture. */
+	/** Loads a RAW 3D texture on a background thread without stalling the game. The file is read and uploaded in slabs of
+	 * Z-slices, so at most SlabBudgetMB megabytes of the file are kept in memory at any time. The volume is swapped in once
+	 * fully uploaded, until then the previous one keeps being drawn.
+	 * @param Volume Volume to load into. None loads into the default one drawn by DrawRaymarchToRenderTarget.
+	 * @param VoxelFormat Type of the voxels stored in the file.
+	 * @param WindowCenter Center of the displayed intensity window, in file units (i.e. Hounsfield units for CT).
+	 * @param WindowWidth Width of the displayed intensity window. Zero or less means the full range of the format.
+	 * @param bQuantizeTo8Bit Applies the window on the CPU and uploads 8-bit voxels. Saves GPU memory, but loses precision.
+	 * @param bGenerateMips Builds a mip chain while loading, so that small or distant volumes sample less memory.
+	 * @param bComputeGradients Builds a gradient volume while loading, needed for shading and gradient opacity curves of transfer functions.
+	 * @param Compression Keeps the volume compressed on the GPU. BC4 halves the memory of 8-bit volumes for a small error,
+	 *                    the ratio and error get logged once loaded.
+	 * @param BrickSize Edge length of bricks for sparse volumes. Anything above 0 packs only the visible bricks into an atlas
+	 *                  (saves GPU memory on mostly empty data like angiographies), but needs the whole file in memory and has no mips.
+	 * @param SlabBudgetMB Host memory budget for the read-but-not-uploaded data.
+	 * @param OnProgress Called whenever another slab got uploaded.
+	 * @param OnCompleted Called once the volume is bound for drawing, or when the load failed.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+		static void LoadRawTexture3DAsync(
+			const UObject* WorldContextObject,
+			URaymarchVolume* Volume,
+			FString textureName, int xDim, int yDim, int zDim,
+			ERaymarchVoxelFormat VoxelFormat,
+			float WindowCenter, float WindowWidth,
+			bool bQuantizeTo8Bit,
+			bool bGenerateMips,
+			bool bComputeGradients,
+			ERaymarchVolumeCompression Compression,
+			int BrickSize,
+			int SlabBudgetMB,
+			FRaymarchLoadProgressEvent OnProgress,
+			FRaymarchLoadCompletedEvent OnCompleted);
+
+	/** Loads a compressed volume file (see Raymarch.ConvertRawVolume) like LoadRawTexture3DAsync. Dimensions and voxel
+	 * format come from the file, chunks of it are decompressed in parallel while streaming.
+	 * @param FileName Path to the file, relative to the content directory.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+		static void LoadRaymarchVolumeFileAsync(
+			const UObject* WorldContextObject,
+			URaymarchVolume* Volume,
+			FString FileName,
+			float WindowCenter, float WindowWidth,
+			bool bQuantizeTo8Bit,
+			bool bGenerateMips,
+			bool bComputeGradients,
+			ERaymarchVolumeCompression Compression,
+			int BrickSize,
+			int SlabBudgetMB,
+			FRaymarchLoadProgressEvent OnProgress,
+			FRaymarchLoadCompletedEvent OnCompleted);
+
+	/** Opens a RAW 3D texture too big for memory for drawing out of core. Bricks are read from the file as they come into
+	 * view, kept in host memory up to HostBudgetMB and copied into a GPU atlas of GpuBudgetMB. Bricks that didn't make it
+	 * yet are drawn as empty. There are no mips, gradients or macro cells.
+	 * @param Volume Volume to page into, it's drawn from the pager from now on.
+	 * @param VoxelFormat Type of the voxels stored in the file.
+	 * @param WindowCenter Center of the displayed intensity window, in file units.
+	 * @param WindowWidth Width of the displayed intensity window. Zero or less means the full range of the format.
+	 * @param BrickSize Edge length of the paged bricks.
+	 * @param HostBudgetMB Host memory the read bricks may take.
+	 * @param GpuBudgetMB GPU memory the atlas may take.
+	 * @return False if the file couldn't be opened or the atlas would be too big.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher", meta = (WorldContext = "WorldContextObject"))
+		static bool OpenPagedRawVolume(
+			const UObject* WorldContextObject,
+			URaymarchVolume* Volume,
+			FString textureName, int xDim, int yDim, int zDim,
+			ERaymarchVoxelFormat VoxelFormat,
+			float WindowCenter, float WindowWidth,
+			int BrickSize = 16,
+			int HostBudgetMB = 256,
+			int GpuBudgetMB = 128);
+
+	/** Reads what a compressed volume file says about the volume in it, i.e. to scale its transform by the voxel spacing.
+	 * @param FileName Path to the file, relative to the content directory.
+	 * @param Spacing Size of a voxel in millimeters.
+	 * @return False if the file isn't a valid volume file.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+		static bool GetRaymarchVolumeFileInfo(FString FileName, FIntVector& Dimensions, ERaymarchVoxelFormat& VoxelFormat, FVector& Spacing);
+
+	/** Initializes the resources shared by all volumes (the cube geometry) and sets the clear color of the render target
+	 * to transparent. Call once before drawing to it. */
 	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
 		static void InitializeRenderResources(class UTextureRenderTarget2D* OutputRenderTarget);
 
@@ -0,0 +1,130 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/LruCache.h"
+#include "HAL/CriticalSection.h"
+#include "PixelFormat.h"
+#include "RaymarchTypes.h"
+#include "RaymarchBrickPool.h"
+
+struct FCompiledCameraModel;
+
+// Default host memory budget of the brick cache.
+#define RAYMARCH_DEFAULT_BRICK_CACHE_BUDGET (256 * 1024 * 1024)
+
+// Default number of worker tasks reading bricks from disk at the same time.
+#define RAYMARCH_DEFAULT_BRICK_FETCH_WORKERS 4
+
+/** Voxels of one brick including its apron, in the GPU format of the volume. Shared, so eviction can't pull it from under a reader. */
+typedef TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe> FRaymarchBrickDataPtr;
+
+/** Counters of a brick cache since it was opened (or since the last ResetStats). */
+struct FRaymarchBrickCacheStats
+{
+	// Number of FindBrick / GetBrickBlocking calls.
+	int64 Lookups = 0;
+	// Lookups that found the brick resident.
+	int64 Hits = 0;
+	// Bricks read from disk and bytes they took in the cache.
+	int64 BricksPaged = 0;
+	int64 BytesPaged = 0;
+	// Bricks dropped from the cache to make room.
+	int64 Evictions = 0;
+	// Time GetBrickBlocking spent waiting for the disk.
+	double StallSeconds = 0.0;
+
+	float GetHitRate() const { return Lookups > 0 ? float(Hits) / Lookups : 1.0f; }
+};
+
+/**
+* Out-of-core residency manager for a bricked RAW volume that doesn't fit into memory. Bricks are read lazily
+* (rows straight out of the RAW file, no preprocessing) on thread pool workers and kept in an LRU cache with a fixed
+* host memory budget. Every frame, UpdateVisibility queues the bricks in the view frustum, closest first.
+*
+* Create with FRaymarchBrickCache::Open. All methods are thread-safe. Workers keep the cache alive until they're done.
+* FRaymarchBrickPager draws from it, copying the resident bricks into the GPU atlas of a volume.
+*/
+class FRaymarchBrickCache : public TSharedFromThis<FRaymarchBrickCache, ESPMode::ThreadSafe>
+{
+public:
+	/** Opens a RAW file for paging. Returns null if the file can't be opened or is too small.
+	* @param FullPath Absolute path to the RAW file.
+	* @param Dimensions Dimensions of the volume in voxels.
+	* @param VoxelFormat Type of the voxels in the file. Signed shorts are flipped to unsigned like in the loader.
+	* @param BrickSize Edge length of a brick without apron.
+	* @param BudgetBytes Host memory the resident bricks may take. At least one brick is always kept.
+	* @param MaxWorkers Maximum number of concurrent fetch tasks.
+	*/
+	static TSharedPtr<FRaymarchBrickCache, ESPMode::ThreadSafe> Open(const FString& FullPath, FIntVector Dimensions,
+		ERaymarchVoxelFormat VoxelFormat, int32 BrickSize = RAYMARCH_DEFAULT_BRICK_SIZE, int64 BudgetBytes = RAYMARCH_DEFAULT_BRICK_CACHE_BUDGET,
+		int32 MaxWorkers = RAYMARCH_DEFAULT_BRICK_FETCH_WORKERS);
+
+	/** Finds the bricks intersecting the view frustum of the camera and queues the ones that aren't resident for fetching,
+	* sorted by distance from the camera. Replaces whatever was queued before (bricks that got out of view aren't fetched).
+	* Resident visible bricks are touched, so the LRU doesn't evict them in favour of invisible ones.
+	* @param CameraModel Model, view and projection of the frame. Only bricks in the frustum are queued.
+	* @param OutVisibleBricks Receives indices of all visible bricks, closest first.
+	*/
+	void UpdateVisibility(const FCompiledCameraModel& CameraModel, TArray<int32>& OutVisibleBricks);
+
+	/** Returns the brick if it's resident, null otherwise. Never blocks on the disk.
+	* @param bFetchIfMissing Queues a missing brick with top priority. Off for bricks that UpdateVisibility already queued.
+	*/
+	FRaymarchBrickDataPtr FindBrick(int32 BrickIndex, bool bFetchIfMissing = true);
+
+	/** Returns the brick, waiting for it to be read if needed. Time spent waiting counts as stall. Null if reading failed. */
+	FRaymarchBrickDataPtr GetBrickBlocking(int32 BrickIndex);
+
+	/** Waits until nothing is queued or being read. */
+	void Flush();
+
+	FRaymarchBrickCacheStats GetStats() const;
+	void ResetStats();
+
+	const FRaymarchBrickLayout& GetLayout() const { return Layout; }
+
+	/** Pixel format of the brick data (what the volume would be uploaded as). */
+	EPixelFormat GetPixelFormat() const { return PixelFormat; }
+
+	/** Size of one brick in the cache in bytes (including the apron). */
+	int64 GetBrickBytes() const { return BrickBytes; }
+
+	/** Maximum number of resident bricks. */
+	int32 GetCapacity() const { return Capacity; }
+
+private:
+	FRaymarchBrickCache(int32 InCapacity);
+
+	// Starts fetch workers if there's work and there are fewer of them than allowed. Lock has to be held.
+	void KickWorkers_Locked();
+
+	// Worker loop, fetches bricks from the queue until it's empty.
+	void FetchBricks_AnyThread();
+
+	// Reads a brick including its apron from the file and converts it into the GPU format.
+	bool ReadBrick_AnyThread(class IFileHandle& FileHandle, int32 BrickIndex, TArray<uint8>& OutData) const;
+
+	FString FullPath;
+	ERaymarchVoxelFormat VoxelFormat = ERaymarchVoxelFormat::U8;
+	EPixelFormat PixelFormat = PF_G8;
+	FRaymarchBrickLayout Layout;
+	int64 BrickBytes = 0;
+	int32 Capacity = 1;
+	int32 MaxWorkers = 1;
+
+	// Guards everything below.
+	mutable FCriticalSection Lock;
+	// Resident bricks, least recently used ones get evicted when adding a new one to a full cache.
+	TLruCache<int32, FRaymarchBrickDataPtr> Resident;
+	// Bricks waiting to be fetched, the first one is fetched next.
+	TArray<int32> FetchQueue;
+	// Bricks that are being read right now.
+	TSet<int32> InFlight;
+	// Bricks that couldn't be read, they're never queued again.
+	TSet<int32> Failed;
+	// Number of running worker tasks.
+	int32 ActiveWorkers = 0;
+	FRaymarchBrickCacheStats Stats;
+};
@@ -0,0 +1,75 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchBrickCache.h"
+#include "RaymarchRendering.h"
+
+// Default GPU memory budget of the atlas of a paged volume.
+#define RAYMARCH_DEFAULT_BRICK_PAGER_BUDGET (128 * 1024 * 1024)
+
+// Default number of bricks uploaded into the atlas per frame, keeps the render thread from hitching while the view changes quickly.
+#define RAYMARCH_DEFAULT_BRICK_UPLOADS_PER_FRAME 32
+
+typedef TSharedPtr<FRaymarchBrickCache, ESPMode::ThreadSafe> FRaymarchBrickCachePtr;
+
+/**
+* Draws a volume that doesn't fit into memory by paging its bricks into a fixed size GPU atlas. Every frame, the bricks
+* visible to the camera of the draw get queued in the host side FRaymarchBrickCache, and the resident ones are copied into
+* free (or least recently drawn) slots of the atlas. Bricks that aren't in the atlas are drawn as empty until they arrive.
+*
+* The atlas and the indirection are swapped into the volume once, under a ticket of its own. After that, only their
+* contents get updated on the render thread, in order with the draws. Another load into the volume supersedes the pager,
+* it stops paging then.
+*/
+class FRaymarchBrickPager : public TSharedFromThis<FRaymarchBrickPager, ESPMode::ThreadSafe>
+{
+public:
+	/** Creates the atlas and the empty indirection for a paged volume and queues them to be shown in it. Game thread function!
+	* @param Volume Volume to draw the paged bricks into.
+	* @param Cache Cache of the bricks, see FRaymarchBrickCache::Open.
+	* @param WindowScaleBias Window of the volume, see GetWindowScaleBias.
+	* @param GpuBudgetBytes GPU memory the atlas may take. Null is returned if the atlas can't be created that big.
+	* @param MaxUploadsPerFrame Bricks copied into the atlas per frame at most.
+	*/
+	static TSharedPtr<FRaymarchBrickPager, ESPMode::ThreadSafe> Open_GameThread(FRaymarchVolumeRenderDataPtr Volume, FRaymarchBrickCachePtr Cache,
+		FVector2D WindowScaleBias, int64 GpuBudgetBytes = RAYMARCH_DEFAULT_BRICK_PAGER_BUDGET,
+		int32 MaxUploadsPerFrame = RAYMARCH_DEFAULT_BRICK_UPLOADS_PER_FRAME);
+
+	/** Queues the bricks visible from the camera and uploads the resident ones that aren't in the atlas yet. Only the first
+	* call of a frame does anything, so drawing the volume into more targets or views doesn't page more. Game thread function!
+	* @param CameraModel Model, view and projection of the draw.
+	*/
+	void Update_GameThread(const FCompiledCameraModel& CameraModel);
+
+	/** Number of bricks in the atlas. */
+	int32 GetPagedBrickCount() const { return PagedBrickCount; }
+
+	/** Number of slots of the atlas. */
+	int32 GetSlotCount() const { return SlotBricks.Num(); }
+
+	const FRaymarchBrickCache& GetCache() const { return *Cache; }
+
+private:
+	// Picks the slot for a new brick - a free one, or the one drawn the longest time ago. INDEX_NONE if all of them are
+	// in use this frame.
+	int32 FindSlotToReplace() const;
+
+	FRaymarchVolumeRenderDataPtr Volume;
+	FRaymarchBrickCachePtr Cache;
+	// Ticket the atlas was shown under.
+	int32 Ticket = 0;
+	int32 MaxUploadsPerFrame = 1;
+	FIntVector SlotCounts = FIntVector::ZeroValue;
+
+	// Brick in every slot (INDEX_NONE for free ones) and the frame it was last visible in.
+	TArray<int32> SlotBricks;
+	TArray<uint64> SlotLastVisibleFrames;
+	// Slot of every brick of the layout, INDEX_NONE if it's not in the atlas.
+	TArray<int32> BrickSlots;
+	int32 PagedBrickCount = 0;
+	// Scratch array for UpdateVisibility.
+	TArray<int32> VisibleBricks;
+	uint64 LastUpdateFrame = MAX_uint64;
+};
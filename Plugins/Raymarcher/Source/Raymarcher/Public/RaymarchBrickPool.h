@@ -0,0 +1,97 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+
+// Default edge length of a brick in voxels (without the apron).
+#define RAYMARCH_DEFAULT_BRICK_SIZE 16
+
+// Marks a brick without a slot in the atlas (it's empty and wasn't packed).
+#define RAYMARCH_EMPTY_BRICK_SLOT FIntVector(-1, -1, -1)
+
+/**
+* How a volume is split into bricks. Every brick covers BrickSize^3 voxels of the volume, but is stored with an apron
+* of neighbouring voxels around it, so that trilinear filtering never has to look into another brick.
+*/
+struct FRaymarchBrickLayout
+{
+	// Dimensions of the volume in voxels.
+	FIntVector VolumeDimensions = FIntVector::ZeroValue;
+	// Edge length of the part of the volume a brick covers.
+	int32 BrickSize = 0;
+	// Number of voxels duplicated from the neighbours on every side of a brick.
+	int32 Apron = 0;
+	// Number of bricks along every axis.
+	FIntVector BrickCounts = FIntVector::ZeroValue;
+
+	/** Edge length of a brick as stored in the atlas. */
+	int32 GetPaddedBrickSize() const { return BrickSize + 2 * Apron; }
+
+	/** Total number of bricks (empty or not). */
+	int32 GetBrickCount() const { return BrickCounts.X * BrickCounts.Y * BrickCounts.Z; }
+
+	/** Returns index of a brick in X-major order. */
+	FORCEINLINE int32 GetBrickIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return X + BrickCounts.X * (Y + BrickCounts.Y * Z);
+	}
+};
+
+/**
+* Occupied bricks packed next to each other into one dense atlas, plus the indirection telling where each brick ended up.
+*/
+struct FRaymarchBrickAtlas
+{
+	// Number of brick slots along every axis of the atlas.
+	FIntVector SlotCounts = FIntVector::ZeroValue;
+	// Dimensions of the atlas in voxels (slots * padded brick size, X and Y rounded up to the requested alignment).
+	FIntVector AtlasDimensions = FIntVector::ZeroValue;
+	// Slot of every brick of the layout (RAYMARCH_EMPTY_BRICK_SLOT for dropped bricks), X-major like the layout.
+	TArray<FIntVector> BrickSlots;
+	// Voxels of the atlas in the volume's pixel format.
+	TArray<uint8> AtlasData;
+	// Number of bricks that made it into the atlas.
+	int32 OccupiedBrickCount = 0;
+
+	/** Size of the indirection texture in bytes (RGBA8 per brick). */
+	int64 GetIndirectionBytes() const { return int64(BrickSlots.Num()) * 4; }
+};
+
+/** Splits a volume into bricks. Bricks at the upper borders can reach past the volume, these parts are clamped.
+* @param VolumeDimensions Dimensions of the volume in voxels.
+* @param BrickSize Edge length of a brick in voxels.
+* @param Apron Voxels duplicated on every side, 1 is enough for trilinear filtering.
+*/
+FRaymarchBrickLayout PartitionIntoBricks(FIntVector VolumeDimensions, int32 BrickSize, int32 Apron = 1);
+
+/** Finds the bricks that have anything visible in them, in parallel over bricks. The apron is included, so a brick next
+* to an occupied one is kept if filtering at its border could pick up the neighbour's values.
+* @param Volume Voxels of the whole volume.
+* @param PixelFormat Format of the voxels (PF_G8, PF_G16, PF_R16F or PF_R32_FLOAT).
+* @param EmptyThreshold Bricks whose maximum (as sampled by the shader) is less or equal to this are empty.
+* @param OutOccupied Receives true for every brick that has to be kept, X-major.
+*/
+void ClassifyBricks(const void* Volume, EPixelFormat PixelFormat, const FRaymarchBrickLayout& Layout, float EmptyThreshold, TArray<bool>& OutOccupied);
+
+/** Computes a roughly cubic slot arrangement for given number of bricks. */
+FIntVector GetAtlasSlotCounts(int32 OccupiedBrickCount);
+
+/** Copies all occupied bricks including their aprons into an atlas, in parallel over bricks.
+* @param Volume Voxels of the whole volume.
+* @param PixelFormat Format of the voxels.
+* @param Occupied Result of ClassifyBricks.
+* @param OutAtlas Receives the packed atlas and brick slots.
+* @param Alignment X and Y of the atlas get rounded up to a multiple of this (i.e. whole blocks for block compression).
+*/
+void PackBrickAtlas(const void* Volume, EPixelFormat PixelFormat, const FRaymarchBrickLayout& Layout, const TArray<bool>& Occupied,
+	FRaymarchBrickAtlas& OutAtlas, int32 Alignment = 1);
+
+/** Builds the RGBA8 indirection volume for the GPU - slot XYZ in RGB, 255 in A for occupied bricks and all zeros for empty ones. */
+void BuildBrickIndirection(const FRaymarchBrickLayout& Layout, const FRaymarchBrickAtlas& Atlas, TArray<FColor>& OutIndirection);
+
+/** Logs how much GPU memory the atlas and indirection take compared to a dense texture of the whole volume.
+* @param VolumeName Name to log the numbers under (i.e. path of the file).
+*/
+void LogBrickAtlasMemory(const FString& VolumeName, const FRaymarchBrickLayout& Layout, const FRaymarchBrickAtlas& Atlas, EPixelFormat PixelFormat);
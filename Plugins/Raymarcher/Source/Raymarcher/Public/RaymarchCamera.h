@@ -0,0 +1,70 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UWorld;
+
+/**
+* Camera data to be handled to renderthread, which will in turn set them as uniform shader parameters.
+*/
+struct FCompiledCameraModel
+{
+	FMatrix ModelMatrix;
+	FMatrix ViewMatrix;
+	FMatrix ProjectionMatrix;
+	FVector RayOrigin;
+};
+
+/**
+* A camera the volumes are seen from - the part of FCompiledCameraModel that's the same for all volumes of a frame.
+*/
+struct FRaymarchView
+{
+	FMatrix ViewMatrix = FMatrix::Identity;
+	FMatrix ProjectionMatrix = FMatrix::Identity;
+	// Position of the camera and the direction it looks in, world space.
+	FVector ViewLocation = FVector::ZeroVector;
+	FVector ViewDirection = FVector::ForwardVector;
+
+	/** Combines the view with the transform of a volume into what the shaders get. Cheap, done for every volume. */
+	FCompiledCameraModel CompileCameraModel(const FTransform& VolumeTransform) const;
+};
+
+/**
+* Source of the views volumes are drawn from. Player views are computed at most once per frame and cached, so drawing
+* any number of volumes or render targets in a frame doesn't pay for the camera setup again. Views of other cameras
+* (scene captures, offscreen viewpoints) are built directly from their transform or matrices.
+*/
+class FRaymarchCameraModelProvider
+{
+public:
+	/** Returns the view of a local player, computed on the first call in a frame and cached for the rest of it. Game thread function!
+	* @param World World the player is in.
+	* @param PlayerIndex Index of the local player (0 is the first one).
+	* @param OutView Receives the view.
+	* @return False if there's no such player or it has no viewport yet.
+	*/
+	static bool GetPlayerView_GameThread(UWorld* World, int32 PlayerIndex, FRaymarchView& OutView);
+
+	/** Returns the views of both eyes of a local player wearing an HMD, cached like GetPlayerView_GameThread. Game thread function!
+	* @return False if stereo rendering is off, or there's no such player.
+	*/
+	static bool GetPlayerStereoViews_GameThread(UWorld* World, int32 PlayerIndex, FRaymarchView& OutLeft, FRaymarchView& OutRight);
+
+	/** Builds a perspective view of a camera placed in the world (i.e. a scene capture component).
+	* @param CameraTransform Location and rotation of the camera, the camera looks along its X axis. Scale is ignored.
+	* @param FieldOfView Horizontal field of view in degrees.
+	* @param ViewSize Size of the render target, gives the aspect ratio.
+	*/
+	static FRaymarchView MakeView(const FTransform& CameraTransform, float FieldOfView, FIntPoint ViewSize);
+
+	/** Builds a view from explicit matrices (in the engine's conventions - view space X right, Y up, Z forward, reversed Z).
+	* The location and direction of the camera are taken from the view matrix.
+	*/
+	static FRaymarchView MakeView(const FMatrix& ViewMatrix, const FMatrix& ProjectionMatrix);
+
+	/** Number of times a player view actually had to be computed, the rest were served from the cache. */
+	static int64 GetPlayerViewComputeCount();
+};
@@ -0,0 +1,84 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchCamera.h"
+#include "RaymarchMacroCells.h"
+#include "RaymarchTypes.h"
+
+// Edge length of the square image tiles the CPU raymarcher hands out to worker threads.
+#define RAYMARCH_CPU_TILE_SIZE 16
+
+/** A volume as the CPU raymarcher sees it - what FRaymarchVolumeRenderData and the transfer function hold on the GPU. */
+struct FRaymarchCpuVolume
+{
+	// Voxels as the shader samples them (normalized for G8/G16 volumes), X-major.
+	TArray<float> Voxels;
+	FIntVector Dimensions = FIntVector::ZeroValue;
+	// See FRaymarchVolumeRenderData::WindowScaleBias.
+	FVector2D WindowScaleBias = FVector2D(1.0f, 0.0f);
+	// Cells of Voxels for empty-space skipping. Skipping is off without them.
+	FRaymarchMacroCellGrid MacroCells;
+	// Color and opacity per voxel over the windowed intensity. Empty draws the plain grey volume.
+	TArray<FLinearColor> Lut;
+	// BuildPreIntegrationTable of Lut, used with FRaymarchRenderSettings::bPreIntegrate.
+	TArray<FLinearColor> PreIntegrationTable;
+	// BuildMaxOpacityTable of the opacities of Lut. Front to back compositing only skips empty space with it.
+	TArray<float> MaxOpacityTable;
+};
+
+/** What the rays of an image did. */
+struct FRaymarchCpuStats
+{
+	int64 Rays = 0;
+	int64 Samples = 0;
+	// Samples that empty-space skipping jumped over.
+	int64 SkippedSamples = 0;
+};
+
+/**
+* CPU version of MainPS (RaymarchShader.usf) - the same box intersection, stepping, empty-space skipping, trilinear
+* sampling, classification and compositing, for one volume seen through a camera model as the renderer compiles it.
+* Rays go through the pixel centers and hit the volume where the rasterized back faces of its cube would.
+* Covers what a dense volume with a single mip uses; bricks, mips, gradients (shading, 2D transfer functions), scene
+* depth and jitter are GPU only.
+* Tiles of the image are marched in parallel, rays within a tile in packets of four with SSE2 where available.
+* @param ImageSize Size of the render target.
+* @param OutImage Receives premultiplied color and opacity per pixel, X-major - what the render target holds after
+*                 drawing the volume over transparent black.
+* @param OutStats Optional, receives the number of rays and samples.
+*/
+void RaymarchVolume_Cpu(
+	const FRaymarchCpuVolume& Volume,
+	const FCompiledCameraModel& CameraModel,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint ImageSize,
+	TArray<FLinearColor>& OutImage,
+	FRaymarchCpuStats* OutStats = nullptr);
+
+/** One ray at a time on a single thread. Reference for validating RaymarchVolume_Cpu. */
+void RaymarchVolume_CpuScalar(
+	const FRaymarchCpuVolume& Volume,
+	const FCompiledCameraModel& CameraModel,
+	const FRaymarchRenderSettings& Settings,
+	FIntPoint ImageSize,
+	TArray<FLinearColor>& OutImage,
+	FRaymarchCpuStats* OutStats = nullptr);
+
+/** How much two images of the same size differ, per channel. */
+struct FRaymarchImageDifference
+{
+	float MaxDifference = 0.0f;
+	float RootMeanSquare = 0.0f;
+	// Pixels with any channel differing by more than the tolerance.
+	int64 DifferingPixels = 0;
+};
+
+FRaymarchImageDifference CompareRaymarchImages(const TArray<FLinearColor>& A, const TArray<FLinearColor>& B, float Tolerance);
+
+/** Saves an image for golden image comparisons, as raw floats after a small header. */
+bool SaveRaymarchGoldenImage(const FString& Filename, FIntPoint Size, const TArray<FLinearColor>& Image);
+
+/** Loads an image saved with SaveRaymarchGoldenImage. */
+bool LoadRaymarchGoldenImage(const FString& Filename, FIntPoint& OutSize, TArray<FLinearColor>& OutImage);
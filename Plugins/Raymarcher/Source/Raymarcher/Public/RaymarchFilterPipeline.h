@@ -0,0 +1,263 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchRendering.h"
+#include "RaymarchFilters.h"
+
+// Edge length of a compute thread group (it's a cube).
+#define RAYMARCH_FILTER_THREADGROUP_SIZE 4
+
+// Common ancestor of the volume filter compute shaders. Every pass reads one volume and writes another.
+class FRaymarchFilterShader : public FGlobalShader
+{
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		// Typed UAV stores into 3D textures need SM5.
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), RAYMARCH_FILTER_THREADGROUP_SIZE);
+		OutEnvironment.SetDefine(TEXT("RAYMARCH_MAX_GAUSSIAN_RADIUS"), RAYMARCH_MAX_GAUSSIAN_RADIUS);
+	}
+
+	FRaymarchFilterShader() {}
+
+	FRaymarchFilterShader(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FGlobalShader(Initializer)
+	{
+		Input.Bind(Initializer.ParameterMap, TEXT("Input"));
+		Output.Bind(Initializer.ParameterMap, TEXT("Output"));
+		Dimensions.Bind(Initializer.ParameterMap, TEXT("Dimensions"));
+	}
+
+	void SetVolumes(
+		FRHICommandListImmediate& RHICmdList,
+		FTexture3DRHIParamRef InputTexture,
+		FUnorderedAccessViewRHIParamRef OutputUAV,
+		const FIntVector& VolumeDimensions)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		SetTextureParameter(RHICmdList, ShaderRHI, Input, InputTexture);
+		SetUAVParameter(RHICmdList, ShaderRHI, Output, OutputUAV);
+		SetShaderValue(RHICmdList, ShaderRHI, Dimensions, VolumeDimensions);
+	}
+
+	/** Unbinds the output, so that the volume can be read by the next pass. */
+	void UnbindOutput(FRHICommandListImmediate& RHICmdList)
+	{
+		SetUAVParameter(RHICmdList, GetComputeShader(), Output, FUnorderedAccessViewRHIRef());
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FGlobalShader::Serialize(Ar);
+		Ar << Input << Output << Dimensions;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderResourceParameter Input;
+	FShaderResourceParameter Output;
+	FShaderParameter Dimensions;
+};
+
+// One axis of the separable Gaussian.
+class FRaymarchGaussianFilterCS : public FRaymarchFilterShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchGaussianFilterCS, Global);
+
+public:
+	FRaymarchGaussianFilterCS() {}
+
+	FRaymarchGaussianFilterCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchFilterShader(Initializer)
+	{
+		Direction.Bind(Initializer.ParameterMap, TEXT("Direction"));
+		Radius.Bind(Initializer.ParameterMap, TEXT("Radius"));
+		KernelWeights.Bind(Initializer.ParameterMap, TEXT("KernelWeights"));
+	}
+
+	/** @param Weights Kernel built by BuildGaussianKernel. @param Axis 0 = X, 1 = Y, 2 = Z. */
+	void SetKernel(FRHICommandListImmediate& RHICmdList, const TArray<float>& Weights, int32 Axis)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		FIntVector AxisDirection = FIntVector::ZeroValue;
+		AxisDirection[Axis] = 1;
+		SetShaderValue(RHICmdList, ShaderRHI, Direction, AxisDirection);
+		SetShaderValue(RHICmdList, ShaderRHI, Radius, Weights.Num() / 2);
+		// The shader keeps the weights packed by four.
+		FVector4 PackedWeights[(2 * RAYMARCH_MAX_GAUSSIAN_RADIUS + 1 + 3) / 4];
+		FMemory::Memzero(PackedWeights);
+		FMemory::Memcpy(PackedWeights, Weights.GetData(), Weights.Num() * sizeof(float));
+		SetShaderValueArray(RHICmdList, ShaderRHI, KernelWeights, PackedWeights, ARRAY_COUNT(PackedWeights));
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FRaymarchFilterShader::Serialize(Ar);
+		Ar << Direction << Radius << KernelWeights;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderParameter Direction;
+	FShaderParameter Radius;
+	FShaderParameter KernelWeights;
+};
+
+// 3x3x3 median.
+class FRaymarchMedianFilterCS : public FRaymarchFilterShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchMedianFilterCS, Global);
+
+public:
+	FRaymarchMedianFilterCS() {}
+
+	FRaymarchMedianFilterCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchFilterShader(Initializer)
+	{ }
+};
+
+// Vesselness of an already smoothed volume.
+class FRaymarchVesselnessFilterCS : public FRaymarchFilterShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchVesselnessFilterCS, Global);
+
+public:
+	FRaymarchVesselnessFilterCS() {}
+
+	FRaymarchVesselnessFilterCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchFilterShader(Initializer)
+	{
+		VesselnessConstants.Bind(Initializer.ParameterMap, TEXT("VesselnessConstants"));
+		VesselnessPolarity.Bind(Initializer.ParameterMap, TEXT("VesselnessPolarity"));
+	}
+
+	void SetConstants(FRHICommandListImmediate& RHICmdList, const FVesselnessConstants& Constants)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		SetShaderValue(RHICmdList, ShaderRHI, VesselnessConstants,
+			FVector4(Constants.HessianScale, Constants.AlphaFactor, Constants.BetaFactor, Constants.StructureFactor));
+		SetShaderValue(RHICmdList, ShaderRHI, VesselnessPolarity, Constants.Polarity);
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FRaymarchFilterShader::Serialize(Ar);
+		Ar << VesselnessConstants << VesselnessPolarity;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderParameter VesselnessConstants;
+	FShaderParameter VesselnessPolarity;
+};
+
+// Rebuilds the min/max macro cells of a volume on the GPU. Output is unused, the cells go to CellOutput.
+class FRaymarchMacroCellCS : public FRaymarchFilterShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchMacroCellCS, Global);
+
+public:
+	FRaymarchMacroCellCS() {}
+
+	FRaymarchMacroCellCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchFilterShader(Initializer)
+	{
+		CellSize.Bind(Initializer.ParameterMap, TEXT("CellSize"));
+		CellOutput.Bind(Initializer.ParameterMap, TEXT("CellOutput"));
+	}
+
+	void SetCells(FRHICommandListImmediate& RHICmdList, FUnorderedAccessViewRHIParamRef CellUAV, int32 InCellSize)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		SetUAVParameter(RHICmdList, ShaderRHI, CellOutput, CellUAV);
+		SetShaderValue(RHICmdList, ShaderRHI, CellSize, InCellSize);
+	}
+
+	void UnbindCells(FRHICommandListImmediate& RHICmdList)
+	{
+		SetUAVParameter(RHICmdList, GetComputeShader(), CellOutput, FUnorderedAccessViewRHIRef());
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FRaymarchFilterShader::Serialize(Ar);
+		Ar << CellSize << CellOutput;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderParameter CellSize;
+	FShaderResourceParameter CellOutput;
+};
+
+// Rebuilds the packed gradients of a volume on the GPU. Output is unused, the gradients go to GradientOutput.
+class FRaymarchGradientCS : public FRaymarchFilterShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchGradientCS, Global);
+
+public:
+	FRaymarchGradientCS() {}
+
+	FRaymarchGradientCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchFilterShader(Initializer)
+	{
+		WindowScaleBias.Bind(Initializer.ParameterMap, TEXT("WindowScaleBias"));
+		GradientMagnitudeScale.Bind(Initializer.ParameterMap, TEXT("GradientMagnitudeScale"));
+		GradientOutput.Bind(Initializer.ParameterMap, TEXT("GradientOutput"));
+	}
+
+	void SetGradients(FRHICommandListImmediate& RHICmdList, FUnorderedAccessViewRHIParamRef GradientUAV, FVector2D InWindowScaleBias)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		SetUAVParameter(RHICmdList, ShaderRHI, GradientOutput, GradientUAV);
+		SetShaderValue(RHICmdList, ShaderRHI, WindowScaleBias, InWindowScaleBias);
+		SetShaderValue(RHICmdList, ShaderRHI, GradientMagnitudeScale, RAYMARCH_GRADIENT_MAGNITUDE_SCALE);
+	}
+
+	void UnbindGradients(FRHICommandListImmediate& RHICmdList)
+	{
+		SetUAVParameter(RHICmdList, GetComputeShader(), GradientOutput, FUnorderedAccessViewRHIRef());
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FRaymarchFilterShader::Serialize(Ar);
+		Ar << WindowScaleBias << GradientMagnitudeScale << GradientOutput;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderParameter WindowScaleBias;
+	FShaderParameter GradientMagnitudeScale;
+	FShaderResourceParameter GradientOutput;
+};
+
+/** Runs a chain of filters over a dense volume on the GPU. The filtered volume replaces the volume texture as a single mip
+* PF_R32_FLOAT texture and the macro cells get rebuilt from it. Bricked volumes aren't supported (and left alone).
+* After vesselness, the volume is in [0,1] already, so the intensity window gets reset. Volumes with gradients get them
+* rebuilt as well (as PF_R8G8B8A8, the same packing in the order UAVs can write). The filtered volume gets swapped in
+* like a loaded one, unless a load into the volume was started meanwhile. Render thread function!
+* @param Volume Volume to filter.
+* @param Filters Filters to run, in order. Same results as ApplyFilters on the CPU.
+*/
+void ApplyVolumeFilters_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchVolumeRenderData& Volume,
+	const TArray<FRaymarchFilterSettings>& Filters,
+	ERHIFeatureLevel::Type FeatureLevel);
+
+/** Enqueues ApplyVolumeFilters_RenderThread. The volume has to be loaded already (or its loading enqueued before).
+* @param World World to get the feature level from.
+*/
+void ApplyVolumeFilters_GameThread(
+	class UWorld* World,
+	FRaymarchVolumeRenderDataPtr Volume,
+	const TArray<FRaymarchFilterSettings>& Filters);
@@ -0,0 +1,60 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchTypes.h"
+
+// Largest radius of a Gaussian kernel in voxels, wider kernels get cut off (the GPU keeps the weights in constants).
+#define RAYMARCH_MAX_GAUSSIAN_RADIUS 16
+
+/**
+* CPU versions of the volume filters the GPU pipeline runs (see RaymarchFilterPipeline.h). They work on float volumes
+* (X-major, values as the shader samples them) and treat everything outside the volume as the closest border voxel,
+* like the compute shaders do. The plain versions run in parallel over rows and use SSE2 where available, the _Scalar ones
+* are single-threaded references for validating them (and the GPU).
+*/
+
+/** Builds normalized weights of a Gaussian kernel, 2 * Radius + 1 of them with Radius = ceil(3 * Sigma) (capped). */
+void BuildGaussianKernel(float Sigma, TArray<float>& OutWeights);
+
+/** Separable Gaussian blur along X, Y and Z.
+* @param Source Voxels to filter.
+* @param Destination Receives the filtered voxels. May be the same as Source.
+*/
+void GaussianFilter(const float* Source, float* Destination, FIntVector Dimensions, float Sigma);
+void GaussianFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions, float Sigma);
+
+/** Median of the 3x3x3 neighbourhood of every voxel. Destination must not be the same as Source. */
+void MedianFilter(const float* Source, float* Destination, FIntVector Dimensions);
+void MedianFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions);
+
+/** Frangi vesselness at a single scale - Gaussian blur with Settings.Sigma followed by eigenanalysis of the scale-normalized
+* Hessian. The result is in [0,1]. Destination must not be the same as Source.
+*/
+void VesselnessFilter(const float* Source, float* Destination, FIntVector Dimensions, const FRaymarchFilterSettings& Settings);
+void VesselnessFilter_Scalar(const float* Source, float* Destination, FIntVector Dimensions, const FRaymarchFilterSettings& Settings);
+
+/** Constants of the vesselness measure, precomputed from the settings. Shared by the CPU and GPU versions. */
+struct FVesselnessConstants
+{
+	float HessianScale;
+	float AlphaFactor;
+	float BetaFactor;
+	float StructureFactor;
+	float Polarity;
+
+	explicit FVesselnessConstants(const FRaymarchFilterSettings& Settings)
+	{
+		const float Sigma = FMath::Max(Settings.Sigma, 0.1f);
+		// Scale normalization of the second derivatives, so responses of different scales are comparable.
+		HessianScale = Sigma * Sigma;
+		AlphaFactor = 1.0f / (2.0f * FMath::Square(FMath::Max(Settings.VesselnessAlpha, 0.01f)));
+		BetaFactor = 1.0f / (2.0f * FMath::Square(FMath::Max(Settings.VesselnessBeta, 0.01f)));
+		StructureFactor = 1.0f / (2.0f * FMath::Square(FMath::Max(Settings.VesselnessStructure, 0.0001f)));
+		Polarity = Settings.bBrightVessels ? 1.0f : -1.0f;
+	}
+};
+
+/** Runs a chain of filters over a volume in place, on the CPU. */
+void ApplyFilters(TArray<float>& Volume, FIntVector Dimensions, const TArray<FRaymarchFilterSettings>& Filters);
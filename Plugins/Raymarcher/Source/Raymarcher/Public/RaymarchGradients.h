@@ -0,0 +1,74 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+
+// Gradient magnitudes (in windowed intensity per voxel) get multiplied by this before they're stored, so that a sharp
+// edge from 0 to 1 across two voxels along one axis is stored as 1. Steeper gradients saturate.
+#define RAYMARCH_GRADIENT_MAGNITUDE_SCALE 2.0f
+
+/**
+* Precomputed gradients of a volume for shading and 2D transfer functions, so the shader doesn't need six extra fetches
+* per sample. Every voxel is packed into an FColor (uploaded as PF_B8G8R8A8) - the normalized gradient direction mapped
+* from [-1,1] to [0,255] in RGB and its scaled magnitude in A. Gradients are central differences of the windowed
+* intensity with the border voxels repeated, like the filters. The direction is in the object space of the volume (the
+* [-1,1] cube), so it accounts for non-cubic volumes being squashed into it; the magnitude is per voxel.
+*/
+
+/** Converts voxels as the shader samples them into windowed intensities in [0,1].
+* @param Voxels Voxels of the volume texture.
+* @param PixelFormat Format of the voxels (PF_G8, PF_G16, PF_R16F or PF_R32_FLOAT).
+* @param VoxelCount Number of voxels to convert.
+* @param WindowScaleBias Window of the volume, see FRaymarchVolumeRenderData.
+* @param OutIntensities Array of at least VoxelCount floats.
+*/
+void ConvertToWindowedIntensity(const void* Voxels, EPixelFormat PixelFormat, int64 VoxelCount, FVector2D WindowScaleBias, float* OutIntensities);
+
+/** Computes packed gradients of slices [FirstSlice, FirstSlice + SliceCount) of a volume. Rows in parallel, SSE2 where available.
+* @param Intensities Windowed intensities of consecutive slices starting at IntensitySlice. Has to contain one slice
+*                    around the requested ones on both sides (where the volume has them).
+* @param IntensitySlice Z coordinate of the first slice in Intensities.
+* @param Dimensions Dimensions of the whole volume.
+* @param OutGradients Receives SliceCount whole slices.
+*/
+void BuildGradientSlab(const float* Intensities, int32 IntensitySlice, FIntVector Dimensions, int32 FirstSlice, int32 SliceCount, FColor* OutGradients);
+
+/** Single-threaded scalar version of BuildGradientSlab. Reference for validating it and fallback without SSE2. */
+void BuildGradientSlab_Scalar(const float* Intensities, int32 IntensitySlice, FIntVector Dimensions, int32 FirstSlice, int32 SliceCount, FColor* OutGradients);
+
+/**
+* Builds the gradients of a volume that arrives in consecutive Z-slabs (i.e. while streaming). A slice needs the one
+* above it, so the gradients lag one slice behind the slabs, and only that one slice (plus the slab) is kept around.
+*/
+class FRaymarchGradientSlabBuilder
+{
+public:
+	void Init(FIntVector InDimensions);
+
+	/** Adds windowed intensities of the next slab.
+	* @return Number of slices whose gradients can be built now, all the remaining ones after the last slab.
+	*/
+	int32 AddSlab(const float* Intensities, int32 SliceCount);
+
+	/** First slice BuildReadySlices builds. */
+	int32 GetFirstReadySlice() const { return NextSlice; }
+
+	/** Builds all slices that are ready (as returned by AddSlab) and lets go of the intensities that aren't needed anymore.
+	* @param OutGradients Receives the ready slices.
+	*/
+	void BuildReadySlices(FColor* OutGradients);
+
+private:
+	FIntVector Dimensions = FIntVector::ZeroValue;
+	// Intensities of the slices that are still needed, starting at WindowSlice.
+	TArray<float> Window;
+	int32 WindowSlice = 0;
+	// First slice without gradients.
+	int32 NextSlice = 0;
+	// Number of slices added so far.
+	int32 AddedSlices = 0;
+	// Slices ready after the last AddSlab.
+	int32 ReadySlices = 0;
+};
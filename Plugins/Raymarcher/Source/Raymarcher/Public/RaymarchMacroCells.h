@@ -0,0 +1,60 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+
+// Default edge length of a macro cell in voxels.
+#define RAYMARCH_DEFAULT_MACRO_CELL_SIZE 8
+
+/**
+* Coarse acceleration volume for empty-space skipping. Every macro cell stores the minimum and maximum of the voxels
+* it covers (as the shader samples them, so normalized for G8/G16 volumes). The cells also include a one voxel apron
+* around them, so that trilinear filtering at the cell border can never fetch a value outside of [min, max].
+*/
+struct FRaymarchMacroCellGrid
+{
+	// Dimensions of the volume the cells cover.
+	FIntVector VolumeDimensions = FIntVector::ZeroValue;
+	// Edge length of one cell in voxels.
+	int32 CellSize = 0;
+	// Number of cells along every axis.
+	FIntVector CellDimensions = FIntVector::ZeroValue;
+	// (Min, Max) of every cell, X-major like the volume.
+	TArray<FVector2D> MinMax;
+
+	/** Prepares an empty grid (min = +inf, max = -inf in all cells) for a volume. */
+	void Init(FIntVector InVolumeDimensions, int32 InCellSize);
+
+	/** Merges a slab of consecutive Z-slices into all the cells that cover it (including their aprons).
+	* Slabs can come in any order and have any depth, the grid is complete once every slice was accumulated.
+	* Cells are processed in parallel on the task graph.
+	* @param SlabData Voxels of the slab, tightly packed.
+	* @param PixelFormat Format of the voxels (PF_G8, PF_G16, PF_R16F or PF_R32_FLOAT).
+	* @param FirstSlice Z coordinate of the first slice in the slab.
+	* @param SliceCount Number of slices in the slab.
+	*/
+	void AccumulateSlab(const void* SlabData, EPixelFormat PixelFormat, int32 FirstSlice, int32 SliceCount);
+
+	/** (Min, Max) over all cells - the range of every value a sample of the volume can have. Anything goes
+	* (-MAX_flt, MAX_flt) if the grid isn't valid.
+	*/
+	FVector2D GetValueRange() const;
+
+	/** Returns index of the cell into MinMax. */
+	FORCEINLINE int32 GetCellIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return X + CellDimensions.X * (Y + CellDimensions.Y * Z);
+	}
+
+	bool IsValid() const
+	{
+		return CellSize > 0 && MinMax.Num() > 0;
+	}
+};
+
+/** Brute-force version of building the grid out of a whole volume, one cell after another on a single thread.
+* Reference for validating FRaymarchMacroCellGrid::AccumulateSlab.
+*/
+void BuildMacroCells_Reference(const void* VolumeData, EPixelFormat PixelFormat, FIntVector VolumeDimensions, int32 CellSize, FRaymarchMacroCellGrid& OutGrid);
@@ -0,0 +1,30 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Number of entries of a baked transfer function (and the edge length of its pre-integration table).
+#define RAYMARCH_TRANSFER_FUNCTION_SIZE 256
+
+/** Builds the pre-integration table of a transfer function (Engel et al., without self-attenuation inside a segment).
+* Entry (Front, Back) describes a ray segment one voxel long along which the windowed intensity goes linearly from Front
+* to Back - RGB is the mean color weighted by extinction, A the opacity of the whole segment. Longer or shorter steps
+* are exact with the usual opacity correction 1 - (1 - A)^Length, so one table serves every sampling rate.
+* Built from running sums of the lookup table in O(Size^2), rows in parallel.
+* @param Lut Transfer function over [0,1] intensity, alpha being the opacity of one voxel.
+* @param OutTable Receives Size * Size entries, Front along X and Back along Y.
+*/
+void BuildPreIntegrationTable(const TArray<FLinearColor>& Lut, TArray<FLinearColor>& OutTable);
+
+/** Integrates every segment numerically with SubSteps samples per table entry it spans, on a single thread. Reference for validating BuildPreIntegrationTable. */
+void BuildPreIntegrationTable_Reference(const TArray<FLinearColor>& Lut, int32 SubSteps, TArray<FLinearColor>& OutTable);
+
+/** Builds the table empty-space skipping tests macro cells against. Entry (Min, Max) is the highest opacity over the
+* entries Min to Max of the transfer function - as it's interpolated linearly between entries, that's the highest opacity
+* of any intensity in between, so a cell whose intensities are blended from those entries is invisible exactly when the
+* entry is zero (with pre-integration too, segments inside the range integrate zero).
+* @param Opacities Opacity per entry of the lookup table. For 2D transfer functions, the highest of every column.
+* @param OutTable Receives Size * Size entries, symmetric, the lower end along X and the upper end along Y.
+*/
+void BuildMaxOpacityTable(const TArray<float>& Opacities, TArray<float>& OutTable);
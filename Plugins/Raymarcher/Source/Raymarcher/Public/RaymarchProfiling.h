@@ -0,0 +1,221 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchRendering.h"
+
+// Frames between drawing and reading the GPU results back, so that reading them never waits for the GPU.
+#define RAYMARCH_PROFILER_LATENCY 3
+// Edge length of the thread groups summing up the sample counters (they're square).
+#define RAYMARCH_COUNTER_THREADGROUP_SIZE 16
+
+DECLARE_STATS_GROUP(TEXT("Raymarcher"), STATGROUP_Raymarch, STATCAT_Advanced);
+
+// Render thread time of the stages.
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Upload"), STAT_RaymarchUpload, STATGROUP_Raymarch, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Filter"), STAT_RaymarchFilter, STATGROUP_Raymarch, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Draw"), STAT_RaymarchDraw, STATGROUP_Raymarch, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Reconstruct"), STAT_RaymarchReconstruct, STATGROUP_Raymarch, );
+// GPU time of the stages, from timestamp queries of a frame RAYMARCH_PROFILER_LATENCY - 1 frames back.
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Upload GPU (ms)"), STAT_RaymarchUploadGpu, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Filter GPU (ms)"), STAT_RaymarchFilterGpu, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Draw GPU (ms)"), STAT_RaymarchDrawGpu, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Reconstruct GPU (ms)"), STAT_RaymarchReconstructGpu, STATGROUP_Raymarch, );
+// What got drawn and uploaded.
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Volumes drawn"), STAT_RaymarchVolumesDrawn, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Uploaded (MB)"), STAT_RaymarchUploadedMB, STATGROUP_Raymarch, );
+// What the rays did, only counted with r.Raymarch.Stats 2.
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Rays"), STAT_RaymarchRays, STATGROUP_Raymarch, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Rays terminated early"), STAT_RaymarchTerminatedRays, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Samples taken (millions)"), STAT_RaymarchSamples, STATGROUP_Raymarch, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Samples skipped (millions)"), STAT_RaymarchSkippedSamples, STATGROUP_Raymarch, );
+// Volume sequence playback, kept across frames (see RaymarchVolumeSequence.h).
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Sequence frames dropped"), STAT_RaymarchSequenceDroppedFrames, STATGROUP_Raymarch, );
+DECLARE_FLOAT_ACCUMULATOR_STAT_EXTERN(TEXT("Sequence prefetch latency (ms)"), STAT_RaymarchSequenceLatency, STATGROUP_Raymarch, );
+
+/** Stages of getting volumes on screen that are timed separately. */
+enum class ERaymarchStage : uint8
+{
+	Upload,
+	Filter,
+	Draw,
+	Reconstruct,
+	Count
+};
+
+/** What the rays of a frame did, summed over all pixels of all draws. */
+struct FRaymarchSampleCounts
+{
+	uint64 Rays = 0;
+	uint64 Samples = 0;
+	// Samples that empty-space skipping jumped over.
+	uint64 SkippedSamples = 0;
+	// Rays that stopped at the early termination threshold instead of leaving the volume.
+	uint64 TerminatedRays = 0;
+};
+
+/**
+* Collects timings and counters of the raymarching stages per frame and turns them into stats (stat Raymarcher) and,
+* while recording, a CSV file with one line per frame.
+* Render thread time is always measured. GPU time (timestamp queries) is measured with r.Raymarch.Stats 1 or while
+* recording, and with r.Raymarch.Stats 2 every draw is repeated by a counting pass that sums up samples taken and
+* skipped. GPU results are read RAYMARCH_PROFILER_LATENCY - 1 frames late, so they never stall the render thread.
+* Render thread only, except for the console commands.
+*/
+class FRaymarchProfiler
+{
+public:
+	static FRaymarchProfiler& Get();
+
+	/** Starts timing a stage. Stages don't nest, every stage may be timed any number of times per frame. */
+	void BeginStage_RenderThread(FRHICommandListImmediate& RHICmdList, ERaymarchStage Stage);
+	void EndStage_RenderThread(FRHICommandListImmediate& RHICmdList, ERaymarchStage Stage);
+
+	void AddVolumesDrawn_RenderThread(int32 Count);
+	void AddUploadedBytes_RenderThread(uint64 Bytes);
+
+	/** True if draws should be repeated by the counting pass this frame. */
+	bool ShouldCountSamples_RenderThread() const;
+
+	/** Sets and clears the target the counting pass adds up its rays in, Size being the size of the targets it repeats. */
+	void BeginCounting_RenderThread(FRHICommandListImmediate& RHICmdList, FIntPoint Size);
+
+	/** Adds what the counting pass drew to the counters of this frame. */
+	void EndCounting_RenderThread(FRHICommandListImmediate& RHICmdList, ERHIFeatureLevel::Type FeatureLevel);
+
+	/** Reads back the frame the GPU has surely finished, updates the stats and the CSV, and starts the next frame. */
+	void EndFrame_RenderThread();
+
+	/** Starts writing a line per frame to the file (overwriting it), or stops with an empty file name. */
+	void SetCsvFile_RenderThread(const FString& Filename);
+
+	/** Drops the frames still waiting for the GPU and releases all queries and textures, and closes the CSV. The profiler
+	* lives in a static that's only destroyed after the RHI, so the module releases it on shutdown. */
+	void Release_RenderThread();
+
+private:
+	// Timestamps around one timed stage.
+	struct FTimerQuery
+	{
+		ERaymarchStage Stage;
+		FRenderQueryRHIRef Begin;
+		FRenderQueryRHIRef End;
+	};
+
+	// Everything measured in one frame.
+	struct FFrame
+	{
+		uint32 FrameNumber = 0;
+		double CpuMilliseconds[(int32)ERaymarchStage::Count] = {};
+		TArray<FTimerQuery> Queries;
+		int32 VolumesDrawn = 0;
+		uint64 UploadedBytes = 0;
+		// Counter buffer the counting pass added into, INDEX_NONE if there was none.
+		int32 CounterSlot = INDEX_NONE;
+	};
+
+	bool ShouldTimeGpu_RenderThread() const;
+	FRenderQueryRHIRef AllocateQuery_RenderThread();
+	void ReadFrame_RenderThread(FFrame& Frame);
+
+	FFrame CurrentFrame;
+	// Frames waiting for the GPU, oldest first.
+	TArray<FFrame> PendingFrames;
+	// Queries of read frames, ready for reuse.
+	TArray<FRenderQueryRHIRef> FreeQueries;
+	// Timers of stages that are running, and when they started on the render thread.
+	FRenderQueryRHIRef OpenQueries[(int32)ERaymarchStage::Count];
+	uint64 StageStartCycles[(int32)ERaymarchStage::Count] = {};
+	// Two words (low, high) per counter of FRaymarchSampleCounts in a row of a texture, one per frame in flight. The
+	// counting pass adds into the GPU ones and copies them to the staging ones, which the CPU maps once the frame is old enough.
+	FTexture2DRHIRef CounterTextures[RAYMARCH_PROFILER_LATENCY];
+	FUnorderedAccessViewRHIRef CounterUAVs[RAYMARCH_PROFILER_LATENCY];
+	FTexture2DRHIRef CounterStagingTextures[RAYMARCH_PROFILER_LATENCY];
+	// Target of the counting pass - rays (r), samples taken (g), samples skipped (b) and terminated rays (a) per pixel.
+	FTexture2DRHIRef CountingTarget;
+	uint32 FrameIndex = 0;
+	TUniquePtr<FArchive> CsvFile;
+};
+
+/** Times a stage for as long as it lives. */
+class FRaymarchScopedStage
+{
+public:
+	FRaymarchScopedStage(FRHICommandListImmediate& InRHICmdList, ERaymarchStage InStage)
+		: RHICmdList(InRHICmdList)
+		, Stage(InStage)
+	{
+		FRaymarchProfiler::Get().BeginStage_RenderThread(RHICmdList, Stage);
+	}
+
+	~FRaymarchScopedStage()
+	{
+		FRaymarchProfiler::Get().EndStage_RenderThread(RHICmdList, Stage);
+	}
+
+private:
+	FRHICommandListImmediate& RHICmdList;
+	ERaymarchStage Stage;
+};
+
+/** Marks a stage for GPU captures (draw event), the stats (cycle counter) and FRaymarchProfiler, until the end of the scope. */
+#define RAYMARCH_SCOPED_STAGE(RHICmdList, Stage) \
+	SCOPED_DRAW_EVENT(RHICmdList, Raymarch##Stage); \
+	SCOPE_CYCLE_COUNTER(STAT_Raymarch##Stage); \
+	FRaymarchScopedStage RaymarchScopedStage##Stage(RHICmdList, ERaymarchStage::Stage)
+
+// Sums the per-pixel counts of the counting pass into the counters of the frame.
+class FRaymarchReduceCountersCS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchReduceCountersCS, Global);
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		// Typed UAV atomics need SM5.
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), RAYMARCH_COUNTER_THREADGROUP_SIZE);
+	}
+
+	FRaymarchReduceCountersCS() {}
+
+	FRaymarchReduceCountersCS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FGlobalShader(Initializer)
+	{
+		CounterTexture.Bind(Initializer.ParameterMap, TEXT("CounterTexture"));
+		CounterTextureSize.Bind(Initializer.ParameterMap, TEXT("CounterTextureSize"));
+		CounterOutput.Bind(Initializer.ParameterMap, TEXT("CounterOutput"));
+	}
+
+	void SetCounters(FRHICommandListImmediate& RHICmdList, FTextureRHIParamRef Texture, FIntPoint Size, FUnorderedAccessViewRHIParamRef OutputUAV)
+	{
+		const FComputeShaderRHIParamRef ShaderRHI = GetComputeShader();
+		SetTextureParameter(RHICmdList, ShaderRHI, CounterTexture, Texture);
+		SetShaderValue(RHICmdList, ShaderRHI, CounterTextureSize, Size);
+		SetUAVParameter(RHICmdList, ShaderRHI, CounterOutput, OutputUAV);
+	}
+
+	/** Unbinds the output, so that it can be copied. */
+	void UnbindCounters(FRHICommandListImmediate& RHICmdList)
+	{
+		SetUAVParameter(RHICmdList, GetComputeShader(), CounterOutput, FUnorderedAccessViewRHIRef());
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FGlobalShader::Serialize(Ar);
+		Ar << CounterTexture << CounterTextureSize << CounterOutput;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderResourceParameter CounterTexture;
+	FShaderParameter CounterTextureSize;
+	FShaderResourceParameter CounterOutput;
+};
@@ -0,0 +1,229 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RaymarchRendering.h"
+
+// Most volumes of one batch that get reprojected with their own matrices. The rest only get upsampled.
+#define RAYMARCH_MAX_RECONSTRUCTION_VOLUMES 8
+// Length of the sub-pixel jitter sequence, the history converges over about this many frames.
+#define RAYMARCH_JITTER_SEQUENCE_LENGTH 8
+
+/** A volume of a reduced resolution batch together with its (unjittered) camera, to reproject it by in the next frame. */
+struct FRaymarchReprojectedVolume
+{
+	const FRaymarchVolumeRenderData* Volume;
+	FCompiledCameraModel CameraModel;
+};
+
+/** Everything about one reduced resolution frame of a render target, decided on the game thread. */
+struct FRaymarchReconstructionFrame
+{
+	// Size of the render target and of the intermediate one rays are marched into.
+	FIntPoint OutputSize = FIntPoint::ZeroValue;
+	FIntPoint LowResSize = FIntPoint::ZeroValue;
+	// Offset of the low resolution pixel centers this frame, in NDC.
+	FVector2D ProjectionJitter = FVector2D::ZeroVector;
+	// Offset of the first sample along the rays this frame, in steps (combined with per-pixel noise in the shader).
+	float RayJitter = 0.0f;
+	// Weight of the reprojected history, see FRaymarchRenderSettings::TemporalAccumulation.
+	float HistoryWeight = 0.0f;
+	// Unjittered projection of the frame, for reconstructing view positions at full resolution.
+	FMatrix ProjectionMatrix = FMatrix::Identity;
+	// Volumes in draw order, as the shader indexes them.
+	TArray<FRaymarchReprojectedVolume> Volumes;
+
+	/** Returns the projection shifted by ProjectionJitter. */
+	FMatrix JitterProjection(const FMatrix& Projection) const;
+};
+
+/**
+* Reduced resolution rendering of one render target. Rays are marched at half or quarter resolution into an intermediate
+* target, each frame from slightly different sub-pixel positions and ray offsets. The full resolution image is upsampled
+* from it (bilaterally, with the scene depth as a guide when there is one) and blended with the previous frames,
+* reprojected through the camera models of the volumes in the previous frame and clamped to the current neighbourhood
+* so that anything that moved doesn't leave a trail.
+* Created on the game thread, everything else happens on the render thread.
+*/
+class FRaymarchReconstruction
+{
+public:
+	/** Returns the reconstruction of a render target (created on first use) and decides its next frame. Game thread function!
+	* @param Target Render target the volumes are drawn to.
+	* @param Settings Settings of the draw, Resolution must not be Full.
+	* @param ProjectionMatrix Projection of the view drawn from.
+	* @param OutFrame Receives the frame. Volumes are left for the caller to fill.
+	*/
+	static TSharedPtr<FRaymarchReconstruction, ESPMode::ThreadSafe> BeginFrame_GameThread(
+		UTextureRenderTarget2D* Target,
+		const FRaymarchRenderSettings& Settings,
+		const FMatrix& ProjectionMatrix,
+		FRaymarchReconstructionFrame& OutFrame);
+
+	/** Creates the intermediate targets (if the size changed), clears them and sets them for drawing. Render thread function! */
+	void BeginLowResolution_RenderThread(FRHICommandListImmediate& RHICmdList, const FRaymarchReconstructionFrame& Frame);
+
+	/** Reconstructs the full resolution image into Output and keeps it as the history of the next frame. Render thread function!
+	* @param SceneDepth Depth the volumes were clipped against, guides the upsampling. Null upsamples bilinearly.
+	*/
+	void Resolve_RenderThread(
+		FRHICommandListImmediate& RHICmdList,
+		const FRaymarchReconstructionFrame& Frame,
+		FTextureRenderTargetResource* Output,
+		FTextureRenderTargetResource* SceneDepth,
+		ERaymarchSceneDepthChannel SceneDepthChannel,
+		ERHIFeatureLevel::Type FeatureLevel);
+
+	/** Forgets the reconstructions of all render targets and releases their targets on the render thread, for module
+	* shutdown. Game thread function! */
+	static void ReleaseAll_GameThread();
+
+private:
+	// Releases the intermediate targets and the history.
+	void Release_RenderThread();
+
+	// Premultiplied color and opacity of the volumes, and view depth, volume index and coverage of the front-most one.
+	FTexture2DRHIRef LowResColor;
+	FTexture2DRHIRef LowResDepth;
+	// Reconstructed images of the previous frame and the current one, alternating.
+	FTexture2DRHIRef History[2];
+	// History the next frame reads.
+	int32 CurrentHistory = 0;
+	// False until the first frame at the current size was resolved.
+	bool bHistoryValid = false;
+	// Volumes of the last resolved frame.
+	TArray<FRaymarchReprojectedVolume> PreviousVolumes;
+};
+
+typedef TSharedPtr<FRaymarchReconstruction, ESPMode::ThreadSafe> FRaymarchReconstructionPtr;
+
+// Full screen pass of the reconstruction, a quad in NDC.
+class FRaymarchResolveVS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchResolveVS, Global);
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM4);
+	}
+
+	FRaymarchResolveVS() {}
+
+	FRaymarchResolveVS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FGlobalShader(Initializer)
+	{ }
+};
+
+// Upsamples the low resolution image and blends it with the reprojected history.
+class FRaymarchResolvePS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchResolvePS, Global);
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM4);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("RAYMARCH_MAX_RECONSTRUCTION_VOLUMES"), RAYMARCH_MAX_RECONSTRUCTION_VOLUMES);
+	}
+
+	FRaymarchResolvePS() {}
+
+	FRaymarchResolvePS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FGlobalShader(Initializer)
+	{
+		LowResColor.Bind(Initializer.ParameterMap, TEXT("LowResColor"));
+		LowResDepth.Bind(Initializer.ParameterMap, TEXT("LowResDepth"));
+		HistoryTexture.Bind(Initializer.ParameterMap, TEXT("HistoryTexture"));
+		PointSampler.Bind(Initializer.ParameterMap, TEXT("PointSampler"));
+		LinearSampler.Bind(Initializer.ParameterMap, TEXT("LinearSampler"));
+		SceneDepthTexture.Bind(Initializer.ParameterMap, TEXT("SceneDepthTexture"));
+		SceneDepthChannelMask.Bind(Initializer.ParameterMap, TEXT("SceneDepthChannelMask"));
+		UseSceneDepth.Bind(Initializer.ParameterMap, TEXT("UseSceneDepth"));
+		LowResSize.Bind(Initializer.ParameterMap, TEXT("LowResSize"));
+		InvOutputSize.Bind(Initializer.ParameterMap, TEXT("InvOutputSize"));
+		ProjectionJitter.Bind(Initializer.ParameterMap, TEXT("ProjectionJitter"));
+		InvProjection.Bind(Initializer.ParameterMap, TEXT("InvProjection"));
+		ReprojectionMatrices.Bind(Initializer.ParameterMap, TEXT("ReprojectionMatrices"));
+		ReprojectionCount.Bind(Initializer.ParameterMap, TEXT("ReprojectionCount"));
+		HistoryWeight.Bind(Initializer.ParameterMap, TEXT("HistoryWeight"));
+	}
+
+	void SetImages(
+		FRHICommandListImmediate& RHICmdList,
+		FTextureRHIParamRef Color,
+		FTextureRHIParamRef Depth,
+		FTextureRHIParamRef History,
+		FIntPoint InLowResSize,
+		FIntPoint OutputSize,
+		FVector2D InProjectionJitter)
+	{
+		const FPixelShaderRHIParamRef ShaderRHI = GetPixelShader();
+		// Low resolution texels are fetched one by one and weighted in the shader, the history is reprojected anywhere.
+		SetTextureParameter(RHICmdList, ShaderRHI, LowResColor, Color);
+		SetTextureParameter(RHICmdList, ShaderRHI, LowResDepth, Depth);
+		SetTextureParameter(RHICmdList, ShaderRHI, HistoryTexture, History);
+		SetSamplerParameter(RHICmdList, ShaderRHI, PointSampler, TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI());
+		SetSamplerParameter(RHICmdList, ShaderRHI, LinearSampler, TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI());
+		SetShaderValue(RHICmdList, ShaderRHI, LowResSize, FVector4(InLowResSize.X, InLowResSize.Y, 1.0f / InLowResSize.X, 1.0f / InLowResSize.Y));
+		SetShaderValue(RHICmdList, ShaderRHI, InvOutputSize, FVector2D(1.0f / OutputSize.X, 1.0f / OutputSize.Y));
+		SetShaderValue(RHICmdList, ShaderRHI, ProjectionJitter, InProjectionJitter);
+	}
+
+	void SetSceneDepth(FRHICommandListImmediate& RHICmdList, FTextureRHIParamRef Depth, ERaymarchSceneDepthChannel Channel)
+	{
+		const FPixelShaderRHIParamRef ShaderRHI = GetPixelShader();
+		SetTextureParameter(RHICmdList, ShaderRHI, SceneDepthTexture, Depth ? Depth : GBlackTexture->TextureRHI);
+		SetShaderValue(RHICmdList, ShaderRHI, SceneDepthChannelMask,
+			Channel == ERaymarchSceneDepthChannel::Alpha ? FVector4(0.0f, 0.0f, 0.0f, 1.0f) : FVector4(1.0f, 0.0f, 0.0f, 0.0f));
+		SetShaderValue(RHICmdList, ShaderRHI, UseSceneDepth, Depth ? 1.0f : 0.0f);
+	}
+
+	/** @param Matrices View space of the current frame to clip space of the previous one, per volume. */
+	void SetReprojection(
+		FRHICommandListImmediate& RHICmdList,
+		const FMatrix& ProjectionMatrix,
+		const TArray<FMatrix>& Matrices,
+		float InHistoryWeight)
+	{
+		const FPixelShaderRHIParamRef ShaderRHI = GetPixelShader();
+		// Inverting the projection of a pixel at a known view depth only needs the scale and the off-center terms.
+		SetShaderValue(RHICmdList, ShaderRHI, InvProjection, FVector4(1.0f / ProjectionMatrix.M[0][0], 1.0f / ProjectionMatrix.M[1][1],
+			ProjectionMatrix.M[2][0], ProjectionMatrix.M[2][1]));
+		SetShaderValueArray(RHICmdList, ShaderRHI, ReprojectionMatrices, Matrices.GetData(), Matrices.Num());
+		SetShaderValue(RHICmdList, ShaderRHI, ReprojectionCount, float(Matrices.Num()));
+		SetShaderValue(RHICmdList, ShaderRHI, HistoryWeight, InHistoryWeight);
+	}
+
+	virtual bool Serialize(FArchive& Ar) override
+	{
+		bool bShaderHasOutdatedParameters = FGlobalShader::Serialize(Ar);
+		Ar << LowResColor << LowResDepth << HistoryTexture << PointSampler << LinearSampler;
+		Ar << SceneDepthTexture << SceneDepthChannelMask << UseSceneDepth;
+		Ar << LowResSize << InvOutputSize << ProjectionJitter << InvProjection << ReprojectionMatrices << ReprojectionCount << HistoryWeight;
+		return bShaderHasOutdatedParameters;
+	}
+
+private:
+	FShaderResourceParameter LowResColor;
+	FShaderResourceParameter LowResDepth;
+	FShaderResourceParameter HistoryTexture;
+	FShaderResourceParameter PointSampler;
+	FShaderResourceParameter LinearSampler;
+	FShaderResourceParameter SceneDepthTexture;
+	FShaderParameter SceneDepthChannelMask;
+	FShaderParameter UseSceneDepth;
+	FShaderParameter LowResSize;
+	FShaderParameter InvOutputSize;
+	FShaderParameter ProjectionJitter;
+	FShaderParameter InvProjection;
+	FShaderParameter ReprojectionMatrices;
+	FShaderParameter ReprojectionCount;
+	FShaderParameter HistoryWeight;
+};
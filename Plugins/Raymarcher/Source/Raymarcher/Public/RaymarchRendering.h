@@ -9,12 +9,21 @@
 #include "Classes/Engine/World.h"
 #include "Public/GlobalShader.h"
 #include "Public/PipelineStateCache.h"
+#include "Public/RenderResource.h"
+#include "Public/RenderingThread.h"
 #include "Public/RHIStaticStates.h"
 #include "Public/SceneUtils.h"
 #include "Public/SceneInterface.h"
 #include "Public/ShaderParameterUtils.h"
+#include "Public/ShaderPermutation.h"
 #include "Public/Logging/MessageLog.h"
 #include "Public/Internationalization/Internationalization.h"
+#include "RaymarchMacroCells.h"
+#include "RaymarchBrickPool.h"
+#include "RaymarchCamera.h"
+#include "RaymarchPreIntegration.h"
+#include "RaymarchGradients.h"
+#include "RaymarchTypes.h"
 
 // Shouldn't surprise anyone...
 #define CUBE_VERTEX_CNT 8
@@ -24,25 +33,146 @@
 #define MY_LOG(x) if(GEngine){GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Yellow, TEXT(x));}
 
 /**
-* Camera data to be handled to renderthread, which will in turn set them as uniform shader parameters.
+* What a volume is drawn from - its texture, acceleration data and parameters. Loads build a complete one and swap it
+* into the volume at once, see FRaymarchVolumeRenderData. Copying one only copies references.
 */
-struct FCompiledCameraModel
+struct FRaymarchVolumeDataset
 {
-	FMatrix ModelMatrix;
-	FMatrix ViewMatrix;
-	FMatrix ProjectionMatrix;
-	FVector RayOrigin;
+	// Volume texture (the brick atlas for bricked volumes). Null until something is loaded.
+	FTexture3DRHIRef VolumeTexture;
+	// Dimensions of the volume in voxels. Differs from the texture size for bricked volumes.
+	FIntVector VolumeDimensions = FIntVector::ZeroValue;
+	// Scale and bias applied to sampled values, maps the intensity window of the volume to [0,1].
+	FVector2D WindowScaleBias = FVector2D(1.0f, 0.0f);
+	// Min/max macro cells for empty-space skipping. Null if the volume was loaded without them.
+	FTexture3DRHIRef MacroCellTexture;
+	// (Min, Max) of all the samples of the volume (before windowing), see FRaymarchMacroCellGrid::GetValueRange.
+	// Projections stop once they reach it. Unknown without macro cells built on the CPU.
+	FVector2D ValueRange = FVector2D(-MAX_flt, MAX_flt);
+	// Packed gradients for shading and 2D transfer functions (see RaymarchGradients.h), laid out like VolumeTexture (so
+	// an atlas with the same slots for bricked volumes). Null if the volume was loaded without them.
+	FTexture3DRHIRef GradientTexture;
+	// Brick slot of every brick of a bricked volume. Null if the volume is a dense texture.
+	FTexture3DRHIRef BrickIndirectionTexture;
+	// Layout of the bricks and size of the atlas, only valid with BrickIndirectionTexture.
+	FRaymarchBrickLayout BrickLayout;
+	FIntVector BrickAtlasDimensions = FIntVector::ZeroValue;
+};
+
+/**
+* Everything needed to draw one volume. Handles to it can be held on any thread, but the dataset is only ever written and
+* read on the render thread, and never written while draws may still use it - loads and filters build a new dataset and
+* swap it in with SwapDataset_RenderThread. The previous one is released once the GPU is done with the frames using it.
+* Every load into the volume takes a ticket when it starts, and only the latest one gets shown. When loads are started
+* quicker than they finish (switching datasets), the ones in between are dropped and can stop early by checking
+* IsSuperseded_AnyThread.
+* Owners init the resource with BeginInitResource and release it on the render thread before letting go of it.
+*/
+class FRaymarchVolumeRenderData : public FRaymarchVolumeDataset, public FRenderResource
+{
+public:
+	virtual ~FRaymarchVolumeRenderData();
+
+	// FRenderResource
+	virtual void ReleaseRHI() override;
+	virtual FString GetFriendlyName() const override { return TEXT("FRaymarchVolumeRenderData"); }
+
+	/** Takes a ticket for a new load into the volume, superseding all loads started before. */
+	int32 BeginLoad_AnyThread() { return LatestTicket.Increment(); }
+
+	/** True if a load was started after the one holding Ticket, or the volume got released since. */
+	bool IsSuperseded_AnyThread(int32 Ticket) const { return LatestTicket.GetValue() != Ticket; }
+
+	/** Ticket of the dataset being shown. Edits of it (i.e. filters) swap under it, so that loads started since win. */
+	int32 GetShownTicket_RenderThread() const { return ShownTicket; }
+
+	/** Replaces the shown dataset and queues the previous one for release after the frames still drawing it.
+	* @param Dataset Dataset to show, left untouched if it gets dropped.
+	* @param Ticket Ticket of the load that built the dataset.
+	* @return False if the dataset got dropped because a later load was started or the volume got released.
+	*/
+	bool SwapDataset_RenderThread(FRaymarchVolumeDataset&& Dataset, int32 Ticket);
+
+private:
+	// Last ticket handed out. Bumped by releasing too, so no load still running shows up afterwards.
+	FThreadSafeCounter LatestTicket;
+	// Ticket of the shown dataset, render thread only.
+	int32 ShownTicket = 0;
+};
+
+typedef TSharedPtr<FRaymarchVolumeRenderData, ESPMode::ThreadSafe> FRaymarchVolumeRenderDataPtr;
+
+/**
+* Baked transfer function of a volume - the lookup table and its pre-integrated version. Like the volume render data,
+* only written and read on the render thread. Updating it never touches the volume.
+*/
+struct FRaymarchTransferFunctionRenderData
+{
+	// Size x 1 RGBA texture, color and opacity per voxel over the windowed intensity. Null until something is baked.
+	FTexture2DRHIRef LutTexture;
+	// Size x Size RGBA texture, see BuildPreIntegrationTable.
+	FTexture2DRHIRef PreIntegrationTexture;
+	// Size x GradientSize RGBA texture over the windowed intensity (X) and gradient magnitude (Y). Null for 1D transfer functions.
+	FTexture2DRHIRef Lut2DTexture;
+	// Size x Size R16F texture, see BuildMaxOpacityTable. Empty-space skipping tests the range of every macro cell against it.
+	FTexture2DRHIRef MaxOpacityTexture;
+};
+
+typedef TSharedPtr<FRaymarchTransferFunctionRenderData, ESPMode::ThreadSafe> FRaymarchTransferFunctionRenderDataPtr;
+
+class FRaymarchBrickPager;
+typedef TSharedPtr<FRaymarchBrickPager, ESPMode::ThreadSafe> FRaymarchBrickPagerPtr;
+
+/** One volume of a batched draw. */
+struct FRaymarchVolumeDrawDesc
+{
+	FRaymarchVolumeRenderDataPtr Volume;
+	// Maps the [-1,1] cube of the volume into the world.
+	FTransform Transform;
+	// Colors the volume in front to back mode. Null draws the plain grey volume.
+	FRaymarchTransferFunctionRenderDataPtr TransferFunction;
+	// Pages the bricks seen by the (first) view into the volume, for volumes that don't fit into memory. Null otherwise.
+	FRaymarchBrickPagerPtr Pager;
 };
 
 // Common ancestor for both Pixel and Vertex shaders.
 class FRaymarchShader : public FGlobalShader
 {
 public:
+	// Dimensions the pixel shaders are specialized in, so that the sample loop of every configuration only does what it
+	// needs instead of branching on uniforms. Picked per volume on the render thread, see GetRaymarchPermutation.
+	// How samples are combined, ERaymarchCompositingMode.
+	class FCompositingModeDim : SHADER_PERMUTATION_INT("RAYMARCH_COMPOSITING_MODE", 5);
+	// Voxels are fetched through a brick indirection from an atlas (without mips) instead of straight from the volume.
+	class FBrickPoolDim : SHADER_PERMUTATION_BOOL("RAYMARCH_BRICK_POOL");
+	class FEmptySpaceSkippingDim : SHADER_PERMUTATION_BOOL("RAYMARCH_EMPTY_SPACE_SKIPPING");
+	class FShadingDim : SHADER_PERMUTATION_BOOL("RAYMARCH_SHADING");
+	typedef TShaderPermutationDomain<FCompositingModeDim, FBrickPoolDim, FEmptySpaceSkippingDim, FShadingDim> FPixelPermutationDomain;
+
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
 		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM4);
 	}
 
+	static bool ShouldCompilePixelPermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		// Only front to back compositing has colors to light.
+		const FPixelPermutationDomain PermutationVector(Parameters.PermutationId);
+		if (PermutationVector.Get<FShadingDim>() &&
+			PermutationVector.Get<FCompositingModeDim>() != int32(ERaymarchCompositingMode::FrontToBack))
+		{
+			return false;
+		}
+		return ShouldCompilePermutation(Parameters);
+	}
+
+	static void ModifyPixelCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		const FPixelPermutationDomain PermutationVector(Parameters.PermutationId);
+		PermutationVector.ModifyCompilationEnvironment(OutEnvironment);
+	}
+
 	FRaymarchShader() {}
 
 	FRaymarchShader(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
@@ -56,6 +186,49 @@ public:
 		View.Bind(Initializer.ParameterMap, TEXT("View"));
 		Projection.Bind(Initializer.ParameterMap, TEXT("Projection"));
 		RayOrigin.Bind(Initializer.ParameterMap, TEXT("RayOrigin"));
+		// Volume uniforms
+		WindowScaleBias.Bind(Initializer.ParameterMap, TEXT("WindowScaleBias"));
+		ProjectionRange.Bind(Initializer.ParameterMap, TEXT("ProjectionRange"));
+		// Empty-space skipping uniforms
+		MacroCellTexture.Bind(Initializer.ParameterMap, TEXT("MacroCellTexture"));
+		MacroCellCount.Bind(Initializer.ParameterMap, TEXT("MacroCellCount"));
+		// Brick pool uniforms
+		BrickIndirectionTexture.Bind(Initializer.ParameterMap, TEXT("BrickIndirectionTexture"));
+		BrickCount.Bind(Initializer.ParameterMap, TEXT("BrickCount"));
+		BrickVolumeSize.Bind(Initializer.ParameterMap, TEXT("BrickVolumeSize"));
+		BrickSizeAndApron.Bind(Initializer.ParameterMap, TEXT("BrickSizeAndApron"));
+		BrickAtlasTexelSize.Bind(Initializer.ParameterMap, TEXT("BrickAtlasTexelSize"));
+		// Transfer function uniforms
+		TransferFunctionTexture.Bind(Initializer.ParameterMap, TEXT("TransferFunctionTexture"));
+		PreIntegrationTexture.Bind(Initializer.ParameterMap, TEXT("PreIntegrationTexture"));
+		MaxOpacityTexture.Bind(Initializer.ParameterMap, TEXT("MaxOpacityTexture"));
+		TransferFunctionSampler.Bind(Initializer.ParameterMap, TEXT("TransferFunctionSampler"));
+		TransferFunctionSize.Bind(Initializer.ParameterMap, TEXT("TransferFunctionSize"));
+		UseTransferFunction.Bind(Initializer.ParameterMap, TEXT("UseTransferFunction"));
+		UsePreIntegration.Bind(Initializer.ParameterMap, TEXT("UsePreIntegration"));
+		TransferFunction2DTexture.Bind(Initializer.ParameterMap, TEXT("TransferFunction2DTexture"));
+		UseTransferFunction2D.Bind(Initializer.ParameterMap, TEXT("UseTransferFunction2D"));
+		// Gradient uniforms
+		GradientTexture.Bind(Initializer.ParameterMap, TEXT("GradientTexture"));
+		UseGradients.Bind(Initializer.ParameterMap, TEXT("UseGradients"));
+		ShadingCoefficients.Bind(Initializer.ParameterMap, TEXT("ShadingCoefficients"));
+		// Scene depth uniforms
+		SceneDepthTexture.Bind(Initializer.ParameterMap, TEXT("SceneDepthTexture"));
+		SceneDepthSampler.Bind(Initializer.ParameterMap, TEXT("SceneDepthSampler"));
+		SceneDepthChannelMask.Bind(Initializer.ParameterMap, TEXT("SceneDepthChannelMask"));
+		InvViewportSize.Bind(Initializer.ParameterMap, TEXT("InvViewportSize"));
+		UseSceneDepth.Bind(Initializer.ParameterMap, TEXT("UseSceneDepth"));
+		// Reduced resolution uniforms
+		RayJitter.Bind(Initializer.ParameterMap, TEXT("RayJitter"));
+		VolumeIndex.Bind(Initializer.ParameterMap, TEXT("VolumeIndex"));
+		// Raymarching uniforms
+		StepSize.Bind(Initializer.ParameterMap, TEXT("StepSize"));
+		StepInVoxels.Bind(Initializer.ParameterMap, TEXT("StepInVoxels"));
+		EarlyTerminationThreshold.Bind(Initializer.ParameterMap, TEXT("EarlyTerminationThreshold"));
+		Slab.Bind(Initializer.ParameterMap, TEXT("Slab"));
+		// Level of detail uniforms
+		LodScale.Bind(Initializer.ParameterMap, TEXT("LodScale"));
+		MaxLod.Bind(Initializer.ParameterMap, TEXT("MaxLod"));
 	}
 
 	template<typename TShaderRHIParamRef>
@@ -71,6 +244,40 @@ public:
 		SetShaderValue(RHICmdList, ShaderRHI, RayOrigin, CompiledCameraModel.RayOrigin);
 	}
 
+	template<typename TShaderRHIParamRef>
+	void SetRaymarchParameters(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FRaymarchRenderSettings& Settings,
+		const FIntVector& VolumeDimensions)
+	{
+		// Rays are marched in texture space ([0,1]^3), where one voxel along the finest axis is 1/MaxDimension long.
+		const float VoxelStep = 1.0f / FMath::Max(VolumeDimensions.GetMax(), 1);
+		const float Quality = FMath::Max(Settings.Quality, 0.05f);
+		SetShaderValue(RHICmdList, ShaderRHI, StepSize, VoxelStep / Quality);
+		// Opacities are defined per voxel, the shader corrects them for steps of a different length.
+		SetShaderValue(RHICmdList, ShaderRHI, StepInVoxels, 1.0f / Quality);
+		SetShaderValue(RHICmdList, ShaderRHI, EarlyTerminationThreshold, Settings.EarlyTerminationThreshold);
+		// Offset and thickness in world units, the shader clips the rays to the view depths in between.
+		SetShaderValue(RHICmdList, ShaderRHI, Slab, FVector2D(Settings.SlabOffset, FMath::Max(Settings.SlabThickness, 0.0f)));
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetLodParameters(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FMatrix& ProjectionMatrix,
+		int32 ViewportHeight,
+		const FIntVector& VolumeDimensions,
+		int32 NumMips)
+	{
+		// A pixel at distance D covers roughly D * 2 / (Projection[1][1] * ViewportHeight) (small angle approximation)
+		// and a voxel is 2 / MaxDimension long in the [-1,1] object space. The shader takes log2 of the ratio.
+		const float PixelAngle = 2.0f / (FMath::Max(ProjectionMatrix.M[1][1], SMALL_NUMBER) * FMath::Max(ViewportHeight, 1));
+		SetShaderValue(RHICmdList, ShaderRHI, LodScale, PixelAngle * VolumeDimensions.GetMax() / 2.0f);
+		SetShaderValue(RHICmdList, ShaderRHI, MaxLod, float(FMath::Max(NumMips - 1, 0)));
+	}
+
 	template<typename TShaderRHIParamRef>
 	void SetTexture(
 			FRHICommandListImmediate& RHICmdList,
@@ -83,10 +290,165 @@ public:
 		SetTextureParameter(RHICmdList, ShaderRHI, MyTexture, MySampler, SamplerRef, Texture);
 	}
 
+	template<typename TShaderRHIParamRef>
+	void SetWindow(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FVector2D& InWindowScaleBias,
+		const FVector2D& ValueRange)
+	{
+		// Sampled intensities get multiplied by X and added Y to in the shader.
+		SetShaderValue(RHICmdList, ShaderRHI, WindowScaleBias, InWindowScaleBias);
+		// The darkest and brightest windowed intensity any sample can have, where projections are done. Windowed here,
+		// as an unknown range is +-MAX_flt.
+		const FVector2D Windowed(
+			FMath::Clamp(ValueRange.X * InWindowScaleBias.X + InWindowScaleBias.Y, 0.0f, 1.0f),
+			FMath::Clamp(ValueRange.Y * InWindowScaleBias.X + InWindowScaleBias.Y, 0.0f, 1.0f));
+		SetShaderValue(RHICmdList, ShaderRHI, ProjectionRange, FVector2D(FMath::Min(Windowed.X, Windowed.Y), FMath::Max(Windowed.X, Windowed.Y)));
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetMacroCells(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FTexture3DRHIRef MacroCells)
+	{
+		// The cells are only ever fetched with Load(), so no sampler is needed. Permutations without empty-space skipping
+		// don't look at them, but get something valid bound anyway.
+		if (MacroCells)
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, MacroCellTexture, MacroCells);
+			SetShaderValue(RHICmdList, ShaderRHI, MacroCellCount, FVector(MacroCells->GetSizeX(), MacroCells->GetSizeY(), MacroCells->GetSizeZ()));
+		}
+		else
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, MacroCellTexture, GBlackVolumeTexture->TextureRHI);
+			SetShaderValue(RHICmdList, ShaderRHI, MacroCellCount, FVector(1.0f, 1.0f, 1.0f));
+		}
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetBrickPool(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FTexture3DRHIRef Indirection,
+		const FRaymarchBrickLayout& Layout,
+		const FIntVector& AtlasDimensions)
+	{
+		// With a brick pool, MyTexture is the atlas and the brick pool permutations find bricks in it through the
+		// indirection (fetched with Load(), so no sampler). Without one, bind something valid.
+		if (Indirection)
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, BrickIndirectionTexture, Indirection);
+			SetShaderValue(RHICmdList, ShaderRHI, BrickCount, FVector(Layout.BrickCounts));
+			SetShaderValue(RHICmdList, ShaderRHI, BrickVolumeSize, FVector(Layout.VolumeDimensions));
+			SetShaderValue(RHICmdList, ShaderRHI, BrickSizeAndApron, FVector2D(Layout.BrickSize, Layout.Apron));
+			SetShaderValue(RHICmdList, ShaderRHI, BrickAtlasTexelSize, FVector(1.0f) / FVector(AtlasDimensions));
+		}
+		else
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, BrickIndirectionTexture, GBlackVolumeTexture->TextureRHI);
+		}
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetTransferFunction(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FRaymarchTransferFunctionRenderData* TransferFunction,
+		bool bPreIntegrate)
+	{
+		// Both tables are sampled bilinearly, the shader offsets coordinates to texel centers so the ends aren't blended.
+		FSamplerStateRHIParamRef SamplerRef = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		if (TransferFunction && TransferFunction->LutTexture)
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, TransferFunctionTexture, TransferFunctionSampler, SamplerRef, TransferFunction->LutTexture);
+			SetTextureParameter(RHICmdList, ShaderRHI, PreIntegrationTexture, TransferFunction->PreIntegrationTexture);
+			SetTextureParameter(RHICmdList, ShaderRHI, MaxOpacityTexture, TransferFunction->MaxOpacityTexture);
+			SetShaderValue(RHICmdList, ShaderRHI, TransferFunctionSize, float(TransferFunction->LutTexture->GetSizeX()));
+			SetShaderValue(RHICmdList, ShaderRHI, UseTransferFunction, 1.0f);
+			SetShaderValue(RHICmdList, ShaderRHI, UsePreIntegration, bPreIntegrate ? 1.0f : 0.0f);
+		}
+		else
+		{
+			SetTextureParameter(RHICmdList, ShaderRHI, TransferFunctionTexture, TransferFunctionSampler, SamplerRef, GWhiteTexture->TextureRHI);
+			SetTextureParameter(RHICmdList, ShaderRHI, PreIntegrationTexture, GWhiteTexture->TextureRHI);
+			SetTextureParameter(RHICmdList, ShaderRHI, MaxOpacityTexture, GWhiteTexture->TextureRHI);
+			SetShaderValue(RHICmdList, ShaderRHI, TransferFunctionSize, 1.0f);
+			SetShaderValue(RHICmdList, ShaderRHI, UseTransferFunction, 0.0f);
+			SetShaderValue(RHICmdList, ShaderRHI, UsePreIntegration, 0.0f);
+		}
+		// The shader only picks the 2D table if the volume has gradients to index it with.
+		const bool bHas2D = TransferFunction && TransferFunction->Lut2DTexture;
+		SetTextureParameter(RHICmdList, ShaderRHI, TransferFunction2DTexture, bHas2D ? TransferFunction->Lut2DTexture : GWhiteTexture->TextureRHI);
+		SetShaderValue(RHICmdList, ShaderRHI, UseTransferFunction2D, bHas2D ? 1.0f : 0.0f);
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetGradients(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FTexture3DRHIRef Gradients,
+		const FRaymarchRenderSettings& Settings)
+	{
+		// Sampled with MySampler, at the same coordinates as the volume.
+		SetTextureParameter(RHICmdList, ShaderRHI, GradientTexture, Gradients ? Gradients : GBlackVolumeTexture->TextureRHI);
+		SetShaderValue(RHICmdList, ShaderRHI, UseGradients, Gradients ? 1.0f : 0.0f);
+		SetShaderValue(RHICmdList, ShaderRHI, ShadingCoefficients,
+			FVector4(Settings.Ambient, Settings.Diffuse, Settings.Specular, FMath::Max(Settings.Shininess, 1.0f)));
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetSceneDepth(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		const FTextureRHIParamRef Depth,
+		ERaymarchSceneDepthChannel Channel,
+		FIntPoint ViewportSize)
+	{
+		// Depth is never filtered, blending depths of a mesh edge and the background would stop rays in thin air.
+		FSamplerStateRHIParamRef SamplerRef = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		SetTextureParameter(RHICmdList, ShaderRHI, SceneDepthTexture, SceneDepthSampler, SamplerRef, Depth ? Depth : GBlackTexture->TextureRHI);
+		SetShaderValue(RHICmdList, ShaderRHI, SceneDepthChannelMask,
+			Channel == ERaymarchSceneDepthChannel::Alpha ? FVector4(0.0f, 0.0f, 0.0f, 1.0f) : FVector4(1.0f, 0.0f, 0.0f, 0.0f));
+		SetShaderValue(RHICmdList, ShaderRHI, InvViewportSize,
+			FVector2D(1.0f / FMath::Max(ViewportSize.X, 1), 1.0f / FMath::Max(ViewportSize.Y, 1)));
+		SetShaderValue(RHICmdList, ShaderRHI, UseSceneDepth, Depth ? 1.0f : 0.0f);
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetReducedResolution(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		bool bEnabled,
+		float Jitter)
+	{
+		// Rays are only jittered when the reconstruction averages the noise away again.
+		SetShaderValue(RHICmdList, ShaderRHI, RayJitter, FVector2D(Jitter, bEnabled ? 1.0f : 0.0f));
+	}
+
+	template<typename TShaderRHIParamRef>
+	void SetVolumeIndex(
+		FRHICommandListImmediate& RHICmdList,
+		const TShaderRHIParamRef ShaderRHI,
+		int32 Index)
+	{
+		SetShaderValue(RHICmdList, ShaderRHI, VolumeIndex, float(Index));
+	}
+
 	virtual bool Serialize(FArchive& Ar) override
 	{			
 		bool bShaderHasOutdatedParameters = FGlobalShader::Serialize(Ar);
-		Ar << MyTexture << MySampler << Model << View << Projection << RayOrigin;
+		Ar << MyTexture << MySampler << Model << View << Projection << RayOrigin << WindowScaleBias << ProjectionRange;
+		Ar << MacroCellTexture << MacroCellCount;
+		Ar << BrickIndirectionTexture << BrickCount << BrickVolumeSize << BrickSizeAndApron << BrickAtlasTexelSize;
+		Ar << TransferFunctionTexture << PreIntegrationTexture << TransferFunctionSampler << TransferFunctionSize << UseTransferFunction << UsePreIntegration;
+		Ar << TransferFunction2DTexture << UseTransferFunction2D << MaxOpacityTexture;
+		Ar << GradientTexture << UseGradients << ShadingCoefficients;
+		Ar << SceneDepthTexture << SceneDepthSampler << SceneDepthChannelMask << InvViewportSize << UseSceneDepth;
+		Ar << RayJitter << VolumeIndex;
+		Ar << StepSize << StepInVoxels << EarlyTerminationThreshold << Slab;
+		Ar << LodScale << MaxLod;
 		return bShaderHasOutdatedParameters;
 	}
 
@@ -100,6 +462,49 @@ private:
 	FShaderParameter Projection;
 
 	FShaderParameter RayOrigin;
+	// Volume parameters
+	FShaderParameter WindowScaleBias;
+	FShaderParameter ProjectionRange;
+	// Empty-space skipping parameters
+	FShaderResourceParameter MacroCellTexture;
+	FShaderParameter MacroCellCount;
+	// Brick pool parameters
+	FShaderResourceParameter BrickIndirectionTexture;
+	FShaderParameter BrickCount;
+	FShaderParameter BrickVolumeSize;
+	FShaderParameter BrickSizeAndApron;
+	FShaderParameter BrickAtlasTexelSize;
+	// Transfer function parameters
+	FShaderResourceParameter TransferFunctionTexture;
+	FShaderResourceParameter PreIntegrationTexture;
+	FShaderResourceParameter TransferFunctionSampler;
+	FShaderParameter TransferFunctionSize;
+	FShaderParameter UseTransferFunction;
+	FShaderParameter UsePreIntegration;
+	FShaderResourceParameter TransferFunction2DTexture;
+	FShaderParameter UseTransferFunction2D;
+	FShaderResourceParameter MaxOpacityTexture;
+	// Gradient parameters
+	FShaderResourceParameter GradientTexture;
+	FShaderParameter UseGradients;
+	FShaderParameter ShadingCoefficients;
+	// Scene depth parameters
+	FShaderResourceParameter SceneDepthTexture;
+	FShaderResourceParameter SceneDepthSampler;
+	FShaderParameter SceneDepthChannelMask;
+	FShaderParameter InvViewportSize;
+	FShaderParameter UseSceneDepth;
+	// Reduced resolution parameters
+	FShaderParameter RayJitter;
+	FShaderParameter VolumeIndex;
+	// Raymarching parameters
+	FShaderParameter StepSize;
+	FShaderParameter StepInVoxels;
+	FShaderParameter EarlyTerminationThreshold;
+	FShaderParameter Slab;
+	// Level of detail parameters
+	FShaderParameter LodScale;
+	FShaderParameter MaxLod;
 };
 
 // Vertex shader class
@@ -125,6 +530,17 @@ class FRaymarchPS : public FRaymarchShader
 	DECLARE_SHADER_TYPE(FRaymarchPS, Global);
 
 public:
+	typedef FPixelPermutationDomain FPermutationDomain;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return ShouldCompilePixelPermutation(Parameters);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		ModifyPixelCompilationEnvironment(Parameters, OutEnvironment);
+	}
 
 	/** Default constructor. */
 	FRaymarchPS() {}
@@ -135,41 +551,189 @@ public:
 	{ }
 };
 
+// Pixel shader of the counting pass of the profiler. Marches the same rays, but writes how many samples they took
+// and skipped instead of their color, see FRaymarchProfiler.
+class FRaymarchCountingPS : public FRaymarchShader
+{
+	DECLARE_SHADER_TYPE(FRaymarchCountingPS, Global);
+
+public:
+	typedef FPixelPermutationDomain FPermutationDomain;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return ShouldCompilePixelPermutation(Parameters);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		ModifyPixelCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("RAYMARCH_COUNTERS"), 1);
+	}
+
+	FRaymarchCountingPS() {}
+
+	FRaymarchCountingPS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FRaymarchShader(Initializer)
+	{ }
+};
+
 
 /** Prepares uniforms for drawing to render target and then calls render-thread function that performs the rendering.
+* Draws the default volume (the one the loaders fill when not given a volume of their own).
 * @param World Current world to get the rendering settings from (such as feature level).
 * @param OutputRenderTarget The render target to draw to.
+* @param Settings Compositing mode, sampling rate and early ray termination.
 */
 void DrawRaymarchToRenderTarget_GameThread(
 	class UWorld* World,
 	class UTextureRenderTarget2D* OutputRenderTarget,
-	const FTransform Transform);
+	const FTransform Transform,
+	const FRaymarchRenderSettings& Settings);
+
+/** Draws any number of volumes into one render target in a single pass, seen by the first local player. All of them share
+* one pipeline state and are drawn back to front (by distance of their centers from the camera), blended over each other.
+* @param World Current world to get the rendering settings from (such as feature level).
+* @param OutputRenderTarget The render target to draw to. It's cleared first.
+* @param Volumes Volumes and their transforms. Volumes with nothing loaded yet are skipped.
+* @param Settings Compositing mode, sampling rate and early ray termination, same for all volumes. With a scene depth,
+*                 rays are clipped against it.
+*/
+void DrawRaymarchVolumesToRenderTarget_GameThread(
+	class UWorld* World,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings);
+
+/** Same as DrawRaymarchVolumesToRenderTarget_GameThread, but seen from any camera (a scene capture, an offscreen viewpoint...).
+* @param View Camera to draw from, see FRaymarchCameraModelProvider.
+*/
+void DrawRaymarchVolumesFromView_GameThread(
+	class UWorld* World,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const FRaymarchView& View);
 
-/** Creates a 3D texture from given data and stores it in RenderThreadResources. Render thread function!
-* @param RawData Byte array of u8 values.
-* @param RawDataDimensions 3D Int vector specifying dimensions of the texture.
-* @note Only supports UINT8 textures as of now (support for any other kind is easily implemented, though)
+/** Draws the volumes seen from several cameras (the eyes of an HMD, a camera array...) into viewports of one render target,
+* in a single render command. The pipeline state, the scene depth and the textures of every volume are set once for all
+* views, only the cameras and viewports change in between. Volumes are drawn in the same order in all views, back to front
+* from the center of the cameras.
+* Reduced resolution needs the whole target for one view, so with more than one view Settings.Resolution is ignored.
+* @param Views Cameras to draw from, see FRaymarchCameraModelProvider.
+* @param Viewports Rectangle of the target per view, in pixels. Empty lays the views out in a grid, see GetRaymarchViewGrid.
+*                  With a scene depth, it has to cover the whole target like the views do.
 */
-void Create3DTexture_RenderThread(
+void DrawRaymarchVolumesFromViews_GameThread(
+	class UWorld* World,
+	class UTextureRenderTarget2D* OutputRenderTarget,
+	const TArray<FRaymarchVolumeDrawDesc>& Volumes,
+	const FRaymarchRenderSettings& Settings,
+	const TArray<FRaymarchView>& Views,
+	const TArray<FIntRect>& Viewports = TArray<FIntRect>());
+
+/** Splits a render target into equally sized viewports, as many columns as rows (or one more), filled row by row.
+* Two views end up side by side, left first.
+*/
+TArray<FIntRect> GetRaymarchViewGrid(FIntPoint TargetSize, int32 ViewCount);
+
+/** Returns the volume used by the single-volume API. Created on first use. Game thread function! */
+FRaymarchVolumeRenderDataPtr GetDefaultRaymarchVolume_GameThread();
+
+/** Releases the volume of the single-volume API, at module shutdown. Handles still held elsewhere keep a released volume. Game thread function! */
+void ReleaseDefaultRaymarchVolume_GameThread();
+
+/** Creates an uninitialized 3D texture with given dimensions. Render thread function!
+* @param Dimensions 3D Int vector specifying dimensions of the texture.
+* @param PixelFormat Format of the texture (PF_G8, PF_G16, PF_R16F, PF_R32_FLOAT or PF_BC4 for volumes).
+* @param NumMips Number of mip levels to allocate.
+*/
+FTexture3DRHIRef CreateEmpty3DTexture_RenderThread(
 	FRHICommandListImmediate& RHICmdList,
-	uint8* RawData,
-	FIntVector RawDataDimensions);
+	FIntVector Dimensions,
+	EPixelFormat PixelFormat,
+	uint32 NumMips = 1);
 
-/** Initializes resources used by rendering thread 
-* @param World Current world to get the rendering settings from (such as feature level).
-* @param OutputRenderTarget The render target to draw to. Only need this to take it's resolution for depth-texture creation.
+/** Uploads a slab of consecutive Z-slices into an existing 3D texture. Render thread function!
+* @param Texture Texture to update, has to be at least FirstSlice + SliceCount deep in the given mip level.
+* @param SlabData Voxels in the texture's pixel format, tightly packed slices of the whole mip level width and height
+*                 (rows of blocks for block compressed formats, see CompressSlabBC4).
+* @param FirstSlice Z coordinate of the first slice in the slab.
+* @param SliceCount Number of slices in the slab.
+* @param MipLevel Mip level to update.
+*/
+void Update3DTextureSlab_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FTexture3DRHIParamRef Texture,
+	const uint8* SlabData,
+	int32 FirstSlice,
+	int32 SliceCount,
+	uint32 MipLevel = 0);
+
+/** Uploads bricks of a volume held in memory into a texture of the same size, merging bricks next to each other along X
+* into one update. Render thread function!
+* @param VolumeData Voxels of the whole volume in the texture's pixel format. Only the bricks are read.
+* @param Bricks Brick coordinates, X-major sorted for merging to work.
+*/
+void Update3DTextureBricks_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FTexture3DRHIParamRef Texture,
+	const uint8* VolumeData,
+	int32 BrickSize,
+	const TArray<FIntVector>& Bricks);
+
+/** Creates a PF_G32R32F texture holding (min, max) of every macro cell for empty-space skipping. Render thread function!
+* @param Grid Completely accumulated macro cell grid.
+*/
+FTexture3DRHIRef CreateMacroCellTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const FRaymarchMacroCellGrid& Grid);
+
+/** Creates the indirection texture of a brick pool, one RGBA8 texel per brick of the volume. Render thread function!
+* @param Layout Layout of the bricks, gives the dimensions of the texture.
+* @param Indirection Texels built by BuildBrickIndirection.
+*/
+FTexture3DRHIRef CreateBrickIndirectionTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	const FRaymarchBrickLayout& Layout,
+	const TArray<FColor>& Indirection);
+
+/** Uploads a baked transfer function. The textures are only created when missing or of a different size, otherwise
+* they're updated in place. Render thread function!
+* @param TransferFunction Transfer function to update.
+* @param Lut Size entries of the lookup table.
+* @param PreIntegrationTable Size * Size entries built by BuildPreIntegrationTable.
+* @param Lut2D Size * GradientSize entries of the 2D lookup table, X-major. Empty releases the 2D table.
+* @param GradientSize Number of gradient magnitude entries of Lut2D.
+*/
+void UpdateTransferFunctionTextures_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FRaymarchTransferFunctionRenderData& TransferFunction,
+	const TArray<FFloat16Color>& Lut,
+	const TArray<FFloat16Color>& PreIntegrationTable,
+	const TArray<FFloat16Color>& Lut2D,
+	int32 GradientSize);
+
+/** Creates a PF_B8G8R8A8 texture of packed gradients. Render thread function!
+* @param Dimensions Dimensions of the texture, same as the volume's (or its atlas').
+* @param Gradients Gradients built by BuildGradientSlab, null leaves the texture uninitialized (for uploading it in slabs).
+*/
+FTexture3DRHIRef CreateGradientTexture_RenderThread(
+	FRHICommandListImmediate& RHICmdList,
+	FIntVector Dimensions,
+	const FColor* Gradients);
+
+/** Initializes resources shared by all volumes on the rendering thread.
+* @param OutputRenderTarget The render target to draw to. Not needed anymore, kept for compatibility.
 */
 void InitializeResources_RenderThread(
 	FRHICommandListImmediate& RHICmdList,
 	FTextureRenderTargetResource* TextureRenderTargetResource);
 
-// Class for global shader resources - shall only be accessed from render thread!
+// Class for global shader resources shared by all volumes - shall only be accessed from render thread!
+// Per-volume data lives in FRaymarchVolumeRenderData.
 class RenderThreadResources {
 public:
-	// Actual loaded volume texture.
-	static FTexture3DRHIRef VolumeTextureRef;
-	// Depth texture (needed as a separate render target for depth-testing).
-	static FTexture2DRHIRef DepthTextureRef;
 	// Vertices of a cube used to draw entry points of our raycasted volume.
 	static FVector4 CubeVertices[CUBE_VERTEX_CNT];
 	// Triangles composed of the vertices.
@@ -0,0 +1,66 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "UObject/ObjectMacros.h"
+#include "RaymarchRendering.h"
+#include "RaymarchTransferFunction.generated.h"
+
+class UCurveLinearColor;
+class UCurveFloat;
+
+// Number of gradient magnitude entries of a baked 2D transfer function.
+#define RAYMARCH_TRANSFER_FUNCTION_GRADIENT_SIZE 64
+
+/**
+* Colors volumes drawn in front to back mode. A color curve over the windowed intensity ([0,1], alpha being the opacity
+* of one voxel) gets baked into a small lookup table and its pre-integrated version. Changing the curve only re-uploads
+* those tables, the volumes stay untouched. Render resources are released when the object is destroyed.
+* An optional gradient opacity curve turns it into a 2D transfer function over intensity and gradient magnitude, which
+* is used for volumes that have precomputed gradients.
+*/
+UCLASS(BlueprintType)
+class URaymarchTransferFunction : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	URaymarchTransferFunction();
+
+	virtual void BeginDestroy() override;
+
+	/** Bakes a curve and uploads the tables. None leaves the previous tables in place. */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void SetCurve(UCurveLinearColor* InCurve);
+
+	/** Scales opacities by a curve over the gradient magnitude ([0,1], see RAYMARCH_GRADIENT_MAGNITUDE_SCALE), so i.e.
+	* only boundaries between materials show up. None goes back to a plain 1D transfer function.
+	* Ray segments are classified sample by sample with it, pre-integration only applies to 1D transfer functions.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void SetGradientOpacityCurve(UCurveFloat* InGradientOpacityCurve);
+
+	/** Bakes the current curve again, i.e. after its keys were changed. */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void Refresh();
+
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	UCurveLinearColor* GetCurve() const { return Curve; }
+
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	UCurveFloat* GetGradientOpacityCurve() const { return GradientOpacityCurve; }
+
+	/** Returns the render thread side of the transfer function. Its contents must only be touched on the render thread. */
+	FRaymarchTransferFunctionRenderDataPtr GetRenderData() const { return RenderData; }
+
+private:
+	UPROPERTY()
+	UCurveLinearColor* Curve = nullptr;
+
+	UPROPERTY()
+	UCurveFloat* GradientOpacityCurve = nullptr;
+
+	FRaymarchTransferFunctionRenderDataPtr RenderData;
+};
@@ -0,0 +1,194 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "RaymarchTypes.generated.h"
+
+class UTextureRenderTarget2D;
+
+/** Type of a single voxel in a RAW file. */
+UENUM(BlueprintType)
+enum class ERaymarchVoxelFormat : uint8
+{
+	// Unsigned byte, uploaded as G8.
+	U8 UMETA(DisplayName = "Unsigned 8-bit"),
+	// Unsigned short (also 12-bit data stored in 16 bits), uploaded as G16.
+	U16 UMETA(DisplayName = "Unsigned 16-bit"),
+	// Signed short (i.e. CT in Hounsfield units), sign bit flipped on load and uploaded as G16.
+	S16 UMETA(DisplayName = "Signed 16-bit"),
+	// Half float, uploaded as R16F.
+	F16 UMETA(DisplayName = "16-bit float"),
+	// Float, uploaded as R32F.
+	F32 UMETA(DisplayName = "32-bit float")
+};
+
+/** How a loaded volume is kept in GPU memory. */
+UENUM(BlueprintType)
+enum class ERaymarchVolumeCompression : uint8
+{
+	// As it was loaded (G8, G16, R16F or R32F).
+	None UMETA(DisplayName = "None"),
+	// BC4 blocks of 4x4 voxels per Z-slice, encoded on the CPU while loading. Half the memory of G8, needs 8-bit voxels
+	// (U8 files or quantized ones). Dense volumes also need X and Y to be a multiple of 4.
+	BC4 UMETA(DisplayName = "BC4 (block compressed)")
+};
+
+/** How samples along a ray are combined into the final pixel. */
+UENUM(BlueprintType)
+enum class ERaymarchCompositingMode : uint8
+{
+	// Sums up intensities (integrated per voxel travelled) and clamps at the end. Stops once the sum reaches 1.
+	Additive UMETA(DisplayName = "Additive"),
+	// Classic emission-absorption front-to-back compositing. Stops once opacity reaches the termination threshold.
+	FrontToBack UMETA(DisplayName = "Front to back"),
+	// Maximum intensity projection (MIP) - the brightest windowed intensity along the ray. Stops once it reaches the
+	// brightest intensity of the volume, and skips macro cells that can't get brighter than the ray already is.
+	MaximumIntensity UMETA(DisplayName = "Maximum intensity projection"),
+	// Minimum intensity projection (MinIP) - the darkest windowed intensity along the ray, i.e. airways in a lung window.
+	// Stops once it reaches the darkest intensity of the volume, and skips macro cells that can't get darker.
+	MinimumIntensity UMETA(DisplayName = "Minimum intensity projection"),
+	// Average intensity projection - the mean windowed intensity along the ray, like a thick radiograph. Marches the
+	// whole ray, skipping only macro cells windowed to zero.
+	AverageIntensity UMETA(DisplayName = "Average intensity projection")
+};
+
+/** Channel of a depth render target the scene depth is stored in. */
+UENUM(BlueprintType)
+enum class ERaymarchSceneDepthChannel : uint8
+{
+	// Scene captures of "SceneDepth in R".
+	Red UMETA(DisplayName = "R (SceneDepth in R)"),
+	// Scene captures of "SceneColor (HDR) in RGB, SceneDepth in A".
+	Alpha UMETA(DisplayName = "A (SceneColor in RGB, SceneDepth in A)")
+};
+
+/** Resolution rays are marched at, relative to the render target. */
+UENUM(BlueprintType)
+enum class ERaymarchResolution : uint8
+{
+	// One ray per pixel.
+	Full UMETA(DisplayName = "Full"),
+	// One ray per 2x2 pixels, upsampled and accumulated over frames.
+	Half UMETA(DisplayName = "Half"),
+	// One ray per 4x4 pixels, upsampled and accumulated over frames.
+	Quarter UMETA(DisplayName = "Quarter")
+};
+
+/** Per-draw settings of the raymarcher, trading image quality for frame time. */
+USTRUCT(BlueprintType)
+struct FRaymarchRenderSettings
+{
+	GENERATED_BODY()
+
+	// How samples along a ray are combined.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	ERaymarchCompositingMode CompositingMode = ERaymarchCompositingMode::Additive;
+
+	// Samples per voxel along the ray. 1 takes one sample per voxel of the loaded volume, 2 takes two etc.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.05", UIMin = "0.25", UIMax = "4.0"))
+	float Quality = 1.0f;
+
+	// Only projects a slab of the volume this thick (in world units, perpendicular to the view direction) instead of all
+	// of it, i.e. a thick-slab MIP. 0 projects the whole volume. Clips the rays of every compositing mode.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0"))
+	float SlabThickness = 0.0f;
+
+	// Moves the center of the slab along the view direction, in world units from the center of the volume. Positive
+	// values move it away from the camera.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	float SlabOffset = 0.0f;
+
+	// Rays stop once their accumulated opacity reaches this (front to back mode only).
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float EarlyTerminationThreshold = 0.99f;
+
+	// Classifies whole ray segments between samples with the pre-integrated transfer function instead of single samples.
+	// Avoids slicing artifacts of sharp transfer functions, so lower quality (longer steps) still looks right.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	bool bPreIntegrate = true;
+
+	// Lights the volume with a headlight (Blinn-Phong on the precomputed gradients). Front to back mode only, volumes
+	// loaded without gradients stay unlit.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	bool bShading = false;
+
+	// Shading: light that reaches every sample regardless of its gradient.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0", UIMax = "1.0"))
+	float Ambient = 0.3f;
+
+	// Shading: Lambertian part of the light.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0", UIMax = "1.0"))
+	float Diffuse = 0.7f;
+
+	// Shading: intensity of the white highlights.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0", UIMax = "1.0"))
+	float Specular = 0.3f;
+
+	// Shading: Blinn-Phong exponent, higher means smaller and sharper highlights.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "1.0", UIMax = "128.0"))
+	float Shininess = 32.0f;
+
+	// Depth of the opaque scene seen from the same camera (linear depth along the view direction in world units, as scene
+	// captures store it). Rays stop at it, so meshes in front of a volume hide it and nothing behind them gets marched.
+	// Can be of any resolution, but not the target drawn to. None draws the volumes over everything.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	UTextureRenderTarget2D* SceneDepth = nullptr;
+
+	// Channel of SceneDepth holding the depth.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	ERaymarchSceneDepthChannel SceneDepthChannel = ERaymarchSceneDepthChannel::Red;
+
+	// Marches rays at a fraction of the render target resolution (4x or 16x fewer rays) and reconstructs the full image
+	// from jittered rays over several frames. Each render target keeps its own history.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	ERaymarchResolution Resolution = ERaymarchResolution::Full;
+
+	// Reduced resolution: weight of the previous frames in the image. Higher is smoother but slower to follow changes,
+	// 0 only upsamples the current frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0", ClampMax = "0.98"))
+	float TemporalAccumulation = 0.9f;
+};
+
+/** Preprocessing filter run over a volume. */
+UENUM(BlueprintType)
+enum class ERaymarchFilter : uint8
+{
+	// Separable Gaussian blur, suppresses noise.
+	Gaussian UMETA(DisplayName = "Gaussian"),
+	// Median of the 3x3x3 neighbourhood, removes speckles while keeping edges sharp.
+	Median UMETA(DisplayName = "Median 3x3x3"),
+	// Frangi's Hessian-based vesselness at one scale, highlights tubular structures (vessels, airways).
+	Vesselness UMETA(DisplayName = "Vesselness")
+};
+
+/** One step of a volume filter chain. */
+USTRUCT(BlueprintType)
+struct FRaymarchFilterSettings
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	ERaymarchFilter Filter = ERaymarchFilter::Gaussian;
+
+	// Standard deviation of the Gaussian in voxels. For vesselness, the scale (radius) of the vessels to look for.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.1", UIMax = "5.0"))
+	float Sigma = 1.0f;
+
+	// Vesselness: sensitivity to the plate-vs-line ratio of the eigenvalues.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.01"))
+	float VesselnessAlpha = 0.5f;
+
+	// Vesselness: sensitivity to the blob-vs-line ratio of the eigenvalues.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.01"))
+	float VesselnessBeta = 0.5f;
+
+	// Vesselness: second order structure (in normalized intensity units) below which everything is considered noise.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0001"))
+	float VesselnessStructure = 0.05f;
+
+	// Vesselness: look for bright vessels on dark background (contrast CT, MRA). Dark vessels otherwise.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	bool bBrightVessels = true;
+};
@@ -0,0 +1,63 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "UObject/ObjectMacros.h"
+#include "RaymarchRendering.h"
+#include "RaymarchVolume.generated.h"
+
+class URaymarchTransferFunction;
+
+/**
+* Handle to one loaded volume with its own texture, acceleration data and window. Create as many as needed and draw
+* them together with DrawRaymarchVolumesToRenderTarget. Render resources are released when the object is destroyed, and
+* the object isn't finished off before the render thread let go of them.
+*/
+UCLASS(BlueprintType)
+class URaymarchVolume : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	URaymarchVolume();
+
+	virtual void BeginDestroy() override;
+	virtual bool IsReadyForFinishDestroy() override;
+
+	/** Returns the render thread side of the volume. Its contents must only be touched on the render thread. */
+	FRaymarchVolumeRenderDataPtr GetRenderData() const { return RenderData; }
+
+	/** Returns the pager of a volume opened with OpenPagedRawVolume, null for volumes loaded whole. */
+	FRaymarchBrickPagerPtr GetPager() const { return Pager; }
+
+	/** Sets the pager drawing into the volume. Loads replacing the paged volume reset it, so its cache gets freed. */
+	void SetPager(FRaymarchBrickPagerPtr InPager) { Pager = InPager; }
+
+private:
+	FRaymarchVolumeRenderDataPtr RenderData;
+	FRaymarchBrickPagerPtr Pager;
+
+	// Passed once the render thread released the volume.
+	FRenderCommandFence ReleaseFence;
+};
+
+/** One volume of a batched draw together with its placement in the world. */
+USTRUCT(BlueprintType)
+struct FRaymarchVolumeDraw
+{
+	GENERATED_BODY()
+
+	// Volume to draw. Volumes that aren't loaded yet are skipped.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	URaymarchVolume* Volume = nullptr;
+
+	// Maps the [-1,1] cube of the volume into the world.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	FTransform Transform;
+
+	// Colors the volume in front to back mode. None draws it plain grey.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	URaymarchTransferFunction* TransferFunction = nullptr;
+};
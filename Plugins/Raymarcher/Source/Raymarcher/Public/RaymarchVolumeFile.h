@@ -0,0 +1,104 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/FileManager.h"
+#include "RaymarchTypes.h"
+
+// Default number of Z-slices compressed together into one chunk. Power of two, so that chunk borders stay aligned with
+// the slabs of mip generation.
+#define RAYMARCH_DEFAULT_CHUNK_DEPTH 16
+
+/**
+* Header of a compressed volume file (.rvol). Layout of the file:
+*   header | chunk table (offset and compressed size of every chunk) | chunks
+* Every chunk holds ChunkDepth consecutive Z-slices (the last one fewer) and is compressed on its own with zlib, so
+* chunks can be decompressed in any order and in parallel. Multi-byte voxels are stored byte-plane by byte-plane within
+* a chunk (all low bytes, then all high bytes...), which compresses much better than interleaved bytes. Chunks that don't
+* get smaller are stored as they are.
+*/
+struct FRaymarchVolumeFileHeader
+{
+	FIntVector Dimensions = FIntVector::ZeroValue;
+	ERaymarchVoxelFormat VoxelFormat = ERaymarchVoxelFormat::U8;
+	// Size of a voxel in millimeters, along every axis.
+	FVector Spacing = FVector(1.0f, 1.0f, 1.0f);
+	// Z-slices per chunk.
+	int32 ChunkDepth = RAYMARCH_DEFAULT_CHUNK_DEPTH;
+
+	int32 GetChunkCount() const { return FMath::DivideAndRoundUp(Dimensions.Z, FMath::Max(ChunkDepth, 1)); }
+
+	/** Size of the voxels of a chunk after decompression. */
+	int64 GetChunkBytes(int32 ChunkIndex) const;
+};
+
+/** Where a chunk is in the file. */
+struct FRaymarchVolumeFileChunk
+{
+	int64 Offset = 0;
+	// Equal to the uncompressed size for chunks stored as they are.
+	int64 CompressedBytes = 0;
+};
+
+/** Sizes of a converted volume. */
+struct FRaymarchVolumeFileStats
+{
+	int64 RawBytes = 0;
+	int64 CompressedBytes = 0;
+
+	float GetRatio() const { return CompressedBytes > 0 ? float(double(RawBytes) / CompressedBytes) : 0.0f; }
+};
+
+/**
+* Reads the voxels of a compressed volume file, any number of whole chunks at a time. The compressed chunks are read with
+* one sequential read and decompressed in parallel on the task graph, straight into the caller's buffer.
+* Not thread safe, use one reader per thread.
+*/
+class FRaymarchVolumeFileReader
+{
+public:
+	/** Opens a file and reads its header and chunk table. Logs and returns null if it's not a valid volume file. */
+	static TUniquePtr<FRaymarchVolumeFileReader> Open(const FString& FullPath);
+
+	const FRaymarchVolumeFileHeader& GetHeader() const { return Header; }
+	const TArray<FRaymarchVolumeFileChunk>& GetChunks() const { return Chunks; }
+
+	/** Decompresses the slices [FirstSlice, FirstSlice + SliceCount) in the voxel format of the file.
+	* @param FirstSlice Has to be the first slice of a chunk.
+	* @param SliceCount Has to end at a chunk border or at the end of the volume.
+	* @param OutVoxels Receives the slices, tightly packed.
+	*/
+	bool ReadSlices(int32 FirstSlice, int32 SliceCount, uint8* OutVoxels);
+
+	/** Bytes read from the file so far - the compressed size of everything read. */
+	int64 GetBytesRead() const { return BytesRead; }
+
+private:
+	FRaymarchVolumeFileReader() {}
+
+	FString FullPath;
+	TUniquePtr<FArchive> File;
+	FRaymarchVolumeFileHeader Header;
+	TArray<FRaymarchVolumeFileChunk> Chunks;
+	// Compressed chunks of the last read, kept to avoid reallocating for every read.
+	TArray<uint8> CompressedBuffer;
+	int64 BytesRead = 0;
+};
+
+/** True if the file starts like a compressed volume file. Cheap, only reads the first bytes. */
+bool IsRaymarchVolumeFile(const FString& FullPath);
+
+/** Reads just the header of a compressed volume file. */
+bool ReadRaymarchVolumeFileHeader(const FString& FullPath, FRaymarchVolumeFileHeader& OutHeader);
+
+/**
+* Converts a RAW file into a compressed volume file. The RAW file is read a batch of chunks at a time (as many as there
+* are worker threads), every batch compressed in parallel and written out before the next one is read.
+* @param RawPath RAW file to convert, voxels as described by Header.
+* @param Header Dimensions, voxel format, spacing and chunk depth of the volume.
+* @param OutputPath File to write, overwritten if it exists.
+* @param OutStats Optional, receives the sizes.
+*/
+bool ConvertRawToRaymarchVolumeFile(const FString& RawPath, const FRaymarchVolumeFileHeader& Header, const FString& OutputPath,
+	FRaymarchVolumeFileStats* OutStats = nullptr);
@@ -0,0 +1,82 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "RHIResources.h"
+#include "RaymarchTypes.h"
+#include "RaymarchMacroCells.h"
+#include "RaymarchRendering.h"
+
+// Default budget for the host memory staging slabs that were read, but not yet uploaded to the GPU.
+#define RAYMARCH_DEFAULT_SLAB_BUDGET (64 * 1024 * 1024)
+
+/** Fired on the game thread every time a slab got uploaded. Progress is in [0,1]. */
+DECLARE_DELEGATE_OneParam(FOnRaymarchVolumeLoadProgress, float /* Progress */);
+/** Fired on the game thread once the whole volume is uploaded and bound (or once the loading failed). */
+DECLARE_DELEGATE_OneParam(FOnRaymarchVolumeLoaded, bool /* bSuccess */);
+
+/**
+* Everything the streaming loader needs to know about a RAW file it should load.
+*/
+struct FRaymarchVolumeLoadRequest
+{
+	// Absolute path to the RAW file, or to a compressed volume file (see RaymarchVolumeFile.h).
+	FString FullPath;
+	// Volume to load into. Null means the default volume drawn by DrawRaymarchToRenderTarget.
+	FRaymarchVolumeRenderDataPtr Volume;
+	// Dimensions of the volume in voxels. Ignored for compressed volume files, they come from the header.
+	FIntVector Dimensions;
+	// Type of the voxels in the file. Ignored for compressed volume files, like the dimensions.
+	ERaymarchVoxelFormat VoxelFormat = ERaymarchVoxelFormat::U8;
+	// Intensity window in raw file units (i.e. Hounsfield units). Width <= 0 means the full range of the format.
+	float WindowCenter = 0.0f;
+	float WindowWidth = 0.0f;
+	// If true, the window gets applied while streaming and the volume is uploaded as G8 (2-4x less GPU memory for
+	// 16/32 bit data). Otherwise, the full precision is uploaded and the window is applied in the shader.
+	bool bQuantizeTo8Bit = false;
+	// Edge length of the empty-space skipping macro cells in voxels, built while streaming. 0 means no skipping.
+	int32 MacroCellSize = RAYMARCH_DEFAULT_MACRO_CELL_SIZE;
+	// If true, a box-filtered mip chain is built on the worker while streaming and uploaded with the volume. As every slab
+	// has to be downsampled on its own, the chain only goes as deep as the slab depth allows (log2(SlabDepth) + 1 levels).
+	bool bGenerateMips = false;
+	// Edge length of the bricks of a sparse volume in voxels. 0 uploads the volume as one dense texture. Otherwise, only
+	// bricks with something visible in the window are packed into an atlas and the shader finds them through an
+	// indirection texture. The whole volume is read into memory for that, and there are no mips.
+	int32 BrickSize = 0;
+	// If true, a gradient volume for shading and 2D transfer functions is built on the worker (see RaymarchGradients.h)
+	// and uploaded along with the volume. Takes 4 bytes per voxel on the GPU, and the slabs in flight grow by as much.
+	bool bComputeGradients = false;
+	// How the texture is kept on the GPU. BC4 is encoded on the worker, slab by slab (and for every mip level), after
+	// macro cells, mips and gradients were built from the exact voxels. Falls back to no compression with a warning
+	// for volumes it doesn't support.
+	ERaymarchVolumeCompression Compression = ERaymarchVolumeCompression::None;
+	// Maximum amount of bytes that can be read from the file but not uploaded yet. Slabs are sized so that two of them
+	// fit into the budget (one being read while the other one is uploaded). A slab is always at least one Z-slice, so
+	// a budget smaller than two slices will be exceeded.
+	int64 SlabBudgetBytes = RAYMARCH_DEFAULT_SLAB_BUDGET;
+
+	FOnRaymarchVolumeLoadProgress OnProgress;
+	FOnRaymarchVolumeLoaded OnLoaded;
+};
+
+/** Starts loading a RAW file without blocking the game thread. The file is read in Z-slabs on a thread pool worker,
+* every slab is uploaded by a partial texture update as soon as it's read. Once everything is uploaded, the new texture
+* replaces the one of the requested volume. Bricked requests are packed on the worker and uploaded all at once.
+* Compressed volume files are recognized by their header (the only part read on the game thread). Their slabs are made
+* of whole chunks, decompressed in parallel on the task graph before the slab goes on like a RAW one.
+* Starting another load into the same volume supersedes this one - it stops at its next slab and reports failure, so
+* when switching datasets quickly only the last one requested gets shown. The volume keeps drawing its previous dataset
+* until then.
+* @param Request Description of the file and callbacks. Callbacks are always executed on the game thread.
+*/
+void LoadRawVolumeStreaming_GameThread(const FRaymarchVolumeLoadRequest& Request);
+
+/** Reads a whole RAW or compressed volume file into memory on the calling thread, converted like the streaming loader
+* uploads it (windowed to 8 bits with bQuantizeTo8Bit, signed shorts flipped). Only the file, dimensions, voxel format,
+* window and bQuantizeTo8Bit of the request are used.
+* @param OutVoxels Receives the voxels, in the pixel format the loader would upload them as.
+* @param OutDimensions Receives the dimensions - the requested ones, or the ones of the header for compressed files.
+*/
+bool ReadVolumeFile_AnyThread(const FRaymarchVolumeLoadRequest& Request, TArray<uint8>& OutVoxels, FIntVector& OutDimensions);
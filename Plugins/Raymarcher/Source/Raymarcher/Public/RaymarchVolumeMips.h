@@ -0,0 +1,41 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+
+/** Returns dimensions of given mip level of a volume (every level is half of the previous one rounded down, at least 1). */
+FIntVector GetVolumeMipDimensions(FIntVector Dimensions, int32 MipLevel);
+
+/** Returns the number of mip levels down to a single voxel. */
+int32 GetMaxVolumeMipCount(FIntVector Dimensions);
+
+/** Computes which slices of the next mip level can be built out of a slab of consecutive slices.
+* A slab has to start at an even slice and contain an even number of slices, unless it's the last one of the volume.
+* @param SourceFirstSlice First slice of the slab in the source level.
+* @param SourceSliceCount Number of slices in the slab.
+* @param SourceDepth Depth of the whole source level.
+* @param OutFirstSlice First slice in the downsampled level.
+* @param OutSliceCount Number of slices in the downsampled level, can be zero.
+*/
+void GetDownsampledSliceRange(int32 SourceFirstSlice, int32 SourceSliceCount, int32 SourceDepth, int32& OutFirstSlice, int32& OutSliceCount);
+
+/** Downsamples a slab of a volume by 2 along all axes with a 2x2x2 box filter, in parallel over the output slices.
+* @param SourceSlab Voxels of the slab, tightly packed.
+* @param PixelFormat Format of the voxels (PF_G8, PF_G16, PF_R16F or PF_R32_FLOAT).
+* @param SourceDimensions Dimensions of the whole source level (not just the slab).
+* @param SourceFirstSlice First slice of the slab in the source level.
+* @param SourceSliceCount Number of slices in the slab.
+* @param OutSlab Receives the slices given by GetDownsampledSliceRange, tightly packed. Has to be big enough for them.
+*/
+void DownsampleVolumeSlab(const void* SourceSlab, EPixelFormat PixelFormat, FIntVector SourceDimensions,
+	int32 SourceFirstSlice, int32 SourceSliceCount, void* OutSlab);
+
+/** Builds a full mip chain of a volume in memory. OutMips[0] is a copy of the volume itself.
+* @param MipCount Number of levels to generate including the full resolution one. 0 means all the way down to 1 voxel.
+*/
+void GenerateVolumeMips(const void* Volume, EPixelFormat PixelFormat, FIntVector Dimensions, int32 MipCount, TArray<TArray<uint8>>& OutMips);
+
+/** Single-threaded, straightforward version of downsampling a whole volume. Reference for validating DownsampleVolumeSlab. */
+void DownsampleVolume_Reference(const void* Source, EPixelFormat PixelFormat, FIntVector SourceDimensions, TArray<uint8>& OutVolume);
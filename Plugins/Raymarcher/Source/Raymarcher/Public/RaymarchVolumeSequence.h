@@ -0,0 +1,222 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tickable.h"
+#include "UObject/Object.h"
+#include "UObject/ObjectMacros.h"
+#include "RaymarchRendering.h"
+#include "RaymarchVolumeLoader.h"
+#include "RaymarchVolumeSequence.generated.h"
+
+class URaymarchVolume;
+
+// Default number of frames kept uploaded at once, the shown one included.
+#define RAYMARCH_DEFAULT_SEQUENCE_RING_SIZE 4
+// Default edge length of the bricks delta uploads compare and upload.
+#define RAYMARCH_DEFAULT_SEQUENCE_BRICK_SIZE 32
+
+/** Playback counters of a volume sequence since it was opened (or since ResetStats). */
+USTRUCT(BlueprintType)
+struct FRaymarchSequenceStats
+{
+	GENERATED_BODY()
+
+	// Frames that got shown.
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	int32 FramesShown = 0;
+
+	// Frames whose time came before they were uploaded, so they were skipped.
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	int32 FramesDropped = 0;
+
+	// Time from queueing a frame for prefetch until it was uploaded, in milliseconds.
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	float AverageLatencyMs = 0.0f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	float MaxLatencyMs = 0.0f;
+
+	// Bricks uploaded, and bricks skipped by delta uploads because the ring slot already held them.
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	int32 BricksUploaded = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	int32 BricksSkipped = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	float UploadedMB = 0.0f;
+
+	// Frames prefetched so far, the latencies are averaged over them.
+	UPROPERTY(BlueprintReadOnly, Category = "Raymarcher")
+	int32 FramesPrefetched = 0;
+};
+
+/**
+* Finds the bricks of a frame that differ from what a texture holds and copies them over, in parallel over bricks.
+* @param Resident Voxels the texture holds. The changed bricks get copied into it.
+* @param Frame Voxels of the new frame, same dimensions and format.
+* @param PixelFormat Format of the voxels (PF_G8, PF_G16, PF_R16F or PF_R32_FLOAT).
+* @param Tolerance Largest difference of a voxel that still counts as unchanged, in stored units (0-255 for G8). 0 only
+*                  skips identical bricks.
+* @param OutChangedBricks Receives the changed bricks, as brick coordinates.
+*/
+void UpdateChangedBricks(TArray<uint8>& Resident, const TArray<uint8>& Frame, FIntVector Dimensions, EPixelFormat PixelFormat,
+	int32 BrickSize, float Tolerance, TArray<FIntVector>& OutChangedBricks);
+
+/**
+* Plays back a time series of volumes (4D scans) from one RAW or compressed volume file per timestep. Frames are read,
+* converted and uploaded on thread pool workers ahead of playback into a ring of textures, and the drawn volume just
+* switches to the next texture when its time comes - nothing on the game or render thread waits for the disk.
+* Frames that aren't uploaded in time are dropped and counted. The shown ring slot is never refilled, so every frame is
+* drawn complete.
+* With delta uploads, a slot being refilled only gets the bricks that differ from the frame it held before - with
+* dynamic scans most of the volume (body, table, air) stays the same between timesteps.
+* Frames are dense volumes with a single mip and no gradients.
+*/
+UCLASS(BlueprintType)
+class URaymarchVolumeSequence : public UObject, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	URaymarchVolumeSequence();
+
+	virtual void BeginDestroy() override;
+
+	// FTickableGameObject
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+
+	/** Opens a sequence and starts prefetching its first frames. Playback starts paused at the first frame.
+	* @param FileNames One file per timestep, relative to the content directory. Compressed volume files take their
+	*                  dimensions and voxel format from their headers, the first one for the whole sequence.
+	* @param InDimensions Dimensions of all frames of RAW files.
+	* @param InVoxelFormat Type of the voxels of RAW files.
+	* @param InWindowCenter Center of the displayed intensity window, in file units.
+	* @param InWindowWidth Width of the displayed intensity window. Zero or less means the full range of the format, which
+	*                      quantizing doesn't support.
+	* @param bInQuantizeTo8Bit Applies the window on the CPU and uploads 8-bit voxels, fitting 2-4x more frames in memory.
+	* @return False if the sequence is empty or the dimensions or window aren't valid.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	bool Open(const TArray<FString>& FileNames, FIntVector InDimensions, ERaymarchVoxelFormat InVoxelFormat,
+		float InWindowCenter, float InWindowWidth, bool bInQuantizeTo8Bit);
+
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void Play();
+
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void Pause();
+
+	/** Jumps to a frame. It's shown as soon as it's uploaded, prefetching starts over from there. */
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void SetFrame(int32 Frame);
+
+	/** Frame being shown, -1 before the first one got uploaded. */
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	int32 GetShownFrame() const { return ShownFrame; }
+
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	int32 GetFrameCount() const { return Frames.Num(); }
+
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	bool IsPlaying() const { return bPlaying; }
+
+	/** The volume showing the current frame, to be drawn like any other. */
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	URaymarchVolume* GetVolume() const { return Volume; }
+
+	UFUNCTION(BlueprintPure, Category = "Raymarcher")
+	FRaymarchSequenceStats GetStats() const { return Stats; }
+
+	UFUNCTION(BlueprintCallable, Category = "Raymarcher")
+	void ResetStats();
+
+	// Playback speed.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.1"))
+	float FramesPerSecond = 10.0f;
+
+	// Starts over at the first frame after the last one, and prefetches across the wrap.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	bool bLoop = true;
+
+	// Frames uploaded at once, the shown one included. Every frame takes a texture of the full volume. Used by Open.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "2"))
+	int32 RingSize = RAYMARCH_DEFAULT_SEQUENCE_RING_SIZE;
+
+	// Frames read and uploaded at the same time at most.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "1"))
+	int32 MaxConcurrentLoads = 2;
+
+	// Only uploads the bricks of a frame that differ from what its ring slot held. Takes a host copy of every slot.
+	// Used by Open.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher")
+	bool bDeltaUploads = true;
+
+	// Edge length of the bricks delta uploads compare. Used by Open.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "4"))
+	int32 DeltaBrickSize = RAYMARCH_DEFAULT_SEQUENCE_BRICK_SIZE;
+
+	// Largest difference of a voxel that delta uploads still count as unchanged, in stored units (0-255 for 8-bit
+	// volumes). Above 0, shown frames can differ from the files by up to this much in return for smaller uploads.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Raymarcher", meta = (ClampMin = "0.0"))
+	float DeltaTolerance = 0.0f;
+
+private:
+	struct FSlot;
+	typedef TSharedPtr<FSlot, ESPMode::ThreadSafe> FSlotPtr;
+
+	// Queues loads of the frames from the shown one on that aren't in the ring yet, as far as slots and loads allow.
+	void Prefetch_GameThread();
+
+	// Reads, compares and uploads a frame into a slot. Runs on a thread pool worker.
+	static void LoadFrame_AnyThread(TWeakObjectPtr<URaymarchVolumeSequence> Sequence, FSlotPtr Slot, FRaymarchVolumeLoadRequest Request,
+		int32 BrickSize, float Tolerance, FIntVector Dimensions, EPixelFormat PixelFormat, FVector2D WindowScaleBias, double QueueTime);
+
+	// Called on the game thread once a load is done.
+	void OnFrameLoaded_GameThread(FSlotPtr Slot, bool bSuccess, double LatencySeconds, int32 BricksUploaded, int32 BricksSkipped, int64 UploadedBytes);
+
+	// Lets go of the ring on the render thread. Loads still running keep their slot until they're done.
+	void ReleaseSlots_GameThread();
+
+	// Makes the drawn volume show the frame of a slot.
+	void ShowSlot_GameThread(const FSlotPtr& Slot);
+
+	// Frame the playback clock is at.
+	int32 GetTargetFrame() const;
+
+	UPROPERTY()
+	URaymarchVolume* Volume = nullptr;
+
+	// Full paths of the frames.
+	TArray<FString> Frames;
+	FIntVector Dimensions = FIntVector::ZeroValue;
+	ERaymarchVoxelFormat VoxelFormat = ERaymarchVoxelFormat::U8;
+	float WindowCenter = 0.0f;
+	float WindowWidth = 0.0f;
+	bool bQuantizeTo8Bit = false;
+	EPixelFormat PixelFormat = PF_G8;
+	FVector2D WindowScaleBias = FVector2D(1.0f, 0.0f);
+	// Delta settings as of Open, the ring was set up for them.
+	bool bRingDeltaUploads = true;
+	int32 RingBrickSize = RAYMARCH_DEFAULT_SEQUENCE_BRICK_SIZE;
+
+	TArray<FSlotPtr> Slots;
+	// Slot the drawn volume shows, never refilled while shown.
+	FSlotPtr ShownSlot;
+	int32 ShownFrame = INDEX_NONE;
+	// Frame at PlaybackTime 0 and seconds played since.
+	int32 StartFrame = 0;
+	double PlaybackTime = 0.0;
+	bool bPlaying = false;
+	// Last frame the clock was at, to count the ones it passed without showing them.
+	int32 LastTargetFrame = 0;
+	// Frames that couldn't be read, they're skipped by prefetching and dropped when their time comes.
+	TSet<int32> FailedFrames;
+
+	FRaymarchSequenceStats Stats;
+	double LatencySumMs = 0.0;
+};
@@ -0,0 +1,43 @@
+// Licensed under the WTFPL(Do What the Fuck You Want To Public License) license.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+#include "RaymarchTypes.h"
+
+/** Returns size of one voxel of given format in bytes. */
+int32 GetVoxelByteSize(ERaymarchVoxelFormat Format);
+
+/** Returns the pixel format a volume of given voxel format is uploaded as (without quantization). */
+EPixelFormat GetVoxelPixelFormat(ERaymarchVoxelFormat Format);
+
+/** Returns the value the shader sees when sampling a texture with given voxel format that has RawValue stored in it.
+* (normalized formats get divided by their max, signed shorts are shifted by 32768 before that, floats stay as they are).
+*/
+float GetNormalizedVoxelValue(ERaymarchVoxelFormat Format, float RawValue);
+
+/** Returns scale and bias that map the sampled (normalized) value of a texture to [0,1] over the given window.
+* A WindowWidth <= 0 means no windowing, so (1, 0) is returned.
+* @param WindowCenter Center of the window in raw file units (i.e. Hounsfield units for S16 CT).
+* @param WindowWidth Width of the window in raw file units.
+*/
+FVector2D GetWindowScaleBias(ERaymarchVoxelFormat Format, float WindowCenter, float WindowWidth);
+
+/** Flips the sign bit of signed 16-bit voxels in place, so they can be uploaded as unsigned normalized G16
+* (-32768 becomes 0, 0 becomes 32768).
+*/
+void ConvertSignedToUnsigned16(int16* Voxels, int64 VoxelCount);
+
+/** Applies window/level to voxels of any format and quantizes them to U8. Uses SSE2 where available.
+* @param Source Voxels read from the file.
+* @param Format Format of the source voxels.
+* @param VoxelCount Number of voxels to convert.
+* @param WindowCenter Center of the window in raw file units.
+* @param WindowWidth Width of the window in raw file units. Values outside the window get clamped to 0 / 255.
+* @param Destination Array of at least VoxelCount bytes.
+*/
+void QuantizeWindowed(const void* Source, ERaymarchVoxelFormat Format, int64 VoxelCount, float WindowCenter, float WindowWidth, uint8* Destination);
+
+/** Plain scalar version of QuantizeWindowed. Reference for the vectorized path and fallback on platforms without SSE2. */
+void QuantizeWindowed_Scalar(const void* Source, ERaymarchVoxelFormat Format, int64 VoxelCount, float WindowCenter, float WindowWidth, uint8* Destination);
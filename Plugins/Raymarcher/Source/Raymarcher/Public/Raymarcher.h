@@ -5,6 +5,9 @@
 #include "CoreMinimal.h"
 #include "ModuleManager.h"
 
+// Log category for messages that can't go to the screen (i.e. coming from worker threads).
+DECLARE_LOG_CATEGORY_EXTERN(LogRaymarch, Log, All);
+
 class FRaymarcherModule : public IModuleInterface
 {
 public:
@@ -12,4 +15,8 @@ public:
 	/** IModuleInterface implementation */
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
+
+private:
+	// Closes the frames of the profiler, see FRaymarchProfiler.
+	FDelegateHandle EndFrameHandle;
 };
\ No newline at end of file
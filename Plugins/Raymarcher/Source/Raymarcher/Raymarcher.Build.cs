@@ -40,7 +40,8 @@ public class Raymarcher : ModuleRules
 			new string[]
 			{
 				"CoreUObject",
-				"Engine"
+				"Engine",
+				"Projects"
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);